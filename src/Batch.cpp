@@ -0,0 +1,104 @@
+#include "Batch.h"
+#include "FileUtils.h"
+#include "utils/logger.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+static FSError readFile(CRBatchOperation *operation) {
+    IFSWrapper *layer = nullptr;
+    FSFileHandle handle{};
+    auto result = callLayers([&](IFSWrapper *cur) { return cur->FSOpenFileWrapper(operation->path, "r", &handle); }, &layer);
+    if (result != FS_ERROR_OK) {
+        return result;
+    }
+    result = layer->FSGetStatFileWrapper(handle, &operation->stat);
+    if (result == FS_ERROR_OK) {
+        auto size = std::min(operation->size, operation->stat.size);
+        result    = size == 0 ? FS_ERROR_OK : layer->FSReadFileWrapper(operation->buffer, 1, size, handle, 0);
+    }
+    if (layer->FSCloseFileWrapper(handle) != FS_ERROR_FORCE_PARENT_LAYER && layer->isValidFileHandle(handle)) {
+        layer->deleteFileHandle(handle);
+    }
+    return result;
+}
+
+/**
+ * Reads at the position of the operation and moves the handle back, so the title's own reads through the
+ * handle are not affected. The layers are locked by the caller, so no other read sees the moved position.
+ */
+static FSError readAt(IFSWrapper *layer, CRBatchOperation *operation) {
+    uint32_t pos{};
+    auto result = layer->FSGetPosFileWrapper(operation->handle, &pos);
+    if (result != FS_ERROR_OK) {
+        return result;
+    }
+    result       = layer->FSReadFileWithPosWrapper(operation->buffer, 1, operation->size, operation->pos, operation->handle, 0);
+    auto restore = layer->FSSetPosFileWrapper(operation->handle, pos);
+    if (restore != FS_ERROR_OK) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to restore the position of handle %08X", operation->handle);
+        return restore;
+    }
+    return result;
+}
+
+static FSError runOperation(CRBatchOperation *operation) {
+    switch (operation->type) {
+        case CR_BATCH_OPERATION_STAT:
+            if (operation->path == nullptr) {
+                return FS_ERROR_INVALID_PARAM;
+            }
+            return callLayers([operation](IFSWrapper *layer) { return layer->FSGetStatWrapper(operation->path, &operation->stat); });
+        case CR_BATCH_OPERATION_READ_FILE:
+            if (operation->path == nullptr || (operation->buffer == nullptr && operation->size > 0)) {
+                return FS_ERROR_INVALID_PARAM;
+            }
+            return readFile(operation);
+        case CR_BATCH_OPERATION_READ:
+            if (operation->buffer == nullptr && operation->size > 0) {
+                return FS_ERROR_INVALID_PARAM;
+            }
+            for (auto &layer : fsLayers) {
+                if (layer->isValidFileHandle(operation->handle)) {
+                    return operation->size == 0 ? FS_ERROR_OK : readAt(layer.get(), operation);
+                }
+            }
+            return FS_ERROR_FORCE_REAL_FUNCTION;
+    }
+    return FS_ERROR_INVALID_PARAM;
+}
+
+void runBatch(CRBatchOperation *operations, uint32_t numOperations) {
+    // Stats and whole files sorted by path, so files of the same directory are handled after each other,
+    // then reads sorted by handle and position.
+    std::vector<CRBatchOperation *> order;
+    order.reserve(numOperations);
+    for (uint32_t i = 0; i < numOperations; i++) {
+        order.push_back(&operations[i]);
+    }
+    std::sort(order.begin(), order.end(), [](const CRBatchOperation *a, const CRBatchOperation *b) {
+        bool aIsRead = a->type == CR_BATCH_OPERATION_READ;
+        bool bIsRead = b->type == CR_BATCH_OPERATION_READ;
+        if (aIsRead != bIsRead) {
+            return bIsRead;
+        }
+        if (aIsRead) {
+            return a->handle != b->handle ? a->handle < b->handle : a->pos < b->pos;
+        }
+        if (a->path == nullptr || b->path == nullptr) {
+            return b->path != nullptr;
+        }
+        return strcmp(a->path, b->path) < 0;
+    });
+
+    for (uint32_t start = 0; start < numOperations; start += BATCH_OPERATIONS_PER_LOCK) {
+        std::lock_guard<std::mutex> lock(fsLayerMutex);
+        for (uint32_t i = start; i < numOperations && i < start + BATCH_OPERATIONS_PER_LOCK; i++) {
+            auto *operation   = order[i];
+            auto result       = runOperation(operation);
+            operation->status = result == FS_ERROR_FORCE_REAL_FUNCTION ? CR_BATCH_STATUS_NOT_REDIRECTED : result;
+        }
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("Completed batch of %u operations", numOperations);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "export.h"
+#include <cstdint>
+
+// The fsLayerMutex is released after this many operations, so redirected FS calls of the title are not
+// delayed by large batches.
+#define BATCH_OPERATIONS_PER_LOCK 8
+
+/**
+ * Runs the operations of a batch (see CRSubmitBatch) through the layers and sets their results. Takes the
+ * fsLayerMutex, so it must only be called on a worker thread.
+ */
+void runBatch(CRBatchOperation *operations, uint32_t numOperations);
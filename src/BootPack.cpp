@@ -0,0 +1,62 @@
+#include "BootPack.h"
+#include "BootTrace.h"
+#include "WorkerThreads.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <sys/stat.h>
+
+BootPack::BootPack(std::shared_ptr<PackArchive> archive) : pArchive(std::move(archive)) {
+}
+
+std::shared_ptr<BootPack> BootPack::open(const std::string &replacementDir) {
+    auto path = BootTrace::getBasePath(replacementDir) + PACK_FILE_SUFFIX;
+    struct stat sb {};
+    if (stat(path.c_str(), &sb) < 0) {
+        return nullptr;
+    }
+    auto archive = PackArchive::open(path);
+    if (!archive) {
+        return nullptr;
+    }
+    archive->setReadAhead(BOOT_PACK_READ_AHEAD_SIZE);
+    auto bootPack = make_shared_nothrow<BootPack>(std::move(archive));
+    if (!bootPack) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate BootPack");
+        return nullptr;
+    }
+    if (!queueWorkerTask([bootPack, replacementDir]() { bootPack->validate(replacementDir); })) {
+        // The queues fill up while several layers are added at boot, the pack is validated right away then.
+        DEBUG_FUNCTION_LINE_VERBOSE("Failed to queue the validation of %s, validating it now", path.c_str());
+        bootPack->validate(replacementDir);
+    }
+    DEBUG_FUNCTION_LINE_INFO("Found boot pack %s", path.c_str());
+    return bootPack;
+}
+
+const PackFile *BootPack::find(std::string_view relativePath) const {
+    if (!pValidated.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return pArchive->find(relativePath);
+}
+
+void BootPack::validate(const std::string &replacementDir) {
+    auto &index = pArchive->getIndex();
+    for (auto &path : pArchive->getFilePaths()) {
+        LayerIndexEntry entry{};
+        struct stat sb {};
+        FSStat fsStat{};
+        auto loosePath = replacementDir + "/" + path;
+        if (index->lookup(path, &entry) != LAYER_INDEX_LOOKUP_FOUND || stat(loosePath.c_str(), &sb) < 0) {
+            DEBUG_FUNCTION_LINE_WARN("Ignore boot pack %s, %s is missing", pArchive->getPath().c_str(), loosePath.c_str());
+            return;
+        }
+        translate_stat(&sb, &fsStat);
+        if (fsStat.size != entry.size || fsStat.modified != entry.modified) {
+            DEBUG_FUNCTION_LINE_WARN("Ignore boot pack %s, %s has been modified", pArchive->getPath().c_str(), loosePath.c_str());
+            return;
+        }
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("Validated boot pack %s", pArchive->getPath().c_str());
+    pValidated.store(true, std::memory_order_release);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "PackArchive.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Size of the reads from a boot pack, the files are stored in the order they are read during boot.
+#define BOOT_PACK_READ_AHEAD_SIZE 0x80000
+
+/**
+ * Pack of the files a title reads while booting, created by tools/pack from a boot trace (see BootTrace)
+ * and stored at "<replacement dir>.<title id>.crpack". Read-only layers prefer it over the loose files.
+ *
+ * The pack is only used once a worker thread has verified that size and modification time of every
+ * file still match the replacement directory, a modified file disables the whole pack. If no worker can
+ * take the task, the pack is verified when it's opened.
+ */
+class BootPack {
+public:
+    explicit BootPack(std::shared_ptr<PackArchive> archive);
+
+    /**
+     * Returns nullptr if there is no valid boot pack for the running title.
+     */
+    static std::shared_ptr<BootPack> open(const std::string &replacementDir);
+
+    /**
+     * Returns nullptr if the pack has no file with this path (relative to the replacement dir) or has not
+     * been verified yet.
+     */
+    const PackFile *find(std::string_view relativePath) const;
+
+    [[nodiscard]] const std::shared_ptr<PackArchive> &getArchive() const {
+        return pArchive;
+    }
+
+private:
+    void validate(const std::string &replacementDir);
+
+    std::shared_ptr<PackArchive> pArchive;
+    std::atomic<bool> pValidated{false};
+};
@@ -0,0 +1,145 @@
+#include "BootTrace.h"
+#include "LayerIndex.h"
+#include "WorkerThreads.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include <coreinit/title.h>
+#include <cstdio>
+
+static OSTime sApplicationStartTime = 0;
+
+BootTrace::BootTrace(std::string pathToReplace, std::string replacementDir, uint32_t cutoffInSeconds) : pPathToReplace(std::move(pathToReplace)),
+                                                                                                      pOutputPath(getBasePath(replacementDir) + BOOT_TRACE_FILE_SUFFIX),
+                                                                                                      pCutoff(sApplicationStartTime + OSSecondsToTicks(cutoffInSeconds)) {
+}
+
+std::string BootTrace::getBasePath(const std::string &replacementDir) {
+    auto res = replacementDir;
+    while (res.size() > 1 && res.back() == '/') {
+        res.pop_back();
+    }
+    return string_format("%s.%016llX", res.c_str(), OSGetTitleID());
+}
+
+void BootTrace::onApplicationStarts() {
+    sApplicationStartTime = OSGetTime();
+}
+
+bool BootTrace::isCutoffReached() const {
+    return OSGetTime() >= pCutoff;
+}
+
+void BootTrace::recordOpen(FSFileHandle handle, std::string_view fullPath) {
+    if (fullPath.size() < pPathToReplace.size()) {
+        return;
+    }
+    auto relativePath = fullPath.substr(pPathToReplace.size());
+    while (!relativePath.empty() && relativePath.front() == '/') {
+        relativePath.remove_prefix(1);
+    }
+    auto key = LayerIndex::getKey(relativePath);
+
+    std::lock_guard<std::mutex> lock(pMutex);
+    if (pFinished) {
+        return;
+    }
+    uint32_t entry;
+    if (auto it = pEntryByKey.find(key); it != pEntryByKey.end()) {
+        entry = it->second;
+    } else {
+        if (pEntries.size() >= BOOT_TRACE_MAX_FILES) {
+            return;
+        }
+        entry = pEntries.size();
+        pEntries.push_back({std::string(relativePath), {}});
+        pEntryByKey.emplace(std::move(key), entry);
+    }
+    pOpenFiles[handle] = {entry, 0};
+}
+
+void BootTrace::recordRead(FSFileHandle handle, uint32_t size) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    auto it = pOpenFiles.find(handle);
+    if (it == pOpenFiles.end() || size == 0) {
+        return;
+    }
+    auto &file   = it->second;
+    auto &ranges = pEntries[file.entry].ranges;
+    uint32_t end = file.pos + size;
+    if (!ranges.empty() && ranges.back().offset <= file.pos && file.pos <= ranges.back().offset + ranges.back().size) {
+        // Sequential reads are merged.
+        ranges.back().size = std::max(ranges.back().offset + ranges.back().size, end) - ranges.back().offset;
+    } else if (ranges.size() >= BOOT_TRACE_MAX_RANGES) {
+        auto &last  = ranges.back();
+        auto start  = std::min(last.offset, file.pos);
+        last.size   = std::max(last.offset + last.size, end) - start;
+        last.offset = start;
+    } else {
+        ranges.push_back({file.pos, size});
+    }
+    file.pos = end;
+}
+
+void BootTrace::recordSetPos(FSFileHandle handle, uint32_t pos) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    if (auto it = pOpenFiles.find(handle); it != pOpenFiles.end()) {
+        it->second.pos = pos;
+    }
+}
+
+void BootTrace::recordClose(FSFileHandle handle) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    pOpenFiles.erase(handle);
+}
+
+void BootTrace::finish(const std::shared_ptr<BootTrace> &trace) {
+    {
+        std::lock_guard<std::mutex> lock(trace->pMutex);
+        if (trace->pFinished) {
+            return;
+        }
+        trace->pFinished = true;
+        trace->pOpenFiles.clear();
+    }
+    // Writing the trace may issue FS calls, this must not happen on an IO thread.
+    if (!queueWorkerTask([trace]() { trace->write(); })) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to queue writing %s", trace->pOutputPath.c_str());
+    }
+}
+
+void BootTrace::write() {
+    std::vector<BootTraceEntry> entries;
+    {
+        std::lock_guard<std::mutex> lock(pMutex);
+        for (auto &entry : pEntries) {
+            // Files that have only been opened don't need to be part of the boot pack.
+            if (!entry.ranges.empty()) {
+                entries.push_back(entry);
+            }
+        }
+    }
+    if (entries.empty()) {
+        DEBUG_FUNCTION_LINE_VERBOSE("Nothing to write to %s", pOutputPath.c_str());
+        return;
+    }
+
+    auto data    = BootTraceFormat::serialize(OSGetTitleID(), entries);
+    auto tmpPath = pOutputPath + ".tmp";
+    FILE *f      = fopen(tmpPath.c_str(), "wb");
+    if (f == nullptr) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to create %s", tmpPath.c_str());
+        return;
+    }
+    bool success = fwrite(data.data(), 1, data.size(), f) == data.size();
+    success      = fclose(f) == 0 && success;
+    if (success) {
+        remove(pOutputPath.c_str());
+        success = rename(tmpPath.c_str(), pOutputPath.c_str()) == 0;
+    }
+    if (!success) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to write %s", pOutputPath.c_str());
+        remove(tmpPath.c_str());
+        return;
+    }
+    DEBUG_FUNCTION_LINE_INFO("Wrote boot trace %s (%d files)", pOutputPath.c_str(), entries.size());
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "BootTraceFormat.h"
+#include <coreinit/filesystem.h>
+#include <coreinit/time.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Limits the memory used by a trace.
+#define BOOT_TRACE_MAX_FILES  0x2000
+#define BOOT_TRACE_MAX_RANGES 0x40
+
+/**
+ * Records which files of a layer are read while the title is booting, in the order they are opened first
+ * (see CR_LAYER_OPTION_BOOT_TRACE). The accesses are reported by the dispatcher (doForLayer), recording
+ * stops once the cutoff after the start of the application has been reached or the layer is removed.
+ * The trace is then written by a worker thread to "<replacement dir>.<title id>.crtrace", tools/pack
+ * turns it into a boot pack (see BootPack).
+ */
+class BootTrace {
+public:
+    BootTrace(std::string pathToReplace, std::string replacementDir, uint32_t cutoffInSeconds);
+
+    /**
+     * Returns "<replacement dir>.<title id>", the base path of the trace and the boot pack of the running title.
+     */
+    static std::string getBasePath(const std::string &replacementDir);
+
+    /**
+     * Called from WUMS_APPLICATION_STARTS, the cutoff is relative to this.
+     */
+    static void onApplicationStarts();
+
+    void recordOpen(FSFileHandle handle, std::string_view fullPath);
+
+    void recordRead(FSFileHandle handle, uint32_t size);
+
+    void recordSetPos(FSFileHandle handle, uint32_t pos);
+
+    void recordClose(FSFileHandle handle);
+
+    [[nodiscard]] bool isCutoffReached() const;
+
+    /**
+     * Stops recording and queues writing the trace. Does nothing if the trace has already been finished.
+     */
+    static void finish(const std::shared_ptr<BootTrace> &trace);
+
+private:
+    void write();
+
+    struct OpenFile {
+        uint32_t entry;
+        uint32_t pos;
+    };
+
+    std::string pPathToReplace;
+    std::string pOutputPath;
+    OSTime pCutoff;
+
+    std::mutex pMutex;
+    bool pFinished = false;
+    std::vector<BootTraceEntry> pEntries;
+    std::unordered_map<std::string, uint32_t> pEntryByKey;
+    std::unordered_map<FSFileHandle, OpenFile> pOpenFiles;
+};
@@ -0,0 +1,97 @@
+#pragma once
+/**
+ * Format of the boot traces written by layers with CR_LAYER_OPTION_BOOT_TRACE. A trace lists the files of
+ * a replacement directory in the order they have been opened first while a title was booting:
+ *
+ *   header
+ *   entries[numEntries] (u16 pathLength, path, u16 numRanges, ranges[numRanges] (u32 offset, u32 size))
+ *
+ * Paths are relative to the replacement directory. This header has no dependencies on wut, so it can be
+ * used by host tools as well. All values are stored big-endian.
+ */
+#include "LayerIndexFormat.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define BOOT_TRACE_FILE_SUFFIX  ".crtrace"
+#define BOOT_TRACE_FILE_MAGIC   0x43524254 // "CRBT"
+#define BOOT_TRACE_FILE_VERSION 1
+#define BOOT_TRACE_HEADER_SIZE  24
+#define BOOT_TRACE_MAX_SIZE     0x100000
+
+struct BootTraceRange {
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct BootTraceEntry {
+    std::string path;
+    std::vector<BootTraceRange> ranges;
+};
+
+namespace BootTraceFormat {
+    static inline std::vector<uint8_t> serialize(uint64_t titleId, const std::vector<BootTraceEntry> &entries) {
+        std::vector<uint8_t> body;
+        for (auto &entry : entries) {
+            LayerIndexFormat::putBE16(body, entry.path.size());
+            body.insert(body.end(), entry.path.begin(), entry.path.end());
+            LayerIndexFormat::putBE16(body, entry.ranges.size());
+            for (auto &range : entry.ranges) {
+                LayerIndexFormat::putBE32(body, range.offset);
+                LayerIndexFormat::putBE32(body, range.size);
+            }
+        }
+        std::vector<uint8_t> out;
+        out.reserve(BOOT_TRACE_HEADER_SIZE + body.size());
+        LayerIndexFormat::putBE32(out, BOOT_TRACE_FILE_MAGIC);
+        LayerIndexFormat::putBE16(out, BOOT_TRACE_FILE_VERSION);
+        LayerIndexFormat::putBE16(out, BOOT_TRACE_HEADER_SIZE);
+        LayerIndexFormat::putBE64(out, titleId);
+        LayerIndexFormat::putBE32(out, entries.size());
+        LayerIndexFormat::putBE32(out, LayerIndexFormat::checksum(body.data(), body.size()));
+        out.insert(out.end(), body.begin(), body.end());
+        return out;
+    }
+
+    /**
+     * Returns false if the data is not a valid trace of this version.
+     */
+    static inline bool parse(const uint8_t *data, uint32_t size, uint64_t *outTitleId, std::vector<BootTraceEntry> &outEntries) {
+        if (size < BOOT_TRACE_HEADER_SIZE ||
+            LayerIndexFormat::getBE32(data) != BOOT_TRACE_FILE_MAGIC ||
+            LayerIndexFormat::getBE16(data + 4) != BOOT_TRACE_FILE_VERSION ||
+            LayerIndexFormat::getBE16(data + 6) != BOOT_TRACE_HEADER_SIZE ||
+            LayerIndexFormat::checksum(data + BOOT_TRACE_HEADER_SIZE, size - BOOT_TRACE_HEADER_SIZE) != LayerIndexFormat::getBE32(data + 20)) {
+            return false;
+        }
+        *outTitleId         = LayerIndexFormat::getBE64(data + 8);
+        uint32_t numEntries = LayerIndexFormat::getBE32(data + 16);
+        const uint8_t *cur  = data + BOOT_TRACE_HEADER_SIZE;
+        const uint8_t *end  = data + size;
+        outEntries.clear();
+        for (uint32_t i = 0; i < numEntries; i++) {
+            BootTraceEntry entry;
+            if (end - cur < 2) {
+                return false;
+            }
+            uint32_t pathLength = LayerIndexFormat::getBE16(cur);
+            cur += 2;
+            if ((uint32_t) (end - cur) < pathLength + 2) {
+                return false;
+            }
+            entry.path.assign(reinterpret_cast<const char *>(cur), pathLength);
+            cur += pathLength;
+            uint32_t numRanges = LayerIndexFormat::getBE16(cur);
+            cur += 2;
+            if ((uint32_t) (end - cur) < numRanges * 8) {
+                return false;
+            }
+            for (uint32_t j = 0; j < numRanges; j++, cur += 8) {
+                entry.ranges.push_back({LayerIndexFormat::getBE32(cur), LayerIndexFormat::getBE32(cur + 4)});
+            }
+            outEntries.push_back(std::move(entry));
+        }
+        return cur == end;
+    }
+} // namespace BootTraceFormat
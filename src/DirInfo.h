@@ -1,10 +1,17 @@
 #pragma once
 #include <coreinit/filesystem.h>
+#include <memory>
+#include <string>
 #include <sys/dirent.h>
 
+struct LayerIndexListing;
+
 struct DirInfo {
     virtual ~DirInfo() = default;
     FSDirectoryHandle handle{};
     DIR *dir{};
-    char path[0x280]{};
+    std::string path;
+    // Set if the directory is listed from the layer index instead of the disk, dir is nullptr then.
+    std::shared_ptr<const LayerIndexListing> listing;
+    uint32_t listingPosition = 0;
 };
@@ -1,16 +1,40 @@
 #pragma once
 #include "DirInfo.h"
+#include "MergedDirCache.h"
+#include "utils/BumpArena.h"
 #include <coreinit/filesystem_fsa.h>
+#include <memory>
 
-typedef struct FSDirectoryEntryEx {
-    FSADirectoryEntry realEntry{};
-    bool isMarkedAsDeleted = false;
-} FSDirectoryEntryEx;
+#define MERGE_DIR_ENTRY_FLAG_DELETE_MARKER 0x01
+#define MERGE_DIR_ENTRY_BUCKETS            32
+
+/**
+ * Compact record of an entry that has been returned from the redirected directory.
+ * Entries are allocated from the arena of the owning DirInfoEx, the (null terminated) name is
+ * stored directly after the struct. For delete markers the name is stored without the prefix.
+ */
+typedef struct MergeDirEntry {
+    MergeDirEntry *next;
+    uint32_t hash;
+    uint8_t flags;
+
+    [[nodiscard]] const char *getName() const {
+        return reinterpret_cast<const char *>(this + 1);
+    }
+} MergeDirEntry;
 
 struct DirInfoEx : public DirInfo {
 public:
-    FSDirectoryEntryEx *readResult  = nullptr;
-    int readResultCapacity          = 0;
-    int readResultNumberOfEntries   = 0;
+    MergeDirEntry *readResultBuckets[MERGE_DIR_ENTRY_BUCKETS]{};
+    uint32_t readResultNumberOfEntries = 0;
+    BumpArena readResultArena{0x800};
+    // Opened lazily, 0 until the redirected directory has been read completely.
     FSDirectoryHandle realDirHandle = 0;
-};
\ No newline at end of file
+    std::string realDirPath;
+    bool realDirOpenFailed = false;
+    // Set if the handle is served from the MergedDirCache.
+    std::shared_ptr<const MergedDirSnapshot> snapshot;
+    uint32_t snapshotPosition = 0;
+    // Listing that is recorded while reading the directories, added to the cache once completed.
+    std::unique_ptr<MergedDirSnapshot> pendingSnapshot;
+};
@@ -0,0 +1,65 @@
+#include "ExistenceFilter.h"
+#include "utils/StringTools.h"
+#include "utils/utils.h"
+#include <algorithm>
+
+bool ExistenceFilter::mayContain(std::string_view relativePath) const {
+    if (!isReady()) {
+        return true;
+    }
+    auto hash = getHash(relativePath);
+    if (pBloomNumBits == 0) {
+        return std::binary_search(pExactHashes.begin(), pExactHashes.end(), hash);
+    }
+    return testBloom(hash);
+}
+
+void ExistenceFilter::build(const std::vector<std::string> &paths) {
+    std::vector<uint32_t> hashes;
+    hashes.reserve(paths.size() + 1);
+    // The root always exists if the layer has been created.
+    hashes.push_back(getHash({}));
+    for (auto &path : paths) {
+        hashes.push_back(getHash(path));
+    }
+
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    if (hashes.size() <= EXISTENCE_FILTER_MAX_EXACT_ENTRIES) {
+        hashes.shrink_to_fit();
+        pExactHashes = std::move(hashes);
+    } else {
+        pBloomNumBits = ROUNDUP(hashes.size() * EXISTENCE_FILTER_BITS_PER_ENTRY, 32);
+        pBloomBits.assign(pBloomNumBits / 32, 0);
+        for (auto hash : hashes) {
+            // Kirsch-Mitzenmacher double hashing
+            uint32_t h2 = (hash >> 17) | (hash << 15);
+            for (uint32_t i = 0; i < EXISTENCE_FILTER_NUM_HASHES; i++) {
+                uint32_t bit = (hash + i * h2) % pBloomNumBits;
+                pBloomBits[bit / 32] |= 1u << (bit % 32);
+            }
+        }
+    }
+
+    pReady.store(true, std::memory_order_release);
+}
+
+bool ExistenceFilter::testBloom(uint32_t hash) const {
+    uint32_t h2 = (hash >> 17) | (hash << 15);
+    for (uint32_t i = 0; i < EXISTENCE_FILTER_NUM_HASHES; i++) {
+        uint32_t bit = (hash + i * h2) % pBloomNumBits;
+        if ((pBloomBits[bit / 32] & (1u << (bit % 32))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t ExistenceFilter::getHash(std::string_view relativePath) {
+    auto key = normalize_path_key(relativePath);
+    if (!key.empty() && key.front() == '/') {
+        return hash_string(std::string_view(key).substr(1));
+    }
+    return hash_string(key);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define EXISTENCE_FILTER_MAX_EXACT_ENTRIES 8192
+#define EXISTENCE_FILTER_BITS_PER_ENTRY    10
+#define EXISTENCE_FILTER_NUM_HASHES        7
+
+/**
+ * Answers "may this path exist in the replacement directory?" without touching the disk.
+ *
+ * The filter contains the relative paths of all files and directories of the replacement directory.
+ * Small trees are stored as a sorted list of path hashes, bigger trees as a bloom filter. Both may
+ * return false positives, but never false negatives. It's built once the LayerIndex of the layer is
+ * complete, until then every path may exist.
+ */
+class ExistenceFilter {
+public:
+    ExistenceFilter() = default;
+
+    /**
+     * Builds the filter from the relative paths of all files and directories. Must only be called once.
+     */
+    void build(const std::vector<std::string> &paths);
+
+    [[nodiscard]] bool isReady() const {
+        return pReady.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Returns false if the path (relative to the replacement directory) definitely does not exist.
+     */
+    [[nodiscard]] bool mayContain(std::string_view relativePath) const;
+
+private:
+    [[nodiscard]] bool testBloom(uint32_t hash) const;
+
+    static uint32_t getHash(std::string_view relativePath);
+
+    // Immutable once pReady is set.
+    std::vector<uint32_t> pExactHashes;
+    std::vector<uint32_t> pBloomBits;
+    uint32_t pBloomNumBits = 0;
+
+    std::atomic<bool> pReady{false};
+};
@@ -1,5 +1,6 @@
 #include "FSAReplacements.h"
 #include "FileUtils.h"
+#include "WorkerThreads.h"
 #include "utils/logger.h"
 #include <coreinit/core.h>
 #include <coreinit/thread.h>
@@ -18,7 +19,8 @@ static FSError processFSAShimInThread(FSAShimBuffer *shimBuffer) {
         param->sync = FS_SHIM_TYPE_SYNC;
         param->shim = shimBuffer;
 
-        if (OSGetCurrentThread() == gThreadData[OSGetCoreId()].thread) {
+        // Workers may hold the fsLayerMutex (e.g. while they run a batch), so they can't wait for an IO thread.
+        if (OSGetCurrentThread() == gThreadData[OSGetCoreId()].thread || isWorkerThread(OSGetCurrentThread())) {
             res = processShimBufferForFSA(param);
             //No need to clean "param", it has been already free'd in processFSAShimBuffer.
         } else {
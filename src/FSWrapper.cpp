@@ -1,5 +1,6 @@
 #include "FSWrapper.h"
 #include "FileUtils.h"
+#include "export.h"
 #include "utils/StringTools.h"
 #include "utils/logger.h"
 #include "utils/utils.h"
@@ -26,6 +27,11 @@ FSError FSWrapper::FSOpenDirWrapper(const char *path, FSDirectoryHandle *handle)
         return FS_ERROR_INVALID_PARAM;
     }
 
+    if (IsDefinitelyMissing(path)) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] Dir %s does not exist in this layer", getName().c_str(), path);
+        return pFallbackOnError ? FS_ERROR_FORCE_PARENT_LAYER : FS_ERROR_NOT_FOUND;
+    }
+
     FSError result = FS_ERROR_OK;
 
     auto dirHandle = getNewDirHandle();
@@ -33,18 +39,15 @@ FSError FSWrapper::FSOpenDirWrapper(const char *path, FSDirectoryHandle *handle)
         DIR *dir;
         auto newPath = GetNewPath(path);
 
-        if ((dir = opendir(newPath.c_str()))) {
-            dirHandle->dir    = dir;
-            dirHandle->handle = (((uint32_t) dirHandle.get()) & 0x0FFFFFFF) | 0x30000000;
-            *handle           = dirHandle->handle;
-
-            dirHandle->path[0] = '\0';
-            strncat(dirHandle->path, newPath.c_str(), sizeof(dirHandle->path) - 1);
-            {
-                std::lock_guard<std::mutex> lock(openDirsMutex);
-                openDirs.push_back(dirHandle);
-                OSMemoryBarrier();
-            }
+        if (auto listing = GetListingFromIndex(path)) {
+            DEBUG_FUNCTION_LINE_VERBOSE("[%s] List %s from the index", getName().c_str(), path);
+            dirHandle->listing = std::move(listing);
+            dirHandle->path    = newPath;
+            addDirHandle(dirHandle, handle);
+        } else if ((dir = opendir(newPath.c_str()))) {
+            dirHandle->dir  = dir;
+            dirHandle->path = newPath;
+            addDirHandle(dirHandle, handle);
         } else {
             auto err = errno;
             if (err == ENOENT) {
@@ -73,6 +76,9 @@ FSError FSWrapper::FSReadDirWrapper(FSDirectoryHandle handle, FSDirectoryEntry *
         return FS_ERROR_FORCE_PARENT_LAYER;
     }
     auto dirHandle = getDirFromHandle(handle);
+    if (dirHandle->listing) {
+        return ReadDirFromListing(dirHandle.get(), entry);
+    }
 
     DIR *dir = dirHandle->dir;
 
@@ -102,7 +108,7 @@ FSError FSWrapper::FSReadDirWrapper(FSDirectoryHandle handle, FSDirectoryEntry *
                     translate_stat(&entry_->d_stat, &entry->info);
 #else
                     struct stat sb {};
-                    auto path = string_format("%s/%s", dirHandle->path, entry_->d_name);
+                    auto path = string_format("%s/%s", dirHandle->path.c_str(), entry_->d_name);
                     std::replace(path.begin(), path.end(), '\\', '/');
 
                     uint32_t length = path.size();
@@ -144,6 +150,10 @@ FSError FSWrapper::FSCloseDirWrapper(FSDirectoryHandle handle) {
         return FS_ERROR_FORCE_PARENT_LAYER;
     }
     auto dirHandle = getDirFromHandle(handle);
+    if (dirHandle->listing) {
+        dirHandle->listing.reset();
+        return FS_ERROR_OK;
+    }
 
     DIR *dir = dirHandle->dir;
 
@@ -163,6 +173,10 @@ FSError FSWrapper::FSRewindDirWrapper(FSDirectoryHandle handle) {
         return FS_ERROR_FORCE_PARENT_LAYER;
     }
     auto dirHandle = getDirFromHandle(handle);
+    if (dirHandle->listing) {
+        dirHandle->listingPosition = 0;
+        return FS_ERROR_OK;
+    }
 
     DIR *dir = dirHandle->dir;
 
@@ -246,22 +260,43 @@ FSError FSWrapper::FSOpenFileWrapper(const char *path, const char *mode, FSFileH
         return FS_ERROR_ACCESS_ERROR;
     }
 
+    if (pBootPack && _mode == O_RDONLY) {
+        if (auto *file = pBootPack->find(std::string_view(newPath).substr(pReplacePathWith.length()))) {
+            DEBUG_FUNCTION_LINE_VERBOSE("[%s] Open %s from the boot pack", getName().c_str(), path);
+            return OpenFileFromPack(pBootPack->getArchive(), file, handle);
+        }
+    }
+
+    // Files that would be created are not part of the index, but only read-only layers have one.
+    if (IsDefinitelyMissing(path)) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] File %s does not exist in this layer", getName().c_str(), path);
+        return pFallbackOnError ? FS_ERROR_FORCE_PARENT_LAYER : FS_ERROR_NOT_FOUND;
+    }
+
     DEBUG_FUNCTION_LINE_VERBOSE("[%s] Open %s (as %s) mode %s,", getName().c_str(), path, newPath.c_str(), mode);
     int32_t fd = open(newPath.c_str(), _mode);
+    if (fd >= 0 && _mode == O_RDONLY && pSlurpSize > 0 && OpenFileSlurped(path, fd, handle)) {
+        return FS_ERROR_OK;
+    }
     if (fd >= 0) {
         auto fileHandle = getNewFileHandle();
         if (fileHandle) {
-            std::lock_guard<std::mutex> lock(openFilesMutex);
-
-            fileHandle->handle = (((uint32_t) fileHandle.get()) & 0x0FFFFFFF) | 0x30000000;
-            *handle            = fileHandle->handle;
-            fileHandle->fd     = fd;
+            fileHandle->reader = CreateFdReader(fd, newPath, _mode == O_RDONLY);
+        }
+        if (fileHandle && fileHandle->reader) {
+            fileHandle->fd      = fd;
+            fileHandle->hasStat = GetStatFromIndex(path, &fileHandle->indexStat);
+            fileHandle->path    = path;
+            if (pPrefetcher && _mode == O_RDONLY) {
+                fileHandle->prefetchKey = pPrefetcher->getCachedKey(path);
+            }
+            if (pCoalescer && _mode == O_RDONLY) {
+                fileHandle->coalesceKey = LayerIndex::getKey(path);
+                MarkSharedOpen(fileHandle.get());
+            }
+            addFileHandle(fileHandle, handle);
 
             DEBUG_FUNCTION_LINE_VERBOSE("[%s] Opened %s (as %s) mode %s (%08X), fd %d (%08X)", getName().c_str(), path, newPath.c_str(), mode, _mode, fd, fileHandle->handle);
-
-            openFiles.push_back(fileHandle);
-
-            OSMemoryBarrier();
         } else {
             close(fd);
             DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc new fileHandle", getName().c_str());
@@ -301,8 +336,16 @@ FSError FSWrapper::FSCloseFileWrapper(FSFileHandle handle) {
     }
 
     auto fileHandle = getFileFromHandle(handle);
+    if (fileHandle->coalesceReads) {
+        UnmarkSharedOpen(fileHandle.get());
+    }
+    // Stops the stream or returns the slurp buffer of the handle.
+    fileHandle->reader.reset();
 
     int real_fd = fileHandle->fd;
+    if (real_fd < 0) {
+        return FS_ERROR_OK;
+    }
 
     FSError result = FS_ERROR_OK;
     DEBUG_FUNCTION_LINE_VERBOSE("[%s] Close %d (handle %08X)", getName().c_str(), real_fd, handle);
@@ -315,13 +358,34 @@ FSError FSWrapper::FSCloseFileWrapper(FSFileHandle handle) {
 }
 
 bool FSWrapper::CheckFileShouldBeIgnored(std::string &path) {
-    auto asPath = std::filesystem::path(path);
+    auto fileNamePos = path.find_last_of('/');
+    auto fileName    = std::string_view(path).substr(fileNamePos == std::string::npos ? 0 : fileNamePos + 1);
 
-    if (starts_with_case_insensitive(asPath.filename().c_str(), deletePrefix)) {
+    if (starts_with_case_insensitive(fileName, deletePrefix)) {
         DEBUG_FUNCTION_LINE_VERBOSE("[%s] Ignore %s, filename starts with %s", getName().c_str(), path.c_str(), deletePrefix.c_str());
         return true;
     }
 
+    if (starts_with_case_insensitive(path, pReplacePathWith)) {
+        auto relativePath = std::string_view(path).substr(pReplacePathWith.length());
+        if (pWhiteouts && pWhiteouts->isReady()) {
+            if (pWhiteouts->contains(relativePath)) {
+                DEBUG_FUNCTION_LINE_VERBOSE("[%s] Ignore %s, path has a whiteout", getName().c_str(), path.c_str());
+                return true;
+            }
+            return false;
+        }
+        if (IsIndexStarted() && pWhiteouts) {
+            // The directory may already be indexed.
+            auto lookup = pIndex->lookup(pWhiteouts->getMarkerPath(relativePath));
+            if (lookup != LAYER_INDEX_LOOKUP_UNKNOWN) {
+                return lookup == LAYER_INDEX_LOOKUP_FOUND;
+            }
+        }
+    }
+
+    // The whiteout index is not ready yet, check for the marker on the disk.
+    auto asPath     = std::filesystem::path(path);
     auto newDelPath = asPath.replace_filename(deletePrefix + asPath.filename().c_str());
     struct stat buf {};
     if (stat(newDelPath.c_str(), &buf) == 0) {
@@ -348,6 +412,16 @@ FSError FSWrapper::FSGetStatWrapper(const char *path, FSStat *stats) {
         return static_cast<FSError>((FS_ERROR_NOT_FOUND & FS_ERROR_REAL_MASK) | FS_ERROR_FORCE_NO_FALLBACK);
     }
 
+    if (IsDefinitelyMissing(path)) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] Path %s does not exist in this layer", getName().c_str(), path);
+        return pFallbackOnError ? FS_ERROR_FORCE_PARENT_LAYER : FS_ERROR_NOT_FOUND;
+    }
+
+    if (GetStatFromIndex(path, stats)) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] stat of %s from the index", getName().c_str(), path);
+        return FS_ERROR_OK;
+    }
+
     FSError result = FS_ERROR_OK;
 
     DEBUG_FUNCTION_LINE_VERBOSE("[%s] stat of %s (%s)", getName().c_str(), path, newPath.c_str());
@@ -365,6 +439,14 @@ FSError FSWrapper::FSGetStatFileWrapper(FSFileHandle handle, FSStat *stats) {
         return FS_ERROR_FORCE_PARENT_LAYER;
     }
     auto fileHandle = getFileFromHandle(handle);
+    if (fileHandle->hasStat) {
+        *stats = fileHandle->indexStat;
+        return FS_ERROR_OK;
+    }
+    if (fileHandle->fd < 0) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] No stat for handle %08X", getName().c_str(), handle);
+        return FS_ERROR_MEDIA_ERROR;
+    }
 
     int real_fd = fileHandle->fd;
 
@@ -397,24 +479,42 @@ FSError FSWrapper::FSReadFileWrapper(void *buffer, uint32_t size, uint32_t count
     }
 
     auto fileHandle = getFileFromHandle(handle);
-    int real_fd     = fileHandle->fd;
+    auto *reader    = fileHandle->reader.get();
+
+    if (auto prefetcher = pPrefetcher; prefetcher && !fileHandle->prefetchKey.empty() && fileHandle->readAheadLength == 0) {
+        auto pos = reader->getPos();
+        if (pos >= 0) {
+            int64_t read = prefetcher->readCached(fileHandle->prefetchKey, pos, buffer, size * count);
+            if (read >= 0 && reader->setPos(pos + read)) {
+                DEBUG_FUNCTION_LINE_VERBOSE("[%s] Read %u bytes of FSFileHandle %08X from the prefetch cache", getName().c_str(), (uint32_t) read, handle);
+                return static_cast<FSError>(((uint32_t) read) / size);
+            }
+        }
+    }
 
-    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Read %u bytes of fd %08X (FSFileHandle %08X) to buffer %08X", getName().c_str(), size * count, real_fd, handle, buffer);
-    int64_t read = readIntoBuffer(real_fd, buffer, size, count);
+    if (fileHandle->advice == CR_FILE_ADVICE_SEQUENTIAL) {
+        return ReadWithReadAhead(fileHandle.get(), buffer, size, count);
+    }
 
-    FSError result;
+    if (pCoalescer && fileHandle->coalesceReads && fileHandle->advice == CR_FILE_ADVICE_NORMAL) {
+        return ReadCoalesced(fileHandle.get(), buffer, size, count);
+    }
+
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Read %u bytes of FSFileHandle %08X to buffer %08X", getName().c_str(), size * count, handle, buffer);
+    int64_t read = reader->read(buffer, size * count);
     if (read < 0) {
-        DEBUG_FUNCTION_LINE_ERR("[%s] Read %u bytes of fd %d (FSFileHandle %08X) failed", getName().c_str(), size * count, real_fd, handle);
-        auto err = errno;
-        if (err == EBADF || err == EROFS) {
-            return FS_ERROR_ACCESS_ERROR;
-        }
-        result = FS_ERROR_MEDIA_ERROR;
-    } else {
-        result = static_cast<FSError>(((uint32_t) read) / size);
+        return GetReadError(fileHandle.get(), size * count);
     }
+    return static_cast<FSError>(((uint32_t) read) / size);
+}
 
-    return result;
+FSError FSWrapper::GetReadError(FileInfo *fileHandle, uint32_t size) {
+    auto err = errno;
+    DEBUG_FUNCTION_LINE_ERR("[%s] Read %u bytes of fd %d (FSFileHandle %08X) failed. errno %d", getName().c_str(), size, fileHandle->fd, fileHandle->handle, err);
+    if (err == EBADF || err == EROFS) {
+        return FS_ERROR_ACCESS_ERROR;
+    }
+    return FS_ERROR_MEDIA_ERROR;
 }
 
 FSError FSWrapper::FSReadFileWithPosWrapper(void *buffer, uint32_t size, uint32_t count, uint32_t pos, FSFileHandle handle, int32_t unk1) {
@@ -437,24 +537,22 @@ FSError FSWrapper::FSSetPosFileWrapper(FSFileHandle handle, uint32_t pos) {
         return FS_ERROR_FORCE_PARENT_LAYER;
     }
     auto fileHandle = getFileFromHandle(handle);
-
-    FSError result = FS_ERROR_OK;
-
-    int real_fd = fileHandle->fd;
-
-    DEBUG_FUNCTION_LINE_VERBOSE("[%s] lseek fd %d (FSFileHandle %08X) SEEK_SET to position %08X", getName().c_str(), real_fd, handle, pos);
-    off_t newPos;
-    if ((newPos = lseek(real_fd, (off_t) pos, SEEK_SET)) != pos) {
-        DEBUG_FUNCTION_LINE_ERR("[%s] lseek fd %d (FSFileHandle %08X) to position %08X failed", getName().c_str(), real_fd, handle, pos);
-        if (newPos < 0) {
-            // TODO: read errno
+    if (fileHandle->readAheadLength > 0) {
+        if (pos >= fileHandle->readAheadOffset && pos - fileHandle->readAheadOffset <= fileHandle->readAheadLength) {
+            fileHandle->readAheadPos = pos - fileHandle->readAheadOffset;
+            return FS_ERROR_OK;
         }
-        result = FS_ERROR_MEDIA_ERROR;
-    } else {
-        DEBUG_FUNCTION_LINE_VERBOSE("[%s] pos set to %u for fd %d (FSFileHandle %08X)", getName().c_str(), pos, real_fd, handle);
+        // The reader is moved anyway.
+        fileHandle->readAheadPos    = 0;
+        fileHandle->readAheadLength = 0;
     }
 
-    return result;
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Set position of FSFileHandle %08X to %08X", getName().c_str(), handle, pos);
+    if (!fileHandle->reader->setPos(pos)) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Setting the position of FSFileHandle %08X to %08X failed", getName().c_str(), handle, pos);
+        return FS_ERROR_MEDIA_ERROR;
+    }
+    return FS_ERROR_OK;
 }
 
 FSError FSWrapper::FSGetPosFileWrapper(FSFileHandle handle, uint32_t *pos) {
@@ -462,20 +560,18 @@ FSError FSWrapper::FSGetPosFileWrapper(FSFileHandle handle, uint32_t *pos) {
         return FS_ERROR_FORCE_PARENT_LAYER;
     }
     auto fileHandle = getFileFromHandle(handle);
+    if (fileHandle->readAheadLength > 0) {
+        *pos = fileHandle->readAheadOffset + fileHandle->readAheadPos;
+        return FS_ERROR_OK;
+    }
 
-    FSError result = FS_ERROR_OK;
-
-    int real_fd = fileHandle->fd;
-
-    DEBUG_FUNCTION_LINE_VERBOSE("[%s] lseek fd %08X (FSFileHandle %08X) to get current position for truncation", getName().c_str(), real_fd, handle);
-    off_t currentPos = lseek(real_fd, (off_t) 0, SEEK_CUR);
-    if (currentPos == -1) {
-        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to get current position (res: %lld) of fd (handle %08X) to check EoF", getName().c_str(), currentPos, real_fd, handle);
-        result = FS_ERROR_MEDIA_ERROR;
-    } else {
-        *pos = currentPos;
+    auto currentPos = fileHandle->reader->getPos();
+    if (currentPos < 0) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to get current position of FSFileHandle %08X", getName().c_str(), handle);
+        return FS_ERROR_MEDIA_ERROR;
     }
-    return result;
+    *pos = currentPos;
+    return FS_ERROR_OK;
 }
 
 FSError FSWrapper::FSIsEofWrapper(FSFileHandle handle) {
@@ -483,30 +579,25 @@ FSError FSWrapper::FSIsEofWrapper(FSFileHandle handle) {
         return FS_ERROR_FORCE_PARENT_LAYER;
     }
     auto fileHandle = getFileFromHandle(handle);
-
-    FSError result;
-
-    int real_fd = fileHandle->fd;
-
-    DEBUG_FUNCTION_LINE_VERBOSE("[%s] lseek fd %08X (FSFileHandle %08X) to get current position for EOF detection", getName().c_str(), real_fd, handle);
-    off_t currentPos = lseek(real_fd, (off_t) 0, SEEK_CUR);
-    DEBUG_FUNCTION_LINE_VERBOSE("[%s] lseek fd %08X (FSFileHandle %08X) to get end position for EOF detection", getName().c_str(), real_fd, handle);
-    off_t endPos = lseek(real_fd, (off_t) 0, SEEK_END);
-
-    if (currentPos == -1 || endPos == -1) {
-        // TODO: check errno
-        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to get current position (res: %lld) or endPos (res: %lld) of fd (handle %08X) to check EoF", getName().c_str(), currentPos, endPos, real_fd, handle);
-        result = FS_ERROR_MEDIA_ERROR;
-    } else if (currentPos == endPos) {
-        DEBUG_FUNCTION_LINE_VERBOSE("[%s] FSIsEof END for %d\n", getName().c_str(), real_fd);
-        result = FS_ERROR_END_OF_FILE;
-    } else {
-        lseek(real_fd, currentPos, SEEK_CUR);
-        DEBUG_FUNCTION_LINE_VERBOSE("[%s] FSIsEof OK for %d\n", getName().c_str(), real_fd);
-        result = FS_ERROR_OK;
+    if (fileHandle->readAheadPos < fileHandle->readAheadLength) {
+        return FS_ERROR_OK;
+    }
+    if (!DropReadAhead(fileHandle.get())) {
+        return FS_ERROR_MEDIA_ERROR;
     }
 
-    return result;
+    auto currentPos = fileHandle->reader->getPos();
+    auto endPos     = fileHandle->reader->getSize();
+    if (currentPos < 0 || endPos < 0) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to get current position (res: %lld) or size (res: %lld) of FSFileHandle %08X to check EoF", getName().c_str(), currentPos, endPos, handle);
+        return FS_ERROR_MEDIA_ERROR;
+    }
+    if (currentPos >= endPos) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] FSIsEof END for FSFileHandle %08X", getName().c_str(), handle);
+        return FS_ERROR_END_OF_FILE;
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] FSIsEof OK for FSFileHandle %08X", getName().c_str(), handle);
+    return FS_ERROR_OK;
 }
 
 FSError FSWrapper::FSTruncateFileWrapper(FSFileHandle handle) {
@@ -678,6 +769,169 @@ bool FSWrapper::IsPathToReplace(const std::string_view &path) {
     return starts_with_case_insensitive(path, pPathToReplace);
 }
 
+bool FSWrapper::IsDefinitelyMissing(const std::string_view &path) {
+    if (!IsIndexStarted()) {
+        return false;
+    }
+    auto relativePath = path.substr(pPathToReplace.length());
+    auto lookup       = pIndex->lookup(relativePath);
+    if (lookup != LAYER_INDEX_LOOKUP_UNKNOWN) {
+        return lookup == LAYER_INDEX_LOOKUP_MISSING;
+    }
+    return pExistenceFilter && !pExistenceFilter->mayContain(relativePath);
+}
+
+bool FSWrapper::IsIndexStarted() {
+    if (!pIndex) {
+        return false;
+    }
+    if (!pIndexStarted) {
+        // Retry if the workers were busy or not running yet.
+        pIndexStarted = LayerIndex::start(pIndex);
+    }
+    return pIndexStarted;
+}
+
+bool FSWrapper::GetStatFromIndex(const std::string_view &path, FSStat *stats) {
+    if (!pServeMetadataFromIndex || !IsIndexStarted()) {
+        return false;
+    }
+    LayerIndexEntry indexEntry;
+    if (pIndex->lookup(path.substr(pPathToReplace.length()), &indexEntry) != LAYER_INDEX_LOOKUP_FOUND) {
+        return false;
+    }
+    indexEntry.toStat(stats);
+    return true;
+}
+
+std::shared_ptr<const LayerIndexListing> FSWrapper::GetListingFromIndex(const std::string_view &path) {
+    if (!pServeMetadataFromIndex || !IsIndexStarted()) {
+        return nullptr;
+    }
+    return pIndex->getListing(path.substr(pPathToReplace.length()));
+}
+
+FSError FSWrapper::ReadDirFromListing(DirInfo *dirHandle, FSDirectoryEntry *entry) {
+    auto &entries = dirHandle->listing->entries;
+    while (dirHandle->listingPosition < entries.size()) {
+        auto &cur = entries[dirHandle->listingPosition++];
+        if (SkipDeletedFilesInReadDir() && starts_with_case_insensitive(cur.name, deletePrefix)) {
+            continue;
+        }
+        entry->name[0] = '\0';
+        strncat(entry->name, cur.name.c_str(), sizeof(entry->name) - 1);
+        cur.entry.toStat(&entry->info);
+        return FS_ERROR_OK;
+    }
+    return FS_ERROR_END_OF_DIR;
+}
+
+bool FSWrapper::setOption(uint32_t option, uint32_t value) {
+    if (option == CR_LAYER_OPTION_INDEX_METADATA) {
+        if (!pIndex) {
+            // Writeable layers don't have an index.
+            return false;
+        }
+        bool serveMetadata = value != 0;
+        if (serveMetadata != pServeMetadataFromIndex) {
+            pServeMetadataFromIndex = serveMetadata;
+            // A completed index may already have dropped its metadata. The new one is usually loaded from the index file.
+            pIndex->cancel();
+            initIndex();
+        }
+        return true;
+    } else if (option == CR_LAYER_OPTION_BOOT_TRACE) {
+        if (pIsWriteable) {
+            return false;
+        }
+        if (pBootTrace) {
+            BootTrace::finish(pBootTrace);
+            pBootTrace.reset();
+        }
+        if (value != 0) {
+            pBootTrace = make_shared_nothrow<BootTrace>(pPathToReplace, pReplacePathWith, value);
+            if (!pBootTrace) {
+                DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate BootTrace", getName().c_str());
+                return false;
+            }
+        }
+        return true;
+    } else if (option == CR_LAYER_OPTION_PREFETCH) {
+        if (pIsWriteable) {
+            return false;
+        }
+        if (value == 0) {
+            if (pPrefetcher) {
+                Prefetcher::setLearning(pPrefetcher, false);
+                pPrefetcher.reset();
+            }
+            return true;
+        }
+        if (!InitPrefetcher()) {
+            return false;
+        }
+        Prefetcher::setLearning(pPrefetcher, true);
+        return true;
+    } else if (option == CR_LAYER_OPTION_SLURP_SIZE) {
+        if (pIsWriteable || value > FILE_SLURP_MAX_SIZE) {
+            return false;
+        }
+        if (value > 0 && !pSlurpPool && !(pSlurpPool = make_shared_nothrow<SlurpPool>())) {
+            return false;
+        }
+        if (pSlurpPool) {
+            pSlurpPool->setSlurpSize(value);
+        }
+        pSlurpSize = value;
+        return true;
+    } else if (option == CR_LAYER_OPTION_STREAMING) {
+        if (pIsWriteable || value > FILE_STREAM_MAX_CHUNKS) {
+            return false;
+        }
+        if (value > 0 && !pStreamCounters && !(pStreamCounters = make_shared_nothrow<StreamCounters>())) {
+            return false;
+        }
+        // Handles that are already open keep their reader.
+        pStreamChunks = value;
+        return true;
+    } else if (option == CR_LAYER_OPTION_COALESCE_READS) {
+        if (pIsWriteable) {
+            return false;
+        }
+        if (value == 0) {
+            pCoalescer.reset();
+        } else if (!pCoalescer && !(pCoalescer = make_unique_nothrow<ReadCoalescer>())) {
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+void FSWrapper::initIndex() {
+    if (pIsWriteable) {
+        return;
+    }
+    pIndex = make_shared_nothrow<LayerIndex>(pReplacePathWith, pServeMetadataFromIndex);
+    if (!pIndex) {
+        return;
+    }
+    pExistenceFilter = make_shared_nothrow<ExistenceFilter>();
+    if (pCheckIfDeleted) {
+        pWhiteouts = make_shared_nothrow<WhiteoutIndex>(pReplacePathWith, deletePrefix);
+    }
+    // Don't capture the layer, the index may be completed after the layer has been removed.
+    pIndex->setCompletionHandler([filter = pExistenceFilter, whiteouts = pWhiteouts](const std::vector<std::string> &paths) {
+        if (filter) {
+            filter->build(paths);
+        }
+        if (whiteouts) {
+            whiteouts->load(paths);
+        }
+    });
+    pIndexStarted = LayerIndex::start(pIndex);
+}
+
 std::string FSWrapper::GetNewPath(const std::string_view &path) {
     auto subStr = path.substr(this->pPathToReplace.length());
     auto res    = string_format("%s%.*s", this->pReplacePathWith.c_str(), int(subStr.length()), subStr.data());
@@ -709,6 +963,262 @@ bool FSWrapper::isValidDirHandle(FSDirectoryHandle handle) {
     return std::ranges::any_of(openDirs, [handle](auto &cur) { return cur->handle == handle; });
 }
 
+FSError FSWrapper::OpenFileFromPack(const std::shared_ptr<PackArchive> &archive, const PackFile *file, FSFileHandle *handle) {
+    auto fileHandle = getNewFileHandle();
+    if (fileHandle) {
+        fileHandle->reader = make_unique_nothrow<PackFileReader>(archive, file);
+    }
+    if (!fileHandle || !fileHandle->reader) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc new fileHandle", getName().c_str());
+        return FS_ERROR_MAX_FILES;
+    }
+    LayerIndexEntry entry{};
+    fileHandle->fd      = -1;
+    fileHandle->hasStat = archive->getIndex()->lookup(file->key, &entry) == LAYER_INDEX_LOOKUP_FOUND;
+    if (fileHandle->hasStat) {
+        entry.toStat(&fileHandle->indexStat);
+    }
+    addFileHandle(fileHandle, handle);
+
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Opened %s from %s (offset %llu, size %u) (%08X)", getName().c_str(), file->key, archive->getPath().c_str(), file->offset, file->size, fileHandle->handle);
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapper::ReadWithReadAhead(FileInfo *fileHandle, void *buffer, uint32_t size, uint32_t count) {
+    auto *reader   = fileHandle->reader.get();
+    auto *out      = (uint8_t *) buffer;
+    uint32_t total = size * count;
+    uint32_t done  = 0;
+    while (done < total) {
+        uint32_t available = fileHandle->readAheadLength - fileHandle->readAheadPos;
+        if (available > 0) {
+            auto toCopy = std::min(available, total - done);
+            memcpy(out + done, fileHandle->readAheadBuffer + fileHandle->readAheadPos, toCopy);
+            fileHandle->readAheadPos += toCopy;
+            done += toCopy;
+            continue;
+        }
+        fileHandle->readAheadPos    = 0;
+        fileHandle->readAheadLength = 0;
+        if (total - done >= FILE_READ_AHEAD_SIZE ||
+            (fileHandle->readAheadBuffer == nullptr && (fileHandle->readAheadBuffer = (uint8_t *) malloc(FILE_READ_AHEAD_SIZE)) == nullptr)) {
+            auto read = reader->read(out + done, total - done);
+            if (read < 0) {
+                return GetReadError(fileHandle, total - done);
+            }
+            done += read;
+            break;
+        }
+        auto pos  = reader->getPos();
+        auto read = pos < 0 ? -1 : reader->read(fileHandle->readAheadBuffer, FILE_READ_AHEAD_SIZE);
+        if (read < 0) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Read ahead of FSFileHandle %08X failed", getName().c_str(), fileHandle->handle);
+            return FS_ERROR_MEDIA_ERROR;
+        }
+        if (read == 0) {
+            break;
+        }
+        fileHandle->readAheadOffset = pos;
+        fileHandle->readAheadLength = read;
+    }
+    return static_cast<FSError>(done / size);
+}
+
+bool FSWrapper::DropReadAhead(FileInfo *fileHandle) {
+    if (fileHandle->readAheadLength == 0) {
+        return true;
+    }
+    uint32_t pos                = fileHandle->readAheadOffset + fileHandle->readAheadPos;
+    fileHandle->readAheadPos    = 0;
+    fileHandle->readAheadLength = 0;
+    return fileHandle->reader->setPos(pos);
+}
+
+FSError FSWrapper::ReadCoalesced(FileInfo *fileHandle, void *buffer, uint32_t size, uint32_t count) {
+    auto *reader   = fileHandle->reader.get();
+    uint32_t total = size * count;
+    auto pos       = reader->getPos();
+    if (pos < 0) {
+        return FS_ERROR_MEDIA_ERROR;
+    }
+    if (pCoalescer->lookup(fileHandle->coalesceKey, pos, buffer, total)) {
+        if (!reader->setPos(pos + total)) {
+            return FS_ERROR_MEDIA_ERROR;
+        }
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] Coalesced read of %u bytes at %u of %s (FSFileHandle %08X)", getName().c_str(), total, (uint32_t) pos, fileHandle->path.c_str(), fileHandle->handle);
+        return static_cast<FSError>(count);
+    }
+
+    auto read = reader->read(buffer, total);
+    if (read < 0) {
+        return GetReadError(fileHandle, total);
+    }
+    pCoalescer->store(fileHandle->coalesceKey, pos, buffer, read);
+    return static_cast<FSError>(((uint32_t) read) / size);
+}
+
+void FSWrapper::MarkSharedOpen(FileInfo *fileHandle) {
+    std::lock_guard<std::mutex> lock(openFilesMutex);
+    for (auto &file : openFiles) {
+        if (!file->coalesceKey.empty() && file->coalesceKey == fileHandle->coalesceKey) {
+            file->coalesceReads       = true;
+            fileHandle->coalesceReads = true;
+        }
+    }
+}
+
+void FSWrapper::UnmarkSharedOpen(FileInfo *fileHandle) {
+    std::shared_ptr<FileInfo> remaining;
+    {
+        std::lock_guard<std::mutex> lock(openFilesMutex);
+        for (auto &file : openFiles) {
+            if (file.get() == fileHandle || file->coalesceKey != fileHandle->coalesceKey) {
+                continue;
+            }
+            if (remaining) {
+                // Still open more than once.
+                return;
+            }
+            remaining = file;
+        }
+    }
+    if (remaining) {
+        remaining->coalesceReads = false;
+    }
+    if (pCoalescer) {
+        pCoalescer->forget(fileHandle->coalesceKey);
+    }
+}
+
+bool FSWrapper::getCoalesceStats(CoalesceStats *outStats) {
+    if (!pCoalescer) {
+        return false;
+    }
+    pCoalescer->getStats(outStats);
+    return true;
+}
+
+bool FSWrapper::getStreamStats(StreamStats *outStats) {
+    if (pStreamChunks == 0 || !pStreamCounters) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(pStreamCounters->mutex);
+    *outStats = pStreamCounters->stats;
+    return true;
+}
+
+std::unique_ptr<FileReader> FSWrapper::CreateFdReader(int fd, const std::string &newPath, bool readOnly) {
+    if (readOnly && pStreamChunks > 0 && pStreamCounters) {
+        return make_unique_nothrow<StreamedFileReader>(fd, newPath, pStreamChunks, pStreamCounters);
+    }
+    return make_unique_nothrow<FdFileReader>(fd);
+}
+
+bool FSWrapper::OpenFileSlurped(const char *path, int fd, FSFileHandle *handle) {
+    FSStat stat{};
+    if (!GetStatFromIndex(path, &stat)) {
+        struct stat sb {};
+        if (fstat(fd, &sb) < 0) {
+            return false;
+        }
+        translate_stat(&sb, &stat);
+    }
+    if (stat.size > pSlurpSize || !pSlurpPool) {
+        return false;
+    }
+    auto fileHandle = getNewFileHandle();
+    if (!fileHandle) {
+        return false;
+    }
+    uint32_t bufferSize = 0;
+    auto *buffer        = pSlurpPool->alloc(stat.size, &bufferSize);
+    if (buffer == nullptr) {
+        return false;
+    }
+    if (readIntoBuffer(fd, buffer, 1, stat.size) != (int64_t) stat.size) {
+        DEBUG_FUNCTION_LINE_WARN("[%s] Failed to slurp %s", getName().c_str(), path);
+        pSlurpPool->release(buffer, bufferSize);
+        lseek(fd, 0, SEEK_SET);
+        return false;
+    }
+    fileHandle->reader = make_unique_nothrow<MemoryFileReader>(buffer, stat.size, bufferSize, [pool = pSlurpPool](uint8_t *data, uint32_t capacity) { pool->release(data, capacity); });
+    if (!fileHandle->reader) {
+        pSlurpPool->release(buffer, bufferSize);
+        lseek(fd, 0, SEEK_SET);
+        return false;
+    }
+    close(fd);
+
+    fileHandle->fd        = -1;
+    fileHandle->path      = path;
+    fileHandle->hasStat   = true;
+    fileHandle->indexStat = stat;
+    addFileHandle(fileHandle, handle);
+
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Slurped %s (%u bytes) (%08X)", getName().c_str(), path, stat.size, fileHandle->handle);
+    return true;
+}
+
+bool FSWrapper::InitPrefetcher() {
+    if (!pPrefetcher) {
+        pPrefetcher = make_shared_nothrow<Prefetcher>(pPathToReplace, pReplacePathWith);
+        if (!pPrefetcher) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate Prefetcher", getName().c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FSWrapper::warmUp(const std::string &path) {
+    if (pIsWriteable || !IsPathToReplace(path) || IsDefinitelyMissing(path) || !InitPrefetcher()) {
+        return false;
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Warm up %s", getName().c_str(), path.c_str());
+    return Prefetcher::warmUp(pPrefetcher, path);
+}
+
+bool FSWrapper::advise(FSFileHandle handle, CRFileAdvice advice) {
+    if (!isValidFileHandle(handle)) {
+        return true;
+    }
+    auto fileHandle = getFileFromHandle(handle);
+    bool isBuffered = fileHandle->reader->isBuffered();
+    switch (advice) {
+        case CR_FILE_ADVICE_NORMAL:
+        case CR_FILE_ADVICE_RANDOM:
+            DropReadAhead(fileHandle.get());
+            fileHandle->advice = advice;
+            fileHandle->reader->advise(advice);
+            break;
+        case CR_FILE_ADVICE_SEQUENTIAL:
+            // Reads from packs and memory are already buffered.
+            if (!isBuffered && !pIsWriteable) {
+                fileHandle->advice = advice;
+                fileHandle->reader->advise(advice);
+            }
+            break;
+        case CR_FILE_ADVICE_WILL_NEED:
+            if (!isBuffered && !pIsWriteable && fileHandle->prefetchKey.empty() && InitPrefetcher()) {
+                if (!Prefetcher::warmUp(pPrefetcher, fileHandle->path)) {
+                    return false;
+                }
+                fileHandle->prefetchKey = pPrefetcher->getKey(fileHandle->path);
+            }
+            break;
+        case CR_FILE_ADVICE_DONT_NEED:
+            DropReadAhead(fileHandle.get());
+            free(fileHandle->readAheadBuffer);
+            fileHandle->readAheadBuffer = nullptr;
+            if (pPrefetcher && !fileHandle->prefetchKey.empty()) {
+                pPrefetcher->drop(fileHandle->prefetchKey);
+            }
+            fileHandle->prefetchKey.clear();
+            break;
+    }
+    return true;
+}
+
 std::shared_ptr<FileInfo> FSWrapper::getNewFileHandle() {
     return make_shared_nothrow<FileInfo>();
 }
@@ -741,6 +1251,22 @@ std::shared_ptr<DirInfo> FSWrapper::getDirFromHandle(FSDirectoryHandle handle) {
     return nullptr;
 }
 
+void FSWrapper::addDirHandle(const std::shared_ptr<DirInfo> &dirHandle, FSDirectoryHandle *handle) {
+    std::lock_guard<std::mutex> lock(openDirsMutex);
+    dirHandle->handle = (((uint32_t) dirHandle.get()) & 0x0FFFFFFF) | 0x30000000;
+    *handle           = dirHandle->handle;
+    openDirs.push_back(dirHandle);
+    OSMemoryBarrier();
+}
+
+void FSWrapper::addFileHandle(const std::shared_ptr<FileInfo> &fileHandle, FSFileHandle *handle) {
+    std::lock_guard<std::mutex> lock(openFilesMutex);
+    fileHandle->handle = (((uint32_t) fileHandle.get()) & 0x0FFFFFFF) | 0x30000000;
+    *handle            = fileHandle->handle;
+    openFiles.push_back(fileHandle);
+    OSMemoryBarrier();
+}
+
 void FSWrapper::deleteDirHandle(FSDirectoryHandle handle) {
     if (!remove_locked_first_if(openDirsMutex, openDirs, [handle](auto &cur) { return (FSFileHandle) cur->handle == handle; })) {
         DEBUG_FUNCTION_LINE_ERR("[%s] Delete failed because the handle %08X was not found", getName().c_str(), handle);
@@ -1,16 +1,37 @@
 #pragma once
+#include "BootPack.h"
+#include "BootTrace.h"
 #include "DirInfo.h"
+#include "ExistenceFilter.h"
 #include "FileInfo.h"
+#include "FileStream.h"
 #include "IFSWrapper.h"
+#include "LayerIndex.h"
+#include "Prefetcher.h"
+#include "ReadCoalescer.h"
+#include "WhiteoutIndex.h"
 #include "utils/logger.h"
+#include "utils/utils.h"
+#include <array>
 #include <coreinit/filesystem.h>
 #include <coreinit/mutex.h>
 #include <functional>
 #include <mutex>
 
+// Size of the read-ahead buffer of handles with CR_FILE_ADVICE_SEQUENTIAL, larger reads bypass it.
+#define FILE_READ_AHEAD_SIZE    0x10000
+
+// See CR_LAYER_OPTION_SLURP_SIZE.
+#define FILE_SLURP_MAX_SIZE     0x100000
+
 class FSWrapper : public IFSWrapper {
 public:
-    FSWrapper(const std::string &name, const std::string &pathToReplace, const std::string &replacePathWith, bool fallbackOnError, bool isWriteable) {
+    /**
+     * If an index is given, it describes the whole content of the layer (e.g. the directory of a pack) and
+     * is used to answer stat and readdir.
+     */
+    FSWrapper(const std::string &name, const std::string &pathToReplace, const std::string &replacePathWith, bool fallbackOnError, bool isWriteable,
+              std::shared_ptr<LayerIndex> index = nullptr) {
         this->pName            = name;
         this->pPathToReplace   = pathToReplace;
         this->pReplacePathWith = replacePathWith;
@@ -20,9 +41,30 @@ public:
 
         std::replace(pPathToReplace.begin(), pPathToReplace.end(), '\\', '/');
         std::replace(pReplacePathWith.begin(), pReplacePathWith.end(), '\\', '/');
+
+        if (index) {
+            pIndex                  = std::move(index);
+            pIndexStarted           = true;
+            pServeMetadataFromIndex = true;
+        } else {
+            initIndex();
+            if (!pIsWriteable) {
+                pBootPack = BootPack::open(pReplacePathWith);
+            }
+        }
     }
     ~FSWrapper() override {
+        if (pIndex) {
+            pIndex->cancel();
+        }
+        if (pBootTrace) {
+            BootTrace::finish(pBootTrace);
+        }
+        if (pPrefetcher) {
+            Prefetcher::save(pPrefetcher);
+        }
         {
+            // The readers stop their streams and return their slurp buffers.
             std::lock_guard<std::mutex> lockFiles(openFilesMutex);
             openFiles.clear();
         }
@@ -95,10 +137,43 @@ public:
 
     FSError FSFlushFileWrapper(FSFileHandle handle) override;
 
+    bool setOption(uint32_t option, uint32_t value) override;
+
     uint32_t getLayerId() override {
         return (uint32_t) this;
     }
 
+    std::shared_ptr<LayerIndex> getIndex() override {
+        return pIndex;
+    }
+
+    std::shared_ptr<BootTrace> getBootTrace() override {
+        return pBootTrace;
+    }
+
+    std::shared_ptr<Prefetcher> getPrefetcher() override {
+        return pPrefetcher;
+    }
+
+    void bumpGeneration() override {
+        IFSWrapper::bumpGeneration();
+        if (pPrefetcher) {
+            pPrefetcher->invalidate();
+        }
+    }
+
+    bool getStreamStats(StreamStats *outStats) override;
+
+    bool getCoalesceStats(CoalesceStats *outStats) override;
+
+    bool warmUp(const std::string &path) override;
+
+    bool advise(FSFileHandle handle, CRFileAdvice advice) override;
+
+    bool isRedirectedPath(const std::string &path) override {
+        return IsPathToReplace(path);
+    }
+
 protected:
     virtual bool IsFileModeAllowed(const char *mode);
 
@@ -112,11 +187,30 @@ protected:
     bool isValidDirHandle(FSDirectoryHandle handle) override;
     bool isValidFileHandle(FSFileHandle handle) override;
 
+    void addDirHandle(const std::shared_ptr<DirInfo> &dirHandle, FSDirectoryHandle *handle);
+
+    void addFileHandle(const std::shared_ptr<FileInfo> &fileHandle, FSFileHandle *handle);
+
     void deleteDirHandle(FSDirectoryHandle handle) override;
     void deleteFileHandle(FSFileHandle handle) override;
 
     virtual bool CheckFileShouldBeIgnored(std::string &path);
 
+    bool IsDefinitelyMissing(const std::string_view &path);
+
+    bool IsIndexStarted();
+
+    bool GetStatFromIndex(const std::string_view &path, FSStat *stats);
+
+    std::shared_ptr<const LayerIndexListing> GetListingFromIndex(const std::string_view &path);
+
+    FSError ReadDirFromListing(DirInfo *dirHandle, FSDirectoryEntry *entry);
+
+    /**
+     * Creates a handle that reads the file from the pack through a PackFileReader.
+     */
+    FSError OpenFileFromPack(const std::shared_ptr<PackArchive> &archive, const PackFile *file, FSFileHandle *handle);
+
     virtual std::shared_ptr<FileInfo> getNewFileHandle();
     virtual std::shared_ptr<DirInfo> getNewDirHandle();
 
@@ -126,7 +220,66 @@ protected:
 
     std::string deletePrefix = ".deleted_";
 
+    // Only set for read-only layers, the content of writeable layers may change.
+    std::shared_ptr<LayerIndex> pIndex;
+    bool pIndexStarted = false;
+    // Answer stat and readdir from the index, see CR_LAYER_OPTION_INDEX_METADATA.
+    bool pServeMetadataFromIndex = false;
+
+    // Built once the index is complete. pWhiteouts is only set if pCheckIfDeleted is true.
+    std::shared_ptr<WhiteoutIndex> pWhiteouts;
+    std::shared_ptr<ExistenceFilter> pExistenceFilter;
+
+    // Only set for read-only layers of which a boot pack exists.
+    std::shared_ptr<BootPack> pBootPack;
+    // Set while the accesses to this layer are recorded, see CR_LAYER_OPTION_BOOT_TRACE.
+    std::shared_ptr<BootTrace> pBootTrace;
+    // Set if CR_LAYER_OPTION_PREFETCH is enabled.
+    std::shared_ptr<Prefetcher> pPrefetcher;
+
 private:
+    void initIndex();
+
+    FSError ReadWithReadAhead(FileInfo *fileHandle, void *buffer, uint32_t size, uint32_t count);
+
+    /**
+     * Moves the reader back to the current position and empties the read-ahead buffer.
+     */
+    bool DropReadAhead(FileInfo *fileHandle);
+
+    bool InitPrefetcher();
+
+    /**
+     * Returns a StreamedFileReader if streaming is enabled, an FdFileReader otherwise.
+     */
+    std::unique_ptr<FileReader> CreateFdReader(int fd, const std::string &newPath, bool readOnly);
+
+    /**
+     * Maps the errno of a failed read of the handle to an FSError.
+     */
+    FSError GetReadError(FileInfo *fileHandle, uint32_t size);
+
+    /**
+     * Serves the read from a read of the same range through another handle if possible (see ReadCoalescer).
+     */
+    FSError ReadCoalesced(FileInfo *fileHandle, void *buffer, uint32_t size, uint32_t count);
+
+    /**
+     * Enables coalescing for the new handle and the other open handles of the file, if there are any.
+     */
+    void MarkSharedOpen(FileInfo *fileHandle);
+
+    /**
+     * Called when a handle is closed, drops the coalesced data once the file is not open more than once anymore.
+     */
+    void UnmarkSharedOpen(FileInfo *fileHandle);
+
+    /**
+     * Reads the whole file into a slurp buffer and creates a handle for it. Returns false if the file is too
+     * large or couldn't be read, the caller keeps the fd then. Otherwise the fd is closed.
+     */
+    bool OpenFileSlurped(const char *path, int fd, FSFileHandle *handle);
+
     std::string pPathToReplace;
     std::string pReplacePathWith;
     bool pIsWriteable = false;
@@ -134,4 +287,16 @@ private:
     std::mutex openDirsMutex;
     std::vector<std::shared_ptr<FileInfo>> openFiles;
     std::vector<std::shared_ptr<DirInfo>> openDirs;
+
+    // See CR_LAYER_OPTION_SLURP_SIZE.
+    uint32_t pSlurpSize = 0;
+    // Shared with the readers of the slurped files, they may outlive the layer.
+    std::shared_ptr<SlurpPool> pSlurpPool;
+
+    // See CR_LAYER_OPTION_STREAMING, number of chunks that are buffered ahead.
+    uint32_t pStreamChunks = 0;
+    std::shared_ptr<StreamCounters> pStreamCounters;
+
+    // Set if CR_LAYER_OPTION_COALESCE_READS is enabled.
+    std::unique_ptr<ReadCoalescer> pCoalescer;
 };
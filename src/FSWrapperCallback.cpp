@@ -0,0 +1,408 @@
+#include "FSWrapperCallback.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <algorithm>
+#include <coreinit/cache.h>
+#include <cstring>
+
+FSWrapperCallback::FSWrapperCallback(const std::string &name, const std::string &pathToReplace, const CRCallbackLayerFunctions &functions) : pPathToReplace(pathToReplace),
+                                                                                                                                           pFunctions(functions) {
+    this->pName            = name;
+    this->pFallbackOnError = false;
+    std::replace(pPathToReplace.begin(), pPathToReplace.end(), '\\', '/');
+    while (pPathToReplace.size() > 1 && pPathToReplace.back() == '/') {
+        pPathToReplace.pop_back();
+    }
+    if (pFunctions.readDir != nullptr) {
+        pClient = make_shared_nothrow<SharedFSAClient>(name.c_str());
+        if (pClient) {
+            pClientHandle = pClient->get();
+        } else {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate SharedFSAClient", name.c_str());
+        }
+    }
+}
+
+FSWrapperCallback::~FSWrapperCallback() {
+    // Parent directories that are still open are closed with the client.
+    pClient.reset();
+    pClientHandle = 0;
+    if (pFunctions.close == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    for (auto &file : pFiles) {
+        pFunctions.close(pFunctions.context, file->file);
+    }
+}
+
+bool FSWrapperCallback::GetRelativePath(std::string_view path, std::string &outPath) {
+    if (!starts_with_case_insensitive(path, pPathToReplace)) {
+        return false;
+    }
+    auto relativePath = path.substr(pPathToReplace.size());
+    if (!relativePath.empty() && relativePath.front() != '/' && relativePath.front() != '\\') {
+        // e.g. "/vol/content2"
+        return false;
+    }
+    outPath.clear();
+    for (char c : relativePath) {
+        if (c == '\\') {
+            c = '/';
+        }
+        if (c == '/' && (outPath.empty() || outPath.back() == '/')) {
+            continue;
+        }
+        outPath.push_back(c);
+    }
+    if (!outPath.empty() && outPath.back() == '/') {
+        outPath.pop_back();
+    }
+    return true;
+}
+
+void FSWrapperCallback::AddTiming(CRCallbackTiming &timing, OSTime start) {
+    auto duration = (uint32_t) OSTicksToMicroseconds(OSGetTime() - start);
+    timing.numCalls++;
+    timing.totalTimeInUs += duration;
+    timing.maxTimeInUs = std::max(timing.maxTimeInUs, duration);
+}
+
+FSError FSWrapperCallback::StatPath(const std::string &relativePath, FSStat *stats) {
+    auto start  = OSGetTime();
+    auto result = pFunctions.stat(pFunctions.context, relativePath.c_str(), stats);
+    AddTiming(pStats.stat, start);
+    if (result == FS_ERROR_NOT_FOUND) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    return result;
+}
+
+FSError FSWrapperCallback::FSOpenDirWrapper(const char *path, FSDirectoryHandle *handle) {
+    std::string relativePath;
+    if (path == nullptr || pFunctions.readDir == nullptr || !GetRelativePath(path, relativePath)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (handle == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] handle was nullptr", getName().c_str());
+        return FS_ERROR_INVALID_PARAM;
+    }
+    FSStat stat{};
+    auto result = StatPath(relativePath, &stat);
+    if (result != FS_ERROR_OK) {
+        return result;
+    }
+    if (!(stat.flags & FS_STAT_DIRECTORY)) {
+        return FS_ERROR_NOT_DIR;
+    }
+    auto dir = make_shared_nothrow<CallbackDir>();
+    if (!dir) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc dir handle", getName().c_str());
+        return FS_ERROR_MAX_DIRS;
+    }
+    dir->path             = std::move(relativePath);
+    dir->fullPath         = path;
+    dir->index            = 0;
+    dir->pluginDone       = false;
+    dir->parentHandle     = 0;
+    dir->parentOpenFailed = false;
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    dir->handle = (((uint32_t) dir.get()) & 0x0FFFFFFF) | 0x30000000;
+    *handle     = dir->handle;
+    pDirs.push_back(dir);
+    OSMemoryBarrier();
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSReadDirWrapper(FSDirectoryHandle handle, FSDirectoryEntry *entry) {
+    auto dir = GetDir(handle);
+    if (!dir) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (dir->pluginDone) {
+        return ReadParentDir(dir.get(), entry);
+    }
+    auto start  = OSGetTime();
+    auto result = pFunctions.readDir(pFunctions.context, dir->path.c_str(), dir->index, entry);
+    AddTiming(pStats.readDir, start);
+    if (result == FS_ERROR_OK) {
+        dir->index++;
+        dir->names.emplace(entry->name);
+    } else if (result == FS_ERROR_END_OF_DIR) {
+        dir->pluginDone = true;
+        return ReadParentDir(dir.get(), entry);
+    }
+    return result;
+}
+
+FSError FSWrapperCallback::ReadParentDir(CallbackDir *dir, FSDirectoryEntry *entry) {
+    if (dir->parentHandle == 0 && !dir->parentOpenFailed) {
+        FSError err;
+        if (!pClientHandle || (err = FSAOpenDir(pClientHandle, dir->fullPath.c_str(), &dir->parentHandle)) != FS_ERROR_OK) {
+            // e.g. the directory only exists in this layer.
+            DEBUG_FUNCTION_LINE_VERBOSE("[%s] Failed to open parent dir %s", getName().c_str(), dir->fullPath.c_str());
+            dir->parentHandle     = 0;
+            dir->parentOpenFailed = true;
+        }
+    }
+    if (dir->parentHandle == 0) {
+        return FS_ERROR_END_OF_DIR;
+    }
+    while (true) {
+        auto result = FSAReadDir(pClientHandle, dir->parentHandle, entry);
+        if (result == FS_ERROR_OK) {
+            if (!dir->names.contains(entry->name)) {
+                return FS_ERROR_OK;
+            }
+        } else if (result == FS_ERROR_END_OF_DIR) {
+            return FS_ERROR_END_OF_DIR;
+        } else {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Reading parent dir %s failed: %s (%d)", getName().c_str(), dir->fullPath.c_str(), FSAGetStatusStr(result), result);
+            return FS_ERROR_END_OF_DIR;
+        }
+    }
+}
+
+FSError FSWrapperCallback::FSCloseDirWrapper(FSDirectoryHandle handle) {
+    auto dir = GetDir(handle);
+    if (!dir) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (dir->parentHandle != 0) {
+        auto result = FSACloseDir(pClientHandle, dir->parentHandle);
+        if (result != FS_ERROR_OK) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Failed to close parent dir %s: %s (%d)", getName().c_str(), dir->fullPath.c_str(), FSAGetStatusStr(result), result);
+        }
+        dir->parentHandle = 0;
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSRewindDirWrapper(FSDirectoryHandle handle) {
+    auto dir = GetDir(handle);
+    if (!dir) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (dir->parentHandle != 0) {
+        FSError result;
+        if ((result = FSARewindDir(pClientHandle, dir->parentHandle)) != FS_ERROR_OK) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Failed to rewind parent dir %s: %s (%d)", getName().c_str(), dir->fullPath.c_str(), FSAGetStatusStr(result), result);
+        }
+    }
+    dir->index      = 0;
+    dir->pluginDone = false;
+    dir->names.clear();
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSOpenFileWrapper(const char *path, const char *mode, FSFileHandle *handle) {
+    std::string relativePath;
+    if (path == nullptr || mode == nullptr || !GetRelativePath(path, relativePath)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (handle == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] handle was nullptr", getName().c_str());
+        return FS_ERROR_INVALID_PARAM;
+    }
+    auto file = make_shared_nothrow<CallbackFile>();
+    if (!file) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc file handle", getName().c_str());
+        return FS_ERROR_MAX_FILES;
+    }
+    auto result = StatPath(relativePath, &file->stat);
+    if (result != FS_ERROR_OK) {
+        return result;
+    }
+    if (file->stat.flags & FS_STAT_DIRECTORY) {
+        return FS_ERROR_NOT_FILE;
+    }
+    if (strcmp(mode, "r") != 0 && strcmp(mode, "rb") != 0) {
+        DEBUG_FUNCTION_LINE("[%s] Given mode is not allowed %s", getName().c_str(), mode);
+        return FS_ERROR_ACCESS_ERROR;
+    }
+
+    auto start = OSGetTime();
+    result     = pFunctions.open(pFunctions.context, relativePath.c_str(), &file->file);
+    AddTiming(pStats.open, start);
+    if (result != FS_ERROR_OK) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] Failed to open %s: %d", getName().c_str(), path, result);
+        return result;
+    }
+    file->pos = 0;
+
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    file->handle = (((uint32_t) file.get()) & 0x0FFFFFFF) | 0x30000000;
+    *handle      = file->handle;
+    pFiles.push_back(file);
+    OSMemoryBarrier();
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Opened %s (%08X)", getName().c_str(), path, file->handle);
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSCloseFileWrapper(FSFileHandle handle) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (pFunctions.close) {
+        auto start = OSGetTime();
+        pFunctions.close(pFunctions.context, file->file);
+        AddTiming(pStats.close, start);
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSGetStatWrapper(const char *path, FSStat *stats) {
+    std::string relativePath;
+    if (path == nullptr || !GetRelativePath(path, relativePath)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (stats == nullptr) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    return StatPath(relativePath, stats);
+}
+
+FSError FSWrapperCallback::FSGetStatFileWrapper(FSFileHandle handle, FSStat *stats) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    *stats = file->stat;
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSReadFileWrapper(void *buffer, uint32_t size, uint32_t count, FSFileHandle handle, [[maybe_unused]] uint32_t unk1) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    uint32_t total = size * count;
+    if (total == 0) {
+        return FS_ERROR_OK;
+    }
+    if (buffer == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] buffer is null but size * count is not 0 (It's: %d)", getName().c_str(), total);
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    auto *out     = (uint8_t *) buffer;
+    uint32_t done = 0;
+    while (done < total) {
+        auto toRead = std::min<uint32_t>(total - done, CALLBACK_LAYER_READ_CHUNK_SIZE);
+        auto start  = OSGetTime();
+        auto read   = pFunctions.readAt(pFunctions.context, file->file, file->pos, out + done, toRead);
+        AddTiming(pStats.readAt, start);
+        if (read < 0) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Read %u bytes at %u (FSFileHandle %08X) failed: %d", getName().c_str(), toRead, file->pos, handle, read);
+            return (FSError) read;
+        }
+        read = std::min<int32_t>(read, toRead);
+        file->pos += read;
+        done += read;
+        if ((uint32_t) read < toRead) {
+            break;
+        }
+    }
+    return static_cast<FSError>(done / size);
+}
+
+FSError FSWrapperCallback::FSReadFileWithPosWrapper(void *buffer, uint32_t size, uint32_t count, uint32_t pos, FSFileHandle handle, int32_t unk1) {
+    FSError result;
+    if ((result = FSSetPosFileWrapper(handle, pos)) != FS_ERROR_OK) {
+        return result;
+    }
+    return FSReadFileWrapper(buffer, size, count, handle, unk1);
+}
+
+FSError FSWrapperCallback::FSSetPosFileWrapper(FSFileHandle handle, uint32_t pos) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    file->pos = pos;
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSGetPosFileWrapper(FSFileHandle handle, uint32_t *pos) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    *pos = file->pos;
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSIsEofWrapper(FSFileHandle handle) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    return file->pos >= file->stat.size ? FS_ERROR_END_OF_FILE : FS_ERROR_OK;
+}
+
+FSError FSWrapperCallback::FSMakeDirWrapper(const char *path) {
+    std::string relativePath;
+    FSStat stat{};
+    if (path == nullptr || !GetRelativePath(path, relativePath) || StatPath(relativePath, &stat) == FS_ERROR_FORCE_PARENT_LAYER) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    return FS_ERROR_ALREADY_EXISTS;
+}
+
+FSError FSWrapperCallback::FSRemoveWrapper(const char *path) {
+    std::string relativePath;
+    FSStat stat{};
+    if (path == nullptr || !GetRelativePath(path, relativePath) || StatPath(relativePath, &stat) == FS_ERROR_FORCE_PARENT_LAYER) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    return FS_ERROR_ACCESS_ERROR;
+}
+
+FSError FSWrapperCallback::FSRenameWrapper(const char *oldPath, [[maybe_unused]] const char *newPath) {
+    return FSRemoveWrapper(oldPath);
+}
+
+std::shared_ptr<FSWrapperCallback::CallbackFile> FSWrapperCallback::GetFile(FSFileHandle handle) {
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    for (auto &file : pFiles) {
+        if (file->handle == handle) {
+            return file;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<FSWrapperCallback::CallbackDir> FSWrapperCallback::GetDir(FSDirectoryHandle handle) {
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    for (auto &dir : pDirs) {
+        if (dir->handle == handle) {
+            return dir;
+        }
+    }
+    return nullptr;
+}
+
+bool FSWrapperCallback::isValidDirHandle(FSDirectoryHandle handle) {
+    return GetDir(handle) != nullptr;
+}
+
+bool FSWrapperCallback::isValidFileHandle(FSFileHandle handle) {
+    return GetFile(handle) != nullptr;
+}
+
+void FSWrapperCallback::deleteDirHandle(FSDirectoryHandle handle) {
+    if (!remove_locked_first_if(pHandlesMutex, pDirs, [handle](auto &cur) { return cur->handle == handle; })) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Delete failed because the handle %08X was not found", getName().c_str(), handle);
+    }
+}
+
+void FSWrapperCallback::deleteFileHandle(FSFileHandle handle) {
+    if (!remove_locked_first_if(pHandlesMutex, pFiles, [handle](auto &cur) { return cur->handle == handle; })) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Delete failed because the handle %08X was not found", getName().c_str(), handle);
+    }
+}
+
+void FSWrapperCallback::getStats(CRCallbackLayerStats *outStats) {
+    *outStats = pStats;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "IFSWrapper.h"
+#include "SharedFSAClient.h"
+#include "export.h"
+#include <coreinit/filesystem.h>
+#include <coreinit/time.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Reads are split into reads of at most this size.
+#define CALLBACK_LAYER_READ_CHUNK_SIZE 0x40000
+
+/**
+ * Replaces the paths of a directory that are known to a plugin with the content the plugin returns from its
+ * callbacks (see CRAddCallbackLayer). Paths the stat callback doesn't find are left to the parent layer.
+ *
+ * The layer is read-only. Open files keep their stat from the time they have been opened, the position is
+ * tracked by the layer and every read is passed to the plugin as positional read.
+ *
+ * Directories are merged with the parent layer: once the plugin has listed all entries, the entries of the
+ * layers below are returned that the plugin hasn't returned already. The parent directory is read through
+ * the FSA client of the layer, so the requests skip this layer.
+ */
+class FSWrapperCallback : public IFSWrapper {
+public:
+    FSWrapperCallback(const std::string &name, const std::string &pathToReplace, const CRCallbackLayerFunctions &functions);
+
+    /**
+     * Closes the files that are still open.
+     */
+    ~FSWrapperCallback() override;
+
+    FSError FSOpenDirWrapper(const char *path, FSDirectoryHandle *handle) override;
+
+    FSError FSReadDirWrapper(FSDirectoryHandle handle, FSDirectoryEntry *entry) override;
+
+    FSError FSCloseDirWrapper(FSDirectoryHandle handle) override;
+
+    FSError FSRewindDirWrapper(FSDirectoryHandle handle) override;
+
+    FSError FSOpenFileWrapper(const char *path, const char *mode, FSFileHandle *handle) override;
+
+    FSError FSCloseFileWrapper(FSFileHandle handle) override;
+
+    FSError FSGetStatWrapper(const char *path, FSStat *stats) override;
+
+    FSError FSGetStatFileWrapper(FSFileHandle handle, FSStat *stats) override;
+
+    FSError FSReadFileWrapper(void *buffer, uint32_t size, uint32_t count, FSFileHandle handle, uint32_t unk1) override;
+
+    FSError FSReadFileWithPosWrapper(void *buffer, uint32_t size, uint32_t count, uint32_t pos, FSFileHandle handle, int32_t unk1) override;
+
+    FSError FSSetPosFileWrapper(FSFileHandle handle, uint32_t pos) override;
+
+    FSError FSGetPosFileWrapper(FSFileHandle handle, uint32_t *pos) override;
+
+    FSError FSIsEofWrapper(FSFileHandle handle) override;
+
+    FSError FSMakeDirWrapper(const char *path) override;
+
+    FSError FSRemoveWrapper(const char *path) override;
+
+    FSError FSRenameWrapper(const char *oldPath, const char *newPath) override;
+
+    bool isValidDirHandle(FSDirectoryHandle handle) override;
+
+    bool isValidFileHandle(FSFileHandle handle) override;
+
+    void deleteDirHandle(FSDirectoryHandle handle) override;
+
+    void deleteFileHandle(FSFileHandle handle) override;
+
+    uint32_t getLayerId() override {
+        return (uint32_t) pClientHandle;
+    }
+
+    void getStats(CRCallbackLayerStats *outStats);
+
+private:
+    struct CallbackFile {
+        FSFileHandle handle;
+        uint32_t file;
+        uint32_t pos;
+        FSStat stat;
+    };
+
+    struct CallbackDir {
+        FSDirectoryHandle handle;
+        std::string path;
+        std::string fullPath;
+        uint32_t index;
+        // Set once the plugin has listed all entries, the parent directory is read then.
+        bool pluginDone;
+        // Names the plugin has returned, they are skipped in the parent directory.
+        std::unordered_set<std::string> names;
+        FSADirectoryHandle parentHandle;
+        bool parentOpenFailed;
+    };
+
+    /**
+     * Returns false if the path is not inside the replaced directory, otherwise sets the path relative to it.
+     */
+    bool GetRelativePath(std::string_view path, std::string &outPath);
+
+    /**
+     * Calls the stat callback, FS_ERROR_NOT_FOUND is turned into FS_ERROR_FORCE_PARENT_LAYER.
+     */
+    FSError StatPath(const std::string &relativePath, FSStat *stats);
+
+    std::shared_ptr<CallbackFile> GetFile(FSFileHandle handle);
+
+    std::shared_ptr<CallbackDir> GetDir(FSDirectoryHandle handle);
+
+    /**
+     * Returns the next entry of the parent directory that the plugin hasn't returned.
+     */
+    FSError ReadParentDir(CallbackDir *dir, FSDirectoryEntry *entry);
+
+    static void AddTiming(CRCallbackTiming &timing, OSTime start);
+
+    std::string pPathToReplace;
+    CRCallbackLayerFunctions pFunctions;
+
+    std::shared_ptr<SharedFSAClient> pClient;
+    FSAClientHandle pClientHandle = 0;
+
+    std::mutex pHandlesMutex;
+    std::vector<std::shared_ptr<CallbackFile>> pFiles;
+    std::vector<std::shared_ptr<CallbackDir>> pDirs;
+
+    // Only accessed while the fsLayerMutex is held.
+    CRCallbackLayerStats pStats{};
+};
@@ -0,0 +1,97 @@
+#include "FSWrapperMemory.h"
+#include "utils/StatTranslation.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <algorithm>
+#include <ctime>
+
+FSWrapperMemory::FSWrapperMemory(const std::string &name,
+                                 const std::string &pathToReplace,
+                                 std::shared_ptr<PackArchive> archive) : FSWrapperPack(name, pathToReplace, std::move(archive)) {
+}
+
+bool FSWrapperMemory::addFile(std::string_view path, const void *data, uint32_t size, MemoryFileReleaseCallback release, void *context) {
+    auto file = make_shared_nothrow<MemoryFile>();
+    if (!file) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate MemoryFile", getName().c_str());
+        return false;
+    }
+    // Keep the case of the path, but drop empty components.
+    for (char c : path) {
+        if (c == '\\') {
+            c = '/';
+        }
+        if (c == '/' && (file->path.empty() || file->path.back() == '/')) {
+            continue;
+        }
+        file->path.push_back(c);
+    }
+    if (!file->path.empty() && file->path.back() == '/') {
+        file->path.pop_back();
+    }
+    file->data     = (const uint8_t *) data;
+    file->size     = size;
+    file->modified = translate_time_value(time(nullptr));
+
+    auto key = LayerIndex::getKey(file->path);
+    if (key.empty() || pDirectories.contains(key)) {
+        DEBUG_FUNCTION_LINE_WARN("[%s] %s is a directory", getName().c_str(), file->path.c_str());
+        return false;
+    }
+    for (auto slash = key.find('/'); slash != std::string::npos; slash = key.find('/', slash + 1)) {
+        if (pFiles.contains(key.substr(0, slash))) {
+            DEBUG_FUNCTION_LINE_WARN("[%s] A parent directory of %s is a file", getName().c_str(), file->path.c_str());
+            return false;
+        }
+    }
+    auto [it, inserted] = pFiles.try_emplace(key);
+    if (inserted) {
+        countInParents(key, 1);
+    }
+    it->second    = file;
+    pFilesChanged = true;
+    // Only release the data once the file has been added.
+    file->release = release;
+    file->context = context;
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Added memory file %s (%u bytes)", getName().c_str(), file->path.c_str(), size);
+    return true;
+}
+
+bool FSWrapperMemory::removeFile(std::string_view path) {
+    auto key = LayerIndex::getKey(path);
+    if (pFiles.erase(key) == 0) {
+        return false;
+    }
+    countInParents(key, -1);
+    pFilesChanged = true;
+    return true;
+}
+
+void FSWrapperMemory::countInParents(const std::string &key, int32_t count) {
+    for (auto slash = key.find('/'); slash != std::string::npos; slash = key.find('/', slash + 1)) {
+        auto it = pDirectories.try_emplace(key.substr(0, slash), 0).first;
+        if ((it->second += count) == 0) {
+            pDirectories.erase(it);
+        }
+    }
+}
+
+bool FSWrapperMemory::applyPendingChanges() {
+    if (!pFilesChanged) {
+        return false;
+    }
+    std::vector<std::shared_ptr<MemoryFile>> files;
+    files.reserve(pFiles.size());
+    for (auto &[key, file] : pFiles) {
+        files.push_back(file);
+    }
+    auto archive = PackArchive::fromMemoryFiles(getArchive()->getPath(), std::move(files));
+    if (!archive) {
+        // The paths have been checked when the files were added, so this only fails if memory is low.
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to create the archive of the memory files", getName().c_str());
+        return false;
+    }
+    pFilesChanged = false;
+    setArchive(std::move(archive));
+    return true;
+}
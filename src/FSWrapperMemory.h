@@ -0,0 +1,51 @@
+#pragma once
+#include "FSWrapperPack.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Replacement path of memory layers, it doesn't exist on any device.
+#define MEMORY_LAYER_ROOT "memory:"
+
+/**
+ * Merges buffers of the caller that are registered as files (see CRAddMemoryFile) with the parent layer.
+ *
+ * The files are served from an archive of memory files. Added and removed files are collected and a new
+ * archive is created once before the layer handles its next request, so registering many files only
+ * builds one archive. Open handles keep the previous archive alive, so the data of a removed file is only
+ * released once the last handle that reads it has been closed.
+ */
+class FSWrapperMemory : public FSWrapperPack {
+public:
+    FSWrapperMemory(const std::string &name,
+                    const std::string &pathToReplace,
+                    std::shared_ptr<PackArchive> archive);
+
+    /**
+     * Adds or replaces the file at the path relative to the replaced directory. If this fails, release is not
+     * called and the data still belongs to the caller.
+     */
+    bool addFile(std::string_view path, const void *data, uint32_t size, MemoryFileReleaseCallback release, void *context);
+
+    bool removeFile(std::string_view path);
+
+    /**
+     * Creates the archive of the current files if they have changed.
+     */
+    bool applyPendingChanges() override;
+
+private:
+    /**
+     * Adds count to the number of files below each parent directory of the key.
+     */
+    void countInParents(const std::string &key, int32_t count);
+
+    // Key is the normalized path (see LayerIndex::getKey), sorted so the archive doesn't depend on the order
+    // the files have been added in.
+    std::map<std::string, std::shared_ptr<MemoryFile>> pFiles;
+    // Number of files below each directory, used to reject files whose path is a directory or vice versa.
+    std::unordered_map<std::string, uint32_t> pDirectories;
+    bool pFilesChanged = false;
+};
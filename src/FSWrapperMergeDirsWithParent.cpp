@@ -1,4 +1,5 @@
 #include "FSWrapperMergeDirsWithParent.h"
+#include "FileUtils.h"
 #include "utils/StringTools.h"
 #include "utils/logger.h"
 #include "utils/utils.h"
@@ -14,6 +15,21 @@ FSError FSWrapperMergeDirsWithParent::FSOpenDirWrapper(const char *path,
         return FS_ERROR_INVALID_PARAM;
     }
 
+    std::string cacheKey;
+    auto generation = getGeneration();
+    if (path != nullptr && IsPathToReplace(path)) {
+        cacheKey = MergedDirCache::getKey(path);
+        if (auto snapshot = pDirCache.get(cacheKey, generation)) {
+            auto dirHandle = std::dynamic_pointer_cast<DirInfoEx>(getNewDirHandle());
+            if (dirHandle) {
+                DEBUG_FUNCTION_LINE_VERBOSE("[%s] Serve %s from cache (%d entries)", getName().c_str(), path, snapshot->entries.size());
+                dirHandle->snapshot = std::move(snapshot);
+                addDirHandle(dirHandle, handle);
+                return FS_ERROR_OK;
+            }
+        }
+    }
+
     auto res = FSWrapper::FSOpenDirWrapper(path, handle);
     if (res == FS_ERROR_OK) {
         if (!isValidDirHandle(*handle)) {
@@ -23,22 +39,18 @@ FSError FSWrapperMergeDirsWithParent::FSOpenDirWrapper(const char *path,
         }
         auto dirHandle = getDirExFromHandle(*handle);
         if (dirHandle != nullptr) {
-            dirHandle->readResultCapacity        = 0;
-            dirHandle->readResultNumberOfEntries = 0;
-            dirHandle->realDirHandle             = 0;
+            clearReadResult(dirHandle.get(), true);
+            dirHandle->realDirHandle = 0;
 
-            if (clientHandle) {
-                FSADirectoryHandle realHandle = 0;
-                DEBUG_FUNCTION_LINE_VERBOSE("[%s] Call FSAOpenDir with %s for parent layer", getName().c_str(), path);
-                FSError err;
-                if ((err = FSAOpenDir(clientHandle, path, &realHandle)) == FS_ERROR_OK) {
-                    dirHandle->realDirHandle = realHandle;
-                } else {
-                    DEBUG_FUNCTION_LINE_ERR("[%s] Failed to open real dir %s. %s (%d)", getName().c_str(), path, FSAGetStatusStr(err), err);
-                }
-            } else {
-                DEBUG_FUNCTION_LINE_ERR("[%s] clientHandle was null", getName().c_str());
+            dirHandle->pendingSnapshot = make_unique_nothrow<MergedDirSnapshot>();
+            if (dirHandle->pendingSnapshot) {
+                dirHandle->pendingSnapshot->key        = std::move(cacheKey);
+                dirHandle->pendingSnapshot->generation = generation;
             }
+
+            // The parent directory is opened once the redirected directory has been read completely.
+            dirHandle->realDirPath       = path;
+            dirHandle->realDirOpenFailed = false;
             OSMemoryBarrier();
         }
     }
@@ -50,6 +62,41 @@ bool FSWrapperMergeDirsWithParent::SkipDeletedFilesInReadDir() {
 }
 
 FSError FSWrapperMergeDirsWithParent::FSReadDirWrapper(FSADirectoryHandle handle, FSADirectoryEntry *entry) {
+    if (!isValidDirHandle(handle)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    auto dirHandle = getDirExFromHandle(handle);
+    if (dirHandle->snapshot) {
+        if (dirHandle->snapshotPosition >= dirHandle->snapshot->entries.size()) {
+            return FS_ERROR_END_OF_DIR;
+        }
+        dirHandle->snapshot->getEntry(dirHandle->snapshotPosition++, entry);
+        return FS_ERROR_OK;
+    }
+
+    auto res = readMergedDir(handle, entry);
+
+    if (dirHandle->pendingSnapshot) {
+        if (res == FS_ERROR_OK) {
+            if (!dirHandle->pendingSnapshot->addEntry(entry)) {
+                DEBUG_FUNCTION_LINE_VERBOSE("[%s] Directory %s is too big to be cached", getName().c_str(), dirHandle->path.c_str());
+                dirHandle->pendingSnapshot.reset();
+            }
+        } else if (res == FS_ERROR_END_OF_DIR) {
+            if (dirHandle->pendingSnapshot->generation == getGeneration()) {
+                dirHandle->pendingSnapshot->entries.shrink_to_fit();
+                dirHandle->pendingSnapshot->names.shrink_to_fit();
+                pDirCache.put(std::move(dirHandle->pendingSnapshot));
+            }
+            dirHandle->pendingSnapshot.reset();
+        } else {
+            dirHandle->pendingSnapshot.reset();
+        }
+    }
+    return res;
+}
+
+FSError FSWrapperMergeDirsWithParent::readMergedDir(FSADirectoryHandle handle, FSADirectoryEntry *entry) {
     do {
         auto res = FSWrapper::FSReadDirWrapper(handle, entry);
         if (res == FS_ERROR_OK || res == FS_ERROR_END_OF_DIR) {
@@ -59,84 +106,29 @@ FSError FSWrapperMergeDirsWithParent::FSReadDirWrapper(FSADirectoryHandle handle
             }
             auto dirHandle = getDirExFromHandle(handle);
             if (res == FS_ERROR_OK) {
-                if (dirHandle->readResultCapacity == 0) {
-                    dirHandle->readResult = (FSDirectoryEntryEx *) malloc(sizeof(FSDirectoryEntryEx));
-                    if (dirHandle->readResult == nullptr) {
-                        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc memory for %08X (handle %08X)", getName().c_str(), dirHandle.get(), handle);
-                        OSFatal("ContentRedirectionModule: Failed to alloc memory for read result");
-                    }
-                    dirHandle->readResultCapacity = 1;
-                }
-
-                if (dirHandle->readResultNumberOfEntries >= dirHandle->readResultCapacity) {
-                    auto newCapacity              = dirHandle->readResultCapacity * 2;
-                    dirHandle->readResult         = (FSDirectoryEntryEx *) realloc(dirHandle->readResult, newCapacity * sizeof(FSDirectoryEntryEx));
-                    dirHandle->readResultCapacity = newCapacity;
-                    if (dirHandle->readResult == nullptr) {
-                        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to realloc memory for %08X (handle %08X)", getName().c_str(), dirHandle.get(), handle);
-                        OSFatal("ContentRedirectionModule: Failed to alloc memory for read result");
-                    }
-                }
-
-                memcpy(&dirHandle->readResult[dirHandle->readResultNumberOfEntries].realEntry, entry, sizeof(FSADirectoryEntry));
-                dirHandle->readResultNumberOfEntries++;
-
                 /**
-                 * Read the next entry if this entry starts with deletePrefix. We keep the entry but mark it as deleted.
+                 * Remember the name so we can filter out the entry when reading the parent directory.
+                 * Entries that start with deletePrefix are stored without the prefix and marked as
+                 * deleted. We don't return them, so read the next entry.
                  */
-                if (starts_with_case_insensitive(entry->name, deletePrefix)) {
-                    dirHandle->readResult[dirHandle->readResultNumberOfEntries].isMarkedAsDeleted = true;
-
-                    OSMemoryBarrier();
-                    continue;
+                bool isDeleteMarker = starts_with_case_insensitive(entry->name, deletePrefix);
+                auto name           = isDeleteMarker ? std::string_view(entry->name).substr(deletePrefix.length()) : std::string_view(entry->name);
+                if (!addReadResult(dirHandle.get(), name, isDeleteMarker ? MERGE_DIR_ENTRY_FLAG_DELETE_MARKER : 0)) {
+                    DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc memory for %08X (handle %08X)", getName().c_str(), dirHandle.get(), handle);
+                    OSFatal("ContentRedirectionModule: Failed to alloc memory for read result");
                 }
 
                 OSMemoryBarrier();
 
+                if (isDeleteMarker) {
+                    continue;
+                }
             } else if (res == FS_ERROR_END_OF_DIR) {
                 // Read the real directory.
-                if (dirHandle->realDirHandle != 0) {
-                    if (clientHandle) {
-                        FSADirectoryEntry realDirEntry;
-                        FSError readDirResult;
-                        while (true) {
-                            DEBUG_FUNCTION_LINE_VERBOSE("[%s] Call FSReadDir with %08X for parent layer", getName().c_str(), dirHandle->realDirHandle);
-                            readDirResult = FSAReadDir(clientHandle, dirHandle->realDirHandle, &realDirEntry);
-                            if (readDirResult == FS_ERROR_OK) {
-                                bool found       = false;
-                                auto nameDeleted = deletePrefix + realDirEntry.name;
-                                for (int i = 0; i < dirHandle->readResultNumberOfEntries; i++) {
-                                    auto curResult = &dirHandle->readResult[i];
-
-                                    // Don't return files that are "deleted"
-                                    if (strcmp(curResult->realEntry.name, nameDeleted.c_str()) == 0) {
-                                        found = true;
-                                        break;
-                                    }
-                                    // Check if this is a new result
-                                    if (strcmp(curResult->realEntry.name, realDirEntry.name) == 0 && !curResult->isMarkedAsDeleted) {
-                                        found = true;
-                                        break;
-                                    }
-                                }
-                                // If it's new we can use it :)
-                                if (!found) {
-                                    memcpy(entry, &realDirEntry, sizeof(FSADirectoryEntry));
-                                    res = FS_ERROR_OK;
-                                    break;
-                                }
-                            } else if (readDirResult == FS_ERROR_END_OF_DIR) {
-                                res = FS_ERROR_END_OF_DIR;
-                                break;
-                            } else {
-                                DEBUG_FUNCTION_LINE_ERR("[%s] real_FSReadDir returned an unexpected error: %s (%d)", getName().c_str(), FSAGetStatusStr(readDirResult), readDirResult);
-                                res = FS_ERROR_END_OF_DIR;
-                                break;
-                            }
-                        }
-                    } else {
-                        DEBUG_FUNCTION_LINE_ERR("[%s] clientHandle was null", getName().c_str());
-                    }
+                res = readRealDir(dirHandle.get(), entry);
+                if (res == FS_ERROR_END_OF_DIR) {
+                    // Both directories have been read completely, we don't need to keep the names anymore.
+                    clearReadResult(dirHandle.get(), true);
                 }
             } else {
                 DEBUG_FUNCTION_LINE_ERR("[%s] Unexpected result %d", getName().c_str(), res);
@@ -146,7 +138,46 @@ FSError FSWrapperMergeDirsWithParent::FSReadDirWrapper(FSADirectoryHandle handle
     } while (true);
 }
 
+FSError FSWrapperMergeDirsWithParent::readRealDir(DirInfoEx *dirHandle, FSADirectoryEntry *entry) {
+    if (dirHandle->realDirHandle == 0 && !dirHandle->realDirOpenFailed) {
+        openRealDir(dirHandle);
+    }
+    if (dirHandle->realDirHandle == 0) {
+        return FS_ERROR_END_OF_DIR;
+    }
+    if (!clientHandle) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] clientHandle was null", getName().c_str());
+        return FS_ERROR_END_OF_DIR;
+    }
+
+    FSADirectoryEntry realDirEntry;
+    while (true) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] Call FSReadDir with %08X for parent layer", getName().c_str(), dirHandle->realDirHandle);
+        auto readDirResult = FSAReadDir(clientHandle, dirHandle->realDirHandle, &realDirEntry);
+        if (readDirResult == FS_ERROR_OK) {
+            // Don't return files that already have been returned or are "deleted"
+            if (!hasReadResult(dirHandle, realDirEntry.name)) {
+                memcpy(entry, &realDirEntry, sizeof(FSADirectoryEntry));
+                return FS_ERROR_OK;
+            }
+        } else if (readDirResult == FS_ERROR_END_OF_DIR) {
+            return FS_ERROR_END_OF_DIR;
+        } else {
+            DEBUG_FUNCTION_LINE_ERR("[%s] real_FSReadDir returned an unexpected error: %s (%d)", getName().c_str(), FSAGetStatusStr(readDirResult), readDirResult);
+            return FS_ERROR_END_OF_DIR;
+        }
+    }
+}
+
 FSError FSWrapperMergeDirsWithParent::FSCloseDirWrapper(FSADirectoryHandle handle) {
+    if (!isValidDirHandle(handle)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (auto dirHandle = getDirExFromHandle(handle); dirHandle->snapshot) {
+        dirHandle->snapshot.reset();
+        return FS_ERROR_OK;
+    }
+
     auto res = FSWrapper::FSCloseDirWrapper(handle);
 
     if (res == FS_ERROR_OK) {
@@ -169,15 +200,11 @@ FSError FSWrapperMergeDirsWithParent::FSCloseDirWrapper(FSADirectoryHandle handl
                 DEBUG_FUNCTION_LINE_ERR("[%s] clientHandle was null", getName().c_str());
             }
         } else {
-            DEBUG_FUNCTION_LINE_VERBOSE("[%s] dirHandle->realDirHandle was 0", getName().c_str());
+            DEBUG_FUNCTION_LINE_VERBOSE("[%s] dirHandle->realDirHandle was 0, parent dir has not been opened", getName().c_str());
         }
 
-        if (dirHandle->readResult != nullptr) {
-            free(dirHandle->readResult);
-            dirHandle->readResult                = nullptr;
-            dirHandle->readResultCapacity        = 0;
-            dirHandle->readResultNumberOfEntries = 0;
-        }
+        clearReadResult(dirHandle.get(), true);
+        dirHandle->pendingSnapshot.reset();
 
         OSMemoryBarrier();
     }
@@ -185,6 +212,14 @@ FSError FSWrapperMergeDirsWithParent::FSCloseDirWrapper(FSADirectoryHandle handl
 }
 
 FSError FSWrapperMergeDirsWithParent::FSRewindDirWrapper(FSADirectoryHandle handle) {
+    if (!isValidDirHandle(handle)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (auto dirHandle = getDirExFromHandle(handle); dirHandle->snapshot) {
+        dirHandle->snapshotPosition = 0;
+        return FS_ERROR_OK;
+    }
+
     auto res = FSWrapper::FSRewindDirWrapper(handle);
     if (res == FS_ERROR_OK) {
         if (!isValidDirHandle(handle)) {
@@ -192,28 +227,27 @@ FSError FSWrapperMergeDirsWithParent::FSRewindDirWrapper(FSADirectoryHandle hand
             return FS_ERROR_INVALID_DIRHANDLE;
         }
         auto dirHandle = getDirExFromHandle(handle);
-        if (dirHandle->readResult != nullptr) {
-            dirHandle->readResultNumberOfEntries = 0;
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wclass-memaccess"
-            memset(dirHandle->readResult, 0, sizeof(FSDirectoryEntryEx) * dirHandle->readResultCapacity);
-#pragma GCC diagnostic pop
+        clearReadResult(dirHandle.get(), false);
+
+        // Start recording the listing from scratch.
+        if (dirHandle->pendingSnapshot) {
+            dirHandle->pendingSnapshot->entries.clear();
+            dirHandle->pendingSnapshot->names.clear();
+            dirHandle->pendingSnapshot->generation = getGeneration();
         }
 
         if (dirHandle->realDirHandle != 0) {
             if (clientHandle) {
                 DEBUG_FUNCTION_LINE_VERBOSE("[%s] Call FSARewindDir with %08X for parent layer", getName().c_str(), dirHandle->realDirHandle);
                 FSError err;
-                if ((err = FSARewindDir(clientHandle, dirHandle->realDirHandle)) == FS_ERROR_OK) {
-                    dirHandle->realDirHandle = 0;
-                } else {
+                if ((err = FSARewindDir(clientHandle, dirHandle->realDirHandle)) != FS_ERROR_OK) {
                     DEBUG_FUNCTION_LINE_ERR("[%s] Failed to rewind dir for realDirHandle %08X. %s (%d)", getName().c_str(), dirHandle->realDirHandle, FSAGetStatusStr(err), err);
                 }
             } else {
                 DEBUG_FUNCTION_LINE_ERR("[%s] clientHandle was null", getName().c_str());
             }
         } else {
-            DEBUG_FUNCTION_LINE_VERBOSE("[%s] dirHandle->realDirHandle was 0", getName().c_str());
+            DEBUG_FUNCTION_LINE_VERBOSE("[%s] dirHandle->realDirHandle was 0, parent dir has not been opened", getName().c_str());
         }
         OSMemoryBarrier();
     }
@@ -223,11 +257,13 @@ FSError FSWrapperMergeDirsWithParent::FSRewindDirWrapper(FSADirectoryHandle hand
 FSWrapperMergeDirsWithParent::FSWrapperMergeDirsWithParent(const std::string &name,
                                                            const std::string &pathToReplace,
                                                            const std::string &replaceWithPath,
-                                                           bool fallbackOnError) : FSWrapper(name,
-                                                                                             pathToReplace,
-                                                                                             replaceWithPath,
-                                                                                             fallbackOnError,
-                                                                                             false) {
+                                                           bool fallbackOnError,
+                                                           std::shared_ptr<LayerIndex> index) : FSWrapper(name,
+                                                                                                          pathToReplace,
+                                                                                                          replaceWithPath,
+                                                                                                          fallbackOnError,
+                                                                                                          false,
+                                                                                                          std::move(index)) {
     FSAInit();
     this->clientHandle = FSAAddClient(nullptr);
     if (clientHandle < 0) {
@@ -256,6 +292,62 @@ std::shared_ptr<DirInfoEx> FSWrapperMergeDirsWithParent::getDirExFromHandle(FSAD
     return dir;
 }
 
+void FSWrapperMergeDirsWithParent::openRealDir(DirInfoEx *dirHandle) {
+    if (!clientHandle) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] clientHandle was null", getName().c_str());
+        dirHandle->realDirOpenFailed = true;
+        return;
+    }
+    FSADirectoryHandle realHandle = 0;
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Call FSAOpenDir with %s for parent layer", getName().c_str(), dirHandle->realDirPath.c_str());
+    FSError err;
+    if ((err = FSAOpenDir(clientHandle, dirHandle->realDirPath.c_str(), &realHandle)) == FS_ERROR_OK) {
+        dirHandle->realDirHandle = realHandle;
+    } else {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to open real dir %s. %s (%d)", getName().c_str(), dirHandle->realDirPath.c_str(), FSAGetStatusStr(err), err);
+        dirHandle->realDirOpenFailed = true;
+    }
+    OSMemoryBarrier();
+}
+
+bool FSWrapperMergeDirsWithParent::addReadResult(DirInfoEx *dirHandle, std::string_view name, uint8_t flags) {
+    auto *entry = (MergeDirEntry *) dirHandle->readResultArena.alloc(sizeof(MergeDirEntry) + name.length() + 1);
+    if (entry == nullptr) {
+        return false;
+    }
+    auto *entryName = (char *) entry->getName();
+    memcpy(entryName, name.data(), name.length());
+    entryName[name.length()] = '\0';
+    entry->hash              = hash_string(name);
+    entry->flags             = flags;
+
+    auto &bucket = dirHandle->readResultBuckets[entry->hash % MERGE_DIR_ENTRY_BUCKETS];
+    entry->next  = bucket;
+    bucket       = entry;
+    dirHandle->readResultNumberOfEntries++;
+    return true;
+}
+
+bool FSWrapperMergeDirsWithParent::hasReadResult(DirInfoEx *dirHandle, std::string_view name) {
+    auto hash = hash_string(name);
+    for (auto *cur = dirHandle->readResultBuckets[hash % MERGE_DIR_ENTRY_BUCKETS]; cur != nullptr; cur = cur->next) {
+        if (cur->hash == hash && name == cur->getName()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FSWrapperMergeDirsWithParent::clearReadResult(DirInfoEx *dirHandle, bool freeMemory) {
+    memset(dirHandle->readResultBuckets, 0, sizeof(dirHandle->readResultBuckets));
+    dirHandle->readResultNumberOfEntries = 0;
+    if (freeMemory) {
+        dirHandle->readResultArena.clear();
+    } else {
+        dirHandle->readResultArena.reset();
+    }
+}
+
 std::shared_ptr<DirInfo> FSWrapperMergeDirsWithParent::getNewDirHandle() {
     return make_shared_nothrow<DirInfoEx>();
 }
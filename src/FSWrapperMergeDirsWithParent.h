@@ -1,6 +1,7 @@
 #pragma once
 #include "DirInfoEx.h"
 #include "FSWrapper.h"
+#include "MergedDirCache.h"
 #include <coreinit/filesystem.h>
 #include <functional>
 
@@ -9,7 +10,8 @@ public:
     FSWrapperMergeDirsWithParent(const std::string &name,
                                  const std::string &pathToReplace,
                                  const std::string &replaceWithPath,
-                                 bool fallbackOnError);
+                                 bool fallbackOnError,
+                                 std::shared_ptr<LayerIndex> index = nullptr);
 
     ~FSWrapperMergeDirsWithParent() override;
 
@@ -34,5 +36,19 @@ public:
 private:
     FSAClientHandle clientHandle;
 
+    MergedDirCache pDirCache;
+
+    FSError readMergedDir(FSDirectoryHandle handle, FSDirectoryEntry *entry);
+
+    FSError readRealDir(DirInfoEx *dirHandle, FSADirectoryEntry *entry);
+
+    void openRealDir(DirInfoEx *dirHandle);
+
     std::shared_ptr<DirInfoEx> getDirExFromHandle(FSDirectoryHandle handle);
+
+    static bool addReadResult(DirInfoEx *dirHandle, std::string_view name, uint8_t flags);
+
+    static bool hasReadResult(DirInfoEx *dirHandle, std::string_view name);
+
+    static void clearReadResult(DirInfoEx *dirHandle, bool freeMemory);
 };
@@ -0,0 +1,83 @@
+#include "FSWrapperPack.h"
+#include "export.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+
+FSWrapperPack::FSWrapperPack(const std::string &name,
+                             const std::string &pathToReplace,
+                             std::shared_ptr<PackArchive> archive) : FSWrapperMergeDirsWithParent(name,
+                                                                                                  pathToReplace,
+                                                                                                  archive->getPath(),
+                                                                                                  true,
+                                                                                                  archive->getIndex()) {
+    setArchive(std::move(archive));
+}
+
+void FSWrapperPack::setArchive(std::shared_ptr<PackArchive> archive) {
+    pArchive = std::move(archive);
+    pIndex   = pArchive->getIndex();
+    if (pCheckIfDeleted) {
+        // Whiteouts can be part of the pack as well.
+        pWhiteouts = make_shared_nothrow<WhiteoutIndex>(pArchive->getPath(), deletePrefix);
+        if (pWhiteouts) {
+            pWhiteouts->load(pArchive->getFilePaths());
+        }
+    }
+}
+
+bool FSWrapperPack::setOption(uint32_t option, uint32_t value) {
+    if (option == CR_LAYER_OPTION_INDEX_METADATA) {
+        // The metadata is always served from the directory of the pack.
+        return false;
+    } else if (option == CR_LAYER_OPTION_BOOT_TRACE || option == CR_LAYER_OPTION_PREFETCH || option == CR_LAYER_OPTION_SLURP_SIZE ||
+               option == CR_LAYER_OPTION_STREAMING || option == CR_LAYER_OPTION_COALESCE_READS) {
+        // The files are already read from a single file.
+        return false;
+    }
+    return FSWrapperMergeDirsWithParent::setOption(option, value);
+}
+
+FSError FSWrapperPack::FSOpenFileWrapper(const char *path, const char *mode, FSFileHandle *handle) {
+    if (path == nullptr || mode == nullptr || handle == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] path, mode or handle was nullptr", getName().c_str());
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (!IsPathToReplace(path)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+
+    auto newPath = GetNewPath(path);
+    if (pCheckIfDeleted && CheckFileShouldBeIgnored(newPath)) {
+        return static_cast<FSError>((FS_ERROR_NOT_FOUND & FS_ERROR_REAL_MASK) | FS_ERROR_FORCE_NO_FALLBACK);
+    }
+
+    auto *file = pArchive->find(std::string_view(newPath).substr(pArchive->getPath().length()));
+    if (file == nullptr) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] File %s is not part of the pack", getName().c_str(), path);
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+
+    if (!IsFileModeAllowed(mode)) {
+        DEBUG_FUNCTION_LINE("[%s] Given mode is not allowed %s", getName().c_str(), mode);
+        return FS_ERROR_ACCESS_ERROR;
+    }
+
+    return OpenFileFromPack(pArchive, file, handle);
+}
+
+std::shared_ptr<PackArchive> FSWrapperPack::mapFile(const char *path, const PackFile **outFile) {
+    if (!IsPathToReplace(path)) {
+        return nullptr;
+    }
+    auto newPath = GetNewPath(path);
+    if (pCheckIfDeleted && CheckFileShouldBeIgnored(newPath)) {
+        return nullptr;
+    }
+    // Only packs that have been loaded into memory, files of pack files on the SD card are not resident.
+    auto *file = pArchive->find(std::string_view(newPath).substr(pArchive->getPath().length()));
+    if (file == nullptr || file->data == nullptr) {
+        return nullptr;
+    }
+    *outFile = file;
+    return pArchive;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "FSWrapperMergeDirsWithParent.h"
+#include "PackArchive.h"
+#include <coreinit/filesystem.h>
+#include <memory>
+
+/**
+ * Merges the content of a pack file (see PackFormat.h), or of a directory that has been loaded into
+ * memory, with the parent layer.
+ *
+ * Stat and readdir are answered by the index of the pack, opening a file only looks it up in the
+ * directory of the pack and reads are positional reads from the pack. Directories are merged with
+ * the parent layer like FSWrapperMergeDirsWithParent does it for replacement directories.
+ */
+class FSWrapperPack : public FSWrapperMergeDirsWithParent {
+public:
+    FSWrapperPack(const std::string &name,
+                  const std::string &pathToReplace,
+                  std::shared_ptr<PackArchive> archive);
+
+    FSError FSOpenFileWrapper(const char *path,
+                              const char *mode,
+                              FSFileHandle *handle) override;
+
+    bool setOption(uint32_t option, uint32_t value) override;
+
+    std::shared_ptr<PackArchive> mapFile(const char *path, const PackFile **outFile) override;
+
+    bool warmUp(const std::string &path) override {
+        // The files are not cached, reads are served from the pack.
+        return false;
+    }
+
+protected:
+    /**
+     * Replaces the archive. Handles that are open keep reading from the previous one.
+     */
+    void setArchive(std::shared_ptr<PackArchive> archive);
+
+    [[nodiscard]] const std::shared_ptr<PackArchive> &getArchive() const {
+        return pArchive;
+    }
+
+private:
+    std::shared_ptr<PackArchive> pArchive;
+};
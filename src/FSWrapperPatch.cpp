@@ -0,0 +1,745 @@
+#include "FSWrapperPatch.h"
+#include "FileUtils.h"
+#include "LayerIndex.h"
+#include "WorkerThreads.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <algorithm>
+#include <coreinit/cache.h>
+#include <cstring>
+#include <cerrno>
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+FSWrapperPatch::FSWrapperPatch(const std::string &name, const std::string &pathToReplace, const std::string &patchDir) : pPathToReplace(pathToReplace),
+                                                                                                                     pPatchDir(patchDir) {
+    this->pName            = name;
+    this->pFallbackOnError = false;
+    while (pPatchDir.size() > 1 && pPatchDir.back() == '/') {
+        pPatchDir.pop_back();
+    }
+    pClient = make_shared_nothrow<SharedFSAClient>(name.c_str());
+    if (pClient) {
+        clientHandle = pClient->get();
+    } else {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate SharedFSAClient", name.c_str());
+    }
+}
+
+FSWrapperPatch::~FSWrapperPatch() {
+    {
+        // The layer may be removed while the fsLayerMutex is held, so the originals and parent dirs are not
+        // closed with FS calls. Deleting the client closes them.
+        std::lock_guard<std::mutex> lock(pHandlesMutex);
+        pFiles.clear();
+        pDirs.clear();
+    }
+    for (auto &[key, patch] : pPatches) {
+        CloseDataFiles(*patch);
+    }
+    for (auto &cached : pCache) {
+        free(cached.data);
+    }
+    free(pScratch);
+    pClient.reset();
+    clientHandle = 0;
+}
+
+bool FSWrapperPatch::loadPatches() {
+    if (!clientHandle) {
+        return false;
+    }
+    pScratch = (uint8_t *) memalign(PATCH_FSA_READ_ALIGNMENT, PATCH_WINDOW_SIZE);
+    if (pScratch == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate scratch buffer", getName().c_str());
+        return false;
+    }
+    if (!scanDirectory("", 0)) {
+        return false;
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Loaded %d patches from %s", getName().c_str(), pPatches.size(), pPatchDir.c_str());
+    return true;
+}
+
+void FSWrapperPatch::queueSourceValidation() {
+    std::vector<std::shared_ptr<Patch>> patches;
+    for (auto &[key, patch] : pPatches) {
+        if (!patch->isOverlay) {
+            patches.push_back(patch);
+        }
+    }
+    if (patches.empty()) {
+        return;
+    }
+    // The client is kept alive by the task, even if the layer is removed in the meantime.
+    if (!queueWorkerTask([client = pClient, patches = std::move(patches)]() { ValidateSources(client, patches); })) {
+        DEBUG_FUNCTION_LINE_WARN("[%s] Failed to queue checking the originals, they are checked when they are opened", getName().c_str());
+    }
+}
+
+void FSWrapperPatch::ValidateSources(const std::shared_ptr<SharedFSAClient> &client, const std::vector<std::shared_ptr<Patch>> &patches) {
+    auto *buffer = (uint8_t *) memalign(PATCH_FSA_READ_ALIGNMENT, PATCH_WINDOW_SIZE);
+    if (buffer == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate buffer to check the originals");
+        return;
+    }
+    for (auto &patch : patches) {
+        if (patch->sourceState.load(std::memory_order_acquire) != SOURCE_UNTESTED) {
+            continue;
+        }
+        FSAFileHandle source;
+        FSStat stat{};
+        if (FSAOpenFileEx(client->get(), patch->sourcePath.c_str(), "r", (FSMode) 0, 0, 0, &source) != FS_ERROR_OK) {
+            // It's checked when it's opened.
+            DEBUG_FUNCTION_LINE_VERBOSE("Failed to open original %s", patch->sourcePath.c_str());
+            continue;
+        }
+        if (FSAGetStatFile(client->get(), source, &stat) == FS_ERROR_OK && !TestSource(client->get(), *patch, source, stat.size, buffer)) {
+            DEBUG_FUNCTION_LINE_ERR("%s doesn't match the original %s, it is ignored", patch->path.c_str(), patch->sourcePath.c_str());
+        }
+        FSACloseFile(client->get(), source);
+    }
+    free(buffer);
+}
+
+bool FSWrapperPatch::scanDirectory(const std::string &relativePath, uint32_t depth) {
+    if (depth >= LAYER_INDEX_MAX_DEPTH) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to load %s/%s, too deep", getName().c_str(), pPatchDir.c_str(), relativePath.c_str());
+        return false;
+    }
+    auto path = relativePath.empty() ? pPatchDir : pPatchDir + "/" + relativePath;
+    DIR *dir  = opendir(path.c_str());
+    if (dir == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to open %s. errno %d", getName().c_str(), path.c_str(), errno);
+        return false;
+    }
+    std::vector<std::string> subDirectories;
+    bool success = true;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        auto childRelativePath = relativePath.empty() ? std::string(entry->d_name) : relativePath + "/" + entry->d_name;
+        if (entry->d_type == DT_DIR) {
+            subDirectories.push_back(std::move(childRelativePath));
+            continue;
+        }
+        std::string_view name(entry->d_name);
+        bool isPatch   = name.size() > strlen(PATCH_FILE_SUFFIX) && name.substr(name.size() - strlen(PATCH_FILE_SUFFIX)) == PATCH_FILE_SUFFIX;
+        bool isOverlay = name.size() > strlen(OVERLAY_FILE_SUFFIX) && name.substr(name.size() - strlen(OVERLAY_FILE_SUFFIX)) == OVERLAY_FILE_SUFFIX;
+        if (!isPatch && !isOverlay) {
+            continue;
+        }
+        auto patch = make_shared_nothrow<Patch>();
+        if (!patch) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate patch", getName().c_str());
+            success = false;
+            break;
+        }
+        auto patchPath = path + "/" + entry->d_name;
+        if (isPatch ? !loadPatch(patchPath, *patch) : !loadOverlay(patchPath, *patch)) {
+            success = false;
+            break;
+        }
+        childRelativePath.resize(childRelativePath.size() - strlen(isPatch ? PATCH_FILE_SUFFIX : OVERLAY_FILE_SUFFIX));
+        patch->sourcePath = pPathToReplace + "/" + childRelativePath;
+        auto key          = normalize_path_key(childRelativePath);
+        if (pPatches.contains(key)) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] %s has more than one patch or overlay", getName().c_str(), childRelativePath.c_str());
+            success = false;
+            break;
+        }
+        pPatches[key] = std::move(patch);
+        pPatchedDirs.insert(normalize_path_key(relativePath));
+    }
+    closedir(dir);
+
+    for (auto &subDirectory : subDirectories) {
+        if (!success) {
+            break;
+        }
+        success = scanDirectory(subDirectory, depth + 1);
+    }
+    return success;
+}
+
+bool FSWrapperPatch::loadPatch(const std::string &path, Patch &patch) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to open patch %s. errno %d", getName().c_str(), path.c_str(), errno);
+        return false;
+    }
+    bool success = false;
+    uint8_t headerData[PATCH_FILE_HEADER_SIZE];
+    if (readIntoBuffer(fd, headerData, 1, sizeof(headerData)) != sizeof(headerData) ||
+        !PatchFormat::parseHeader(headerData, sizeof(headerData), &patch.header)) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] %s is not a patch of version %d", getName().c_str(), path.c_str(), PATCH_FILE_VERSION);
+    } else {
+        // Every op covers at least one byte of the modified file.
+        if (patch.header.numOps <= patch.header.targetSize && patch.header.numOps <= UINT32_MAX / PATCH_FILE_OP_SIZE) {
+            std::vector<uint8_t> ops(patch.header.numOps * PATCH_FILE_OP_SIZE);
+            success = readIntoBuffer(fd, ops.data(), 1, ops.size()) == (int64_t) ops.size() &&
+                      PatchFormat::parseOps(ops.data(), patch.header, patch.ops);
+        }
+        if (!success) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Invalid ops in patch %s", getName().c_str(), path.c_str());
+        }
+    }
+    close(fd);
+    patch.path = path;
+    patch.dataFiles.push_back(path);
+    patch.dataFds.push_back(-1);
+    if (patch.header.dataSize > 0) {
+        patch.dataExtents.push_back({0, 0, patch.header.dataSize, 0, (uint32_t) PatchFormat::getDataOffset(patch.header)});
+    }
+    return success;
+}
+
+static bool parseNumber(const char *str, uint32_t *outValue) {
+    char *end;
+    errno      = 0;
+    // Base 16 for "0x", but no octal numbers.
+    auto value = strtoul(str, &end, (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) ? 16 : 10);
+    if (errno != 0 || end == str || *end != '\0' || value > UINT32_MAX) {
+        return false;
+    }
+    *outValue = value;
+    return true;
+}
+
+bool FSWrapperPatch::loadOverlay(const std::string &path, Patch &patch) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to open overlay %s. errno %d", getName().c_str(), path.c_str(), errno);
+        return false;
+    }
+    std::string text(OVERLAY_FILE_MAX_SIZE + 1, '\0');
+    auto read = readIntoBuffer(fd, text.data(), 1, text.size());
+    close(fd);
+    if (read < 0 || read > OVERLAY_FILE_MAX_SIZE) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to read overlay %s or it's bigger than %d bytes", getName().c_str(), path.c_str(), OVERLAY_FILE_MAX_SIZE);
+        return false;
+    }
+    text.resize(read);
+
+    patch.path      = path;
+    patch.isOverlay = true;
+    patch.sourceState.store(SOURCE_VALID, std::memory_order_relaxed);
+    auto directory      = path.substr(0, path.find_last_of('/'));
+    uint32_t lineNumber = 0;
+    uint64_t dataSize   = 0;
+    size_t lineStart    = 0;
+    while (lineStart < text.size()) {
+        auto lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = text.size();
+        }
+        auto line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        lineNumber++;
+        if (auto comment = line.find('#'); comment != std::string::npos) {
+            line.resize(comment);
+        }
+        std::vector<std::string> fields;
+        for (auto *field = strtok(line.data(), " \t\r"); field != nullptr; field = strtok(nullptr, " \t\r")) {
+            fields.emplace_back(field);
+        }
+        if (fields.empty()) {
+            continue;
+        }
+        DataExtent extent{};
+        if ((fields.size() != 3 && fields.size() != 4) || !parseNumber(fields[0].c_str(), &extent.targetOffset) ||
+            !parseNumber(fields[1].c_str(), &extent.length) || extent.length == 0 ||
+            (fields.size() == 4 && !parseNumber(fields[3].c_str(), &extent.fileOffset))) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Invalid extent in line %u of %s", getName().c_str(), lineNumber, path.c_str());
+            return false;
+        }
+        auto file = directory + "/" + fields[2];
+        struct stat sb {};
+        if (stat(file.c_str(), &sb) < 0 || (uint64_t) extent.fileOffset + extent.length > (uint64_t) sb.st_size) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] %s (line %u of %s) doesn't exist or is too small", getName().c_str(), file.c_str(), lineNumber, path.c_str());
+            return false;
+        }
+        auto it = std::find(patch.dataFiles.begin(), patch.dataFiles.end(), file);
+        if (it == patch.dataFiles.end()) {
+            it = patch.dataFiles.insert(it, file);
+            patch.dataFds.push_back(-1);
+        }
+        extent.file = it - patch.dataFiles.begin();
+        patch.dataExtents.push_back(extent);
+    }
+
+    std::sort(patch.dataExtents.begin(), patch.dataExtents.end(), [](auto &a, auto &b) { return a.targetOffset < b.targetOffset; });
+    uint64_t end = 0;
+    for (auto &extent : patch.dataExtents) {
+        if (extent.targetOffset < end || (uint64_t) extent.targetOffset + extent.length > UINT32_MAX || dataSize + extent.length > UINT32_MAX) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Extents of %s overlap or are too big", getName().c_str(), path.c_str());
+            return false;
+        }
+        extent.dataOffset = dataSize;
+        dataSize += extent.length;
+        end = (uint64_t) extent.targetOffset + extent.length;
+    }
+    patch.overlayEnd = end;
+    return true;
+}
+
+bool FSWrapperPatch::PrepareOverlay(Patch &patch, uint32_t sourceSize) {
+    if (patch.overlayPrepared) {
+        return true;
+    }
+    if (!OverlayFitsSource(patch, sourceSize)) {
+        return false;
+    }
+    std::vector<PatchOp> ops;
+    uint32_t pos = 0;
+    for (auto &extent : patch.dataExtents) {
+        if (extent.targetOffset > pos) {
+            ops.push_back({pos, extent.targetOffset - pos, PATCH_OP_COPY, pos});
+        }
+        ops.push_back({extent.targetOffset, extent.length, PATCH_OP_DATA, extent.dataOffset});
+        pos = extent.targetOffset + extent.length;
+    }
+    if (pos < sourceSize) {
+        ops.push_back({pos, sourceSize - pos, PATCH_OP_COPY, pos});
+    }
+    patch.ops               = std::move(ops);
+    patch.header.sourceSize = sourceSize;
+    patch.header.targetSize = std::max(sourceSize, patch.overlayEnd);
+    patch.overlayPrepared   = true;
+    return true;
+}
+
+bool FSWrapperPatch::OverlayFitsSource(const Patch &patch, uint32_t sourceSize) {
+    // The extents are sorted by targetOffset and don't change after loading.
+    return patch.dataExtents.empty() || patch.dataExtents.back().targetOffset <= sourceSize;
+}
+
+void FSWrapperPatch::CloseDataFiles(Patch &patch) {
+    for (auto &fd : patch.dataFds) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+bool FSWrapperPatch::GetRelativeKey(const char *path, std::string &outKey) {
+    if (path == nullptr || !starts_with_case_insensitive(path, pPathToReplace)) {
+        return false;
+    }
+    std::string_view relativePath(path + pPathToReplace.size());
+    if (!relativePath.empty()) {
+        if (relativePath.front() != '/' && relativePath.front() != '\\') {
+            return false;
+        }
+        relativePath.remove_prefix(1);
+    }
+    outKey = normalize_path_key(relativePath);
+    return true;
+}
+
+std::shared_ptr<FSWrapperPatch::Patch> FSWrapperPatch::FindPatch(const char *path) {
+    std::string key;
+    if (!GetRelativeKey(path, key) || key.empty()) {
+        return nullptr;
+    }
+    if (auto it = pPatches.find(key); it != pPatches.end()) {
+        return it->second;
+    }
+    return nullptr;
+}
+
+uint32_t FSWrapperPatch::GetPatchedSize(const Patch &patch, uint32_t sourceSize) {
+    if (patch.isOverlay) {
+        return OverlayFitsSource(patch, sourceSize) ? std::max(sourceSize, patch.overlayEnd) : sourceSize;
+    }
+    if (sourceSize == patch.header.sourceSize && patch.sourceState.load(std::memory_order_acquire) != SOURCE_INVALID) {
+        return patch.header.targetSize;
+    }
+    return sourceSize;
+}
+
+bool FSWrapperPatch::TestSource(FSAClientHandle client, Patch &patch, FSAFileHandle source, uint32_t sourceSize, uint8_t *buffer) {
+    auto state = patch.sourceState.load(std::memory_order_acquire);
+    if (state != SOURCE_UNTESTED) {
+        return state == SOURCE_VALID;
+    }
+    // The worker and an open may check the same original at the same time, they come to the same result.
+    bool valid = sourceSize == patch.header.sourceSize;
+    if (valid) {
+        uint32_t checksum = LayerIndexFormat::checksum(nullptr, 0);
+        uint32_t offset   = 0;
+        while (offset < sourceSize) {
+            auto toRead = std::min<uint32_t>(sourceSize - offset, PATCH_WINDOW_SIZE);
+            auto res    = (int32_t) FSAReadFileWithPos(client, buffer, 1, toRead, offset, source, 0);
+            if (res <= 0) {
+                // Checked again on the next open.
+                DEBUG_FUNCTION_LINE_ERR("Failed to read %u bytes at %u of the original of %s: %d", toRead, offset, patch.path.c_str(), res);
+                return false;
+            }
+            checksum = LayerIndexFormat::checksum(buffer, res, checksum);
+            offset += res;
+        }
+        valid = checksum == patch.header.sourceChecksum;
+    }
+    patch.sourceState.store(valid ? SOURCE_VALID : SOURCE_INVALID, std::memory_order_release);
+    return valid;
+}
+
+bool FSWrapperPatch::ReadSource(FSAFileHandle source, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    while (size > 0) {
+        auto toRead = std::min<uint32_t>(size, PATCH_WINDOW_SIZE);
+        auto res    = (int32_t) FSAReadFileWithPos(clientHandle, pScratch, 1, toRead, offset, source, 0);
+        if (res <= 0) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] Failed to read %u bytes at %u of the original: %d", getName().c_str(), toRead, offset, res);
+            return false;
+        }
+        memcpy(buffer, pScratch, res);
+        buffer += res;
+        offset += res;
+        size -= res;
+    }
+    return true;
+}
+
+bool FSWrapperPatch::ReadData(Patch &patch, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    // The range of an op never spans more than one extent.
+    auto it = std::upper_bound(patch.dataExtents.begin(), patch.dataExtents.end(), offset, [](uint32_t value, const DataExtent &extent) { return value < extent.dataOffset; });
+    if (it == patch.dataExtents.begin() || offset - (it - 1)->dataOffset + (uint64_t) size > (it - 1)->length) {
+        return false;
+    }
+    auto &extent = *(it - 1);
+    auto &fd     = patch.dataFds[extent.file];
+    if (fd < 0 && (fd = open(patch.dataFiles[extent.file].c_str(), O_RDONLY)) < 0) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to open %s. errno %d", patch.dataFiles[extent.file].c_str(), errno);
+        return false;
+    }
+    off_t fileOffset = (off_t) extent.fileOffset + (offset - extent.dataOffset);
+    if (lseek(fd, fileOffset, SEEK_SET) != fileOffset) {
+        return false;
+    }
+    return readIntoBuffer(fd, buffer, 1, size) == size;
+}
+
+const FSWrapperPatch::CachedWindow *FSWrapperPatch::GetWindow(const PatchedFile &file, uint32_t window) {
+    auto *patch = file.patch.get();
+    for (auto &cached : pCache) {
+        if (cached.data != nullptr && cached.patch == patch && cached.window == window) {
+            cached.lastUse = ++pCacheClock;
+            return &cached;
+        }
+    }
+
+    auto *oldest = &pCache[0];
+    for (auto &cached : pCache) {
+        if (cached.data == nullptr) {
+            oldest = &cached;
+            break;
+        }
+        if (cached.lastUse < oldest->lastUse) {
+            oldest = &cached;
+        }
+    }
+    if (oldest->data == nullptr && (oldest->data = (uint8_t *) malloc(PATCH_WINDOW_SIZE)) == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to allocate window", getName().c_str());
+        return nullptr;
+    }
+    // The entry is reused for the new window, it must not be found if the reconstruction fails.
+    oldest->patch = nullptr;
+
+    uint32_t offset = window * PATCH_WINDOW_SIZE;
+    uint32_t length = std::min<uint32_t>(patch->header.targetSize - offset, PATCH_WINDOW_SIZE);
+    bool success    = PatchFormat::reconstruct(
+            patch->ops, offset, oldest->data, length,
+            [this, &file](uint32_t srcOffset, uint8_t *buffer, uint32_t size) { return ReadSource(file.source, srcOffset, buffer, size); },
+            [patch](uint32_t dataOffset, uint8_t *buffer, uint32_t size) { return ReadData(*patch, dataOffset, buffer, size); });
+    if (!success) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to reconstruct window %u of %s", getName().c_str(), window, patch->path.c_str());
+        return nullptr;
+    }
+    oldest->patch   = patch;
+    oldest->window  = window;
+    oldest->length  = length;
+    oldest->lastUse = ++pCacheClock;
+    return oldest;
+}
+
+FSError FSWrapperPatch::FSOpenDirWrapper(const char *path, FSADirectoryHandle *handle) {
+    std::string key;
+    if (!GetRelativeKey(path, key) || !pPatchedDirs.contains(key)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (handle == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] handle was nullptr", getName().c_str());
+        return FS_ERROR_INVALID_PARAM;
+    }
+    auto dir = make_shared_nothrow<PatchedDir>();
+    if (!dir) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc dir handle", getName().c_str());
+        return FS_ERROR_MAX_DIRS;
+    }
+    // Requests of the client of the layer skip this layer, the layers below list the directory.
+    auto result = FSAOpenDir(clientHandle, path, &dir->parentHandle);
+    if (result != FS_ERROR_OK) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] Failed to open parent dir %s: %d", getName().c_str(), path, result);
+        return result;
+    }
+    dir->path      = path;
+    dir->keyPrefix = key.empty() ? key : key + "/";
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    dir->handle = (((uint32_t) dir.get()) & 0x0FFFFFFF) | 0x30000000;
+    *handle     = dir->handle;
+    pDirs.push_back(dir);
+    OSMemoryBarrier();
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSReadDirWrapper(FSADirectoryHandle handle, FSADirectoryEntry *entry) {
+    auto dir = GetDir(handle);
+    if (!dir) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    auto result = FSAReadDir(clientHandle, dir->parentHandle, entry);
+    if (result != FS_ERROR_OK || (entry->info.flags & FS_STAT_DIRECTORY)) {
+        return result;
+    }
+    if (auto it = pPatches.find(dir->keyPrefix + normalize_path_key(entry->name)); it != pPatches.end()) {
+        entry->info.size = GetPatchedSize(*it->second, entry->info.size);
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSCloseDirWrapper(FSADirectoryHandle handle) {
+    auto dir = GetDir(handle);
+    if (!dir) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    auto result = FSACloseDir(clientHandle, dir->parentHandle);
+    if (result != FS_ERROR_OK) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to close parent dir %s: %s (%d)", getName().c_str(), dir->path.c_str(), FSAGetStatusStr(result), result);
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSRewindDirWrapper(FSADirectoryHandle handle) {
+    auto dir = GetDir(handle);
+    if (!dir) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    return FSARewindDir(clientHandle, dir->parentHandle);
+}
+
+FSError FSWrapperPatch::FSOpenFileWrapper(const char *path, const char *mode, FSFileHandle *handle) {
+    auto patch = FindPatch(path);
+    if (!patch) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (handle == nullptr || mode == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] handle or mode was nullptr", getName().c_str());
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (strcmp(mode, "r") != 0 && strcmp(mode, "rb") != 0) {
+        DEBUG_FUNCTION_LINE("[%s] Given mode is not allowed %s", getName().c_str(), mode);
+        return FS_ERROR_ACCESS_ERROR;
+    }
+    auto file = make_shared_nothrow<PatchedFile>();
+    if (!file) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to alloc file handle", getName().c_str());
+        return FS_ERROR_MAX_FILES;
+    }
+
+    auto result = FSAOpenFileEx(clientHandle, path, "r", (FSMode) 0, 0, 0, &file->source);
+    if (result != FS_ERROR_OK) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] Failed to open original %s: %d", getName().c_str(), path, result);
+        return result;
+    }
+    if ((result = FSAGetStatFile(clientHandle, file->source, &file->stat)) != FS_ERROR_OK) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Failed to stat original %s: %d", getName().c_str(), path, result);
+        FSACloseFile(clientHandle, file->source);
+        return result;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pCacheMutex);
+        if ((patch->isOverlay && !PrepareOverlay(*patch, file->stat.size)) ||
+            !TestSource(clientHandle, *patch, file->source, file->stat.size, pScratch) || file->stat.size != patch->header.sourceSize) {
+            DEBUG_FUNCTION_LINE_ERR("[%s] %s doesn't match the original %s, it is ignored", getName().c_str(), patch->path.c_str(), path);
+            FSACloseFile(clientHandle, file->source);
+            return FS_ERROR_FORCE_PARENT_LAYER;
+        }
+        patch->numOpen++;
+    }
+    file->stat.size = patch->header.targetSize;
+    file->patch     = std::move(patch);
+    file->pos       = 0;
+
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    file->handle = (((uint32_t) file.get()) & 0x0FFFFFFF) | 0x30000000;
+    *handle      = file->handle;
+    pFiles.push_back(file);
+    OSMemoryBarrier();
+    DEBUG_FUNCTION_LINE_VERBOSE("[%s] Opened %s (%08X) with patch %s", getName().c_str(), path, file->handle, file->patch->path.c_str());
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSCloseFileWrapper(FSFileHandle handle) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    FSACloseFile(clientHandle, file->source);
+    std::lock_guard<std::mutex> lock(pCacheMutex);
+    if (--file->patch->numOpen == 0) {
+        CloseDataFiles(*file->patch);
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSGetStatWrapper(const char *path, FSStat *stats) {
+    auto patch = FindPatch(path);
+    if (!patch) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (stats == nullptr) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    auto result = FSAGetStat(clientHandle, path, stats);
+    if (result != FS_ERROR_OK) {
+        return result;
+    }
+    stats->size = GetPatchedSize(*patch, stats->size);
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSGetStatFileWrapper(FSFileHandle handle, FSStat *stats) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    *stats = file->stat;
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSReadFileWrapper(void *buffer, uint32_t size, uint32_t count, FSFileHandle handle, [[maybe_unused]] uint32_t unk1) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    uint32_t total = size * count;
+    if (total == 0) {
+        return FS_ERROR_OK;
+    }
+    if (buffer == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] buffer is null but size * count is not 0 (It's: %d)", getName().c_str(), total);
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    auto *out         = (uint8_t *) buffer;
+    uint32_t done     = 0;
+    uint32_t fileSize = file->patch->header.targetSize;
+
+    std::lock_guard<std::mutex> lock(pCacheMutex);
+    while (done < total && file->pos < fileSize) {
+        uint32_t window = file->pos / PATCH_WINDOW_SIZE;
+        auto *cached    = GetWindow(*file, window);
+        if (cached == nullptr) {
+            return FS_ERROR_MEDIA_ERROR;
+        }
+        uint32_t posInWindow = file->pos - window * PATCH_WINDOW_SIZE;
+        auto toCopy          = std::min(cached->length - posInWindow, total - done);
+        memcpy(out + done, cached->data + posInWindow, toCopy);
+        file->pos += toCopy;
+        done += toCopy;
+    }
+    return static_cast<FSError>(done / size);
+}
+
+FSError FSWrapperPatch::FSReadFileWithPosWrapper(void *buffer, uint32_t size, uint32_t count, uint32_t pos, FSFileHandle handle, int32_t unk1) {
+    FSError result;
+    if ((result = FSSetPosFileWrapper(handle, pos)) != FS_ERROR_OK) {
+        return result;
+    }
+    return FSReadFileWrapper(buffer, size, count, handle, unk1);
+}
+
+FSError FSWrapperPatch::FSSetPosFileWrapper(FSFileHandle handle, uint32_t pos) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    file->pos = pos;
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSGetPosFileWrapper(FSFileHandle handle, uint32_t *pos) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    *pos = file->pos;
+    return FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSIsEofWrapper(FSFileHandle handle) {
+    auto file = GetFile(handle);
+    if (!file) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    return file->pos >= file->stat.size ? FS_ERROR_END_OF_FILE : FS_ERROR_OK;
+}
+
+FSError FSWrapperPatch::FSMakeDirWrapper(const char *path) {
+    return FindPatch(path) ? FS_ERROR_ALREADY_EXISTS : FS_ERROR_FORCE_PARENT_LAYER;
+}
+
+FSError FSWrapperPatch::FSRemoveWrapper(const char *path) {
+    return FindPatch(path) ? FS_ERROR_ACCESS_ERROR : FS_ERROR_FORCE_PARENT_LAYER;
+}
+
+FSError FSWrapperPatch::FSRenameWrapper(const char *oldPath, [[maybe_unused]] const char *newPath) {
+    return FSRemoveWrapper(oldPath);
+}
+
+std::shared_ptr<FSWrapperPatch::PatchedFile> FSWrapperPatch::GetFile(FSFileHandle handle) {
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    for (auto &file : pFiles) {
+        if (file->handle == handle) {
+            return file;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<FSWrapperPatch::PatchedDir> FSWrapperPatch::GetDir(FSADirectoryHandle handle) {
+    std::lock_guard<std::mutex> lock(pHandlesMutex);
+    for (auto &dir : pDirs) {
+        if (dir->handle == handle) {
+            return dir;
+        }
+    }
+    return nullptr;
+}
+
+bool FSWrapperPatch::isValidDirHandle(FSDirectoryHandle handle) {
+    return GetDir(handle) != nullptr;
+}
+
+bool FSWrapperPatch::isValidFileHandle(FSFileHandle handle) {
+    return GetFile(handle) != nullptr;
+}
+
+void FSWrapperPatch::deleteDirHandle(FSDirectoryHandle handle) {
+    if (!remove_locked_first_if(pHandlesMutex, pDirs, [handle](auto &cur) { return cur->handle == handle; })) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Delete failed because the handle %08X was not found", getName().c_str(), handle);
+    }
+}
+
+void FSWrapperPatch::deleteFileHandle(FSFileHandle handle) {
+    if (!remove_locked_first_if(pHandlesMutex, pFiles, [handle](auto &cur) { return cur->handle == handle; })) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] Delete failed because the handle %08X was not found", getName().c_str(), handle);
+    }
+}
@@ -0,0 +1,251 @@
+#pragma once
+#include "IFSWrapper.h"
+#include "PatchFormat.h"
+#include "SharedFSAClient.h"
+#include <atomic>
+#include <coreinit/filesystem.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Buffers that are passed to the FSA functions need this alignment.
+#define PATCH_FSA_READ_ALIGNMENT 0x40
+
+#define OVERLAY_FILE_SUFFIX   ".croverlay"
+#define OVERLAY_FILE_MAX_SIZE 0x10000
+
+/**
+ * Serves files of a directory as modifications of the original files of the title (see
+ * FS_LAYER_TYPE_CONTENT_PATCH). For every "<path>.crpatch" in the patch directory, "<path>" is reconstructed
+ * from the original and the patch (see PatchFormat.h), all other paths are left to the parent layer.
+ *
+ * A "<path>.croverlay" replaces ranges of the original with ranges of other files instead. It's a text file
+ * with one extent per line:
+ *
+ *   <offset> <length> <replacement file> [<offset in the replacement file>]
+ *
+ * Numbers are decimal or hex with "0x", replacement files are relative to the directory of the overlay and
+ * "#" starts a comment. Extents must not overlap, they may extend the file past the end of the original.
+ * The overlay is turned into the ops of a patch once the size of the original is known.
+ *
+ * The originals are read through the layers below with a private FSA client, whose requests skip this layer
+ * (see getLayerId). Open, stat and readdir all take this path. Reads only reconstruct the windows of
+ * PATCH_WINDOW_SIZE bytes they cover, the last PATCH_CACHE_WINDOWS windows are kept for following reads.
+ *
+ * Once the patches are loaded, a worker thread compares every original with the checksum of its patch. A
+ * patch whose original doesn't match is ignored. If a file is opened before its original has been checked,
+ * the open checks it instead.
+ *
+ * Directories that contain patched files are read from the layers below through the FSA client of the layer,
+ * the entries of patched files get the size of the modified file.
+ */
+class FSWrapperPatch : public IFSWrapper {
+public:
+    FSWrapperPatch(const std::string &name, const std::string &pathToReplace, const std::string &patchDir);
+
+    /**
+     * Deletes the FSA client, which closes the originals that are still open.
+     */
+    ~FSWrapperPatch() override;
+
+    /**
+     * Reads the headers and ops of all patches in the patch directory. Returns false if the directory can't
+     * be read or contains an invalid patch.
+     */
+    bool loadPatches();
+
+    /**
+     * Checks the originals of all patches on a worker thread. The originals are read through the layers
+     * below this one, so it must be called once the layer has been added.
+     */
+    void queueSourceValidation();
+
+    FSError FSOpenDirWrapper(const char *path, FSADirectoryHandle *handle) override;
+
+    FSError FSReadDirWrapper(FSADirectoryHandle handle, FSADirectoryEntry *entry) override;
+
+    FSError FSCloseDirWrapper(FSADirectoryHandle handle) override;
+
+    FSError FSRewindDirWrapper(FSADirectoryHandle handle) override;
+
+    FSError FSOpenFileWrapper(const char *path, const char *mode, FSFileHandle *handle) override;
+
+    FSError FSCloseFileWrapper(FSFileHandle handle) override;
+
+    FSError FSGetStatWrapper(const char *path, FSStat *stats) override;
+
+    FSError FSGetStatFileWrapper(FSFileHandle handle, FSStat *stats) override;
+
+    FSError FSReadFileWrapper(void *buffer, uint32_t size, uint32_t count, FSFileHandle handle, uint32_t unk1) override;
+
+    FSError FSReadFileWithPosWrapper(void *buffer, uint32_t size, uint32_t count, uint32_t pos, FSFileHandle handle, int32_t unk1) override;
+
+    FSError FSSetPosFileWrapper(FSFileHandle handle, uint32_t pos) override;
+
+    FSError FSGetPosFileWrapper(FSFileHandle handle, uint32_t *pos) override;
+
+    FSError FSIsEofWrapper(FSFileHandle handle) override;
+
+    FSError FSMakeDirWrapper(const char *path) override;
+
+    FSError FSRemoveWrapper(const char *path) override;
+
+    FSError FSRenameWrapper(const char *oldPath, const char *newPath) override;
+
+    bool isValidDirHandle(FSDirectoryHandle handle) override;
+
+    bool isValidFileHandle(FSFileHandle handle) override;
+
+    void deleteDirHandle(FSDirectoryHandle handle) override;
+
+    void deleteFileHandle(FSFileHandle handle) override;
+
+    uint32_t getLayerId() override {
+        return (uint32_t) clientHandle;
+    }
+
+private:
+    enum SourceState : uint32_t {
+        SOURCE_UNTESTED = 0,
+        SOURCE_VALID    = 1,
+        SOURCE_INVALID  = 2,
+    };
+
+    struct DataExtent {
+        // Offset in the modified file, only used by overlays.
+        uint32_t targetOffset;
+        // Offset in the data that is referenced by PATCH_OP_DATA ops.
+        uint32_t dataOffset;
+        uint32_t length;
+        uint32_t file;
+        uint32_t fileOffset;
+    };
+
+    struct Patch {
+        // Path of the patch file or the overlay.
+        std::string path;
+        bool isOverlay = false;
+        PatchFileHeader header{};
+        std::vector<PatchOp> ops;
+        // Where the data of the PATCH_OP_DATA ops is stored, sorted by dataOffset. A patch file stores it in
+        // its data section, an overlay in the replacement files.
+        std::vector<DataExtent> dataExtents;
+        std::vector<std::string> dataFiles;
+        // Opened on the first read, closed once no handle of the file is open anymore.
+        std::vector<int> dataFds;
+        uint32_t numOpen = 0;
+        // Full path of the original.
+        std::string sourcePath;
+        // Whether the original matches header.sourceChecksum, overlays don't have a checksum.
+        std::atomic<uint32_t> sourceState{SOURCE_UNTESTED};
+        // End of the last extent of an overlay.
+        uint32_t overlayEnd  = 0;
+        bool overlayPrepared = false;
+    };
+
+    struct PatchedFile {
+        FSFileHandle handle;
+        std::shared_ptr<Patch> patch;
+        FSAFileHandle source;
+        uint32_t pos;
+        FSStat stat;
+    };
+
+    struct PatchedDir {
+        FSADirectoryHandle handle;
+        std::string path;
+        // Prefix of the keys of the entries in pPatches.
+        std::string keyPrefix;
+        FSADirectoryHandle parentHandle;
+    };
+
+    struct CachedWindow {
+        const Patch *patch;
+        uint32_t window;
+        uint32_t lastUse;
+        uint32_t length;
+        uint8_t *data;
+    };
+
+    bool scanDirectory(const std::string &relativePath, uint32_t depth);
+
+    bool loadPatch(const std::string &path, Patch &patch);
+
+    bool loadOverlay(const std::string &path, Patch &patch);
+
+    /**
+     * Creates the ops of an overlay for an original of sourceSize bytes. Returns false if an extent starts
+     * after the end of the original.
+     */
+    static bool PrepareOverlay(Patch &patch, uint32_t sourceSize);
+
+    /**
+     * Returns false if an extent of the overlay starts after the end of an original of sourceSize bytes.
+     */
+    static bool OverlayFitsSource(const Patch &patch, uint32_t sourceSize);
+
+    static void CloseDataFiles(Patch &patch);
+
+    /**
+     * Returns false if the path is not inside the replaced directory, otherwise sets the key of the path
+     * relative to it (see normalize_path_key).
+     */
+    bool GetRelativeKey(const char *path, std::string &outKey);
+
+    /**
+     * Returns the patch of the path, or nullptr if the path is not patched by this layer.
+     */
+    std::shared_ptr<Patch> FindPatch(const char *path);
+
+    /**
+     * Returns the size of the modified file for an original of sourceSize bytes, or sourceSize if the patch
+     * doesn't apply to it.
+     */
+    static uint32_t GetPatchedSize(const Patch &patch, uint32_t sourceSize);
+
+    static void ValidateSources(const std::shared_ptr<SharedFSAClient> &client, const std::vector<std::shared_ptr<Patch>> &patches);
+
+    /**
+     * Returns false if the original doesn't match the size and checksum of the patch. The first call reads the
+     * whole original into buffer (PATCH_WINDOW_SIZE bytes, aligned for FSA reads).
+     */
+    static bool TestSource(FSAClientHandle client, Patch &patch, FSAFileHandle source, uint32_t sourceSize, uint8_t *buffer);
+
+    /**
+     * Returns the reconstructed window of the file, from the cache if possible. Must be called with
+     * pCacheMutex held.
+     */
+    const CachedWindow *GetWindow(const PatchedFile &file, uint32_t window);
+
+    bool ReadSource(FSAFileHandle source, uint32_t offset, uint8_t *buffer, uint32_t size);
+
+    static bool ReadData(Patch &patch, uint32_t offset, uint8_t *buffer, uint32_t size);
+
+    std::shared_ptr<PatchedFile> GetFile(FSFileHandle handle);
+
+    std::shared_ptr<PatchedDir> GetDir(FSADirectoryHandle handle);
+
+    std::string pPathToReplace;
+    std::string pPatchDir;
+    // Key is the normalized path relative to pPathToReplace (see normalize_path_key).
+    std::unordered_map<std::string, std::shared_ptr<Patch>> pPatches;
+    // Keys of the directories that contain patched files.
+    std::unordered_set<std::string> pPatchedDirs;
+
+    std::shared_ptr<SharedFSAClient> pClient;
+    FSAClientHandle clientHandle = 0;
+
+    std::mutex pHandlesMutex;
+    std::vector<std::shared_ptr<PatchedFile>> pFiles;
+    std::vector<std::shared_ptr<PatchedDir>> pDirs;
+
+    // Guards the cache, the scratch buffer, the ops of overlays and the fds of the patches.
+    std::mutex pCacheMutex;
+    CachedWindow pCache[PATCH_CACHE_WINDOWS]{};
+    uint32_t pCacheClock = 0;
+    // Originals are read into this buffer first, FSA reads need an aligned destination.
+    uint8_t *pScratch = nullptr;
+};
@@ -0,0 +1,62 @@
+#include "FSWrapperRam.h"
+#include "export.h"
+#include "utils/logger.h"
+
+FSWrapperRam::FSWrapperRam(const std::string &name,
+                           const std::string &pathToReplace,
+                           std::shared_ptr<PackArchive> archive) : FSWrapper(name,
+                                                                             pathToReplace,
+                                                                             archive->getPath(),
+                                                                             false,
+                                                                             false,
+                                                                             archive->getIndex()),
+                                                                   pArchive(std::move(archive)) {
+}
+
+bool FSWrapperRam::setOption(uint32_t option, uint32_t value) {
+    if (option == CR_LAYER_OPTION_INDEX_METADATA) {
+        // The metadata is always served from memory.
+        return false;
+    } else if (option == CR_LAYER_OPTION_BOOT_TRACE || option == CR_LAYER_OPTION_PREFETCH || option == CR_LAYER_OPTION_SLURP_SIZE ||
+               option == CR_LAYER_OPTION_STREAMING || option == CR_LAYER_OPTION_COALESCE_READS) {
+        // Nothing is read from the SD card.
+        return false;
+    }
+    return FSWrapper::setOption(option, value);
+}
+
+FSError FSWrapperRam::FSOpenFileWrapper(const char *path, const char *mode, FSFileHandle *handle) {
+    if (path == nullptr || mode == nullptr || handle == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] path, mode or handle was nullptr", getName().c_str());
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (!IsPathToReplace(path)) {
+        return FS_ERROR_FORCE_PARENT_LAYER;
+    }
+    if (!IsFileModeAllowed(mode)) {
+        DEBUG_FUNCTION_LINE("[%s] Given mode is not allowed %s", getName().c_str(), mode);
+        return FS_ERROR_ACCESS_ERROR;
+    }
+
+    auto newPath = GetNewPath(path);
+    auto *file   = pArchive->find(std::string_view(newPath).substr(pArchive->getPath().length()));
+    if (file == nullptr) {
+        DEBUG_FUNCTION_LINE_VERBOSE("[%s] File %s does not exist in this layer", getName().c_str(), path);
+        return FS_ERROR_NOT_FOUND;
+    }
+
+    return OpenFileFromPack(pArchive, file, handle);
+}
+
+std::shared_ptr<PackArchive> FSWrapperRam::mapFile(const char *path, const PackFile **outFile) {
+    if (!IsPathToReplace(path)) {
+        return nullptr;
+    }
+    auto newPath = GetNewPath(path);
+    auto *file   = pArchive->find(std::string_view(newPath).substr(pArchive->getPath().length()));
+    if (file == nullptr) {
+        return nullptr;
+    }
+    *outFile = file;
+    return pArchive;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "FSWrapper.h"
+#include "PackArchive.h"
+#include <coreinit/filesystem.h>
+#include <memory>
+
+/**
+ * Replaces a directory with a replacement directory that has been loaded into memory when the layer was
+ * created (see PackArchive::loadDirectory).
+ *
+ * Open, read, stat and readdir are served from memory, the SD card is never accessed afterwards.
+ * Changes to the replacement directory are not visible until the layer is created again.
+ */
+class FSWrapperRam : public FSWrapper {
+public:
+    FSWrapperRam(const std::string &name,
+                 const std::string &pathToReplace,
+                 std::shared_ptr<PackArchive> archive);
+
+    FSError FSOpenFileWrapper(const char *path,
+                              const char *mode,
+                              FSFileHandle *handle) override;
+
+    bool setOption(uint32_t option, uint32_t value) override;
+
+    std::shared_ptr<PackArchive> mapFile(const char *path, const PackFile **outFile) override;
+
+    bool warmUp(const std::string &path) override {
+        // Everything is in memory already.
+        return false;
+    }
+
+private:
+    std::shared_ptr<PackArchive> pArchive;
+};
@@ -1,8 +1,38 @@
 #pragma once
+#include "FileReader.h"
+#include "export.h"
 #include <coreinit/filesystem.h>
+#include <cstdlib>
+#include <memory>
+#include <string>
 
 struct FileInfo {
 public:
+    virtual ~FileInfo() {
+        free(readAheadBuffer);
+    }
     FSFileHandle handle;
+    // -1 if the file is not read from the SD card directly (e.g. from a pack or memory).
     int fd;
+    // Chosen when the file is opened, every read goes through it.
+    std::unique_ptr<FileReader> reader;
+    // Set if the stat is served from the layer index.
+    bool hasStat = false;
+    FSStat indexStat{};
+    // The path the file has been opened with.
+    std::string path;
+    // Set if the start of the file has been prefetched, see Prefetcher.
+    std::string prefetchKey;
+    // See CRAdvise.
+    CRFileAdvice advice = CR_FILE_ADVICE_NORMAL;
+    // Only used with CR_FILE_ADVICE_SEQUENTIAL. Holds the data from readAheadOffset on, the reader is
+    // positioned after it. The current position is readAheadOffset + readAheadPos.
+    uint8_t *readAheadBuffer = nullptr;
+    uint32_t readAheadOffset = 0;
+    uint32_t readAheadPos    = 0;
+    uint32_t readAheadLength = 0;
+    // Set once the file is open through more than one handle of the layer, see CR_LAYER_OPTION_COALESCE_READS.
+    bool coalesceReads = false;
+    // Normalized path of the file (see LayerIndex::getKey), only set if reads may be coalesced.
+    std::string coalesceKey;
 };
@@ -0,0 +1,102 @@
+#include "FileReader.h"
+#include "FileUtils.h"
+#include "utils/logger.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int64_t FdFileReader::read(void *buffer, uint32_t size) {
+    return readIntoBuffer(pFd, buffer, 1, size);
+}
+
+bool FdFileReader::setPos(uint32_t pos) {
+    return lseek(pFd, (off_t) pos, SEEK_SET) == (off_t) pos;
+}
+
+int64_t FdFileReader::getPos() {
+    return lseek(pFd, 0, SEEK_CUR);
+}
+
+int64_t FdFileReader::getSize() {
+    struct stat sb {};
+    if (fstat(pFd, &sb) < 0) {
+        return -1;
+    }
+    return sb.st_size;
+}
+
+int64_t PackFileReader::read(void *buffer, uint32_t size) {
+    auto read = pArchive->read(pFile, pPos, buffer, size, pUseReadAhead);
+    if (read > 0) {
+        pPos += read;
+    }
+    return read;
+}
+
+int64_t MemoryFileReader::read(void *buffer, uint32_t size) {
+    uint32_t read = pPos < pSize ? std::min(size, pSize - pPos) : 0;
+    memcpy(buffer, pData + pPos, read);
+    pPos += read;
+    return read;
+}
+
+SlurpPool::~SlurpPool() {
+    freeBuffers();
+}
+
+uint32_t SlurpPool::getClass(uint32_t size) {
+    uint32_t sizeClass = FILE_SLURP_MIN_CLASS;
+    while (sizeClass < FILE_SLURP_MAX_CLASS && (1u << sizeClass) < size) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+uint8_t *SlurpPool::alloc(uint32_t size, uint32_t *outCapacity) {
+    auto sizeClass = getClass(size);
+    *outCapacity   = 1u << sizeClass;
+    {
+        std::lock_guard<std::mutex> lock(pMutex);
+        auto &buffers = pBuffers[sizeClass - FILE_SLURP_MIN_CLASS];
+        if (!buffers.empty()) {
+            auto *buffer = buffers.back();
+            buffers.pop_back();
+            pPoolSize -= *outCapacity;
+            return buffer;
+        }
+    }
+    return (uint8_t *) malloc(*outCapacity);
+}
+
+void SlurpPool::release(uint8_t *buffer, uint32_t capacity) {
+    if (buffer == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pMutex);
+        if (pPoolSize + capacity <= pMaxPoolSize) {
+            pBuffers[getClass(capacity) - FILE_SLURP_MIN_CLASS].push_back(buffer);
+            pPoolSize += capacity;
+            return;
+        }
+    }
+    free(buffer);
+}
+
+void SlurpPool::setSlurpSize(uint32_t slurpSize) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    freeBuffers();
+    pMaxPoolSize = FILE_SLURP_POOL_SIZE * slurpSize;
+}
+
+void SlurpPool::freeBuffers() {
+    for (auto &buffers : pBuffers) {
+        for (auto *buffer : buffers) {
+            free(buffer);
+        }
+        buffers.clear();
+    }
+    pPoolSize = 0;
+}
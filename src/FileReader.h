@@ -0,0 +1,195 @@
+#pragma once
+#include "PackArchive.h"
+#include "export.h"
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Slurp buffers are allocated in power of two size classes from 4 KiB to 1 MiB.
+#define FILE_SLURP_MIN_CLASS 12
+#define FILE_SLURP_MAX_CLASS 20
+// Unused slurp buffers of up to this many times the slurp size are kept for reuse.
+#define FILE_SLURP_POOL_SIZE 8
+
+/**
+ * Source of the data of an open file, chosen by the layer when the file is opened. The reader keeps the
+ * position of the handle, the read-ahead, prefetch and coalescing of FSWrapper are built on top of it.
+ */
+class FileReader {
+public:
+    virtual ~FileReader() = default;
+
+    /**
+     * Reads up to size bytes at the current position and moves the position behind them. Returns the
+     * number of bytes read, which is less than size at the end of the file, or -1 on errors.
+     */
+    virtual int64_t read(void *buffer, uint32_t size) = 0;
+
+    virtual bool setPos(uint32_t pos) = 0;
+
+    /**
+     * Returns -1 on errors.
+     */
+    virtual int64_t getPos() = 0;
+
+    /**
+     * Returns -1 on errors.
+     */
+    virtual int64_t getSize() = 0;
+
+    /**
+     * Returns false if every read goes to the SD card, so buffering reads in memory pays off.
+     */
+    [[nodiscard]] virtual bool isBuffered() const {
+        return true;
+    }
+
+    virtual void advise(CRFileAdvice advice) {
+    }
+};
+
+/**
+ * Reads a file of the SD card through its fd, the fd is owned by the caller.
+ */
+class FdFileReader : public FileReader {
+public:
+    explicit FdFileReader(int fd) : pFd(fd) {
+    }
+
+    int64_t read(void *buffer, uint32_t size) override;
+
+    bool setPos(uint32_t pos) override;
+
+    int64_t getPos() override;
+
+    int64_t getSize() override;
+
+    [[nodiscard]] bool isBuffered() const override {
+        return false;
+    }
+
+protected:
+    int pFd;
+};
+
+/**
+ * Reads a file of a pack. The archive keeps the data of the file alive.
+ */
+class PackFileReader : public FileReader {
+public:
+    PackFileReader(std::shared_ptr<PackArchive> archive, const PackFile *file) : pArchive(std::move(archive)),
+                                                                                 pFile(file) {
+    }
+
+    int64_t read(void *buffer, uint32_t size) override;
+
+    bool setPos(uint32_t pos) override {
+        pPos = pos;
+        return true;
+    }
+
+    int64_t getPos() override {
+        return pPos;
+    }
+
+    int64_t getSize() override {
+        return pFile->size;
+    }
+
+    void advise(CRFileAdvice advice) override {
+        pUseReadAhead = advice != CR_FILE_ADVICE_RANDOM;
+    }
+
+private:
+    std::shared_ptr<PackArchive> pArchive;
+    const PackFile *pFile;
+    uint32_t pPos      = 0;
+    bool pUseReadAhead = true;
+};
+
+/**
+ * Reads a file that has been read into memory completely (see CR_LAYER_OPTION_SLURP_SIZE). The buffer is
+ * passed to the release function once the reader is destroyed.
+ */
+class MemoryFileReader : public FileReader {
+public:
+    typedef std::function<void(uint8_t *data, uint32_t capacity)> ReleaseFunction;
+
+    MemoryFileReader(uint8_t *data, uint32_t size, uint32_t capacity, ReleaseFunction &&release) : pData(data),
+                                                                                                   pSize(size),
+                                                                                                   pCapacity(capacity),
+                                                                                                   pRelease(std::move(release)) {
+    }
+
+    ~MemoryFileReader() override {
+        pRelease(pData, pCapacity);
+    }
+
+    MemoryFileReader(const MemoryFileReader &)            = delete;
+    MemoryFileReader &operator=(const MemoryFileReader &) = delete;
+
+    int64_t read(void *buffer, uint32_t size) override;
+
+    bool setPos(uint32_t pos) override {
+        pPos = pos;
+        return true;
+    }
+
+    int64_t getPos() override {
+        return pPos;
+    }
+
+    int64_t getSize() override {
+        return pSize;
+    }
+
+private:
+    uint8_t *pData;
+    uint32_t pSize;
+    uint32_t pCapacity;
+    ReleaseFunction pRelease;
+    uint32_t pPos = 0;
+};
+
+/**
+ * Buffers for slurped files (see CR_LAYER_OPTION_SLURP_SIZE). The readers of the files keep the pool alive, so
+ * they can return their buffers after the layer has been removed.
+ */
+class SlurpPool {
+public:
+    SlurpPool() = default;
+
+    ~SlurpPool();
+
+    SlurpPool(const SlurpPool &)            = delete;
+    SlurpPool &operator=(const SlurpPool &) = delete;
+
+    /**
+     * Returns a buffer of the smallest size class that fits size bytes, from the pool if possible.
+     */
+    uint8_t *alloc(uint32_t size, uint32_t *outCapacity);
+
+    /**
+     * Keeps the buffer for reuse if the pool isn't full, otherwise frees it.
+     */
+    void release(uint8_t *buffer, uint32_t capacity);
+
+    /**
+     * Frees the unused buffers, the pool is bounded by the slurp size.
+     */
+    void setSlurpSize(uint32_t slurpSize);
+
+private:
+    static uint32_t getClass(uint32_t size);
+
+    void freeBuffers();
+
+    std::mutex pMutex;
+    // Unused buffers by size class.
+    std::array<std::vector<uint8_t *>, FILE_SLURP_MAX_CLASS - FILE_SLURP_MIN_CLASS + 1> pBuffers;
+    uint32_t pPoolSize    = 0;
+    uint32_t pMaxPoolSize = 0;
+};
@@ -0,0 +1,239 @@
+#include "FileStream.h"
+#include "FileUtils.h"
+#include "WorkerThreads.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/fcntl.h>
+#include <sys/unistd.h>
+
+FileStream::FileStream(std::string path, uint32_t offset, uint32_t chunkSize, uint32_t numChunks) : pPath(std::move(path)),
+                                                                                                   pOffset(offset),
+                                                                                                   pChunkSize(chunkSize),
+                                                                                                   pChunks(numChunks, Chunk{0, CHUNK_EMPTY, 0, nullptr}) {
+}
+
+FileStream::~FileStream() {
+    if (pFd >= 0) {
+        close(pFd);
+    }
+    for (auto &chunk : pChunks) {
+        free(chunk.data);
+    }
+}
+
+std::shared_ptr<FileStream> FileStream::start(const std::string &path, uint32_t offset, uint32_t chunkSize, uint32_t numChunks) {
+    auto stream = make_shared_nothrow<FileStream>(path, offset, chunkSize, numChunks);
+    if (!stream) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate FileStream");
+        return nullptr;
+    }
+    stream->pFilling = true;
+    if (!queueWorkerTask([stream]() { stream->fill(); })) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to queue streaming %s", path.c_str());
+        return nullptr;
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("Stream %s from %u, %u chunks of %u bytes", path.c_str(), offset, numChunks, chunkSize);
+    return stream;
+}
+
+void FileStream::queueFill(const std::shared_ptr<FileStream> &stream) {
+    if (!queueWorkerTask([stream]() { stream->fill(); })) {
+        std::lock_guard<std::mutex> lock(stream->pMutex);
+        stream->pFilling = false;
+    }
+}
+
+int64_t FileStream::read(const std::shared_ptr<FileStream> &stream, uint32_t pos, void *buffer, uint32_t size) {
+    auto *out     = (uint8_t *) buffer;
+    uint32_t done = 0;
+    bool needFill = false;
+    {
+        std::lock_guard<std::mutex> lock(stream->pMutex);
+        uint32_t numChunks = stream->pChunks.size();
+        if (pos < stream->pOffset) {
+            return FILE_STREAM_OUT_OF_RANGE;
+        }
+        uint32_t first = (pos - stream->pOffset) / stream->pChunkSize;
+        if (first < stream->pFirstChunk || first >= stream->pFirstChunk + numChunks) {
+            return FILE_STREAM_OUT_OF_RANGE;
+        }
+        while (done < size) {
+            uint32_t relativePos = pos + done - stream->pOffset;
+            uint32_t index       = relativePos / stream->pChunkSize;
+            uint32_t posInChunk  = relativePos % stream->pChunkSize;
+            auto &chunk          = stream->pChunks[index % numChunks];
+            if (chunk.index != index || chunk.state != CHUNK_READY || posInChunk >= chunk.length) {
+                break;
+            }
+            auto toCopy = std::min(chunk.length - posInChunk, size - done);
+            memcpy(out + done, chunk.data + posInChunk, toCopy);
+            done += toCopy;
+        }
+        // The caller reads whatever is missing itself, so the chunks before pos + size are not needed anymore.
+        uint32_t newFirst = (pos + size - stream->pOffset) / stream->pChunkSize;
+        if (newFirst > stream->pFirstChunk) {
+            stream->pFirstChunk = newFirst;
+            if (!stream->pStopped && !stream->pFilling && newFirst <= stream->pLastChunk) {
+                stream->pFilling = true;
+                needFill         = true;
+            }
+        }
+    }
+    if (needFill) {
+        queueFill(stream);
+    }
+    return done;
+}
+
+void FileStream::stop() {
+    std::lock_guard<std::mutex> lock(pMutex);
+    pStopped = true;
+}
+
+void FileStream::fill() {
+    if (pFd < 0 && (pFd = open(pPath.c_str(), O_RDONLY)) < 0) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to open %s for streaming", pPath.c_str());
+        std::lock_guard<std::mutex> lock(pMutex);
+        pStopped = true;
+        pFilling = false;
+        return;
+    }
+    uint32_t numChunks = pChunks.size();
+    while (true) {
+        Chunk *chunk   = nullptr;
+        uint32_t index = 0;
+        {
+            std::lock_guard<std::mutex> lock(pMutex);
+            if (!pStopped) {
+                for (index = pFirstChunk; index < pFirstChunk + numChunks && index <= pLastChunk; index++) {
+                    auto &cur = pChunks[index % numChunks];
+                    if (cur.index != index || cur.state != CHUNK_READY) {
+                        chunk = &cur;
+                        break;
+                    }
+                }
+            }
+            if (chunk == nullptr) {
+                pFilling = false;
+                return;
+            }
+            // Only this worker writes to chunks that are filling, the IO thread only copies from ready ones.
+            chunk->index = index;
+            chunk->state = CHUNK_FILLING;
+        }
+
+        int64_t read = -1;
+        if (chunk->data != nullptr || (chunk->data = (uint8_t *) malloc(pChunkSize)) != nullptr) {
+            off_t offset = (off_t) pOffset + (off_t) index * pChunkSize;
+            if (lseek(pFd, offset, SEEK_SET) == offset) {
+                read = readIntoBuffer(pFd, chunk->data, 1, pChunkSize);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(pMutex);
+        if (read < 0) {
+            DEBUG_FUNCTION_LINE_WARN("Failed to read chunk %u of %s, stop streaming", index, pPath.c_str());
+            chunk->state = CHUNK_EMPTY;
+            pStopped     = true;
+            pFilling     = false;
+            return;
+        }
+        chunk->length = read;
+        chunk->state  = CHUNK_READY;
+        if (read < pChunkSize) {
+            pLastChunk = index;
+        }
+    }
+}
+
+StreamedFileReader::StreamedFileReader(int fd, std::string path, uint32_t numChunks, std::shared_ptr<StreamCounters> counters) : FdFileReader(fd),
+                                                                                                                                  pPath(std::move(path)),
+                                                                                                                                  pNumChunks(numChunks),
+                                                                                                                                  pCounters(std::move(counters)) {
+}
+
+StreamedFileReader::~StreamedFileReader() {
+    stopStream();
+}
+
+int64_t StreamedFileReader::read(void *buffer, uint32_t size) {
+    if (!pEnabled) {
+        return FdFileReader::read(buffer, size);
+    }
+    auto *out     = (uint8_t *) buffer;
+    uint32_t done = 0;
+    off_t pos     = lseek(pFd, 0, SEEK_CUR);
+    if (pos < 0) {
+        return -1;
+    }
+    if (pStream) {
+        auto copied = FileStream::read(pStream, pos, buffer, size);
+        if (copied == FILE_STREAM_OUT_OF_RANGE) {
+            DEBUG_FUNCTION_LINE_VERBOSE("Stop streaming %s, read at %u", pPath.c_str(), (uint32_t) pos);
+            stopStream();
+        } else if (copied > 0) {
+            done = copied;
+            if (lseek(pFd, pos + done, SEEK_SET) != pos + done) {
+                return -1;
+            }
+        }
+    }
+    if (done < size) {
+        auto read = readIntoBuffer(pFd, out + done, 1, size - done);
+        if (read < 0) {
+            return -1;
+        }
+        if (read > 0 && pStream) {
+            std::lock_guard<std::mutex> lock(pCounters->mutex);
+            pCounters->stats.numUnderruns++;
+        }
+        done += read;
+    } else if (pStream) {
+        std::lock_guard<std::mutex> lock(pCounters->mutex);
+        pCounters->stats.numHits++;
+    }
+
+    if (!pStream) {
+        bool sequential = done == size && size <= FILE_STREAM_MAX_CHUNK_SIZE;
+        if (!sequential) {
+            pSequentialReads = 0;
+        } else if (pos == pLastReadEnd) {
+            pSequentialReads++;
+        } else {
+            pSequentialReads = 1;
+        }
+        pLastReadEnd = pos + done;
+        if (pSequentialReads >= FILE_STREAM_DETECT_READS) {
+            pSequentialReads = 0;
+            std::lock_guard<std::mutex> lock(pCounters->mutex);
+            if (pCounters->stats.numActive < FILE_STREAM_MAX_ACTIVE) {
+                auto chunkSize = std::max<uint32_t>(size, FILE_STREAM_MIN_CHUNK_SIZE);
+                pStream        = FileStream::start(pPath, pos + done, chunkSize, pNumChunks);
+                if (pStream) {
+                    pCounters->stats.numStreams++;
+                    pCounters->stats.numActive++;
+                }
+            }
+        }
+    }
+    return done;
+}
+
+void StreamedFileReader::advise(CRFileAdvice advice) {
+    pEnabled = advice == CR_FILE_ADVICE_NORMAL;
+    if (!pEnabled) {
+        stopStream();
+    }
+}
+
+void StreamedFileReader::stopStream() {
+    if (!pStream) {
+        return;
+    }
+    pStream->stop();
+    pStream.reset();
+    std::lock_guard<std::mutex> lock(pCounters->mutex);
+    pCounters->stats.numActive--;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "FileReader.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A handle is streamed after this many sequential reads of at most FILE_STREAM_MAX_CHUNK_SIZE bytes.
+#define FILE_STREAM_DETECT_READS   4
+#define FILE_STREAM_MIN_CHUNK_SIZE 0x10000
+#define FILE_STREAM_MAX_CHUNK_SIZE 0x40000
+#define FILE_STREAM_MAX_CHUNKS     8
+#define FILE_STREAM_MAX_ACTIVE     4
+
+// Returned by FileStream::read if the position is not inside the window of the stream.
+#define FILE_STREAM_OUT_OF_RANGE   (-1)
+
+struct StreamStats {
+    // Handles that have been switched to streaming.
+    uint32_t numStreams;
+    uint32_t numActive;
+    // Reads that have been served completely from the chunks of a stream.
+    uint32_t numHits;
+    // Reads of streamed handles that had to wait for the SD card because the chunk was not ready yet.
+    uint32_t numUnderruns;
+};
+
+/**
+ * Stream stats of a layer, shared by its handles.
+ */
+struct StreamCounters {
+    std::mutex mutex;
+    StreamStats stats{};
+};
+
+/**
+ * Keeps the next chunks of a file that is read sequentially (e.g. an audio or video stream) buffered ahead of
+ * the read position (see CR_LAYER_OPTION_STREAMING).
+ *
+ * The chunks are read by a worker thread with its own fd into a ring of numChunks buffers, reads of the handle
+ * are then memcpys. A chunk is refilled once the read position has moved past it. The IO thread never waits
+ * for the worker: if the data is not ready yet, the caller reads it from its own fd and counts an underrun.
+ */
+class FileStream {
+public:
+    FileStream(std::string path, uint32_t offset, uint32_t chunkSize, uint32_t numChunks);
+
+    ~FileStream();
+
+    FileStream(const FileStream &)            = delete;
+    FileStream &operator=(const FileStream &) = delete;
+
+    /**
+     * Creates the stream and queues reading the chunks from offset on. Returns nullptr if the task could not be queued.
+     */
+    static std::shared_ptr<FileStream> start(const std::string &path, uint32_t offset, uint32_t chunkSize, uint32_t numChunks);
+
+    /**
+     * Copies the data at pos from the ready chunks and moves the window to pos. Returns the number of bytes
+     * copied, which is less than size if the data is not ready yet or the end of the file has been reached,
+     * or FILE_STREAM_OUT_OF_RANGE if pos is before or far after the window (e.g. after a seek).
+     */
+    static int64_t read(const std::shared_ptr<FileStream> &stream, uint32_t pos, void *buffer, uint32_t size);
+
+    /**
+     * Stops reading ahead, the buffers are freed once the worker is done with the stream.
+     */
+    void stop();
+
+private:
+    // Fills the chunks of the window until all are ready, runs on a worker thread.
+    void fill();
+
+    static void queueFill(const std::shared_ptr<FileStream> &stream);
+
+    enum ChunkState {
+        CHUNK_EMPTY,
+        CHUNK_FILLING,
+        CHUNK_READY,
+    };
+
+    struct Chunk {
+        // Index of the chunk in the stream, the chunk starts at pOffset + index * pChunkSize.
+        uint32_t index;
+        ChunkState state;
+        uint32_t length;
+        uint8_t *data;
+    };
+
+    std::string pPath;
+    uint32_t pOffset;
+    uint32_t pChunkSize;
+    int pFd = -1;
+
+    std::mutex pMutex;
+    std::vector<Chunk> pChunks;
+    // Index of the chunk the read position is in.
+    uint32_t pFirstChunk = 0;
+    // Index of the last chunk of the file, once it has been read.
+    uint32_t pLastChunk = UINT32_MAX;
+    bool pFilling       = false;
+    bool pStopped       = false;
+};
+
+/**
+ * Reader of the handles of layers with CR_LAYER_OPTION_STREAMING. Reads from the fd until the handle has been
+ * read sequentially often enough, then a FileStream is started at the read position and reads are served
+ * from it. A seek outside the window of the stream stops it again.
+ */
+class StreamedFileReader : public FdFileReader {
+public:
+    StreamedFileReader(int fd, std::string path, uint32_t numChunks, std::shared_ptr<StreamCounters> counters);
+
+    ~StreamedFileReader() override;
+
+    int64_t read(void *buffer, uint32_t size) override;
+
+    /**
+     * Handles are only streamed with CR_FILE_ADVICE_NORMAL.
+     */
+    void advise(CRFileAdvice advice) override;
+
+private:
+    void stopStream();
+
+    // Path on the SD card, the stream opens it with its own fd.
+    std::string pPath;
+    uint32_t pNumChunks;
+    std::shared_ptr<StreamCounters> pCounters;
+    std::shared_ptr<FileStream> pStream;
+    bool pEnabled = true;
+    // The handle is streamed once enough reads have started at pLastReadEnd.
+    uint32_t pLastReadEnd     = 0;
+    uint32_t pSequentialReads = 0;
+};
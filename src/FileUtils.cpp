@@ -1,12 +1,15 @@
 #include "FileUtils.h"
+#include "BootTrace.h"
 #include "FSWrapper.h"
 #include "IFSWrapper.h"
+#include "Prefetcher.h"
 #include "utils/StringTools.h"
 #include "utils/logger.h"
 #include "utils/utils.h"
 #include <coreinit/cache.h>
 #include <coreinit/filesystem_fsa.h>
 #include <coreinit/thread.h>
+#include <algorithm>
 #include <malloc.h>
 #include <map>
 #include <unistd.h>
@@ -62,6 +65,12 @@ void setWorkingDir(FSAClientHandle client, const char *path) {
     setWorkingDirGeneric(client, path, workingDirMutex, workingDirs);
 }
 
+void bumpLayerGenerations(uint32_t index) {
+    for (auto i = index; i < fsLayers.size(); i++) {
+        fsLayers[i]->bumpGeneration();
+    }
+}
+
 void clearFSLayer() {
     {
         std::lock_guard<std::mutex> workingDirLock(workingDirMutex);
@@ -92,23 +101,181 @@ bool sendMessageToThread(FSShimWrapperMessage *param) {
     return false;
 }
 
-FSError doForLayer(FSShimWrapper *param) {
-    std::lock_guard<std::mutex> lock(fsLayerMutex);
-    if (!fsLayers.empty()) {
-        uint32_t startIndex = fsLayers.size();
+static bool isModifyingCommand(FSAShimBuffer *shim) {
+    switch ((FSACommandEnum) shim->command) {
+        case FSA_COMMAND_MAKE_DIR:
+        case FSA_COMMAND_REMOVE:
+        case FSA_COMMAND_RENAME:
+        case FSA_COMMAND_WRITE_FILE:
+        case FSA_COMMAND_TRUNCATE_FILE:
+        case FSA_COMMAND_APPEND_FILE:
+        case FSA_COMMAND_CHANGE_MODE:
+            return true;
+        case FSA_COMMAND_OPEN_FILE: {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
+            auto *mode = shim->request.openFile.mode;
+#pragma GCC diagnostic pop
+            return strcmp(mode, "r") != 0 && strcmp(mode, "rb") != 0;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Reports a successful request to the boot trace of the layer that handled it.
+ */
+static void recordBootTrace(IFSWrapper *layer, FSAShimBuffer *shim, FSError result) {
+    if (result < FS_ERROR_OK) {
+        return;
+    }
+    auto trace = layer->getBootTrace();
+    if (!trace) {
+        return;
+    }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
+    switch ((FSACommandEnum) shim->command) {
+        case FSA_COMMAND_OPEN_FILE: {
+            auto *hackyBuffer = (uint32_t *) &shim->response;
+            auto *handlePtr   = (FSFileHandle *) hackyBuffer[1];
+            trace->recordOpen(*handlePtr, getFullPath((FSAClientHandle) shim->clientHandle, shim->request.openFile.path));
+            break;
+        }
+        case FSA_COMMAND_READ_FILE: {
+            auto *request = &shim->request.readFile;
+            if (request->readFlags == FSA_READ_FLAG_READ_WITH_POS) {
+                trace->recordSetPos(request->handle, request->pos);
+            }
+            trace->recordRead(request->handle, (uint32_t) result * request->size);
+            break;
+        }
+        case FSA_COMMAND_SET_POS_FILE:
+            trace->recordSetPos(shim->request.setPosFile.handle, shim->request.setPosFile.pos);
+            break;
+        case FSA_COMMAND_CLOSE_FILE:
+            trace->recordClose(shim->request.closeFile.handle);
+            break;
+        default:
+            break;
+    }
+#pragma GCC diagnostic pop
+    if (trace->isCutoffReached()) {
+        BootTrace::finish(trace);
+    }
+}
+
+static void learnFromOpen(IFSWrapper *layer, FSAShimBuffer *shim, FSError result) {
+    if (result < FS_ERROR_OK || (FSACommandEnum) shim->command != FSA_COMMAND_OPEN_FILE) {
+        return;
+    }
+    if (auto prefetcher = layer->getPrefetcher()) {
+        Prefetcher::onOpen(prefetcher, getFullPath((FSAClientHandle) shim->clientHandle, shim->request.openFile.path));
+    }
+}
+
+/**
+ * Returns the paths a modifying request targets. Writes through file handles have none, they are covered by
+ * the open that created the handle.
+ */
+static std::vector<std::string> getModifiedPaths(FSAShimBuffer *shim) {
+    std::vector<std::string> paths;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
+    switch ((FSACommandEnum) shim->command) {
+        case FSA_COMMAND_MAKE_DIR:
+            paths.push_back(getFullPath((FSAClientHandle) shim->clientHandle, shim->request.makeDir.path));
+            break;
+        case FSA_COMMAND_REMOVE:
+            paths.push_back(getFullPath((FSAClientHandle) shim->clientHandle, shim->request.remove.path));
+            break;
+        case FSA_COMMAND_RENAME:
+            paths.push_back(getFullPath((FSAClientHandle) shim->clientHandle, shim->request.rename.oldPath));
+            paths.push_back(getFullPath((FSAClientHandle) shim->clientHandle, shim->request.rename.newPath));
+            break;
+        case FSA_COMMAND_OPEN_FILE:
+            paths.push_back(getFullPath((FSAClientHandle) shim->clientHandle, shim->request.openFile.path));
+            break;
+        case FSA_COMMAND_CHANGE_MODE:
+            paths.push_back(getFullPath((FSAClientHandle) shim->clientHandle, shim->request.changeMode.path));
+            break;
+        default:
+            break;
+    }
+#pragma GCC diagnostic pop
+    return paths;
+}
+
+/**
+ * Bumps the generation of the layers from index on that redirect one of the modified paths, e.g. their merged
+ * listings include the modified directory through the parent layer. Must be called with fsLayerMutex held.
+ */
+static void bumpLayerGenerationsForPaths(uint32_t index, const std::vector<std::string> &paths) {
+    for (auto i = index; i < fsLayers.size(); i++) {
+        auto &layer = fsLayers[i];
+        if (std::ranges::any_of(paths, [&layer](auto &path) { return layer->isRedirectedPath(path); })) {
+            layer->bumpGeneration();
+        }
+    }
+}
+
+/**
+ * Returns the number of layers from the bottom that may handle a request of the client. Requests of the FSA
+ * client of a layer (see IFSWrapper::getLayerId) only go to the layers below it. 0 is no client.
+ */
+static uint32_t getStartIndex(uint32_t clientHandle) {
+    if (clientHandle != 0) {
         for (uint32_t i = fsLayers.size(); i > 0; i--) {
-            if ((uint32_t) fsLayers[i - 1]->getLayerId() == param->shim->clientHandle) {
-                startIndex = i - 1;
-                break;
+            if ((uint32_t) fsLayers[i - 1]->getLayerId() == clientHandle) {
+                return i - 1;
+            }
+        }
+    }
+    return fsLayers.size();
+}
+
+/**
+ * Returns false if the request has to be passed to the next layer, either because the layer doesn't
+ * redirect it or because it failed and the layer falls back on errors. Otherwise outResult is set to the
+ * result for the title.
+ */
+static bool isHandledByLayer(IFSWrapper *layer, FSError layerResult, FSError *outResult) {
+    if (layerResult == FS_ERROR_FORCE_PARENT_LAYER) {
+        return false;
+    }
+    auto maskedResult = (FSError) ((layerResult & FS_ERROR_REAL_MASK) | FS_ERROR_EXTRA_MASK);
+    auto result       = layerResult >= 0 ? layerResult : maskedResult;
+
+    if (result < FS_ERROR_OK && result != FS_ERROR_END_OF_FILE && result != FS_ERROR_END_OF_DIR && result != FS_ERROR_CANCELLED) {
+        if (layer->fallbackOnError()) {
+            // Only fallback if FS_ERROR_FORCE_NO_FALLBACK flag is not set.
+            if (static_cast<FSError>(layerResult & FS_ERROR_EXTRA_MASK) != FS_ERROR_FORCE_NO_FALLBACK) {
+                return false;
             }
         }
+    }
+    *outResult = result;
+    return true;
+}
+
+FSError doForLayer(FSShimWrapper *param) {
+    // Cached directory listings and prefetched data are tagged with the generation of their layer, it's only
+    // bumped once a modification that may affect the layer has been done.
+    bool isModifying = isModifyingCommand(param->shim);
 
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    if (!fsLayers.empty()) {
+        uint32_t startIndex = getStartIndex(param->shim->clientHandle);
         if (startIndex > 0) {
             for (uint32_t i = startIndex; i > 0; i--) {
                 auto &layer = fsLayers[i - 1];
                 if (!layer->isActive()) {
                     continue;
                 }
+                if (layer->applyPendingChanges()) {
+                    bumpLayerGenerations(i - 1);
+                }
                 auto layerResult = FS_ERROR_FORCE_PARENT_LAYER;
                 auto command     = (FSACommandEnum) param->shim->command;
 #pragma GCC diagnostic push
@@ -315,18 +482,14 @@ FSError doForLayer(FSShimWrapper *param) {
                     }
                 }
 #pragma GCC diagnostic pop
-                if (layerResult != FS_ERROR_FORCE_PARENT_LAYER) {
-                    auto maskedResult = (FSError) ((layerResult & FS_ERROR_REAL_MASK) | FS_ERROR_EXTRA_MASK);
-                    auto result       = layerResult >= 0 ? layerResult : maskedResult;
-
-                    if (result < FS_ERROR_OK && result != FS_ERROR_END_OF_FILE && result != FS_ERROR_END_OF_DIR && result != FS_ERROR_CANCELLED) {
-                        if (layer->fallbackOnError()) {
-                            // Only fallback if FS_ERROR_FORCE_NO_FALLBACK flag is not set.
-                            if (static_cast<FSError>(layerResult & FS_ERROR_EXTRA_MASK) != FS_ERROR_FORCE_NO_FALLBACK) {
-                                continue;
-                            }
-                        }
+                FSError result;
+                if (isHandledByLayer(layer.get(), layerResult, &result)) {
+                    if (isModifying) {
+                        layer->bumpGeneration();
+                        bumpLayerGenerationsForPaths(i, getModifiedPaths(param->shim));
                     }
+                    recordBootTrace(layer.get(), param->shim, result);
+                    learnFromOpen(layer.get(), param->shim, result);
                     if (param->sync == FS_SHIM_TYPE_SYNC) {
                         DEBUG_FUNCTION_LINE_VERBOSE("[%s] Return with result %08X %s", layer->getName().c_str(), result, result <= 0 ? FSAGetStatusStr(result) : "");
                         return result;
@@ -355,6 +518,34 @@ FSError doForLayer(FSShimWrapper *param) {
                 }
             }
         }
+        if (isModifying) {
+            bumpLayerGenerationsForPaths(0, getModifiedPaths(param->shim));
+        }
+    }
+    return FS_ERROR_FORCE_REAL_FUNCTION;
+}
+
+FSError callLayers(const std::function<FSError(IFSWrapper *)> &func, IFSWrapper **outLayer, uint32_t clientHandle) {
+    for (auto i = getStartIndex(clientHandle); i > 0; i--) {
+        auto &layer = fsLayers[i - 1];
+        if (!layer->isActive()) {
+            continue;
+        }
+        if (layer->applyPendingChanges()) {
+            bumpLayerGenerations(i - 1);
+        }
+        auto layerResult = func(layer.get());
+        if (layerResult == FS_ERROR_FORCE_REAL_FUNCTION) {
+            return FS_ERROR_FORCE_REAL_FUNCTION;
+        }
+        FSError result;
+        if (!isHandledByLayer(layer.get(), layerResult, &result)) {
+            continue;
+        }
+        if (outLayer) {
+            *outLayer = layer.get();
+        }
+        return result;
     }
     return FS_ERROR_FORCE_REAL_FUNCTION;
 }
@@ -90,8 +90,23 @@ bool sendMessageToThread(FSShimWrapperMessage *param);
 
 void clearFSLayer();
 
+/**
+ * Bumps the generation (see IFSWrapper::getGeneration) of fsLayers[index] and of all layers above it, e.g. after
+ * the layer at index has been removed or its content has changed. Must be called with fsLayerMutex held.
+ */
+void bumpLayerGenerations(uint32_t index);
+
 FSError doForLayer(FSShimWrapper *param);
 
+/**
+ * Calls func for the active layers from the top like doForLayer, until a layer handles the request. Layers
+ * fall back the same way, and requests of the FSA client of a layer only go to the layers below it (0 if the
+ * request doesn't come from a client, e.g. from the plugin API). Must be called with the fsLayerMutex held.
+ * Returns FS_ERROR_FORCE_REAL_FUNCTION if no layer handles the request, otherwise the result and the layer
+ * that handled it.
+ */
+FSError callLayers(const std::function<FSError(IFSWrapper *)> &func, IFSWrapper **outLayer = nullptr, uint32_t clientHandle = 0);
+
 FSError processShimBufferForFS(FSShimWrapper *param);
 
 FSError processShimBufferForFSA(FSShimWrapper *param);
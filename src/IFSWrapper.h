@@ -1,6 +1,9 @@
 #pragma once
+#include "export.h"
+#include <atomic>
 #include <coreinit/filesystem_fsa.h>
 #include <functional>
+#include <memory>
 #include <string>
 
 #define FS_ERROR_EXTRA_MASK          0xFFF00000
@@ -12,6 +15,14 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
+class LayerIndex;
+class BootTrace;
+class Prefetcher;
+class PackArchive;
+struct PackFile;
+struct StreamStats;
+struct CoalesceStats;
+
 class IFSWrapper {
 public:
     virtual ~IFSWrapper() = default;
@@ -132,10 +143,38 @@ public:
         return pIsActive;
     }
 
+    /**
+     * Called with the fsLayerMutex held before the layer handles a request. Layers that collect changes of
+     * their content (e.g. FSWrapperMemory) apply them here. Returns true if the content has changed.
+     */
+    virtual bool applyPendingChanges() {
+        return false;
+    }
+
+    /**
+     * Changes whenever what the layer returns may have changed, because the layer itself or a layer below it
+     * that redirects the same paths has been modified (see bumpLayerGenerations). Cached directory listings and
+     * prefetched data are tagged with it.
+     */
+    [[nodiscard]] uint32_t getGeneration() const {
+        return pGeneration.load();
+    }
+
+    virtual void bumpGeneration() {
+        pGeneration++;
+    }
+
     virtual void setActive(bool newValue) {
         pIsActive = newValue;
     }
 
+    /**
+     * Sets a layer specific option (see CRLayerOption). Returns false if the option is not supported by the layer.
+     */
+    virtual bool setOption(uint32_t option, uint32_t value) {
+        return false;
+    }
+
     [[nodiscard]] virtual std::string getName() const {
         return pName;
     }
@@ -150,12 +189,77 @@ public:
 
     virtual uint32_t getLayerId() = 0;
 
+    virtual std::shared_ptr<LayerIndex> getIndex() {
+        return nullptr;
+    }
+
+    /**
+     * Returns the trace that records the accesses to this layer (see CR_LAYER_OPTION_BOOT_TRACE), if any.
+     */
+    virtual std::shared_ptr<BootTrace> getBootTrace() {
+        return nullptr;
+    }
+
+    /**
+     * Returns the prefetcher of this layer (see CR_LAYER_OPTION_PREFETCH), if any.
+     */
+    virtual std::shared_ptr<Prefetcher> getPrefetcher() {
+        return nullptr;
+    }
+
+    /**
+     * Returns false if streaming (see CR_LAYER_OPTION_STREAMING) is not enabled for this layer.
+     */
+    virtual bool getStreamStats(StreamStats *outStats) {
+        return false;
+    }
+
+    /**
+     * Returns false if CR_LAYER_OPTION_COALESCE_READS is not enabled for this layer.
+     */
+    virtual bool getCoalesceStats(CoalesceStats *outStats) {
+        return false;
+    }
+
+    /**
+     * Queues warming up the cache with the file or directory (see CRPrefetch). Returns false if the layer
+     * doesn't have the path or doesn't cache it.
+     */
+    virtual bool warmUp(const std::string &path) {
+        return false;
+    }
+
+    /**
+     * Returns the archive that holds the file in memory if this layer serves it from memory (see CRMapFile),
+     * nullptr otherwise. The archive keeps the data of outFile alive.
+     */
+    virtual std::shared_ptr<PackArchive> mapFile(const char *path, const PackFile **outFile) {
+        return nullptr;
+    }
+
+    /**
+     * Returns true if the layer redirects the path. A modification of such a path through the real FS may
+     * change what the layer returns (e.g. the merged listing of a directory).
+     */
+    virtual bool isRedirectedPath(const std::string &path) {
+        return false;
+    }
+
+    /**
+     * Applies the hint to a file handle of this layer (see CRAdvise), called with the fsLayerMutex held. Reads
+     * of the SD card must be queued to a worker thread, returns false if that fails.
+     */
+    virtual bool advise(FSAFileHandle handle, CRFileAdvice advice) {
+        return true;
+    }
+
     virtual uint32_t getHandle() {
         return (uint32_t) this;
     }
 
 private:
     bool pIsActive = true;
+    std::atomic<uint32_t> pGeneration{0};
 
 protected:
     bool pFallbackOnError = false;
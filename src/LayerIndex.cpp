@@ -0,0 +1,523 @@
+#include "LayerIndex.h"
+#include "WorkerThreads.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/dirent.h>
+#include <sys/stat.h>
+
+void LayerIndexEntry::toStat(FSStat *stat) const {
+    memset(stat, 0, sizeof(FSStat));
+    stat->flags = static_cast<FSStatFlags>(0x1C000000); // These bits are always set
+    if (flags & LAYER_INDEX_ENTRY_FLAG_DIRECTORY) {
+        stat->flags = static_cast<FSStatFlags>(stat->flags | FS_STAT_DIRECTORY);
+    } else {
+        stat->flags     = static_cast<FSStatFlags>(stat->flags | FS_STAT_FILE);
+        stat->allocSize = size;
+        stat->quotaSize = size;
+    }
+    stat->mode     = mode;
+    stat->size     = size;
+    stat->created  = created;
+    stat->modified = modified;
+}
+
+LayerIndex::LayerIndex(std::string rootPath, bool retainMetadata) : pRootPath(std::move(rootPath)),
+                                                                    pRetainMetadata(retainMetadata) {
+    while (pRootPath.size() > 1 && pRootPath.back() == '/') {
+        pRootPath.pop_back();
+    }
+}
+
+bool LayerIndex::start(const std::shared_ptr<LayerIndex> &index) {
+    if (!index) {
+        return false;
+    }
+    if (index->pCachedEntries.empty() && index->loadCache(index->pRootPath + LAYER_INDEX_MANIFEST_SUFFIX)) {
+        DEBUG_FUNCTION_LINE_VERBOSE("Use manifest for %s", index->pRootPath.c_str());
+        auto entries = std::move(index->pCachedEntries);
+        return startWithEntries(index, std::move(entries));
+    }
+    index->pStartTime = OSGetTime();
+    index->pPendingDirectories++;
+    // A single read now saves walking the whole tree later.
+    bool hasCache = !index->pCachedEntries.empty() || index->loadCache(index->pRootPath + LAYER_INDEX_FILE_SUFFIX);
+    if (!queueWorkerTask([index, hasCache]() {
+            if (hasCache && index->validateCache()) {
+                index->publishCache();
+                index->finishDirectory();
+                return;
+            }
+            index->pCachedEntries.clear();
+            index->pWriteCache = true;
+            {
+                std::lock_guard<std::mutex> lock(index->pWorkMutex);
+                index->pWorkList.push_back({std::string(), 0});
+                index->pNumWorkers++;
+            }
+            processWorkList(index);
+        })) {
+        index->pPendingDirectories--;
+        return false;
+    }
+    return true;
+}
+
+bool LayerIndex::startWithEntries(const std::shared_ptr<LayerIndex> &index, std::vector<LayerIndexFileEntry> &&entries) {
+    if (!index) {
+        return false;
+    }
+    index->pStartTime = OSGetTime();
+    index->pPendingDirectories++;
+    index->pCachedEntries = std::move(entries);
+    index->publishCache();
+    index->finishDirectory();
+    return true;
+}
+
+LayerIndexLookupResult LayerIndex::lookup(std::string_view relativePath, LayerIndexEntry *outEntry) {
+    auto key = getKey(relativePath);
+
+    std::lock_guard<std::mutex> lock(pMutex);
+    if (pEntries.empty()) {
+        return LAYER_INDEX_LOOKUP_UNKNOWN;
+    }
+    if (auto it = pEntries.find(key); it != pEntries.end()) {
+        if (outEntry) {
+            *outEntry = it->second.entry;
+        }
+        return LAYER_INDEX_LOOKUP_FOUND;
+    }
+    // Find the closest ancestor that is part of the index. If it has been listed, the path doesn't exist.
+    std::string_view ancestor = key;
+    while (!ancestor.empty()) {
+        auto slash = ancestor.find_last_of('/');
+        ancestor   = slash == std::string_view::npos ? std::string_view() : ancestor.substr(0, slash);
+        if (auto it = pEntries.find(std::string(ancestor)); it != pEntries.end()) {
+            if (!(it->second.entry.flags & LAYER_INDEX_ENTRY_FLAG_DIRECTORY)) {
+                return LAYER_INDEX_LOOKUP_MISSING;
+            }
+            return (it->second.entry.flags & LAYER_INDEX_ENTRY_FLAG_LISTED) ? LAYER_INDEX_LOOKUP_MISSING : LAYER_INDEX_LOOKUP_UNKNOWN;
+        }
+    }
+    return LAYER_INDEX_LOOKUP_UNKNOWN;
+}
+
+std::shared_ptr<const LayerIndexListing> LayerIndex::getListing(std::string_view relativePath) {
+    if (!pRetainMetadata || getState() != LAYER_INDEX_STATE_COMPLETE) {
+        return nullptr;
+    }
+    auto key = getKey(relativePath);
+
+    std::lock_guard<std::mutex> lock(pMutex);
+    if (auto it = pListings.find(key); it != pListings.end()) {
+        return it->second;
+    }
+    return nullptr;
+}
+
+void LayerIndex::getStats(LayerIndexStats *outStats) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    outStats->state          = getState();
+    outStats->numEntries     = pNumEntries;
+    outStats->numDirectories = pNumDirectories;
+    outStats->memoryUsage    = pMemoryUsage;
+    outStats->buildTimeInUs  = pBuildTimeUs;
+}
+
+std::string LayerIndex::getKey(std::string_view relativePath) {
+    auto res = normalize_path_key(relativePath);
+    if (!res.empty() && res.front() == '/') {
+        res.erase(0, 1);
+    }
+    return res;
+}
+
+void LayerIndex::queueDirectory(const std::shared_ptr<LayerIndex> &index, const std::string &relativePath, uint32_t depth) {
+    index->pPendingDirectories++;
+    std::lock_guard<std::mutex> lock(index->pWorkMutex);
+    index->pWorkList.push_back({relativePath, depth});
+    // If the queues are full, the directory is indexed by one of the running tasks (e.g. the caller).
+    if (index->pNumWorkers < LAYER_INDEX_MAX_WORKERS && queueWorkerTask([index]() { processWorkList(index); })) {
+        index->pNumWorkers++;
+    }
+}
+
+void LayerIndex::processWorkList(const std::shared_ptr<LayerIndex> &index) {
+    while (true) {
+        PendingDirectory directory;
+        {
+            std::lock_guard<std::mutex> lock(index->pWorkMutex);
+            if (index->pWorkList.empty()) {
+                index->pNumWorkers--;
+                return;
+            }
+            directory = std::move(index->pWorkList.back());
+            index->pWorkList.pop_back();
+        }
+        index->indexDirectory(index, directory.relativePath, directory.depth);
+    }
+}
+
+void LayerIndex::indexDirectory(const std::shared_ptr<LayerIndex> &index, const std::string &relativePath, uint32_t depth) {
+    if (pCancelled.load(std::memory_order_relaxed) || pFailed.load(std::memory_order_relaxed)) {
+        finishDirectory();
+        return;
+    }
+    if (depth >= LAYER_INDEX_MAX_DEPTH) {
+        DEBUG_FUNCTION_LINE_WARN("Stop indexing %s/%s, too deep", pRootPath.c_str(), relativePath.c_str());
+        pFailed = true;
+        finishDirectory();
+        return;
+    }
+
+    auto path = relativePath.empty() ? pRootPath : pRootPath + "/" + relativePath;
+    std::vector<std::pair<std::string, Node>> children;
+    std::vector<std::string> subDirectories;
+
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        // A missing replacement directory is just empty.
+        if (!(relativePath.empty() && errno == ENOENT)) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to open %s for indexing. errno %d", path.c_str(), errno);
+            pFailed = true;
+            finishDirectory();
+            return;
+        }
+    } else {
+        struct dirent *entry;
+        while (true) {
+            errno = 0;
+            entry = readdir(dir);
+            if (entry == nullptr) {
+                if (errno != 0) {
+                    DEBUG_FUNCTION_LINE_ERR("Failed to read %s for indexing. errno %d", path.c_str(), errno);
+                    pFailed = true;
+                }
+                break;
+            }
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            auto childRelativePath = relativePath.empty() ? std::string(entry->d_name) : relativePath + "/" + entry->d_name;
+
+            FSStat fsStat;
+#ifdef _DIRENT_HAVE_D_STAT
+            translate_stat(&entry->d_stat, &fsStat);
+#else
+            struct stat sb {};
+            auto childPath = path + "/" + entry->d_name;
+            if (stat(childPath.c_str(), &sb) < 0) {
+                DEBUG_FUNCTION_LINE_ERR("Failed to stat %s for indexing", childPath.c_str());
+                pFailed = true;
+                break;
+            }
+            translate_stat(&sb, &fsStat);
+#endif
+            LayerIndexEntry indexEntry{};
+            indexEntry.flags    = (entry->d_type == DT_DIR || (fsStat.flags & FS_STAT_DIRECTORY)) ? LAYER_INDEX_ENTRY_FLAG_DIRECTORY : 0;
+            indexEntry.mode     = fsStat.mode;
+            indexEntry.size     = fsStat.size;
+            indexEntry.created  = fsStat.created;
+            indexEntry.modified = fsStat.modified;
+            if (indexEntry.flags & LAYER_INDEX_ENTRY_FLAG_DIRECTORY) {
+                subDirectories.push_back(childRelativePath);
+            }
+            children.emplace_back(getKey(childRelativePath), Node{indexEntry, entry->d_name});
+        }
+        closedir(dir);
+    }
+
+    if (pFailed.load(std::memory_order_relaxed)) {
+        finishDirectory();
+        return;
+    }
+
+    {
+        // Publish the directory with all its children at once.
+        std::lock_guard<std::mutex> lock(pMutex);
+        for (auto &[key, node] : children) {
+            pMemoryUsage += key.capacity() + node.name.capacity() + sizeof(Node) + 0x10;
+            pEntries.insert_or_assign(std::move(key), std::move(node));
+        }
+        auto &self = pEntries[getKey(relativePath)];
+        self.entry.flags |= LAYER_INDEX_ENTRY_FLAG_DIRECTORY | LAYER_INDEX_ENTRY_FLAG_LISTED;
+        pNumEntries += children.size();
+        pNumDirectories++;
+    }
+
+    for (auto &subDirectory : subDirectories) {
+        queueDirectory(index, subDirectory, depth + 1);
+    }
+
+    finishDirectory();
+}
+
+bool LayerIndex::loadCache(const std::string &cachePath) {
+    FILE *f = fopen(cachePath.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    bool result = false;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        auto size = ftell(f);
+        if (size > 0 && size <= LAYER_INDEX_FILE_MAX_SIZE && fseek(f, 0, SEEK_SET) == 0) {
+            std::vector<uint8_t> data(size);
+            if (fread(data.data(), 1, size, f) == (size_t) size) {
+                result = LayerIndexFormat::parse(data.data(), size, &pCachedRootModified, pCachedEntries);
+            }
+        }
+    }
+    fclose(f);
+    if (!result) {
+        DEBUG_FUNCTION_LINE_WARN("Ignore invalid index %s", cachePath.c_str());
+        pCachedEntries.clear();
+    }
+    return result;
+}
+
+bool LayerIndex::validateCache() {
+    uint64_t modified;
+    uint32_t numChildren;
+    if (!getDirectoryInfo(pRootPath, &modified, &numChildren) || modified != pCachedRootModified) {
+        DEBUG_FUNCTION_LINE_VERBOSE("Index of %s is outdated", pRootPath.c_str());
+        return false;
+    }
+    for (auto &entry : pCachedEntries) {
+        if (pCancelled.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        auto path = entry.path.empty() ? pRootPath : pRootPath + "/" + entry.path;
+        if (!(entry.flags & LAYER_INDEX_ENTRY_FLAG_DIRECTORY)) {
+            // Overwriting a file doesn't change its directory on FAT, but stat and readdir are answered from
+            // the index if the metadata is retained.
+            if (pRetainMetadata) {
+                struct stat sb {};
+                FSStat fsStat{};
+                if (stat(path.c_str(), &sb) < 0) {
+                    DEBUG_FUNCTION_LINE_VERBOSE("Index of %s is outdated (%s is missing)", pRootPath.c_str(), path.c_str());
+                    return false;
+                }
+                translate_stat(&sb, &fsStat);
+                if (fsStat.size != entry.size || fsStat.modified != entry.modified) {
+                    DEBUG_FUNCTION_LINE_VERBOSE("Index of %s is outdated (%s changed)", pRootPath.c_str(), path.c_str());
+                    return false;
+                }
+            }
+            continue;
+        }
+        if (!getDirectoryInfo(path, &modified, &numChildren) ||
+            (!entry.path.empty() && modified != entry.modified) ||
+            numChildren != entry.numChildren) {
+            DEBUG_FUNCTION_LINE_VERBOSE("Index of %s is outdated (%s changed)", pRootPath.c_str(), path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void LayerIndex::publishCache() {
+    std::lock_guard<std::mutex> lock(pMutex);
+    for (auto &cached : pCachedEntries) {
+        LayerIndexEntry entry{};
+        entry.flags    = cached.flags & LAYER_INDEX_ENTRY_FLAG_DIRECTORY;
+        entry.mode     = (FSMode) cached.mode;
+        entry.size     = cached.size;
+        entry.created  = cached.created;
+        entry.modified = cached.modified;
+        if (entry.flags & LAYER_INDEX_ENTRY_FLAG_DIRECTORY) {
+            entry.flags |= LAYER_INDEX_ENTRY_FLAG_LISTED;
+            pNumDirectories++;
+        }
+        if (!cached.path.empty()) {
+            pNumEntries++;
+        }
+        auto slash = cached.path.find_last_of('/');
+        Node node{entry, cached.path.substr(slash == std::string::npos ? 0 : slash + 1)};
+        auto key   = getKey(cached.path);
+        pMemoryUsage += key.capacity() + node.name.capacity() + sizeof(Node) + 0x10;
+        pEntries.insert_or_assign(std::move(key), std::move(node));
+    }
+    std::vector<LayerIndexFileEntry>().swap(pCachedEntries);
+}
+
+void LayerIndex::writeCache() {
+    uint64_t rootModified;
+    uint32_t rootNumChildren;
+    if (!getDirectoryInfo(pRootPath, &rootModified, &rootNumChildren)) {
+        return;
+    }
+
+    std::vector<LayerIndexFileEntry> entries;
+    {
+        std::lock_guard<std::mutex> lock(pMutex);
+        entries.reserve(pEntries.size());
+        std::unordered_map<std::string_view, uint32_t> numChildren;
+        for (auto &[key, node] : pEntries) {
+            if (key.empty()) {
+                continue;
+            }
+            auto slash = key.find_last_of('/');
+            numChildren[slash == std::string::npos ? std::string_view() : std::string_view(key).substr(0, slash)]++;
+        }
+        for (auto &[key, node] : pEntries) {
+            auto it = numChildren.find(key);
+            entries.push_back({getOriginalPath(key),
+                               (uint8_t) (node.entry.flags & LAYER_INDEX_ENTRY_FLAG_DIRECTORY),
+                               node.entry.mode,
+                               node.entry.size,
+                               it != numChildren.end() ? it->second : 0,
+                               node.entry.created,
+                               node.entry.modified});
+        }
+    }
+
+    auto data      = LayerIndexFormat::serialize(entries, rootModified);
+    auto cachePath = pRootPath + LAYER_INDEX_FILE_SUFFIX;
+    auto tmpPath   = cachePath + ".tmp";
+    FILE *f        = fopen(tmpPath.c_str(), "wb");
+    if (f == nullptr) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to create %s", tmpPath.c_str());
+        return;
+    }
+    bool success = fwrite(data.data(), 1, data.size(), f) == data.size();
+    success      = fclose(f) == 0 && success;
+    if (success) {
+        // rename doesn't replace an existing file, the old one is only removed once the new one is complete.
+        remove(cachePath.c_str());
+        success = rename(tmpPath.c_str(), cachePath.c_str()) == 0;
+    }
+    if (!success) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to write %s", cachePath.c_str());
+        remove(tmpPath.c_str());
+        return;
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("Wrote %s (%d bytes)", cachePath.c_str(), data.size());
+}
+
+bool LayerIndex::getDirectoryInfo(const std::string &path, uint64_t *outModified, uint32_t *outNumChildren) {
+    struct stat sb {};
+    if (stat(path.c_str(), &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        return false;
+    }
+    FSStat fsStat;
+    translate_stat(&sb, &fsStat);
+    *outModified = fsStat.modified;
+
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+    uint32_t numChildren = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            numChildren++;
+        }
+    }
+    closedir(dir);
+    *outNumChildren = numChildren;
+    return true;
+}
+
+std::string LayerIndex::getOriginalPath(const std::string &key) {
+    // pMutex has to be held.
+    std::string res;
+    for (size_t pos = 0; pos != std::string::npos && !key.empty();) {
+        auto slash = key.find('/', pos);
+        auto it    = pEntries.find(slash == std::string::npos ? key : key.substr(0, slash));
+        if (it == pEntries.end()) {
+            return key;
+        }
+        if (!res.empty()) {
+            res += '/';
+        }
+        res += it->second.name;
+        pos = slash == std::string::npos ? slash : slash + 1;
+    }
+    return res;
+}
+
+void LayerIndex::buildListings() {
+    // pMutex has to be held.
+    std::unordered_map<std::string_view, std::shared_ptr<LayerIndexListing>> listings;
+    for (auto &[key, node] : pEntries) {
+        if (node.entry.flags & LAYER_INDEX_ENTRY_FLAG_LISTED) {
+            auto listing = make_shared_nothrow<LayerIndexListing>();
+            if (!listing) {
+                DEBUG_FUNCTION_LINE_ERR("Failed to allocate listing for %s", key.c_str());
+                return;
+            }
+            listings[key] = std::move(listing);
+        }
+    }
+    for (auto &[key, node] : pEntries) {
+        if (key.empty()) {
+            continue;
+        }
+        auto slash = key.find_last_of('/');
+        auto it    = listings.find(slash == std::string::npos ? std::string_view() : std::string_view(key).substr(0, slash));
+        if (it != listings.end()) {
+            it->second->entries.push_back({node.name, node.entry});
+            pMemoryUsage += node.name.capacity() + sizeof(LayerIndexListingEntry);
+        }
+    }
+    for (auto &[key, listing] : listings) {
+        pMemoryUsage += key.size() + sizeof(LayerIndexListing) + 0x10;
+        pListings.emplace(key, std::move(listing));
+    }
+}
+
+void LayerIndex::finishDirectory() {
+    if (--pPendingDirectories == 0) {
+        finish();
+    }
+}
+
+void LayerIndex::finish() {
+    if (pCancelled.load(std::memory_order_relaxed)) {
+        pState.store(LAYER_INDEX_STATE_CANCELLED, std::memory_order_release);
+        return;
+    }
+    if (pFailed.load(std::memory_order_relaxed)) {
+        // The directories that have been listed can still be used.
+        DEBUG_FUNCTION_LINE_WARN("Failed to index %s", pRootPath.c_str());
+        pState.store(LAYER_INDEX_STATE_FAILED, std::memory_order_release);
+        return;
+    }
+
+    std::vector<std::string> paths;
+    {
+        std::lock_guard<std::mutex> lock(pMutex);
+        pBuildTimeUs = OSTicksToMicroseconds(OSGetTime() - pStartTime);
+        paths.reserve(pEntries.size());
+        for (auto &[key, node] : pEntries) {
+            paths.push_back(key);
+        }
+    }
+
+    if (pCompletionHandler) {
+        pCompletionHandler(paths);
+    }
+
+    if (pWriteCache) {
+        writeCache();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pMutex);
+        if (!pRetainMetadata) {
+            // Only the compact structures of the completion handler are needed from now on.
+            std::unordered_map<std::string, Node>().swap(pEntries);
+            pMemoryUsage = 0;
+        } else {
+            buildListings();
+        }
+    }
+    pState.store(LAYER_INDEX_STATE_COMPLETE, std::memory_order_release);
+
+    DEBUG_FUNCTION_LINE_VERBOSE("Indexed %s: %d entries, %d directories in %lld us", pRootPath.c_str(), pNumEntries, pNumDirectories, pBuildTimeUs);
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include "LayerIndexFormat.h"
+#include <atomic>
+#include <coreinit/filesystem.h>
+#include <coreinit/time.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define LAYER_INDEX_MAX_DEPTH           32
+// Number of worker tasks that list directories of the same index at most, one per core.
+#define LAYER_INDEX_MAX_WORKERS         3
+
+#define LAYER_INDEX_ENTRY_FLAG_DIRECTORY 0x01
+// Set for directories whose children are all part of the index.
+#define LAYER_INDEX_ENTRY_FLAG_LISTED    0x02
+
+typedef enum LayerIndexState {
+    LAYER_INDEX_STATE_BUILDING  = 0,
+    LAYER_INDEX_STATE_COMPLETE  = 1,
+    LAYER_INDEX_STATE_FAILED    = 2,
+    LAYER_INDEX_STATE_CANCELLED = 3,
+} LayerIndexState;
+
+typedef enum LayerIndexLookupResult {
+    // The directory that would contain the path has not been indexed (yet).
+    LAYER_INDEX_LOOKUP_UNKNOWN = 0,
+    LAYER_INDEX_LOOKUP_MISSING = 1,
+    LAYER_INDEX_LOOKUP_FOUND   = 2,
+} LayerIndexLookupResult;
+
+struct LayerIndexEntry {
+    uint32_t flags;
+    FSMode mode;
+    uint32_t size;
+    FSTime created;
+    FSTime modified;
+
+    void toStat(FSStat *stat) const;
+};
+
+struct LayerIndexListingEntry {
+    // Name in its original case.
+    std::string name;
+    LayerIndexEntry entry;
+};
+
+struct LayerIndexListing {
+    std::vector<LayerIndexListingEntry> entries;
+};
+
+struct LayerIndexStats {
+    LayerIndexState state;
+    uint32_t numEntries;
+    uint32_t numDirectories;
+    uint32_t memoryUsage;
+    uint64_t buildTimeInUs;
+};
+
+/**
+ * Index of all files and directories of a replacement directory, keyed by the normalized relative path.
+ *
+ * The directories are listed by up to LAYER_INDEX_MAX_WORKERS tasks on the worker threads, which take the
+ * directories from a work list of the index. This keeps the queues of the workers free for other tasks
+ * while a large tree is indexed. Each directory is published as soon as it has been listed completely.
+ * Lookups return LAYER_INDEX_LOOKUP_UNKNOWN for paths in directories that have not been listed yet, the
+ * caller has to check the disk in that case.
+ *
+ * Once the index is complete, the completion handler is called with all paths of the index. If the
+ * metadata is not retained, the index drops its entries afterwards and only the compact structures
+ * built by the handler (e.g. the ExistenceFilter) remain. If it is retained, the listings of all
+ * directories are built as well, so stat and readdir can be answered without touching the disk.
+ *
+ * A completed index is stored next to the replacement directory ("<replacement dir>.cr_index") and
+ * loaded with a single read when the layer is created again. Before it's used, it is validated in the
+ * background by comparing the modification time and number of entries of each directory, and the size and
+ * modification time of each file if the metadata is retained. If that fails, the directories are indexed
+ * again.
+ *
+ * A manifest created by the host tool ("<replacement dir>.cr_manifest") is used as is, without
+ * scanning or validating anything.
+ */
+class LayerIndex {
+public:
+    typedef std::function<void(const std::vector<std::string> &paths)> CompletionHandler;
+
+    LayerIndex(std::string rootPath, bool retainMetadata);
+
+    void setCompletionHandler(CompletionHandler &&handler) {
+        pCompletionHandler = std::move(handler);
+    }
+
+    /**
+     * Queues the indexing of the root directory.
+     */
+    static bool start(const std::shared_ptr<LayerIndex> &index);
+
+    /**
+     * Publishes the given entries (e.g. the directory of a pack) and completes the index synchronously.
+     */
+    static bool startWithEntries(const std::shared_ptr<LayerIndex> &index, std::vector<LayerIndexFileEntry> &&entries);
+
+    void cancel() {
+        pCancelled.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] LayerIndexState getState() const {
+        return (LayerIndexState) pState.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] bool retainsMetadata() const {
+        return pRetainMetadata;
+    }
+
+    LayerIndexLookupResult lookup(std::string_view relativePath, LayerIndexEntry *outEntry = nullptr);
+
+    /**
+     * Returns nullptr if the metadata is not retained or the index is not complete yet.
+     */
+    std::shared_ptr<const LayerIndexListing> getListing(std::string_view relativePath);
+
+    void getStats(LayerIndexStats *outStats);
+
+    static std::string getKey(std::string_view relativePath);
+
+private:
+    /**
+     * Adds the directory to the work list and queues another task for it if less than
+     * LAYER_INDEX_MAX_WORKERS are running. Must only be called by a task that processes the work list.
+     */
+    static void queueDirectory(const std::shared_ptr<LayerIndex> &index, const std::string &relativePath, uint32_t depth);
+
+    /**
+     * Indexes the directories of the work list until it's empty.
+     */
+    static void processWorkList(const std::shared_ptr<LayerIndex> &index);
+
+    void indexDirectory(const std::shared_ptr<LayerIndex> &index, const std::string &relativePath, uint32_t depth);
+
+    void finishDirectory();
+
+    bool loadCache(const std::string &path);
+
+    bool validateCache();
+
+    void publishCache();
+
+    void writeCache();
+
+    static bool getDirectoryInfo(const std::string &path, uint64_t *outModified, uint32_t *outNumChildren);
+
+    std::string getOriginalPath(const std::string &key);
+
+    void buildListings();
+
+    void finish();
+
+    struct PendingDirectory {
+        std::string relativePath;
+        uint32_t depth;
+    };
+
+    struct Node {
+        LayerIndexEntry entry;
+        // Last path component in its original case.
+        std::string name;
+    };
+
+    std::string pRootPath;
+    bool pRetainMetadata;
+    CompletionHandler pCompletionHandler;
+
+    std::vector<LayerIndexFileEntry> pCachedEntries;
+    uint64_t pCachedRootModified = 0;
+    bool pWriteCache             = false;
+
+    std::mutex pMutex;
+    std::unordered_map<std::string, Node> pEntries;
+    std::unordered_map<std::string, std::shared_ptr<const LayerIndexListing>> pListings;
+    uint32_t pNumEntries     = 0;
+    uint32_t pNumDirectories = 0;
+    uint32_t pMemoryUsage    = 0;
+
+    std::mutex pWorkMutex;
+    std::vector<PendingDirectory> pWorkList;
+    // Number of tasks that process the work list.
+    uint32_t pNumWorkers = 0;
+
+    // Directories that are in the work list or are being indexed.
+    std::atomic<uint32_t> pPendingDirectories{0};
+    std::atomic<uint32_t> pState{LAYER_INDEX_STATE_BUILDING};
+    std::atomic<bool> pFailed{false};
+    std::atomic<bool> pCancelled{false};
+    OSTime pStartTime     = 0;
+    uint64_t pBuildTimeUs = 0;
+};
@@ -0,0 +1,158 @@
+#pragma once
+/**
+ * On-disk format of the persistent layer index ("<replacement dir>.cr_index") and of the manifests created
+ * by the host tool ("<replacement dir>.cr_manifest").
+ *
+ * This header has no dependencies on wut, so it can be used by host tools as well. All values are
+ * stored big-endian.
+ *
+ *   header
+ *   entries[numEntries]
+ *   string table (relative paths in their original case, not null terminated)
+ *
+ * The paths keep their case so listings can be served from the index, LayerIndex::getKey is applied
+ * when the file is loaded.
+ */
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define LAYER_INDEX_FILE_SUFFIX      ".cr_index"
+#define LAYER_INDEX_MANIFEST_SUFFIX  ".cr_manifest"
+#define LAYER_INDEX_FILE_MAGIC       0x43524958 // "CRIX"
+#define LAYER_INDEX_FILE_VERSION     2
+#define LAYER_INDEX_FILE_HEADER_SIZE 28
+#define LAYER_INDEX_FILE_ENTRY_SIZE  36
+#define LAYER_INDEX_FILE_MAX_SIZE    (16 * 1024 * 1024)
+
+// Same values as LAYER_INDEX_ENTRY_FLAG_*
+#define LAYER_INDEX_FILE_FLAG_DIRECTORY 0x01
+
+struct LayerIndexFileEntry {
+    std::string path;
+    uint8_t flags;
+    uint32_t mode;
+    uint32_t size;
+    // Only valid for directories.
+    uint32_t numChildren;
+    uint64_t created;
+    uint64_t modified;
+};
+
+namespace LayerIndexFormat {
+    static inline void putBE16(std::vector<uint8_t> &out, uint16_t val) {
+        out.push_back(val >> 8);
+        out.push_back(val);
+    }
+
+    static inline void putBE32(std::vector<uint8_t> &out, uint32_t val) {
+        putBE16(out, val >> 16);
+        putBE16(out, val);
+    }
+
+    static inline void putBE64(std::vector<uint8_t> &out, uint64_t val) {
+        putBE32(out, val >> 32);
+        putBE32(out, val);
+    }
+
+    static inline uint16_t getBE16(const uint8_t *in) {
+        return (uint16_t) ((in[0] << 8) | in[1]);
+    }
+
+    static inline uint32_t getBE32(const uint8_t *in) {
+        return ((uint32_t) getBE16(in) << 16) | getBE16(in + 2);
+    }
+
+    static inline uint64_t getBE64(const uint8_t *in) {
+        return ((uint64_t) getBE32(in) << 32) | getBE32(in + 4);
+    }
+
+    /**
+     * 32-bit FNV-1a. Pass the checksum of the previous part to continue it, e.g. for files that are read in chunks.
+     */
+    static inline uint32_t checksum(const uint8_t *data, uint32_t size, uint32_t hash = 0x811C9DC5) {
+        for (uint32_t i = 0; i < size; i++) {
+            hash ^= data[i];
+            hash *= 0x01000193;
+        }
+        return hash;
+    }
+
+    static inline std::vector<uint8_t> serialize(const std::vector<LayerIndexFileEntry> &entries, uint64_t rootModified) {
+        std::vector<uint8_t> body;
+        std::string strings;
+        body.reserve(entries.size() * LAYER_INDEX_FILE_ENTRY_SIZE);
+        for (auto &entry : entries) {
+            putBE32(body, strings.size());
+            putBE16(body, entry.path.size());
+            body.push_back(entry.flags);
+            body.push_back(0);
+            putBE32(body, entry.mode);
+            putBE32(body, entry.size);
+            putBE32(body, entry.numChildren);
+            putBE64(body, entry.created);
+            putBE64(body, entry.modified);
+            strings += entry.path;
+        }
+        body.insert(body.end(), strings.begin(), strings.end());
+
+        std::vector<uint8_t> out;
+        out.reserve(LAYER_INDEX_FILE_HEADER_SIZE + body.size());
+        putBE32(out, LAYER_INDEX_FILE_MAGIC);
+        putBE16(out, LAYER_INDEX_FILE_VERSION);
+        putBE16(out, LAYER_INDEX_FILE_HEADER_SIZE);
+        putBE32(out, entries.size());
+        putBE32(out, strings.size());
+        putBE64(out, rootModified);
+        putBE32(out, checksum(body.data(), body.size()));
+        out.insert(out.end(), body.begin(), body.end());
+        return out;
+    }
+
+    /**
+     * Returns false if the data is not a valid index of this version.
+     */
+    static inline bool parse(const uint8_t *data, uint32_t size, uint64_t *outRootModified, std::vector<LayerIndexFileEntry> &outEntries) {
+        if (size < LAYER_INDEX_FILE_HEADER_SIZE ||
+            getBE32(data) != LAYER_INDEX_FILE_MAGIC ||
+            getBE16(data + 4) != LAYER_INDEX_FILE_VERSION ||
+            getBE16(data + 6) != LAYER_INDEX_FILE_HEADER_SIZE) {
+            return false;
+        }
+        uint32_t numEntries      = getBE32(data + 8);
+        uint32_t stringTableSize = getBE32(data + 12);
+        uint64_t bodySize        = (uint64_t) numEntries * LAYER_INDEX_FILE_ENTRY_SIZE + stringTableSize;
+        if (bodySize != size - LAYER_INDEX_FILE_HEADER_SIZE) {
+            return false;
+        }
+        const uint8_t *body = data + LAYER_INDEX_FILE_HEADER_SIZE;
+        if (checksum(body, bodySize) != getBE32(data + 24)) {
+            return false;
+        }
+        auto *strings = reinterpret_cast<const char *>(body + numEntries * LAYER_INDEX_FILE_ENTRY_SIZE);
+
+        outEntries.clear();
+        outEntries.reserve(numEntries);
+        for (uint32_t i = 0; i < numEntries; i++) {
+            const uint8_t *cur  = body + i * LAYER_INDEX_FILE_ENTRY_SIZE;
+            uint32_t nameOffset = getBE32(cur);
+            uint16_t nameLength = getBE16(cur + 4);
+            if ((uint64_t) nameOffset + nameLength > stringTableSize) {
+                return false;
+            }
+            LayerIndexFileEntry entry;
+            entry.path.assign(strings + nameOffset, nameLength);
+            entry.flags       = cur[6];
+            entry.mode        = getBE32(cur + 8);
+            entry.size        = getBE32(cur + 12);
+            entry.numChildren = getBE32(cur + 16);
+            entry.created     = getBE64(cur + 20);
+            entry.modified    = getBE64(cur + 28);
+            outEntries.push_back(std::move(entry));
+        }
+        *outRootModified = getBE64(data + 16);
+        return true;
+    }
+} // namespace LayerIndexFormat
@@ -0,0 +1,68 @@
+#include "MergedDirCache.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+bool MergedDirSnapshot::addEntry(const FSADirectoryEntry *entry) {
+    auto nameLength = strnlen(entry->name, sizeof(entry->name) - 1);
+    if (getSize() + sizeof(Entry) + nameLength + 1 > MERGED_DIR_CACHE_MAX_SNAPSHOT_SIZE) {
+        return false;
+    }
+    entries.push_back({entry->info, names.size()});
+    names.append(entry->name, nameLength);
+    names.push_back('\0');
+    return true;
+}
+
+void MergedDirSnapshot::getEntry(uint32_t index, FSADirectoryEntry *outEntry) const {
+    auto &entry       = entries[index];
+    outEntry->info    = entry.info;
+    outEntry->name[0] = '\0';
+    strncat(outEntry->name, names.c_str() + entry.nameOffset, sizeof(outEntry->name) - 1);
+}
+
+std::shared_ptr<const MergedDirSnapshot> MergedDirCache::get(const std::string &key, uint32_t generation) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    for (auto it = pSnapshots.begin(); it != pSnapshots.end(); ++it) {
+        if ((*it)->key != key) {
+            continue;
+        }
+        if ((*it)->generation != generation) {
+            DEBUG_FUNCTION_LINE_VERBOSE("Drop outdated snapshot for %s", key.c_str());
+            pSize -= (*it)->getSize();
+            pSnapshots.erase(it);
+            return nullptr;
+        }
+        auto res = *it;
+        pSnapshots.erase(it);
+        pSnapshots.push_back(res);
+        return res;
+    }
+    return nullptr;
+}
+
+void MergedDirCache::put(std::shared_ptr<const MergedDirSnapshot> snapshot) {
+    if (!snapshot) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pMutex);
+    auto it = std::find_if(pSnapshots.begin(), pSnapshots.end(), [&snapshot](auto &cur) { return cur->key == snapshot->key; });
+    if (it != pSnapshots.end()) {
+        pSize -= (*it)->getSize();
+        pSnapshots.erase(it);
+    }
+    pSize += snapshot->getSize();
+    pSnapshots.push_back(std::move(snapshot));
+
+    // Evict the least recently used snapshots
+    while (!pSnapshots.empty() && (pSnapshots.size() > MERGED_DIR_CACHE_MAX_ENTRIES || pSize > MERGED_DIR_CACHE_MAX_BYTES)) {
+        pSize -= pSnapshots.front()->getSize();
+        pSnapshots.erase(pSnapshots.begin());
+    }
+}
+
+std::string MergedDirCache::getKey(std::string_view path) {
+    return normalize_path_key(path);
+}
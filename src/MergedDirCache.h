@@ -0,0 +1,58 @@
+#pragma once
+#include <coreinit/filesystem_fsa.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define MERGED_DIR_CACHE_MAX_ENTRIES       16
+#define MERGED_DIR_CACHE_MAX_BYTES         (256 * 1024)
+#define MERGED_DIR_CACHE_MAX_SNAPSHOT_SIZE (MERGED_DIR_CACHE_MAX_BYTES / 4)
+
+/**
+ * Fully merged listing of a directory as it has been returned to the caller.
+ * Entries that have been hidden by delete markers are not part of the snapshot.
+ */
+struct MergedDirSnapshot {
+    struct Entry {
+        FSAStat info;
+        uint32_t nameOffset;
+    };
+
+    std::string key;
+    uint32_t generation = 0;
+    std::vector<Entry> entries;
+    std::string names;
+
+    /**
+     * Returns false if the snapshot would grow bigger than MERGED_DIR_CACHE_MAX_SNAPSHOT_SIZE.
+     */
+    bool addEntry(const FSADirectoryEntry *entry);
+
+    void getEntry(uint32_t index, FSADirectoryEntry *outEntry) const;
+
+    [[nodiscard]] uint32_t getSize() const {
+        return sizeof(MergedDirSnapshot) + key.capacity() + entries.capacity() * sizeof(Entry) + names.capacity();
+    }
+};
+
+/**
+ * Bounded LRU cache of merged directory listings, keyed by the (normalized) path that has been opened.
+ * Snapshots are tagged with the generation of the layer they have been created with and are
+ * discarded once the generation changes.
+ */
+class MergedDirCache {
+public:
+    std::shared_ptr<const MergedDirSnapshot> get(const std::string &key, uint32_t generation);
+
+    void put(std::shared_ptr<const MergedDirSnapshot> snapshot);
+
+    static std::string getKey(std::string_view path);
+
+private:
+    std::mutex pMutex;
+    // Most recently used entry is at the end.
+    std::vector<std::shared_ptr<const MergedDirSnapshot>> pSnapshots;
+    uint32_t pSize = 0;
+};
@@ -0,0 +1,614 @@
+#include "PackArchive.h"
+#include "FileUtils.h"
+#include "WorkerThreads.h"
+#include "utils/LZ4Block.h"
+#include "utils/StatTranslation.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <functional>
+#include <malloc.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+PackArchive::PackArchive(std::string path) : pPath(std::move(path)) {
+}
+
+PackArchive::~PackArchive() {
+    if (pFd >= 0) {
+        close(pFd);
+    }
+    for (auto &cached : pChunkCache) {
+        free(cached.data);
+    }
+    free(pReadAheadBuffer);
+    free(pMemory);
+}
+
+std::shared_ptr<PackArchive> PackArchive::open(const std::string &path) {
+    auto archive = make_shared_nothrow<PackArchive>(path);
+    if (!archive) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate PackArchive");
+        return nullptr;
+    }
+    if (!archive->load()) {
+        return nullptr;
+    }
+    return archive;
+}
+
+std::shared_ptr<PackArchive> PackArchive::loadDirectory(const std::string &path, uint32_t maxSize) {
+    auto archive = make_shared_nothrow<PackArchive>(path);
+    if (!archive) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate PackArchive");
+        return nullptr;
+    }
+    if (!archive->loadFromDirectory(maxSize)) {
+        return nullptr;
+    }
+    return archive;
+}
+
+std::shared_ptr<PackArchive> PackArchive::fromMemoryFiles(const std::string &path, std::vector<std::shared_ptr<MemoryFile>> files) {
+    auto archive = make_shared_nothrow<PackArchive>(path);
+    if (!archive) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate PackArchive");
+        return nullptr;
+    }
+    if (!archive->loadMemoryFiles(std::move(files))) {
+        return nullptr;
+    }
+    return archive;
+}
+
+const PackFile *PackArchive::find(std::string_view relativePath) const {
+    auto key  = LayerIndex::getKey(relativePath);
+    auto hash = hash_string(key);
+    auto it   = std::lower_bound(pFiles.begin(), pFiles.end(), hash, [](const PackFile &file, uint32_t value) { return file.hash < value; });
+    for (; it != pFiles.end() && it->hash == hash; ++it) {
+        if (key == it->key) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<std::string> PackArchive::getFilePaths() const {
+    std::vector<std::string> res;
+    res.reserve(pFiles.size());
+    for (auto &file : pFiles) {
+        res.emplace_back(file.key);
+    }
+    return res;
+}
+
+int64_t PackArchive::read(const PackFile *file, uint32_t pos, void *buffer, uint32_t size, bool useReadAhead) {
+    if (pos >= file->size) {
+        return 0;
+    }
+    size = std::min(size, file->size - pos);
+
+    if (file->data != nullptr) {
+        memcpy(buffer, file->data + pos, size);
+        return size;
+    }
+
+    std::lock_guard<std::mutex> lock(pReadMutex);
+    if (file->flags & PACK_LOCATION_FLAG_LZ4_CHUNKS) {
+        return readChunks(file, pos, static_cast<uint8_t *>(buffer), size);
+    }
+    if (useReadAhead && size < pReadAheadSize) {
+        if (!readBuffered(file->offset + pos, buffer, size)) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to read %u bytes at %llu from %s", size, file->offset + pos, pPath.c_str());
+            return -1;
+        }
+        return size;
+    }
+    if (!readAt(file->offset + pos, buffer, size)) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to read %u bytes at %llu from %s", size, file->offset + pos, pPath.c_str());
+        return -1;
+    }
+    return size;
+}
+
+bool PackArchive::readAt(uint64_t offset, void *buffer, uint32_t size) {
+    if (lseek(pFd, (off_t) offset, SEEK_SET) != (off_t) offset) {
+        return false;
+    }
+    return readIntoBuffer(pFd, buffer, 1, size) == size;
+}
+
+void PackArchive::setReadAhead(uint32_t size) {
+    std::lock_guard<std::mutex> lock(pReadMutex);
+    free(pReadAheadBuffer);
+    pReadAheadBuffer = nullptr;
+    pReadAheadSize   = size;
+    pReadAheadLength = 0;
+}
+
+bool PackArchive::readBuffered(uint64_t offset, void *buffer, uint32_t size) {
+    if (offset < pReadAheadOffset || offset + size > pReadAheadOffset + pReadAheadLength) {
+        if (pReadAheadBuffer == nullptr && (pReadAheadBuffer = (uint8_t *) malloc(pReadAheadSize)) == nullptr) {
+            return readAt(offset, buffer, size);
+        }
+        auto length      = (uint32_t) std::min<uint64_t>(pReadAheadSize, pDataEnd - offset);
+        pReadAheadLength = 0;
+        if (!readAt(offset, pReadAheadBuffer, length)) {
+            return false;
+        }
+        pReadAheadOffset = offset;
+        pReadAheadLength = length;
+    }
+    memcpy(buffer, pReadAheadBuffer + (offset - pReadAheadOffset), size);
+    return true;
+}
+
+int64_t PackArchive::readChunks(const PackFile *file, uint32_t pos, uint8_t *buffer, uint32_t size) {
+    auto *table = getChunkTable(file);
+    if (table == nullptr) {
+        return -1;
+    }
+    uint64_t dataOffset = file->offset + PackFormat::getChunkTableSize(file->size);
+    uint32_t end        = pos + size;
+
+    struct ChunkJob {
+        uint32_t start;
+        uint32_t size;
+        const uint8_t *src;
+        uint32_t srcSize;
+        uint8_t *dst;
+        bool success;
+    };
+    ChunkJob jobs[PACK_MAX_CHUNKS_PER_READ];
+
+    uint32_t cur = pos;
+    while (cur < end) {
+        uint32_t chunk = cur / PACK_CHUNK_SIZE;
+        if (auto *cached = getCachedChunk(file, chunk)) {
+            uint32_t chunkEnd = std::min((chunk + 1) * PACK_CHUNK_SIZE, end);
+            memcpy(buffer + (cur - pos), cached + (cur - chunk * PACK_CHUNK_SIZE), chunkEnd - cur);
+            cur = chunkEnd;
+            continue;
+        }
+
+        // Read all following chunks that are not cached at once.
+        uint32_t numChunks = 1;
+        while (numChunks < PACK_MAX_CHUNKS_PER_READ && (chunk + numChunks) * PACK_CHUNK_SIZE < end &&
+               getCachedChunk(file, chunk + numChunks) == nullptr) {
+            numChunks++;
+        }
+        uint32_t srcStart = (*table)[chunk];
+        uint32_t srcSize  = (*table)[chunk + numChunks] - srcStart;
+        auto *src         = (uint8_t *) malloc(srcSize);
+        if (src == nullptr) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to allocate %u bytes to read %s", srcSize, file->key);
+            return -1;
+        }
+        if (!readAt(dataOffset + srcStart, src, srcSize)) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to read chunks %u-%u of %s", chunk, chunk + numChunks - 1, file->key);
+            free(src);
+            return -1;
+        }
+
+        bool success = true;
+        for (uint32_t i = 0; i < numChunks; i++) {
+            auto &job   = jobs[i];
+            job.start   = (chunk + i) * PACK_CHUNK_SIZE;
+            job.size    = std::min((uint32_t) PACK_CHUNK_SIZE, file->size - job.start);
+            job.src     = src + ((*table)[chunk + i] - srcStart);
+            job.srcSize = (*table)[chunk + i + 1] - (*table)[chunk + i];
+            job.success = false;
+            // Chunks that are read completely are decompressed directly into the buffer.
+            if (job.start >= pos && job.start + job.size <= end) {
+                job.dst = buffer + (job.start - pos);
+            } else {
+                job.dst = (uint8_t *) malloc(PACK_CHUNK_SIZE);
+                success = success && job.dst != nullptr;
+            }
+        }
+        if (success) {
+            parallelForOnWorkers(numChunks, PACK_DECOMPRESS_HELPERS, [&jobs](uint32_t i) {
+                auto &job = jobs[i];
+                if (job.srcSize == job.size) {
+                    memcpy(job.dst, job.src, job.size);
+                    job.success = true;
+                } else {
+                    job.success = lz4_decompress_block(job.src, job.srcSize, job.dst, job.size) == (int32_t) job.size;
+                }
+            });
+        }
+        free(src);
+
+        for (uint32_t i = 0; i < numChunks; i++) {
+            auto &job = jobs[i];
+            if (!job.success) {
+                success = false;
+            }
+            if (job.dst == nullptr || (job.dst >= buffer && job.dst < buffer + size)) {
+                continue;
+            }
+            if (job.success) {
+                uint32_t copyStart = std::max(job.start, pos);
+                uint32_t copyEnd   = std::min(job.start + job.size, end);
+                memcpy(buffer + (copyStart - pos), job.dst + (copyStart - job.start), copyEnd - copyStart);
+                putCachedChunk(file, job.start / PACK_CHUNK_SIZE, job.dst);
+            } else {
+                free(job.dst);
+            }
+        }
+        if (!success) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to decompress chunks %u-%u of %s", chunk, chunk + numChunks - 1, file->key);
+            return -1;
+        }
+        cur = std::min((chunk + numChunks) * PACK_CHUNK_SIZE, end);
+    }
+    return size;
+}
+
+const std::vector<uint32_t> *PackArchive::getChunkTable(const PackFile *file) {
+    if (auto it = pChunkTables.find(file); it != pChunkTables.end()) {
+        return &it->second;
+    }
+    uint32_t tableSize = PackFormat::getChunkTableSize(file->size);
+    std::vector<uint8_t> data(tableSize);
+    if (!readAt(file->offset, data.data(), tableSize)) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to read the chunk table of %s", file->key);
+        return nullptr;
+    }
+    uint32_t numChunks = PackFormat::getNumChunks(file->size);
+    std::vector<uint32_t> table(numChunks + 1);
+    for (uint32_t i = 0; i <= numChunks; i++) {
+        table[i] = LayerIndexFormat::getBE32(data.data() + i * sizeof(uint32_t));
+        // A chunk is never stored bigger than its uncompressed size.
+        if (i > 0 && (table[i] < table[i - 1] || table[i] - table[i - 1] > PACK_CHUNK_SIZE)) {
+            DEBUG_FUNCTION_LINE_ERR("Invalid chunk table of %s", file->key);
+            return nullptr;
+        }
+    }
+    if (table[0] != 0 || table[numChunks] != file->storedSize - tableSize) {
+        DEBUG_FUNCTION_LINE_ERR("Invalid chunk table of %s", file->key);
+        return nullptr;
+    }
+    return &(pChunkTables[file] = std::move(table));
+}
+
+const uint8_t *PackArchive::getCachedChunk(const PackFile *file, uint32_t chunk) {
+    for (auto &cached : pChunkCache) {
+        if (cached.data != nullptr && cached.file == file && cached.chunk == chunk) {
+            cached.lastUse = ++pChunkCacheClock;
+            return cached.data;
+        }
+    }
+    return nullptr;
+}
+
+void PackArchive::putCachedChunk(const PackFile *file, uint32_t chunk, uint8_t *data) {
+    auto *oldest = &pChunkCache[0];
+    for (auto &cached : pChunkCache) {
+        if (cached.data == nullptr) {
+            oldest = &cached;
+            break;
+        }
+        if (cached.lastUse < oldest->lastUse) {
+            oldest = &cached;
+        }
+    }
+    free(oldest->data);
+    *oldest = {file, chunk, ++pChunkCacheClock, data};
+}
+
+bool PackArchive::load() {
+    pFd = ::open(pPath.c_str(), O_RDONLY);
+    if (pFd < 0) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to open pack %s. errno %d", pPath.c_str(), errno);
+        return false;
+    }
+    off_t fileSize = lseek(pFd, 0, SEEK_END);
+    if (fileSize < PACK_FILE_HEADER_SIZE || (uint64_t) fileSize > PACK_ARCHIVE_MAX_SIZE) {
+        DEBUG_FUNCTION_LINE_ERR("Pack %s has an invalid size (%lld)", pPath.c_str(), (int64_t) fileSize);
+        return false;
+    }
+
+    uint8_t headerData[PACK_FILE_HEADER_SIZE];
+    PackFileHeader header{};
+    if (!readAt(0, headerData, sizeof(headerData)) || !PackFormat::parseHeader(headerData, sizeof(headerData), &header)) {
+        DEBUG_FUNCTION_LINE_ERR("%s is not a valid pack of version %d", pPath.c_str(), PACK_FILE_VERSION);
+        return false;
+    }
+    if (header.directorySize > LAYER_INDEX_FILE_MAX_SIZE || header.directoryOffset + header.directorySize > (uint64_t) fileSize) {
+        DEBUG_FUNCTION_LINE_ERR("Directory of pack %s is out of bounds", pPath.c_str());
+        return false;
+    }
+
+    std::vector<LayerIndexFileEntry> entries;
+    uint64_t rootModified;
+    {
+        std::vector<uint8_t> directory(header.directorySize);
+        if (!readAt(header.directoryOffset, directory.data(), directory.size()) ||
+            !LayerIndexFormat::parse(directory.data(), directory.size(), &rootModified, entries)) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to load the directory of pack %s", pPath.c_str());
+            return false;
+        }
+    }
+
+    pDataEnd = header.directoryOffset;
+
+    std::vector<PackFileLocation> locations;
+    {
+        uint64_t locationsSize = (uint64_t) entries.size() * PACK_FILE_LOCATION_SIZE;
+        if (header.locationsOffset + locationsSize > (uint64_t) fileSize) {
+            DEBUG_FUNCTION_LINE_ERR("Locations of pack %s are out of bounds", pPath.c_str());
+            return false;
+        }
+        std::vector<uint8_t> data(locationsSize);
+        if (!readAt(header.locationsOffset, data.data(), data.size()) ||
+            !PackFormat::parseLocations(data.data(), entries.size(), header.locationsChecksum, locations)) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to load the locations of pack %s", pPath.c_str());
+            return false;
+        }
+    }
+
+    pFiles.reserve(entries.size());
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        auto &entry    = entries[i];
+        auto &location = locations[i];
+        if (entry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY) {
+            continue;
+        }
+        bool validSize = location.flags == PACK_LOCATION_FLAG_STORED ? location.storedSize == entry.size : location.storedSize >= PackFormat::getChunkTableSize(entry.size);
+        if ((location.flags != PACK_LOCATION_FLAG_STORED && location.flags != PACK_LOCATION_FLAG_LZ4_CHUNKS) || !validSize ||
+            location.offset + location.storedSize > header.directoryOffset) {
+            DEBUG_FUNCTION_LINE_ERR("Invalid location of %s in pack %s", entry.path.c_str(), pPath.c_str());
+            return false;
+        }
+        auto key = LayerIndex::getKey(entry.path);
+        PackFile file{};
+        file.hash       = hash_string(key);
+        file.key        = pKeys.copyString(key);
+        file.offset     = location.offset;
+        file.size       = entry.size;
+        file.storedSize = location.storedSize;
+        file.flags      = location.flags;
+        if (file.key == nullptr) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to allocate the directory of pack %s", pPath.c_str());
+            return false;
+        }
+        pFiles.push_back(file);
+    }
+    std::sort(pFiles.begin(), pFiles.end(), [](const PackFile &a, const PackFile &b) {
+        return a.hash != b.hash ? a.hash < b.hash : strcmp(a.key, b.key) < 0;
+    });
+
+    pIndex = make_shared_nothrow<LayerIndex>(pPath, true);
+    if (!pIndex || !LayerIndex::startWithEntries(pIndex, std::move(entries))) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to create the index of pack %s", pPath.c_str());
+        return false;
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("Loaded pack %s: %d files", pPath.c_str(), pFiles.size());
+    return true;
+}
+
+bool PackArchive::scanDirectory(uint32_t dirEntry, uint32_t depth, std::vector<LayerIndexFileEntry> &entries, uint64_t *totalSize) {
+    // Copy, entries may be reallocated.
+    auto relativePath = entries[dirEntry].path;
+    if (depth >= LAYER_INDEX_MAX_DEPTH) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to load %s/%s, too deep", pPath.c_str(), relativePath.c_str());
+        return false;
+    }
+    auto path = relativePath.empty() ? pPath : pPath + "/" + relativePath;
+    DIR *dir  = opendir(path.c_str());
+    if (dir == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to open %s. errno %d", path.c_str(), errno);
+        return false;
+    }
+    std::vector<uint32_t> subDirectories;
+    bool success = true;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        auto childRelativePath = relativePath.empty() ? std::string(entry->d_name) : relativePath + "/" + entry->d_name;
+        struct stat sb {};
+        FSStat fsStat{};
+        if (stat((path + "/" + entry->d_name).c_str(), &sb) < 0) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to stat %s/%s", path.c_str(), entry->d_name);
+            success = false;
+            break;
+        }
+        translate_stat(&sb, &fsStat);
+        LayerIndexFileEntry fileEntry{};
+        fileEntry.path     = childRelativePath;
+        fileEntry.flags    = (fsStat.flags & FS_STAT_DIRECTORY) ? LAYER_INDEX_FILE_FLAG_DIRECTORY : 0;
+        fileEntry.mode     = fsStat.mode;
+        fileEntry.size     = fsStat.size;
+        fileEntry.created  = fsStat.created;
+        fileEntry.modified = fsStat.modified;
+        if (fileEntry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY) {
+            subDirectories.push_back(entries.size());
+        } else {
+            *totalSize += fsStat.size;
+        }
+        entries[dirEntry].numChildren++;
+        entries.push_back(std::move(fileEntry));
+    }
+    closedir(dir);
+
+    for (auto subDirectory : subDirectories) {
+        if (!success) {
+            break;
+        }
+        success = scanDirectory(subDirectory, depth + 1, entries, totalSize);
+    }
+    return success;
+}
+
+bool PackArchive::loadFromDirectory(uint32_t maxSize) {
+    auto startTime = OSGetTime();
+    std::vector<LayerIndexFileEntry> entries;
+    {
+        struct stat sb {};
+        FSStat fsStat{};
+        if (stat(pPath.c_str(), &sb) < 0) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to stat %s", pPath.c_str());
+            return false;
+        }
+        translate_stat(&sb, &fsStat);
+        LayerIndexFileEntry root{};
+        root.flags    = LAYER_INDEX_FILE_FLAG_DIRECTORY;
+        root.mode     = fsStat.mode;
+        root.created  = fsStat.created;
+        root.modified = fsStat.modified;
+        entries.push_back(std::move(root));
+    }
+    uint64_t totalSize = 0;
+    if (!scanDirectory(0, 0, entries, &totalSize)) {
+        return false;
+    }
+    if (totalSize > maxSize) {
+        DEBUG_FUNCTION_LINE_ERR("%s is too large to be loaded into memory (%llu bytes, max %u)", pPath.c_str(), totalSize, maxSize);
+        return false;
+    }
+    // Keep the pointer valid for empty directories.
+    pMemory = (uint8_t *) malloc(std::max<uint64_t>(totalSize, 1));
+    if (pMemory == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate %llu bytes for %s", totalSize, pPath.c_str());
+        return false;
+    }
+
+    uint32_t offset = 0;
+    pFiles.reserve(entries.size());
+    for (auto &entry : entries) {
+        if (entry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY) {
+            continue;
+        }
+        auto path = pPath + "/" + entry.path;
+        int fd    = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0 || readIntoBuffer(fd, pMemory + offset, 1, entry.size) != (int64_t) entry.size) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to read %s", path.c_str());
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        close(fd);
+        auto key = LayerIndex::getKey(entry.path);
+        PackFile file{};
+        file.hash       = hash_string(key);
+        file.key        = pKeys.copyString(key);
+        file.offset     = offset;
+        file.size       = entry.size;
+        file.storedSize = entry.size;
+        file.flags      = PACK_LOCATION_FLAG_STORED;
+        file.data       = pMemory + offset;
+        if (file.key == nullptr) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to allocate the directory of %s", pPath.c_str());
+            return false;
+        }
+        pFiles.push_back(file);
+        offset += entry.size;
+    }
+    std::sort(pFiles.begin(), pFiles.end(), [](const PackFile &a, const PackFile &b) {
+        return a.hash != b.hash ? a.hash < b.hash : strcmp(a.key, b.key) < 0;
+    });
+
+    pIndex = make_shared_nothrow<LayerIndex>(pPath, true);
+    if (!pIndex || !LayerIndex::startWithEntries(pIndex, std::move(entries))) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to create the index of %s", pPath.c_str());
+        return false;
+    }
+    DEBUG_FUNCTION_LINE_INFO("Loaded %s into memory: %d files, %u bytes in %llu ms", pPath.c_str(), pFiles.size(), offset, OSTicksToMilliseconds(OSGetTime() - startTime));
+    return true;
+}
+
+bool PackArchive::loadMemoryFiles(std::vector<std::shared_ptr<MemoryFile>> &&files) {
+    std::vector<LayerIndexFileEntry> entries;
+    std::unordered_map<std::string, uint32_t> entryByKey;
+    auto dirMode = translate_permission_mode_value(S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+    // Returns the index of the directory entry, adds it and its parents if needed. Returns -1 if it's a file.
+    std::function<int32_t(std::string_view)> getDirectory = [&](std::string_view dirPath) -> int32_t {
+        auto key = LayerIndex::getKey(dirPath);
+        if (auto it = entryByKey.find(key); it != entryByKey.end()) {
+            return (entries[it->second].flags & LAYER_INDEX_FILE_FLAG_DIRECTORY) ? (int32_t) it->second : -1;
+        }
+        int32_t parent = -1;
+        if (!dirPath.empty()) {
+            auto slash = dirPath.find_last_of('/');
+            parent     = getDirectory(slash == std::string_view::npos ? std::string_view() : dirPath.substr(0, slash));
+            if (parent < 0) {
+                return -1;
+            }
+            entries[parent].numChildren++;
+        }
+        LayerIndexFileEntry entry{};
+        entry.path  = dirPath;
+        entry.flags = LAYER_INDEX_FILE_FLAG_DIRECTORY;
+        entry.mode  = dirMode;
+        entries.push_back(std::move(entry));
+        entryByKey.emplace(std::move(key), entries.size() - 1);
+        return (int32_t) entries.size() - 1;
+    };
+    getDirectory({});
+
+    pFiles.reserve(files.size());
+    for (auto &memoryFile : files) {
+        std::string_view filePath = memoryFile->path;
+        auto slash                = filePath.find_last_of('/');
+        auto key                  = LayerIndex::getKey(filePath);
+        auto parentPath           = slash == std::string_view::npos ? std::string_view() : filePath.substr(0, slash);
+        int32_t parent            = getDirectory(parentPath);
+        if (parent < 0 || key.empty() || entryByKey.contains(key)) {
+            DEBUG_FUNCTION_LINE_ERR("Can't add %s to %s", memoryFile->path.c_str(), pPath.c_str());
+            return false;
+        }
+        entries[parent].numChildren++;
+        // Directories get the time of their newest file.
+        for (auto dirPath = parentPath;;) {
+            auto &dir    = entries[entryByKey[LayerIndex::getKey(dirPath)]];
+            dir.modified = std::max(dir.modified, memoryFile->modified);
+            dir.created  = dir.modified;
+            if (dirPath.empty()) {
+                break;
+            }
+            auto dirSlash = dirPath.find_last_of('/');
+            dirPath       = dirSlash == std::string_view::npos ? std::string_view() : dirPath.substr(0, dirSlash);
+        }
+
+        LayerIndexFileEntry entry{};
+        entry.path     = memoryFile->path;
+        entry.mode     = translate_permission_mode_value(S_IRUSR | S_IRGRP | S_IROTH);
+        entry.size     = memoryFile->size;
+        entry.created  = memoryFile->modified;
+        entry.modified = memoryFile->modified;
+        entries.push_back(std::move(entry));
+        entryByKey.emplace(key, entries.size() - 1);
+
+        PackFile file{};
+        file.hash       = hash_string(key);
+        file.key        = pKeys.copyString(key);
+        file.size       = memoryFile->size;
+        file.storedSize = memoryFile->size;
+        file.flags      = PACK_LOCATION_FLAG_STORED;
+        file.data       = memoryFile->data;
+        if (file.key == nullptr) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to allocate the directory of %s", pPath.c_str());
+            return false;
+        }
+        pFiles.push_back(file);
+    }
+    std::sort(pFiles.begin(), pFiles.end(), [](const PackFile &a, const PackFile &b) {
+        return a.hash != b.hash ? a.hash < b.hash : strcmp(a.key, b.key) < 0;
+    });
+    pMemoryFiles = std::move(files);
+
+    pIndex = make_shared_nothrow<LayerIndex>(pPath, true);
+    if (!pIndex || !LayerIndex::startWithEntries(pIndex, std::move(entries))) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to create the index of %s", pPath.c_str());
+        return false;
+    }
+    return true;
+}
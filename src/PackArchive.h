@@ -0,0 +1,182 @@
+#pragma once
+#include "LayerIndex.h"
+#include "PackFormat.h"
+#include "utils/BumpArena.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// lseek works with a signed 32-bit offset.
+#define PACK_ARCHIVE_MAX_SIZE      0x7FFFFFFF
+
+// Number of decompressed chunks that are kept for reads that only cover a part of a chunk.
+#define PACK_CHUNK_CACHE_ENTRIES   8
+// Limits the compressed data that is read at once.
+#define PACK_MAX_CHUNKS_PER_READ   16
+// Workers that help decompressing reads that cover multiple chunks.
+#define PACK_DECOMPRESS_HELPERS    2
+
+// Limits the memory used by a directory that is loaded into memory, see PackArchive::loadDirectory.
+#define PACK_MEMORY_MAX_SIZE       0x1000000
+
+struct PackFile {
+    uint32_t hash;
+    // Normalized relative path, see LayerIndex::getKey.
+    const char *key;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t storedSize;
+    uint32_t flags;
+    // Set if the (uncompressed) file is in memory, offset is unused then.
+    const uint8_t *data;
+};
+
+typedef void (*MemoryFileReleaseCallback)(void *data, void *context);
+
+/**
+ * A buffer of the caller that is served as a file (see CRAddMemoryFile). It's shared by all archives and
+ * handles that use it, release is called once the last of them is gone.
+ */
+struct MemoryFile {
+    // Relative to the root of the archive.
+    std::string path;
+    const uint8_t *data = nullptr;
+    uint32_t size       = 0;
+    uint64_t modified   = 0;
+    MemoryFileReleaseCallback release = nullptr;
+    void *context                     = nullptr;
+
+    ~MemoryFile() {
+        if (release != nullptr) {
+            release((void *) data, context);
+        }
+    }
+};
+
+/**
+ * Read-only view of a pack file (see PackFormat.h).
+ *
+ * The directory of the pack is loaded once: the files are kept in a table sorted by the hash of their
+ * path, the metadata is published as a complete LayerIndex so stat and readdir never touch the SD card.
+ * All files are read from the same fd.
+ *
+ * Compressed files are read chunk by chunk: only the chunks that are touched by a read are read and
+ * decompressed, reads that cover multiple chunks are decompressed in parallel with the help of the worker
+ * threads. Chunks that have been read partially are kept in a small LRU cache.
+ *
+ * A replacement directory can be loaded into memory as well (see loadDirectory): all files are read into
+ * one contiguous buffer and reads are served with memcpy. The same applies to archives of memory files
+ * (see fromMemoryFiles), which are immutable as well: changing the files creates a new archive.
+ */
+class PackArchive {
+public:
+    explicit PackArchive(std::string path);
+
+    ~PackArchive();
+
+    PackArchive(const PackArchive &)            = delete;
+    PackArchive &operator=(const PackArchive &) = delete;
+
+    /**
+     * Returns nullptr if the pack could not be opened or is invalid.
+     */
+    static std::shared_ptr<PackArchive> open(const std::string &path);
+
+    /**
+     * Reads all files of the directory into memory. Returns nullptr if the directory could not be read or
+     * its files are larger than maxSize in total.
+     */
+    static std::shared_ptr<PackArchive> loadDirectory(const std::string &path, uint32_t maxSize);
+
+    /**
+     * Creates an archive of the given memory files, the parent directories are added implicitly.
+     * Returns nullptr if a path is used both as file and directory.
+     */
+    static std::shared_ptr<PackArchive> fromMemoryFiles(const std::string &path, std::vector<std::shared_ptr<MemoryFile>> files);
+
+    [[nodiscard]] const std::string &getPath() const {
+        return pPath;
+    }
+
+    [[nodiscard]] const std::shared_ptr<LayerIndex> &getIndex() const {
+        return pIndex;
+    }
+
+    /**
+     * Returns nullptr if the pack has no file with this path (relative to the root of the pack).
+     */
+    const PackFile *find(std::string_view relativePath) const;
+
+    /**
+     * Returns the normalized relative paths of all files.
+     */
+    [[nodiscard]] std::vector<std::string> getFilePaths() const;
+
+    /**
+     * Reads up to size bytes of the file, starting at pos. Returns the number of bytes read or -1 on error.
+     * If useReadAhead is false, the read-ahead buffer (see setReadAhead) is bypassed.
+     */
+    int64_t read(const PackFile *file, uint32_t pos, void *buffer, uint32_t size, bool useReadAhead = true);
+
+    /**
+     * Reads of uncompressed files that are smaller than size are served from a buffer of this size which is
+     * filled with the following data of the pack. Useful if the files are read in the order they are stored.
+     */
+    void setReadAhead(uint32_t size);
+
+private:
+    bool load();
+
+    bool loadFromDirectory(uint32_t maxSize);
+
+    bool loadMemoryFiles(std::vector<std::shared_ptr<MemoryFile>> &&files);
+
+    // Adds the children of entries[dirEntry] to the entries.
+    bool scanDirectory(uint32_t dirEntry, uint32_t depth, std::vector<LayerIndexFileEntry> &entries, uint64_t *totalSize);
+
+    bool readAt(uint64_t offset, void *buffer, uint32_t size);
+
+    bool readBuffered(uint64_t offset, void *buffer, uint32_t size);
+
+    int64_t readChunks(const PackFile *file, uint32_t pos, uint8_t *buffer, uint32_t size);
+
+    const std::vector<uint32_t> *getChunkTable(const PackFile *file);
+
+    const uint8_t *getCachedChunk(const PackFile *file, uint32_t chunk);
+
+    void putCachedChunk(const PackFile *file, uint32_t chunk, uint8_t *data);
+
+    struct CachedChunk {
+        const PackFile *file;
+        uint32_t chunk;
+        uint32_t lastUse;
+        uint8_t *data;
+    };
+
+    std::string pPath;
+    int pFd = -1;
+    // End of the file data.
+    uint64_t pDataEnd = 0;
+    // Guards the fd, the chunk tables, the chunk cache and the read ahead buffer.
+    std::mutex pReadMutex;
+    std::unordered_map<const PackFile *, std::vector<uint32_t>> pChunkTables;
+    CachedChunk pChunkCache[PACK_CHUNK_CACHE_ENTRIES]{};
+    uint32_t pChunkCacheClock = 0;
+    uint8_t *pReadAheadBuffer = nullptr;
+    uint32_t pReadAheadSize   = 0;
+    uint64_t pReadAheadOffset = 0;
+    uint32_t pReadAheadLength = 0;
+
+    // Set if the files have been loaded from a directory.
+    uint8_t *pMemory = nullptr;
+    std::vector<std::shared_ptr<MemoryFile>> pMemoryFiles;
+
+    BumpArena pKeys{0x1000};
+    // Sorted by hash, then key.
+    std::vector<PackFile> pFiles;
+
+    std::shared_ptr<LayerIndex> pIndex;
+};
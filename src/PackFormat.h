@@ -0,0 +1,115 @@
+#pragma once
+/**
+ * Format of the pack files created by the host tool in tools/pack. A pack holds the content of a
+ * replacement directory in a single file:
+ *
+ *   header
+ *   file data
+ *   directory (same format as a layer index, see LayerIndexFormat.h)
+ *   locations[numEntries of the directory] (in the same order as the entries of the directory)
+ *
+ * The data of a file is either stored as is or split into chunks of PACK_CHUNK_SIZE bytes that are
+ * compressed independently (PACK_LOCATION_FLAG_LZ4_CHUNKS):
+ *
+ *   chunkOffsets[numChunks + 1] (u32, relative to the end of this table)
+ *   chunks (LZ4 blocks, a chunk that has the uncompressed size is stored as is)
+ *
+ * This header has no dependencies on wut, so it can be used by host tools as well. All values are
+ * stored big-endian.
+ */
+#include "LayerIndexFormat.h"
+#include <cstdint>
+#include <vector>
+
+#define PACK_FILE_SUFFIX        ".crpack"
+#define PACK_FILE_MAGIC         0x4352504B // "CRPK"
+#define PACK_FILE_VERSION       1
+#define PACK_FILE_HEADER_SIZE   32
+#define PACK_FILE_LOCATION_SIZE 16
+
+// Data of the file is stored as is. Directories have no data.
+#define PACK_LOCATION_FLAG_STORED     0x00
+#define PACK_LOCATION_FLAG_LZ4_CHUNKS 0x01
+
+#define PACK_CHUNK_SIZE 0x10000
+
+struct PackFileHeader {
+    uint64_t directoryOffset;
+    uint32_t directorySize;
+    uint64_t locationsOffset;
+    uint32_t locationsChecksum;
+};
+
+struct PackFileLocation {
+    uint64_t offset;
+    // Size of the data in the pack.
+    uint32_t storedSize;
+    uint32_t flags;
+};
+
+namespace PackFormat {
+    static inline uint32_t getNumChunks(uint32_t size) {
+        return (uint32_t) (((uint64_t) size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE);
+    }
+
+    static inline uint32_t getChunkTableSize(uint32_t size) {
+        return (getNumChunks(size) + 1) * sizeof(uint32_t);
+    }
+
+    static inline std::vector<uint8_t> serializeHeader(const PackFileHeader &header) {
+        std::vector<uint8_t> out;
+        out.reserve(PACK_FILE_HEADER_SIZE);
+        LayerIndexFormat::putBE32(out, PACK_FILE_MAGIC);
+        LayerIndexFormat::putBE16(out, PACK_FILE_VERSION);
+        LayerIndexFormat::putBE16(out, PACK_FILE_HEADER_SIZE);
+        LayerIndexFormat::putBE64(out, header.directoryOffset);
+        LayerIndexFormat::putBE32(out, header.directorySize);
+        LayerIndexFormat::putBE64(out, header.locationsOffset);
+        LayerIndexFormat::putBE32(out, header.locationsChecksum);
+        return out;
+    }
+
+    /**
+     * Returns false if the data is not a pack header of this version.
+     */
+    static inline bool parseHeader(const uint8_t *data, uint32_t size, PackFileHeader *outHeader) {
+        if (size < PACK_FILE_HEADER_SIZE ||
+            LayerIndexFormat::getBE32(data) != PACK_FILE_MAGIC ||
+            LayerIndexFormat::getBE16(data + 4) != PACK_FILE_VERSION ||
+            LayerIndexFormat::getBE16(data + 6) != PACK_FILE_HEADER_SIZE) {
+            return false;
+        }
+        outHeader->directoryOffset   = LayerIndexFormat::getBE64(data + 8);
+        outHeader->directorySize     = LayerIndexFormat::getBE32(data + 16);
+        outHeader->locationsOffset   = LayerIndexFormat::getBE64(data + 20);
+        outHeader->locationsChecksum = LayerIndexFormat::getBE32(data + 28);
+        return true;
+    }
+
+    static inline std::vector<uint8_t> serializeLocations(const std::vector<PackFileLocation> &locations) {
+        std::vector<uint8_t> out;
+        out.reserve(locations.size() * PACK_FILE_LOCATION_SIZE);
+        for (auto &location : locations) {
+            LayerIndexFormat::putBE64(out, location.offset);
+            LayerIndexFormat::putBE32(out, location.storedSize);
+            LayerIndexFormat::putBE32(out, location.flags);
+        }
+        return out;
+    }
+
+    /**
+     * Returns false if the checksum doesn't match.
+     */
+    static inline bool parseLocations(const uint8_t *data, uint32_t numLocations, uint32_t checksum, std::vector<PackFileLocation> &outLocations) {
+        if (LayerIndexFormat::checksum(data, numLocations * PACK_FILE_LOCATION_SIZE) != checksum) {
+            return false;
+        }
+        outLocations.clear();
+        outLocations.reserve(numLocations);
+        for (uint32_t i = 0; i < numLocations; i++) {
+            const uint8_t *cur = data + i * PACK_FILE_LOCATION_SIZE;
+            outLocations.push_back({LayerIndexFormat::getBE64(cur), LayerIndexFormat::getBE32(cur + 8), LayerIndexFormat::getBE32(cur + 12)});
+        }
+        return true;
+    }
+} // namespace PackFormat
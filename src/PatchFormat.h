@@ -0,0 +1,164 @@
+#pragma once
+/**
+ * Format of the patch files created by the host tool in tools/patch. A patch describes a modified file as a
+ * list of operations on the original file:
+ *
+ *   header
+ *   ops[numOps]
+ *   data (the bytes of the modified file that are not taken from the original)
+ *
+ * The ops are sorted by their offset in the modified file and cover it without gaps. An op either copies a
+ * range of the original (PATCH_OP_COPY) or of the data section (PATCH_OP_DATA). Any range of the modified
+ * file can be reconstructed by finding the first op with a binary search, no other part of the patch has to
+ * be decoded.
+ *
+ * This header has no dependencies on wut, so it can be used by host tools as well. All values are stored
+ * big-endian.
+ */
+#include "LayerIndexFormat.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#define PATCH_FILE_SUFFIX      ".crpatch"
+#define PATCH_FILE_MAGIC       0x43524450 // "CRDP"
+#define PATCH_FILE_VERSION     2
+#define PATCH_FILE_HEADER_SIZE 32
+#define PATCH_FILE_OP_SIZE     16
+
+#define PATCH_OP_COPY 0
+#define PATCH_OP_DATA 1
+
+// Readers reconstruct the modified file in windows of this size and keep the last PATCH_CACHE_WINDOWS of them.
+#define PATCH_WINDOW_SIZE   0x10000
+#define PATCH_CACHE_WINDOWS 8
+
+struct PatchFileHeader {
+    uint32_t sourceSize;
+    uint32_t targetSize;
+    uint32_t numOps;
+    uint32_t opsChecksum;
+    uint32_t dataSize;
+    // Checksum of the whole original, to detect patches for another version of the file.
+    uint32_t sourceChecksum;
+};
+
+struct PatchOp {
+    uint32_t targetOffset;
+    uint32_t length;
+    uint32_t type;
+    // Offset in the original (PATCH_OP_COPY) or in the data section (PATCH_OP_DATA).
+    uint32_t offset;
+};
+
+namespace PatchFormat {
+    static inline uint32_t getOpsOffset() {
+        return PATCH_FILE_HEADER_SIZE;
+    }
+
+    static inline uint64_t getDataOffset(const PatchFileHeader &header) {
+        return (uint64_t) PATCH_FILE_HEADER_SIZE + (uint64_t) header.numOps * PATCH_FILE_OP_SIZE;
+    }
+
+    static inline std::vector<uint8_t> serializeHeader(const PatchFileHeader &header) {
+        std::vector<uint8_t> out;
+        out.reserve(PATCH_FILE_HEADER_SIZE);
+        LayerIndexFormat::putBE32(out, PATCH_FILE_MAGIC);
+        LayerIndexFormat::putBE16(out, PATCH_FILE_VERSION);
+        LayerIndexFormat::putBE16(out, PATCH_FILE_HEADER_SIZE);
+        LayerIndexFormat::putBE32(out, header.sourceSize);
+        LayerIndexFormat::putBE32(out, header.targetSize);
+        LayerIndexFormat::putBE32(out, header.numOps);
+        LayerIndexFormat::putBE32(out, header.opsChecksum);
+        LayerIndexFormat::putBE32(out, header.dataSize);
+        LayerIndexFormat::putBE32(out, header.sourceChecksum);
+        return out;
+    }
+
+    /**
+     * Returns false if the data is not a patch header of this version.
+     */
+    static inline bool parseHeader(const uint8_t *data, uint32_t size, PatchFileHeader *outHeader) {
+        if (size < PATCH_FILE_HEADER_SIZE ||
+            LayerIndexFormat::getBE32(data) != PATCH_FILE_MAGIC ||
+            LayerIndexFormat::getBE16(data + 4) != PATCH_FILE_VERSION ||
+            LayerIndexFormat::getBE16(data + 6) != PATCH_FILE_HEADER_SIZE) {
+            return false;
+        }
+        outHeader->sourceSize     = LayerIndexFormat::getBE32(data + 8);
+        outHeader->targetSize     = LayerIndexFormat::getBE32(data + 12);
+        outHeader->numOps         = LayerIndexFormat::getBE32(data + 16);
+        outHeader->opsChecksum    = LayerIndexFormat::getBE32(data + 20);
+        outHeader->dataSize       = LayerIndexFormat::getBE32(data + 24);
+        outHeader->sourceChecksum = LayerIndexFormat::getBE32(data + 28);
+        return true;
+    }
+
+    static inline std::vector<uint8_t> serializeOps(const std::vector<PatchOp> &ops) {
+        std::vector<uint8_t> out;
+        out.reserve(ops.size() * PATCH_FILE_OP_SIZE);
+        for (auto &op : ops) {
+            LayerIndexFormat::putBE32(out, op.targetOffset);
+            LayerIndexFormat::putBE32(out, op.length);
+            LayerIndexFormat::putBE32(out, op.type);
+            LayerIndexFormat::putBE32(out, op.offset);
+        }
+        return out;
+    }
+
+    /**
+     * Returns false if the checksum doesn't match or the ops don't describe a file of header.targetSize bytes
+     * that only uses ranges inside the original and the data section.
+     */
+    static inline bool parseOps(const uint8_t *data, const PatchFileHeader &header, std::vector<PatchOp> &outOps) {
+        if (LayerIndexFormat::checksum(data, header.numOps * PATCH_FILE_OP_SIZE) != header.opsChecksum) {
+            return false;
+        }
+        outOps.clear();
+        outOps.reserve(header.numOps);
+        uint64_t end = 0;
+        for (uint32_t i = 0; i < header.numOps; i++) {
+            const uint8_t *cur = data + i * PATCH_FILE_OP_SIZE;
+            PatchOp op{LayerIndexFormat::getBE32(cur), LayerIndexFormat::getBE32(cur + 4), LayerIndexFormat::getBE32(cur + 8), LayerIndexFormat::getBE32(cur + 12)};
+            uint32_t limit = op.type == PATCH_OP_COPY ? header.sourceSize : header.dataSize;
+            if (op.targetOffset != end || op.length == 0 || (op.type != PATCH_OP_COPY && op.type != PATCH_OP_DATA) ||
+                (uint64_t) op.offset + op.length > limit) {
+                return false;
+            }
+            end += op.length;
+            outOps.push_back(op);
+        }
+        return end == header.targetSize;
+    }
+
+    /**
+     * Returns the index of the op that contains offset, offset must be less than the size of the modified file.
+     */
+    static inline uint32_t findOp(const std::vector<PatchOp> &ops, uint32_t offset) {
+        auto it = std::upper_bound(ops.begin(), ops.end(), offset, [](uint32_t value, const PatchOp &op) { return value < op.targetOffset; });
+        return (uint32_t) (it - ops.begin()) - 1;
+    }
+
+    /**
+     * Reconstructs size bytes of the modified file at offset. readSource(offset, buffer, size) and
+     * readData(offset, buffer, size) read from the original and the data section and return false on errors.
+     */
+    template<typename ReadSource, typename ReadData>
+    static inline bool reconstruct(const std::vector<PatchOp> &ops, uint32_t offset, uint8_t *out, uint32_t size, ReadSource &&readSource, ReadData &&readData) {
+        if (size == 0) {
+            return true;
+        }
+        uint32_t done = 0;
+        for (uint32_t i = findOp(ops, offset); i < ops.size() && done < size; i++) {
+            auto &op        = ops[i];
+            uint32_t within = offset + done - op.targetOffset;
+            uint32_t length = std::min(op.length - within, size - done);
+            bool success    = op.type == PATCH_OP_COPY ? readSource(op.offset + within, out + done, length) : readData(op.offset + within, out + done, length);
+            if (!success) {
+                return false;
+            }
+            done += length;
+        }
+        return done == size;
+    }
+} // namespace PatchFormat
@@ -0,0 +1,435 @@
+#include "Prefetcher.h"
+#include "BootTrace.h"
+#include "FileUtils.h"
+#include "LayerIndex.h"
+#include "LayerIndexFormat.h"
+#include "WorkerThreads.h"
+#include "utils/logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+#define PREFETCH_FILE_HEADER_SIZE 16
+
+Prefetcher::Prefetcher(std::string pathToReplace, std::string replacementDir) : pPathToReplace(std::move(pathToReplace)),
+                                                                              pReplacementDir(std::move(replacementDir)) {
+    while (pReplacementDir.size() > 1 && pReplacementDir.back() == '/') {
+        pReplacementDir.pop_back();
+    }
+    pFilePath = BootTrace::getBasePath(pReplacementDir) + PREFETCH_FILE_SUFFIX;
+}
+
+Prefetcher::~Prefetcher() {
+    for (auto &cached : pCache) {
+        free(cached.data);
+    }
+}
+
+void Prefetcher::load(const std::shared_ptr<Prefetcher> &prefetcher) {
+    if (!queueWorkerTask([prefetcher]() { prefetcher->loadSuccessors(); })) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to queue loading %s", prefetcher->pFilePath.c_str());
+    }
+}
+
+std::string Prefetcher::getKey(std::string_view fullPath) const {
+    if (fullPath.size() < pPathToReplace.size()) {
+        return {};
+    }
+    auto relativePath = fullPath.substr(pPathToReplace.size());
+    while (!relativePath.empty() && relativePath.front() == '/') {
+        relativePath.remove_prefix(1);
+    }
+    return LayerIndex::getKey(relativePath);
+}
+
+void Prefetcher::onOpen(const std::shared_ptr<Prefetcher> &prefetcher, std::string_view fullPath) {
+    auto key = prefetcher->getKey(fullPath);
+    if (key.empty()) {
+        return;
+    }
+    std::vector<std::string> toPrefetch;
+    {
+        std::lock_guard<std::mutex> lock(prefetcher->pMutex);
+        if (!prefetcher->pLearning) {
+            return;
+        }
+        prefetcher->learn(key);
+        if (auto it = prefetcher->pSuccessors.find(key); it != prefetcher->pSuccessors.end()) {
+            for (auto &successor : it->second) {
+                if (successor.count >= PREFETCH_MIN_COUNT && prefetcher->pPending < PREFETCH_MAX_PENDING && prefetcher->reserve(successor.key)) {
+                    toPrefetch.push_back(successor.key);
+                }
+            }
+        }
+    }
+    for (auto &successor : toPrefetch) {
+        if (!queueWorkerTask([prefetcher, successor]() { prefetcher->readAhead(successor); })) {
+            std::lock_guard<std::mutex> lock(prefetcher->pMutex);
+            std::erase_if(prefetcher->pCache, [&](auto &cached) { return cached.pending && cached.key == successor; });
+            prefetcher->pPending--;
+        }
+    }
+}
+
+bool Prefetcher::warmUp(const std::shared_ptr<Prefetcher> &prefetcher, std::string_view fullPath) {
+    auto key = prefetcher->getKey(fullPath);
+    return queueWorkerTask([prefetcher, key]() { prefetcher->warmUpPath(key); });
+}
+
+void Prefetcher::warmUpPath(const std::string &key) {
+    auto path = pReplacementDir;
+    if (!key.empty()) {
+        path += "/" + key;
+    }
+    struct stat sb {};
+    if (stat(path.c_str(), &sb) < 0) {
+        DEBUG_FUNCTION_LINE_VERBOSE("Failed to warm up %s", path.c_str());
+        return;
+    }
+    if (!S_ISDIR(sb.st_mode)) {
+        if (reserveLocked(key)) {
+            readAhead(key);
+        }
+        return;
+    }
+
+    // Only the files directly inside the directory, until the cache is full.
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    uint32_t totalSize = 0;
+    struct dirent *entry;
+    while (totalSize < PREFETCH_CACHE_MAX_BYTES && (entry = readdir(dir)) != nullptr) {
+        if (entry->d_type == DT_DIR) {
+            continue;
+        }
+        auto fileKey = key.empty() ? LayerIndex::getKey(entry->d_name) : key + "/" + LayerIndex::getKey(entry->d_name);
+        if (reserveLocked(fileKey)) {
+            totalSize += readAhead(fileKey);
+        }
+    }
+    closedir(dir);
+}
+
+bool Prefetcher::reserve(const std::string &key) {
+    if (std::ranges::any_of(pCache, [&](auto &cached) { return cached.key == key; })) {
+        return false;
+    }
+    pCache.push_back({key, 0, ++pClock, true, false, 0, nullptr});
+    pPending++;
+    return true;
+}
+
+bool Prefetcher::reserveLocked(const std::string &key) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    return reserve(key);
+}
+
+void Prefetcher::drop(const std::string &key) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    auto it = std::ranges::find_if(pCache, [&](auto &cached) { return !cached.pending && cached.key == key; });
+    if (it != pCache.end()) {
+        pCacheSize -= it->size;
+        free(it->data);
+        pCache.erase(it);
+    }
+}
+
+void Prefetcher::setLearning(const std::shared_ptr<Prefetcher> &prefetcher, bool learning) {
+    {
+        std::lock_guard<std::mutex> lock(prefetcher->pMutex);
+        if (prefetcher->pLearning == learning) {
+            return;
+        }
+        prefetcher->pLearning = learning;
+        prefetcher->pLastKey.clear();
+    }
+    if (learning) {
+        load(prefetcher);
+    } else {
+        save(prefetcher);
+    }
+}
+
+void Prefetcher::learn(const std::string &key) {
+    auto now = OSGetTime();
+    if (!pLastKey.empty() && pLastKey != key && OSTicksToMilliseconds(now - pLastOpenTime) <= PREFETCH_SUCCESSOR_WINDOW) {
+        auto it = pSuccessors.find(pLastKey);
+        if (it == pSuccessors.end() && pSuccessors.size() < PREFETCH_MAX_FILES) {
+            it = pSuccessors.emplace(pLastKey, std::vector<Successor>()).first;
+        }
+        if (it != pSuccessors.end()) {
+            auto &successors = it->second;
+            auto successor   = std::ranges::find_if(successors, [&](auto &cur) { return cur.key == key; });
+            if (successor != successors.end()) {
+                successor->count++;
+            } else if (successors.size() < PREFETCH_MAX_SUCCESSORS) {
+                successors.push_back({key, 1});
+            } else {
+                // Replace the least common successor, so a changed load order is learned eventually.
+                auto least = std::ranges::min_element(successors, [](auto &a, auto &b) { return a.count < b.count; });
+                *least     = {key, 1};
+            }
+            std::ranges::sort(successors, [](auto &a, auto &b) { return a.count > b.count; });
+            pSuccessorsChanged = true;
+        }
+    }
+    pLastKey      = key;
+    pLastOpenTime = now;
+}
+
+void Prefetcher::evict(uint32_t neededSize) {
+    while (pCacheSize + neededSize > PREFETCH_CACHE_MAX_BYTES) {
+        auto oldest = pCache.end();
+        for (auto it = pCache.begin(); it != pCache.end(); ++it) {
+            if (!it->pending && (oldest == pCache.end() || it->lastUse < oldest->lastUse)) {
+                oldest = it;
+            }
+        }
+        if (oldest == pCache.end()) {
+            return;
+        }
+        if (!oldest->used) {
+            pStats.numWasted++;
+        }
+        pCacheSize -= oldest->size;
+        free(oldest->data);
+        pCache.erase(oldest);
+    }
+}
+
+uint32_t Prefetcher::readAhead(const std::string &key) {
+    auto generation = pGeneration.load();
+    auto path       = pReplacementDir + "/" + key;
+    uint8_t *data   = nullptr;
+    int64_t read    = -1;
+    int fd          = open(path.c_str(), O_RDONLY);
+    struct stat sb {};
+    if (fd >= 0 && fstat(fd, &sb) == 0) {
+        // The buffer is charged against PREFETCH_CACHE_MAX_BYTES, so it must not be larger than the data.
+        auto toRead = (uint32_t) std::min<off_t>(sb.st_size, PREFETCH_READ_SIZE);
+        if (toRead == 0) {
+            read = 0;
+        } else if ((data = (uint8_t *) malloc(toRead)) != nullptr) {
+            read = readIntoBuffer(fd, data, 1, toRead);
+            if (read >= 0 && read < toRead) {
+                // The file has been truncated in the meantime.
+                if (read == 0) {
+                    free(data);
+                    data = nullptr;
+                } else if (auto *shrunk = (uint8_t *) realloc(data, read)) {
+                    data = shrunk;
+                }
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    std::lock_guard<std::mutex> lock(pMutex);
+    pPending--;
+    auto it = std::ranges::find_if(pCache, [&](auto &cached) { return cached.pending && cached.key == key; });
+    if (it == pCache.end()) {
+        free(data);
+        return 0;
+    }
+    if (read < 0) {
+        DEBUG_FUNCTION_LINE_VERBOSE("Failed to prefetch %s", path.c_str());
+        free(data);
+        pCache.erase(it);
+        return 0;
+    }
+    it->pending    = false;
+    it->generation = generation;
+    it->size       = read;
+    it->data       = data;
+    pStats.numPrefetched++;
+    it->lastUse    = ++pClock;
+    pCacheSize += read;
+    // The new entry is the most recently used one, older entries are evicted first.
+    evict(0);
+    return read;
+}
+
+std::string Prefetcher::getCachedKey(std::string_view fullPath) {
+    auto key = getKey(fullPath);
+    std::lock_guard<std::mutex> lock(pMutex);
+    auto generation = pGeneration.load();
+    if (std::ranges::any_of(pCache, [&](auto &cached) { return (cached.pending || cached.generation == generation) && cached.key == key; })) {
+        return key;
+    }
+    return {};
+}
+
+int64_t Prefetcher::readCached(const std::string &key, uint32_t pos, void *buffer, uint32_t size) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    auto it = std::ranges::find_if(pCache, [&](auto &cached) { return !cached.pending && cached.key == key; });
+    if (it == pCache.end() || it->generation != pGeneration.load()) {
+        return -1;
+    }
+    if (pos + size > it->size) {
+        if (it->size == PREFETCH_READ_SIZE) {
+            // Only the start of the file is cached.
+            return -1;
+        }
+        size = pos < it->size ? it->size - pos : 0;
+    }
+    if (size > 0) {
+        memcpy(buffer, it->data + pos, size);
+    }
+    if (!it->used) {
+        it->used = true;
+        pStats.numUsed++;
+    }
+    it->lastUse = ++pClock;
+    pStats.numHits++;
+    return size;
+}
+
+void Prefetcher::getStats(PrefetchStats *outStats) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    *outStats           = pStats;
+    outStats->cacheSize = pCacheSize;
+}
+
+void Prefetcher::save(const std::shared_ptr<Prefetcher> &prefetcher) {
+    PrefetchStats stats{};
+    prefetcher->getStats(&stats);
+    DEBUG_FUNCTION_LINE_INFO("Prefetched %d files for %s, %d used, %d wasted, %d reads from the cache", stats.numPrefetched, prefetcher->pReplacementDir.c_str(),
+                             stats.numUsed, stats.numWasted, stats.numHits);
+    {
+        std::lock_guard<std::mutex> lock(prefetcher->pMutex);
+        if (!prefetcher->pSuccessorsChanged) {
+            return;
+        }
+        prefetcher->pSuccessorsChanged = false;
+    }
+    // Writing may issue FS calls, this must not happen on an IO thread.
+    if (!queueWorkerTask([prefetcher]() { prefetcher->writeSuccessors(); })) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to queue writing %s", prefetcher->pFilePath.c_str());
+    }
+}
+
+void Prefetcher::loadSuccessors() {
+    FILE *f = fopen(pFilePath.c_str(), "rb");
+    if (f == nullptr) {
+        return;
+    }
+    std::vector<uint8_t> data;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        auto size = ftell(f);
+        if (size >= PREFETCH_FILE_HEADER_SIZE && size <= PREFETCH_FILE_MAX_SIZE && fseek(f, 0, SEEK_SET) == 0) {
+            data.resize(size);
+            if (fread(data.data(), 1, size, f) != (size_t) size) {
+                data.clear();
+            }
+        }
+    }
+    fclose(f);
+
+    const uint8_t *cur = data.data();
+    const uint8_t *end = data.data() + data.size();
+    if (data.empty() ||
+        LayerIndexFormat::getBE32(cur) != PREFETCH_FILE_MAGIC ||
+        LayerIndexFormat::getBE16(cur + 4) != PREFETCH_FILE_VERSION ||
+        LayerIndexFormat::getBE16(cur + 6) != PREFETCH_FILE_HEADER_SIZE ||
+        LayerIndexFormat::checksum(cur + PREFETCH_FILE_HEADER_SIZE, data.size() - PREFETCH_FILE_HEADER_SIZE) != LayerIndexFormat::getBE32(cur + 12)) {
+        DEBUG_FUNCTION_LINE_WARN("Ignore invalid %s", pFilePath.c_str());
+        return;
+    }
+    uint32_t numFiles = LayerIndexFormat::getBE32(cur + 8);
+    cur += PREFETCH_FILE_HEADER_SIZE;
+
+    auto readString = [&](std::string &out) {
+        if (end - cur < 2 || (uint32_t) (end - cur - 2) < LayerIndexFormat::getBE16(cur)) {
+            return false;
+        }
+        out.assign(reinterpret_cast<const char *>(cur + 2), LayerIndexFormat::getBE16(cur));
+        cur += 2 + out.size();
+        return true;
+    };
+    std::unordered_map<std::string, std::vector<Successor>> successors;
+    for (uint32_t i = 0; i < numFiles && i < PREFETCH_MAX_FILES; i++) {
+        std::string key;
+        if (!readString(key) || end - cur < 2) {
+            DEBUG_FUNCTION_LINE_WARN("Ignore invalid %s", pFilePath.c_str());
+            return;
+        }
+        uint32_t numSuccessors = LayerIndexFormat::getBE16(cur);
+        cur += 2;
+        auto &list = successors[key];
+        for (uint32_t j = 0; j < numSuccessors; j++) {
+            Successor successor;
+            if (!readString(successor.key) || end - cur < 4) {
+                DEBUG_FUNCTION_LINE_WARN("Ignore invalid %s", pFilePath.c_str());
+                return;
+            }
+            successor.count = LayerIndexFormat::getBE32(cur);
+            cur += 4;
+            if (list.size() < PREFETCH_MAX_SUCCESSORS) {
+                list.push_back(std::move(successor));
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(pMutex);
+    // Successors that have been learned while loading win.
+    pSuccessors.merge(successors);
+    DEBUG_FUNCTION_LINE_VERBOSE("Loaded %s (%d files)", pFilePath.c_str(), pSuccessors.size());
+}
+
+void Prefetcher::writeSuccessors() {
+    std::vector<uint8_t> body;
+    uint32_t numFiles = 0;
+    {
+        std::lock_guard<std::mutex> lock(pMutex);
+        for (auto &[key, successors] : pSuccessors) {
+            LayerIndexFormat::putBE16(body, key.size());
+            body.insert(body.end(), key.begin(), key.end());
+            LayerIndexFormat::putBE16(body, successors.size());
+            for (auto &successor : successors) {
+                LayerIndexFormat::putBE16(body, successor.key.size());
+                body.insert(body.end(), successor.key.begin(), successor.key.end());
+                LayerIndexFormat::putBE32(body, successor.count);
+            }
+            numFiles++;
+        }
+    }
+    if (body.size() + PREFETCH_FILE_HEADER_SIZE > PREFETCH_FILE_MAX_SIZE) {
+        DEBUG_FUNCTION_LINE_WARN("Too many successors, not writing %s", pFilePath.c_str());
+        return;
+    }
+    std::vector<uint8_t> data;
+    LayerIndexFormat::putBE32(data, PREFETCH_FILE_MAGIC);
+    LayerIndexFormat::putBE16(data, PREFETCH_FILE_VERSION);
+    LayerIndexFormat::putBE16(data, PREFETCH_FILE_HEADER_SIZE);
+    LayerIndexFormat::putBE32(data, numFiles);
+    LayerIndexFormat::putBE32(data, LayerIndexFormat::checksum(body.data(), body.size()));
+    data.insert(data.end(), body.begin(), body.end());
+
+    auto tmpPath = pFilePath + ".tmp";
+    FILE *f      = fopen(tmpPath.c_str(), "wb");
+    if (f == nullptr) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to create %s", tmpPath.c_str());
+        return;
+    }
+    bool success = fwrite(data.data(), 1, data.size(), f) == data.size();
+    success      = fclose(f) == 0 && success;
+    if (success) {
+        remove(pFilePath.c_str());
+        success = rename(tmpPath.c_str(), pFilePath.c_str()) == 0;
+    }
+    if (!success) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to write %s", pFilePath.c_str());
+        remove(tmpPath.c_str());
+        return;
+    }
+    DEBUG_FUNCTION_LINE_VERBOSE("Wrote %s (%d bytes)", pFilePath.c_str(), data.size());
+}
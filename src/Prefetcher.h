@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <coreinit/time.h>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define PREFETCH_FILE_SUFFIX        ".crprefetch"
+#define PREFETCH_FILE_MAGIC         0x43525046 // "CRPF"
+#define PREFETCH_FILE_VERSION       1
+#define PREFETCH_FILE_MAX_SIZE      0x40000
+
+// B is a successor of A if it is opened within this time after A.
+#define PREFETCH_SUCCESSOR_WINDOW   500
+#define PREFETCH_MAX_SUCCESSORS     4
+#define PREFETCH_MAX_FILES          0x1000
+// A successor is prefetched once it has followed the file this often.
+#define PREFETCH_MIN_COUNT          2
+// Bytes that are read from the start of a predicted file.
+#define PREFETCH_READ_SIZE          0x20000
+#define PREFETCH_CACHE_MAX_BYTES    0x200000
+#define PREFETCH_MAX_PENDING        4
+
+struct PrefetchStats {
+    // Files that have been read ahead.
+    uint32_t numPrefetched;
+    // Prefetched files that have been read by the title.
+    uint32_t numUsed;
+    // Prefetched files that have been evicted before they have been read.
+    uint32_t numWasted;
+    // Reads that have been served from the cache.
+    uint32_t numHits;
+    uint32_t cacheSize;
+};
+
+/**
+ * Learns which files of a layer are opened after each other and reads the start of the file that
+ * is likely opened next on a worker thread (see CR_LAYER_OPTION_PREFETCH).
+ *
+ * The opens are reported by the dispatcher (doForLayer). If B has been opened within PREFETCH_SUCCESSOR_WINDOW
+ * ms after A often enough, opening A queues reading the first PREFETCH_READ_SIZE bytes of B into a bounded
+ * LRU cache, reads of B are then served from memory. The successors are persisted per title to
+ * "<replacement dir>.<title id>.crprefetch" when the layer is removed.
+ *
+ * Plugins can warm up the cache explicitly with CRPrefetch and CRAdvise, which works without learning.
+ */
+class Prefetcher {
+public:
+    Prefetcher(std::string pathToReplace, std::string replacementDir);
+
+    ~Prefetcher();
+
+    Prefetcher(const Prefetcher &)            = delete;
+    Prefetcher &operator=(const Prefetcher &) = delete;
+
+    /**
+     * Learns from the open and queues the prefetch of the likely successors. Never blocks on a worker.
+     */
+    static void onOpen(const std::shared_ptr<Prefetcher> &prefetcher, std::string_view fullPath);
+
+    /**
+     * Queues reading the start of the file into the cache, for directories the start of the files directly
+     * inside it, until the cache is full. Works without learning. Returns false if the task could not be queued.
+     */
+    static bool warmUp(const std::shared_ptr<Prefetcher> &prefetcher, std::string_view fullPath);
+
+    /**
+     * Learning (and prefetching the learned successors) is disabled until it is enabled by CR_LAYER_OPTION_PREFETCH.
+     * Enabling it loads the successors of previous runs, disabling it saves them.
+     */
+    static void setLearning(const std::shared_ptr<Prefetcher> &prefetcher, bool learning);
+
+    /**
+     * Returns the key of the file if (a part of) it is cached or being prefetched, an empty string otherwise.
+     */
+    std::string getCachedKey(std::string_view fullPath);
+
+    /**
+     * Frees the cached data of the file.
+     */
+    void drop(const std::string &key);
+
+    /**
+     * Called when the files of the layer may have been modified, the data that is cached (or being read) is not
+     * used anymore.
+     */
+    void invalidate() {
+        pGeneration++;
+    }
+
+    /**
+     * Returns the key of a file of the layer, the normalized path relative to the replacement directory.
+     */
+    [[nodiscard]] std::string getKey(std::string_view fullPath) const;
+
+    /**
+     * Copies the range from the cache. Returns the number of bytes copied, or -1 if the range is not cached.
+     */
+    int64_t readCached(const std::string &key, uint32_t pos, void *buffer, uint32_t size);
+
+    /**
+     * Queues writing the learned successors if they have changed.
+     */
+    static void save(const std::shared_ptr<Prefetcher> &prefetcher);
+
+    void getStats(PrefetchStats *outStats);
+
+private:
+    // Loads the successors that have been learned during previous runs on a worker thread.
+    static void load(const std::shared_ptr<Prefetcher> &prefetcher);
+
+    struct Successor {
+        std::string key;
+        uint32_t count;
+    };
+
+    struct CachedFile {
+        std::string key;
+        uint32_t generation;
+        uint32_t lastUse;
+        bool pending;
+        bool used;
+        // The whole file if size < PREFETCH_READ_SIZE.
+        uint32_t size;
+        uint8_t *data;
+    };
+
+    void learn(const std::string &key);
+
+    // Adds a pending entry for the file, returns false if it is already cached or pending.
+    bool reserve(const std::string &key);
+
+    bool reserveLocked(const std::string &key);
+
+    void evict(uint32_t neededSize);
+
+    // Returns the number of bytes that have been cached.
+    uint32_t readAhead(const std::string &key);
+
+    void warmUpPath(const std::string &key);
+
+    void loadSuccessors();
+
+    void writeSuccessors();
+
+    std::string pPathToReplace;
+    std::string pReplacementDir;
+    std::string pFilePath;
+
+    std::mutex pMutex;
+    std::unordered_map<std::string, std::vector<Successor>> pSuccessors;
+    bool pLearning          = false;
+    bool pSuccessorsChanged = false;
+    std::string pLastKey;
+    OSTime pLastOpenTime = 0;
+
+    std::vector<CachedFile> pCache;
+    uint32_t pCacheSize = 0;
+    uint32_t pClock     = 0;
+    uint32_t pPending   = 0;
+    std::atomic<uint32_t> pGeneration{0};
+
+    PrefetchStats pStats{};
+};
@@ -0,0 +1,75 @@
+#include "ReadCoalescer.h"
+#include "utils/logger.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+ReadCoalescer::~ReadCoalescer() {
+    for (auto &entry : pEntries) {
+        free(entry.data);
+    }
+}
+
+bool ReadCoalescer::lookup(const std::string &file, uint32_t pos, void *buffer, uint32_t size) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    auto now = OSGetTime();
+    for (auto &entry : pEntries) {
+        if (entry.size == 0 || entry.file != file || pos < entry.pos || pos - entry.pos > entry.size || size > entry.size - (pos - entry.pos)) {
+            continue;
+        }
+        if (OSTicksToMilliseconds(now - entry.time) > READ_COALESCE_WINDOW) {
+            continue;
+        }
+        memcpy(buffer, entry.data + (pos - entry.pos), size);
+        pStats.numCoalesced++;
+        pStats.bytesCoalesced += size;
+        return true;
+    }
+    return false;
+}
+
+void ReadCoalescer::store(const std::string &file, uint32_t pos, const void *buffer, uint32_t size) {
+    if (size == 0 || size > READ_COALESCE_MAX_SIZE) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pMutex);
+    Entry *entry = nullptr;
+    if (pEntries.size() < READ_COALESCE_MAX_ENTRIES) {
+        entry = &pEntries.emplace_back();
+    } else {
+        entry = &*std::min_element(pEntries.begin(), pEntries.end(), [](auto &a, auto &b) { return a.time < b.time; });
+    }
+    // The buffer of the replaced entry is reused unless it's too small or much larger than the read.
+    if (entry->capacity < size || entry->capacity / 2 > size) {
+        free(entry->data);
+        entry->data     = (uint8_t *) malloc(size);
+        entry->capacity = entry->data != nullptr ? size : 0;
+    }
+    if (entry->data == nullptr) {
+        entry->file.clear();
+        entry->size = 0;
+        entry->time = 0;
+        return;
+    }
+    entry->file = file;
+    entry->pos  = pos;
+    entry->size = size;
+    entry->time = OSGetTime();
+    memcpy(entry->data, buffer, size);
+}
+
+void ReadCoalescer::forget(const std::string &file) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    std::erase_if(pEntries, [&](auto &entry) {
+        if (entry.file != file) {
+            return false;
+        }
+        free(entry.data);
+        return true;
+    });
+}
+
+void ReadCoalescer::getStats(CoalesceStats *outStats) {
+    std::lock_guard<std::mutex> lock(pMutex);
+    *outStats = pStats;
+}
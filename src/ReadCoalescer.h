@@ -0,0 +1,69 @@
+#pragma once
+#include <coreinit/time.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define READ_COALESCE_MAX_ENTRIES 4
+// Larger reads are not kept.
+#define READ_COALESCE_MAX_SIZE    0x40000
+// A read is only served from a previous one if it has been done within this time (in ms).
+#define READ_COALESCE_WINDOW      100
+
+struct CoalesceStats {
+    // Reads that have been served from the data of a previous read.
+    uint32_t numCoalesced;
+    uint32_t bytesCoalesced;
+};
+
+/**
+ * Deduplicates reads of the same range of a file through different handles (see CR_LAYER_OPTION_COALESCE_READS),
+ * e.g. when several threads of a job system load the same asset at the same time.
+ *
+ * All redirected FS calls are serialized by the fsLayerMutex, so two reads are never in flight at the same
+ * time: the read of the first handle completes before the next one starts. The data of the last reads of
+ * files that are open more than once is therefore kept for a short time, and reads of a range that has just
+ * been read by another handle are served from it.
+ */
+class ReadCoalescer {
+public:
+    ReadCoalescer() = default;
+
+    ~ReadCoalescer();
+
+    ReadCoalescer(const ReadCoalescer &)            = delete;
+    ReadCoalescer &operator=(const ReadCoalescer &) = delete;
+
+    /**
+     * Copies the range if it has been read from the file within the last READ_COALESCE_WINDOW ms. Files are
+     * identified by their normalized path (see LayerIndex::getKey).
+     */
+    bool lookup(const std::string &file, uint32_t pos, void *buffer, uint32_t size);
+
+    /**
+     * Keeps the data that has been read, replacing the oldest entry. The buffers are sized to the reads.
+     */
+    void store(const std::string &file, uint32_t pos, const void *buffer, uint32_t size);
+
+    /**
+     * Drops the data of the file, e.g. once it is not open more than once anymore.
+     */
+    void forget(const std::string &file);
+
+    void getStats(CoalesceStats *outStats);
+
+private:
+    struct Entry {
+        std::string file;
+        uint32_t pos;
+        uint32_t size;
+        OSTime time;
+        uint32_t capacity;
+        uint8_t *data;
+    };
+
+    std::mutex pMutex;
+    std::vector<Entry> pEntries;
+    CoalesceStats pStats{};
+};
@@ -0,0 +1,21 @@
+#include "SharedFSAClient.h"
+#include "utils/logger.h"
+
+SharedFSAClient::SharedFSAClient(const char *name) {
+    FSAInit();
+    pHandle = FSAAddClient(nullptr);
+    if (pHandle < 0) {
+        DEBUG_FUNCTION_LINE_ERR("[%s] FSAClientHandle failed: %s (%d)", name, FSAGetStatusStr(static_cast<FSError>(pHandle)), pHandle);
+        pHandle = 0;
+    }
+}
+
+SharedFSAClient::~SharedFSAClient() {
+    if (pHandle) {
+        FSError res;
+        if ((res = FSADelClient(pHandle)) != FS_ERROR_OK) {
+            DEBUG_FUNCTION_LINE_ERR("FSADelClient failed: %s (%d)", FSAGetStatusStr(res), res);
+        }
+        pHandle = 0;
+    }
+}
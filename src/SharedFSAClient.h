@@ -0,0 +1,23 @@
+#pragma once
+#include <coreinit/filesystem_fsa.h>
+
+/**
+ * Owns a FSA client. Layers share it with background tasks via std::shared_ptr, so the client
+ * stays valid until the last task that uses it has finished, even if the layer has been removed.
+ */
+class SharedFSAClient {
+public:
+    explicit SharedFSAClient(const char *name);
+
+    ~SharedFSAClient();
+
+    SharedFSAClient(const SharedFSAClient &)            = delete;
+    SharedFSAClient &operator=(const SharedFSAClient &) = delete;
+
+    [[nodiscard]] FSAClientHandle get() const {
+        return pHandle;
+    }
+
+private:
+    FSAClientHandle pHandle = 0;
+};
@@ -0,0 +1,95 @@
+#include "WhiteoutIndex.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include <cstdio>
+#include <cstring>
+
+WhiteoutIndex::WhiteoutIndex(std::string rootPath, std::string deletePrefix) : pRootPath(std::move(rootPath)),
+                                                                               pDeletePrefix(std::move(deletePrefix)) {
+    while (pRootPath.size() > 1 && pRootPath.back() == '/') {
+        pRootPath.pop_back();
+    }
+}
+
+bool WhiteoutIndex::contains(std::string_view relativePath) {
+    auto key = getKey(relativePath);
+    std::lock_guard<std::mutex> lock(pMutex);
+    return pWhiteouts.contains(key);
+}
+
+uint32_t WhiteoutIndex::getSize() {
+    std::lock_guard<std::mutex> lock(pMutex);
+    return pWhiteouts.size();
+}
+
+void WhiteoutIndex::load(const std::vector<std::string> &paths) {
+    if (!loadManifest()) {
+        for (auto &path : paths) {
+            addMarker(path);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(pMutex);
+    pReady.store(true, std::memory_order_release);
+    DEBUG_FUNCTION_LINE_VERBOSE("Loaded %d whiteouts for %s", pWhiteouts.size(), pRootPath.c_str());
+}
+
+bool WhiteoutIndex::loadManifest() {
+    auto manifestPath = pRootPath + WHITEOUT_MANIFEST_SUFFIX;
+    FILE *f           = fopen(manifestPath.c_str(), "r");
+    if (f == nullptr) {
+        return false;
+    }
+    char line[0x300];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        auto length = strlen(line);
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            length--;
+        }
+        if (length == 0 || line[0] == '#') {
+            continue;
+        }
+        auto key = getKey(std::string_view(line, length));
+        std::lock_guard<std::mutex> lock(pMutex);
+        pWhiteouts.insert(std::move(key));
+    }
+    fclose(f);
+    DEBUG_FUNCTION_LINE_VERBOSE("Loaded whiteouts from %s", manifestPath.c_str());
+    return true;
+}
+
+void WhiteoutIndex::addMarker(std::string_view relativeMarkerPath) {
+    std::string key;
+    if (!getTargetKey(relativeMarkerPath, key)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pMutex);
+    pWhiteouts.insert(std::move(key));
+}
+
+std::string WhiteoutIndex::getMarkerPath(std::string_view relativePath) const {
+    auto slash = relativePath.find_last_of("/\\");
+    if (slash == std::string_view::npos) {
+        return pDeletePrefix + std::string(relativePath);
+    }
+    return std::string(relativePath.substr(0, slash + 1)).append(pDeletePrefix).append(relativePath.substr(slash + 1));
+}
+
+bool WhiteoutIndex::getTargetKey(std::string_view relativeMarkerPath, std::string &outKey) {
+    auto slash    = relativeMarkerPath.find_last_of("/\\");
+    auto fileName = slash == std::string_view::npos ? relativeMarkerPath : relativeMarkerPath.substr(slash + 1);
+    if (!starts_with_case_insensitive(fileName, pDeletePrefix) || fileName.length() == pDeletePrefix.length()) {
+        return false;
+    }
+    auto dirName = slash == std::string_view::npos ? std::string_view() : relativeMarkerPath.substr(0, slash + 1);
+    outKey       = getKey(std::string(dirName).append(fileName.substr(pDeletePrefix.length())));
+    return true;
+}
+
+std::string WhiteoutIndex::getKey(std::string_view relativePath) {
+    auto res = normalize_path_key(relativePath);
+    if (!res.empty() && res.front() == '/') {
+        res.erase(0, 1);
+    }
+    return res;
+}
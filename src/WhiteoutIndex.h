@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#define WHITEOUT_MANIFEST_SUFFIX ".cr_whiteouts"
+
+/**
+ * Set of the paths (relative to the replacement directory) that have been marked as deleted.
+ *
+ * The index is loaded once the LayerIndex of the layer is complete, either from the manifest file next
+ * to the replacement directory ("<replacement dir>.cr_whiteouts", one relative path per line) or from
+ * the markers found by the LayerIndex. If a manifest exists, it is used exclusively. Only read-only layers
+ * have an index, so the whiteouts don't change once they have been loaded.
+ */
+class WhiteoutIndex {
+public:
+    WhiteoutIndex(std::string rootPath, std::string deletePrefix);
+
+    /**
+     * Loads the manifest, or uses the markers of the given relative paths if no manifest exists.
+     */
+    void load(const std::vector<std::string> &paths);
+
+    [[nodiscard]] bool isReady() const {
+        return pReady.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Returns true if a whiteout for the path (relative to the replacement directory) exists.
+     * Must only be used once the index is ready.
+     */
+    bool contains(std::string_view relativePath);
+
+    /**
+     * Returns the relative path of the marker for the given relative path.
+     */
+    [[nodiscard]] std::string getMarkerPath(std::string_view relativePath) const;
+
+    uint32_t getSize();
+
+private:
+    bool loadManifest();
+
+    /**
+     * Adds the whiteout of a marker, the path is relative to the replacement directory and includes the
+     * delete prefix.
+     */
+    void addMarker(std::string_view relativeMarkerPath);
+
+    bool getTargetKey(std::string_view relativeMarkerPath, std::string &outKey);
+
+    static std::string getKey(std::string_view relativePath);
+
+    std::string pRootPath;
+    std::string pDeletePrefix;
+
+    std::mutex pMutex;
+    std::unordered_set<std::string> pWhiteouts;
+
+    std::atomic<bool> pReady{false};
+};
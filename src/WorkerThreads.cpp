@@ -0,0 +1,221 @@
+#include "WorkerThreads.h"
+#include "utils/StringTools.h"
+#include "utils/logger.h"
+#include "utils/utils.h"
+#include <algorithm>
+#include <coreinit/cache.h>
+#include <coreinit/core.h>
+#include <coreinit/debug.h>
+#include <coreinit/event.h>
+#include <malloc.h>
+
+WorkerThreadData gWorkerThreadData[3];
+static bool sWorkerThreadsRunning = false;
+
+static int32_t workerThreadCallback([[maybe_unused]] int argc, const char **argv) {
+    auto *magic = ((WorkerThreadData *) argv);
+
+    DEBUG_FUNCTION_LINE_VERBOSE("Hello from Worker Thread for core: %d", OSGetCoreId());
+
+    OSMessage recv;
+    while (OSReceiveMessage(&magic->queue, &recv, OS_MESSAGE_FLAGS_BLOCKING)) {
+        if (recv.args[0] == WORKER_QUEUE_COMMAND_STOP) {
+            DEBUG_FUNCTION_LINE_VERBOSE("Received break command! Stop thread");
+            break;
+        } else if (recv.args[0] == WORKER_QUEUE_COMMAND_RUN) {
+            auto *task = (std::function<void()> *) recv.message;
+            (*task)();
+            delete task;
+            __atomic_fetch_sub(&magic->pendingTasks, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return 0;
+}
+
+void startWorkerThreads() {
+    int32_t threadAttributes[] = {OS_THREAD_ATTRIB_AFFINITY_CPU0, OS_THREAD_ATTRIB_AFFINITY_CPU1, OS_THREAD_ATTRIB_AFFINITY_CPU2};
+
+    int coreId = 0;
+    for (int core : threadAttributes) {
+        auto *threadData = &gWorkerThreadData[coreId];
+        memset(threadData, 0, sizeof(*threadData));
+        threadData->setup  = false;
+        threadData->thread = (OSThread *) memalign(8, sizeof(OSThread));
+        if (!threadData->thread) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to allocate threadData");
+            OSFatal("ContentRedirectionModule: Failed to allocate Worker Thread");
+            continue;
+        }
+        threadData->stack = (uint8_t *) memalign(0x20, WORKER_THREAD_STACK_SIZE);
+        if (!threadData->stack) {
+            free(threadData->thread);
+            DEBUG_FUNCTION_LINE_ERR("Failed to allocate threadData stack");
+            OSFatal("ContentRedirectionModule: Failed to allocate Worker Thread stack");
+            continue;
+        }
+
+        // Init the queue before the thread is started, tasks may be queued at any time.
+        constexpr int32_t messageSize = sizeof(threadData->messages) / sizeof(threadData->messages[0]);
+        OSInitMessageQueue(&threadData->queue, threadData->messages, messageSize);
+
+        OSMemoryBarrier();
+
+        if (!OSCreateThread(threadData->thread, &workerThreadCallback, 1, (char *) threadData, reinterpret_cast<void *>((uint32_t) threadData->stack + WORKER_THREAD_STACK_SIZE), WORKER_THREAD_STACK_SIZE, WORKER_THREAD_PRIORITY, core)) {
+            free(threadData->thread);
+            free(threadData->stack);
+            threadData->setup = false;
+            DEBUG_FUNCTION_LINE_ERR("failed to create threadData");
+            OSFatal("ContentRedirectionModule: Failed to create threadData");
+        }
+
+        strncpy(threadData->threadName, string_format("ContentRedirection Worker Thread %d", coreId).c_str(), sizeof(threadData->threadName) - 1);
+        OSSetThreadName(threadData->thread, threadData->threadName);
+        OSResumeThread(threadData->thread);
+        threadData->setup = true;
+        coreId++;
+    }
+
+    sWorkerThreadsRunning = true;
+    OSMemoryBarrier();
+}
+
+void stopWorkerThreads() {
+    if (!sWorkerThreadsRunning) {
+        return;
+    }
+    sWorkerThreadsRunning = false;
+    OSMemoryBarrier();
+
+    for (auto &gThread : gWorkerThreadData) {
+        auto *thread = &gThread;
+        if (!thread->setup) {
+            continue;
+        }
+        OSMessage message;
+        message.args[0] = WORKER_QUEUE_COMMAND_STOP;
+        OSSendMessage(&thread->queue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+
+        if (OSIsThreadSuspended(thread->thread)) {
+            OSResumeThread(thread->thread);
+        }
+
+        OSJoinThread(thread->thread, nullptr);
+        thread->setup = false;
+        if (thread->stack) {
+            free(thread->stack);
+            thread->stack = nullptr;
+        }
+        if (thread->thread) {
+            free(thread->thread);
+            thread->thread = nullptr;
+        }
+    }
+}
+
+bool queueWorkerTask(std::function<void()> &&task, int32_t coreId) {
+    if (!sWorkerThreadsRunning) {
+        return false;
+    }
+    if (coreId == WORKER_THREAD_ANY_CORE) {
+        auto currentCore = (int32_t) OSGetCoreId();
+        uint32_t best    = 0xFFFFFFFF;
+        for (int32_t i = 0; i < 3; i++) {
+            if (!gWorkerThreadData[i].setup) {
+                continue;
+            }
+            // Pretend the worker of the current core is busier, the caller is most likely running on that core.
+            auto pending = __atomic_load_n(&gWorkerThreadData[i].pendingTasks, __ATOMIC_RELAXED) * 2 + (i == currentCore ? 1 : 0);
+            if (pending < best) {
+                best   = pending;
+                coreId = i;
+            }
+        }
+    }
+    if (coreId < 0 || coreId >= 3 || !gWorkerThreadData[coreId].setup) {
+        return false;
+    }
+
+    auto *taskPtr = new (std::nothrow) std::function<void()>(std::move(task));
+    if (taskPtr == nullptr) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate memory for task");
+        return false;
+    }
+
+    auto *threadData = &gWorkerThreadData[coreId];
+    __atomic_fetch_add(&threadData->pendingTasks, 1, __ATOMIC_RELAXED);
+
+    OSMessage send;
+    send.message = taskPtr;
+    send.args[0] = WORKER_QUEUE_COMMAND_RUN;
+    if (!OSSendMessage(&threadData->queue, &send, OS_MESSAGE_FLAGS_NONE)) {
+        DEBUG_FUNCTION_LINE_VERBOSE("Message Queue for Worker Thread %d is full", coreId);
+        __atomic_fetch_sub(&threadData->pendingTasks, 1, __ATOMIC_RELAXED);
+        delete taskPtr;
+        return false;
+    }
+    return true;
+}
+
+namespace {
+    struct ParallelForState {
+        const std::function<void(uint32_t)> *func;
+        uint32_t numItems;
+        uint32_t nextItem;
+        uint32_t finishedItems;
+        OSEvent finished;
+
+        void run() {
+            while (true) {
+                auto item = __atomic_fetch_add(&nextItem, 1, __ATOMIC_RELAXED);
+                if (item >= numItems) {
+                    break;
+                }
+                (*func)(item);
+                if (__atomic_add_fetch(&finishedItems, 1, __ATOMIC_ACQ_REL) == numItems) {
+                    OSSignalEvent(&finished);
+                }
+            }
+        }
+    };
+} // namespace
+
+void parallelForOnWorkers(uint32_t numItems, uint32_t maxHelpers, const std::function<void(uint32_t)> &func) {
+    if (numItems == 0) {
+        return;
+    }
+    std::shared_ptr<ParallelForState> state;
+    if (numItems > 1 && maxHelpers > 0) {
+        state = make_shared_nothrow<ParallelForState>();
+    }
+    if (!state) {
+        for (uint32_t i = 0; i < numItems; i++) {
+            func(i);
+        }
+        return;
+    }
+    state->func          = &func;
+    state->numItems      = numItems;
+    state->nextItem      = 0;
+    state->finishedItems = 0;
+    OSInitEvent(&state->finished, false, OS_EVENT_MODE_MANUAL);
+
+    // Tasks that run after all items have been claimed do nothing, they only keep the state alive.
+    uint32_t numHelpers = std::min(numItems - 1, maxHelpers);
+    for (uint32_t i = 0; i < numHelpers; i++) {
+        if (!queueWorkerTask([state]() { state->run(); })) {
+            break;
+        }
+    }
+    state->run();
+    OSWaitEvent(&state->finished);
+}
+
+bool isWorkerThread(OSThread *thread) {
+    for (auto &data : gWorkerThreadData) {
+        if (data.setup && data.thread == thread) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <coreinit/messagequeue.h>
+#include <coreinit/thread.h>
+#include <functional>
+
+#define WORKER_THREAD_PRIORITY       25
+#define WORKER_THREAD_STACK_SIZE     (32 * 1024)
+
+#define WORKER_QUEUE_COMMAND_STOP    0x13371338
+#define WORKER_QUEUE_COMMAND_RUN     0x42424243
+
+#define WORKER_THREAD_ANY_CORE       -1
+
+struct WorkerThreadData {
+    OSThread *thread;
+    void *stack;
+    OSMessageQueue queue;
+    OSMessage messages[0x20];
+    uint32_t pendingTasks;
+    bool setup;
+    char threadName[0x50];
+};
+
+extern WorkerThreadData gWorkerThreadData[3];
+
+/**
+ * Starts one low priority worker thread per core. Worker threads are used for background work
+ * like prefetching and must never be waited on from an IO thread while holding the fsLayerMutex.
+ */
+void startWorkerThreads();
+
+/**
+ * Stops the workers threads. Tasks that already have been queued are executed before the threads exit.
+ */
+void stopWorkerThreads();
+
+/**
+ * Queues a task to a worker thread, never blocks. If coreId is WORKER_THREAD_ANY_CORE the worker
+ * with the fewest pending tasks is used, preferring workers that are not running on the current core.
+ * Returns false if the task could not be queued.
+ */
+bool queueWorkerTask(std::function<void()> &&task, int32_t coreId = WORKER_THREAD_ANY_CORE);
+
+/**
+ * Calls func(i) for every i < numItems on the calling thread and up to maxHelpers workers. The items are
+ * claimed one by one: the caller processes all items no worker has started yet and only waits for the
+ * ones a worker is already processing. This makes it safe to use on an IO thread, as long as func never
+ * issues FS calls.
+ */
+void parallelForOnWorkers(uint32_t numItems, uint32_t maxHelpers, const std::function<void(uint32_t)> &func);
+
+bool isWorkerThread(OSThread *thread);
@@ -1,7 +1,19 @@
+#include "Batch.h"
 #include "FSWrapper.h"
+#include "FSWrapperCallback.h"
+#include "FSWrapperMemory.h"
 #include "FSWrapperMergeDirsWithParent.h"
+#include "FSWrapperPack.h"
+#include "FSWrapperPatch.h"
+#include "FSWrapperRam.h"
+#include "FileStream.h"
 #include "FileUtils.h"
 #include "IFSWrapper.h"
+#include "LayerIndex.h"
+#include "Prefetcher.h"
+#include "ReadCoalescer.h"
+#include "WorkerThreads.h"
+#include "export.h"
 #include "malloc.h"
 #include "utils/StringTools.h"
 #include "utils/logger.h"
@@ -96,6 +108,7 @@ ContentRedirectionApiErrorType CRAddFSLayer(CRLayerHandle *handle, const char *l
         return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
     }
     std::unique_ptr<IFSWrapper> ptr;
+    FSWrapperPatch *addedPatchLayer = nullptr;
     if (layerType == FS_LAYER_TYPE_CONTENT_REPLACE) {
         DEBUG_FUNCTION_LINE_INFO("Redirecting \"/vol/content\" to \"%s\", mode: \"replace\"", replacementDir);
         ptr = make_unique_nothrow<FSWrapper>(layerName, "/vol/content", replacementDir, false, false);
@@ -114,6 +127,49 @@ ContentRedirectionApiErrorType CRAddFSLayer(CRLayerHandle *handle, const char *l
         } else {
             ptr = make_unique_nothrow<FSWrapper>(layerName, targetPath.c_str(), replacementDir, false, false);
         }
+    } else if (layerType == FS_LAYER_TYPE_CONTENT_PACK_MERGE || layerType == FS_LAYER_TYPE_AOC_PACK_MERGE) {
+        std::string targetPath = "/vol/content";
+        if (layerType == FS_LAYER_TYPE_AOC_PACK_MERGE && !getAOCPath(targetPath)) {
+            DEBUG_FUNCTION_LINE_ERR("(%s) Failed to get the AOC path. Not redirecting /vol/aoc", layerName);
+            return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+        }
+        auto archive = PackArchive::open(replacementDir);
+        if (!archive) {
+            DEBUG_FUNCTION_LINE_ERR("(%s) Failed to open pack %s", layerName, replacementDir);
+            return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+        }
+        DEBUG_FUNCTION_LINE_INFO("Redirecting \"%s\" to pack \"%s\", mode: \"merge\"", targetPath.c_str(), replacementDir);
+        ptr = make_unique_nothrow<FSWrapperPack>(layerName, targetPath, std::move(archive));
+    } else if (layerType == FS_LAYER_TYPE_CONTENT_REPLACE_RAM || layerType == FS_LAYER_TYPE_CONTENT_MERGE_RAM) {
+        auto archive = PackArchive::loadDirectory(replacementDir, PACK_MEMORY_MAX_SIZE);
+        if (!archive) {
+            DEBUG_FUNCTION_LINE_ERR("(%s) Failed to load %s into memory", layerName, replacementDir);
+            return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+        }
+        if (layerType == FS_LAYER_TYPE_CONTENT_MERGE_RAM) {
+            DEBUG_FUNCTION_LINE_INFO("Redirecting \"/vol/content\" to \"%s\" (in memory), mode: \"merge\"", replacementDir);
+            ptr = make_unique_nothrow<FSWrapperPack>(layerName, "/vol/content", std::move(archive));
+        } else {
+            DEBUG_FUNCTION_LINE_INFO("Redirecting \"/vol/content\" to \"%s\" (in memory), mode: \"replace\"", replacementDir);
+            ptr = make_unique_nothrow<FSWrapperRam>(layerName, "/vol/content", std::move(archive));
+        }
+    } else if (layerType == FS_LAYER_TYPE_CONTENT_MEMORY_FILES) {
+        auto archive = PackArchive::fromMemoryFiles(MEMORY_LAYER_ROOT, {});
+        if (!archive) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to allocate memory");
+            return CONTENT_REDIRECTION_API_ERROR_NO_MEMORY;
+        }
+        DEBUG_FUNCTION_LINE_INFO("Redirecting \"/vol/content\" to memory files, mode: \"merge\"");
+        ptr = make_unique_nothrow<FSWrapperMemory>(layerName, "/vol/content", std::move(archive));
+    } else if (layerType == FS_LAYER_TYPE_CONTENT_PATCH) {
+        auto patchLayer = make_unique_nothrow<FSWrapperPatch>(layerName, "/vol/content", replacementDir);
+        if (patchLayer && !patchLayer->loadPatches()) {
+            DEBUG_FUNCTION_LINE_ERR("(%s) Failed to load patches from %s", layerName, replacementDir);
+            return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+        }
+        DEBUG_FUNCTION_LINE_INFO("Patching \"/vol/content\" with \"%s\"", replacementDir);
+        addedPatchLayer = patchLayer.get();
+        ptr             = std::move(patchLayer);
     } else if (layerType == FS_LAYER_TYPE_SAVE_REPLACE) {
         DEBUG_FUNCTION_LINE_INFO("Redirecting \"/vol/save\" to \"%s\", mode: \"replace\"", replacementDir);
         ptr = make_unique_nothrow<FSWrapper>(layerName, "/vol/save", replacementDir, false, true);
@@ -135,25 +191,90 @@ ContentRedirectionApiErrorType CRAddFSLayer(CRLayerHandle *handle, const char *l
         std::lock_guard<std::mutex> lock(fsLayerMutex);
         *handle = (CRLayerHandle) ptr->getHandle();
         fsLayers.push_back(std::move(ptr));
+        if (addedPatchLayer != nullptr) {
+            addedPatchLayer->queueSourceValidation();
+        }
         return CONTENT_REDIRECTION_API_ERROR_NONE;
     }
     DEBUG_FUNCTION_LINE_ERR("Failed to allocate memory");
     return CONTENT_REDIRECTION_API_ERROR_NO_MEMORY;
 }
 
-ContentRedirectionApiErrorType CRRemoveFSLayer(CRLayerHandle handle) {
-    if (!remove_locked_first_if(fsLayerMutex, fsLayers, [handle](auto &cur) { return (CRLayerHandle) cur->getHandle() == handle; })) {
-        DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
-        return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+ContentRedirectionApiErrorType CRAddCallbackLayer(CRLayerHandle *handle, const char *layerName, const char *pathToReplace,
+                                                  const CRCallbackLayerFunctions *functions) {
+    if (!handle || layerName == nullptr || pathToReplace == nullptr || pathToReplace[0] != '/' || functions == nullptr ||
+        functions->stat == nullptr || functions->open == nullptr || functions->readAt == nullptr) {
+        DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_INVALID_ARG");
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
     }
+    auto ptr = make_unique_nothrow<FSWrapperCallback>(layerName, pathToReplace, *functions);
+    if (!ptr) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to allocate memory");
+        return CONTENT_REDIRECTION_API_ERROR_NO_MEMORY;
+    }
+    DEBUG_FUNCTION_LINE_INFO("Redirecting \"%s\" to callbacks of layer %s", pathToReplace, layerName);
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    *handle = (CRLayerHandle) ptr->getHandle();
+    fsLayers.push_back(std::move(ptr));
     return CONTENT_REDIRECTION_API_ERROR_NONE;
 }
 
+ContentRedirectionApiErrorType CRGetCallbackLayerStats(CRLayerHandle handle, CRCallbackLayerStats *outStats) {
+    if (outStats == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if ((CRLayerHandle) cur->getHandle() == handle) {
+            auto *layer = dynamic_cast<FSWrapperCallback *>(cur.get());
+            if (layer == nullptr) {
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
+            layer->getStats(outStats);
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+ContentRedirectionApiErrorType CRRemoveFSLayer(CRLayerHandle handle) {
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (uint32_t i = 0; i < fsLayers.size(); i++) {
+        if ((CRLayerHandle) fsLayers[i]->getHandle() == handle) {
+            fsLayers.erase(fsLayers.begin() + i);
+            // The layers above saw the removed layer through their parent.
+            bumpLayerGenerations(i);
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
 ContentRedirectionApiErrorType CRSetActive(CRLayerHandle handle, bool active) {
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (uint32_t i = 0; i < fsLayers.size(); i++) {
+        if ((CRLayerHandle) fsLayers[i]->getHandle() == handle) {
+            fsLayers[i]->setActive(active);
+            bumpLayerGenerations(i);
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+ContentRedirectionApiErrorType CRSetLayerOption(CRLayerHandle handle, CRLayerOption option, uint32_t value) {
     std::lock_guard<std::mutex> lock(fsLayerMutex);
     for (auto &cur : fsLayers) {
         if ((CRLayerHandle) cur->getHandle() == handle) {
-            cur->setActive(active);
+            if (!cur->setOption(option, value)) {
+                DEBUG_FUNCTION_LINE_WARN("Layer %s does not support option %d", cur->getName().c_str(), option);
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
             return CONTENT_REDIRECTION_API_ERROR_NONE;
         }
     }
@@ -162,6 +283,239 @@ ContentRedirectionApiErrorType CRSetActive(CRLayerHandle handle, bool active) {
     return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
 }
 
+ContentRedirectionApiErrorType CRGetLayerIndexStats(CRLayerHandle handle, CRLayerIndexStats *outStats) {
+    if (outStats == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if ((CRLayerHandle) cur->getHandle() == handle) {
+            auto index = cur->getIndex();
+            if (!index) {
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
+            LayerIndexStats stats{};
+            index->getStats(&stats);
+            outStats->state          = (CRLayerIndexState) stats.state;
+            outStats->numEntries     = stats.numEntries;
+            outStats->numDirectories = stats.numDirectories;
+            outStats->memoryUsage    = stats.memoryUsage;
+            outStats->buildTimeInUs  = stats.buildTimeInUs;
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+ContentRedirectionApiErrorType CRGetLayerPrefetchStats(CRLayerHandle handle, CRLayerPrefetchStats *outStats) {
+    if (outStats == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if ((CRLayerHandle) cur->getHandle() == handle) {
+            auto prefetcher = cur->getPrefetcher();
+            if (!prefetcher) {
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
+            PrefetchStats stats{};
+            prefetcher->getStats(&stats);
+            outStats->numPrefetched = stats.numPrefetched;
+            outStats->numUsed       = stats.numUsed;
+            outStats->numWasted     = stats.numWasted;
+            outStats->numHits       = stats.numHits;
+            outStats->cacheSize     = stats.cacheSize;
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+ContentRedirectionApiErrorType CRGetLayerStreamStats(CRLayerHandle handle, CRLayerStreamStats *outStats) {
+    if (outStats == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if ((CRLayerHandle) cur->getHandle() == handle) {
+            StreamStats stats{};
+            if (!cur->getStreamStats(&stats)) {
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
+            outStats->numStreams   = stats.numStreams;
+            outStats->numActive    = stats.numActive;
+            outStats->numHits      = stats.numHits;
+            outStats->numUnderruns = stats.numUnderruns;
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+ContentRedirectionApiErrorType CRGetLayerCoalesceStats(CRLayerHandle handle, CRLayerCoalesceStats *outStats) {
+    if (outStats == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if ((CRLayerHandle) cur->getHandle() == handle) {
+            CoalesceStats stats{};
+            if (!cur->getCoalesceStats(&stats)) {
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
+            outStats->numCoalesced   = stats.numCoalesced;
+            outStats->bytesCoalesced = stats.bytesCoalesced;
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+ContentRedirectionApiErrorType CRPrefetch(const char *path) {
+    if (path == nullptr || path[0] != '/') {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    // The caller must not wait for the fsLayerMutex, which is held during every redirected FS call.
+    if (!queueWorkerTask([path = std::string(path)]() {
+            std::lock_guard<std::mutex> lock(fsLayerMutex);
+            for (auto it = fsLayers.rbegin(); it != fsLayers.rend(); ++it) {
+                if ((*it)->isActive() && (*it)->warmUp(path)) {
+                    return;
+                }
+            }
+            DEBUG_FUNCTION_LINE_VERBOSE("No layer caches %s", path.c_str());
+        })) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to queue the prefetch of %s", path);
+        return CONTENT_REDIRECTION_API_ERROR_NO_MEMORY;
+    }
+    return CONTENT_REDIRECTION_API_ERROR_NONE;
+}
+
+ContentRedirectionApiErrorType CRAdvise(FSFileHandle handle, CRFileAdvice advice) {
+    if (advice < CR_FILE_ADVICE_NORMAL || advice > CR_FILE_ADVICE_DONT_NEED) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    // The handle is resolved right away, once it's closed its value may be reused by another file. The layer
+    // queues the IO of the hint to a worker itself.
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if (cur->isValidFileHandle(handle)) {
+            if (!cur->advise(handle, advice)) {
+                DEBUG_FUNCTION_LINE_WARN("Failed to queue the advice for handle %08X", handle);
+                return CONTENT_REDIRECTION_API_ERROR_NO_MEMORY;
+            }
+            break;
+        }
+    }
+    return CONTENT_REDIRECTION_API_ERROR_NONE;
+}
+
+ContentRedirectionApiErrorType CRAddMemoryFile(CRLayerHandle handle, const char *path, const void *data, uint32_t size,
+                                               CRMemoryFileReleaseCallback release, void *context) {
+    if (path == nullptr || (data == nullptr && size > 0)) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if ((CRLayerHandle) cur->getHandle() == handle) {
+            auto *layer = dynamic_cast<FSWrapperMemory *>(cur.get());
+            if (layer == nullptr || !layer->addFile(path, data, size, release, context)) {
+                DEBUG_FUNCTION_LINE_WARN("Failed to add memory file %s to layer %s", path, cur->getName().c_str());
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+ContentRedirectionApiErrorType CRRemoveMemoryFile(CRLayerHandle handle, const char *path) {
+    if (path == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(fsLayerMutex);
+    for (auto &cur : fsLayers) {
+        if ((CRLayerHandle) cur->getHandle() == handle) {
+            auto *layer = dynamic_cast<FSWrapperMemory *>(cur.get());
+            if (layer == nullptr || !layer->removeFile(path)) {
+                return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+            }
+            return CONTENT_REDIRECTION_API_ERROR_NONE;
+        }
+    }
+
+    DEBUG_FUNCTION_LINE_WARN("CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND for handle %08X", handle);
+    return CONTENT_REDIRECTION_API_ERROR_LAYER_NOT_FOUND;
+}
+
+struct CRFileMapping {
+    std::shared_ptr<PackArchive> archive;
+};
+
+ContentRedirectionApiErrorType CRMapFile(const char *path, const void **outData, uint32_t *outSize, CRFileMapping **outMapping) {
+    if (path == nullptr || path[0] != '/' || outData == nullptr || outSize == nullptr || outMapping == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    std::shared_ptr<PackArchive> archive;
+    const PackFile *file = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(fsLayerMutex);
+        // The topmost layer that has the file decides, a file of a lower layer may be replaced by one on the SD card.
+        auto result = callLayers([&](IFSWrapper *layer) {
+            if ((archive = layer->mapFile(path, &file))) {
+                return FS_ERROR_OK;
+            }
+            FSStat stat{};
+            return layer->FSGetStatWrapper(path, &stat);
+        });
+        if (result != FS_ERROR_OK || !archive) {
+            DEBUG_FUNCTION_LINE_VERBOSE("Can't map %s, it is not served from memory", path);
+            return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+        }
+    }
+    auto *mapping = new (std::nothrow) CRFileMapping{std::move(archive)};
+    if (mapping == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_NO_MEMORY;
+    }
+    *outData    = file->data;
+    *outSize    = file->size;
+    *outMapping = mapping;
+    return CONTENT_REDIRECTION_API_ERROR_NONE;
+}
+
+ContentRedirectionApiErrorType CRUnmapFile(CRFileMapping *mapping) {
+    if (mapping == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    delete mapping;
+    return CONTENT_REDIRECTION_API_ERROR_NONE;
+}
+
+ContentRedirectionApiErrorType CRSubmitBatch(CRBatchOperation *operations, uint32_t numOperations, CRBatchCallback callback, void *context) {
+    if ((operations == nullptr && numOperations > 0) || callback == nullptr) {
+        return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
+    }
+    // The caller must not wait for the fsLayerMutex, which is held during every redirected FS call.
+    if (!queueWorkerTask([operations, numOperations, callback, context]() {
+            runBatch(operations, numOperations);
+            callback(operations, numOperations, context);
+        })) {
+        DEBUG_FUNCTION_LINE_WARN("Failed to queue a batch of %u operations", numOperations);
+        return CONTENT_REDIRECTION_API_ERROR_NO_MEMORY;
+    }
+    return CONTENT_REDIRECTION_API_ERROR_NONE;
+}
+
 ContentRedirectionApiErrorType CRGetVersion(ContentRedirectionVersion *outVersion) {
     if (outVersion == nullptr) {
         return CONTENT_REDIRECTION_API_ERROR_INVALID_ARG;
@@ -182,5 +536,19 @@ WUMS_EXPORT_FUNCTION(CRGetVersion);
 WUMS_EXPORT_FUNCTION(CRAddFSLayer);
 WUMS_EXPORT_FUNCTION(CRRemoveFSLayer);
 WUMS_EXPORT_FUNCTION(CRSetActive);
+WUMS_EXPORT_FUNCTION(CRSetLayerOption);
+WUMS_EXPORT_FUNCTION(CRGetLayerIndexStats);
+WUMS_EXPORT_FUNCTION(CRGetLayerPrefetchStats);
+WUMS_EXPORT_FUNCTION(CRGetLayerStreamStats);
+WUMS_EXPORT_FUNCTION(CRGetLayerCoalesceStats);
+WUMS_EXPORT_FUNCTION(CRPrefetch);
+WUMS_EXPORT_FUNCTION(CRAdvise);
+WUMS_EXPORT_FUNCTION(CRAddMemoryFile);
+WUMS_EXPORT_FUNCTION(CRRemoveMemoryFile);
+WUMS_EXPORT_FUNCTION(CRAddCallbackLayer);
+WUMS_EXPORT_FUNCTION(CRGetCallbackLayerStats);
+WUMS_EXPORT_FUNCTION(CRMapFile);
+WUMS_EXPORT_FUNCTION(CRUnmapFile);
+WUMS_EXPORT_FUNCTION(CRSubmitBatch);
 WUMS_EXPORT_FUNCTION(CRAddDevice);
 WUMS_EXPORT_FUNCTION(CRRemoveDevice);
\ No newline at end of file
@@ -0,0 +1,312 @@
+#pragma once
+#include <content_redirection/redirection.h>
+#include <coreinit/filesystem.h>
+#include <cstdint>
+
+/**
+ * Module side extensions of the ContentRedirection API. Until they are part of libcontentredirection,
+ * they have to be resolved via OSDynLoad_FindExport on "homebrew_content_redirection".
+ */
+
+/**
+ * Additional layer types for CRAddFSLayer. For pack layers, replacementDir is the path of a pack file
+ * created with tools/pack, its files are merged with the parent layer.
+ */
+#define FS_LAYER_TYPE_CONTENT_PACK_MERGE ((FSLayerType) 0x100)
+#define FS_LAYER_TYPE_AOC_PACK_MERGE     ((FSLayerType) 0x101)
+
+/**
+ * Layer types for small replacement directories (up to 16 MiB) that are loaded into memory by CRAddFSLayer.
+ * All accesses are then served from memory, changes to the directory are not visible until the layer is
+ * added again.
+ */
+#define FS_LAYER_TYPE_CONTENT_REPLACE_RAM ((FSLayerType) 0x102)
+#define FS_LAYER_TYPE_CONTENT_MERGE_RAM   ((FSLayerType) 0x103)
+
+/**
+ * Layer type for files that are registered with CRAddMemoryFile, they are merged with /vol/content.
+ * replacementDir is ignored.
+ */
+#define FS_LAYER_TYPE_CONTENT_MEMORY_FILES ((FSLayerType) 0x104)
+
+/**
+ * Layer type for patches created with tools/patch. replacementDir holds a "<path>.crpatch" for every modified
+ * file of /vol/content, which is then reconstructed from the original file and the patch on read. A
+ * "<path>.croverlay" replaces byte ranges of the original with ranges of other files instead. All other paths
+ * are left to the parent layer.
+ */
+#define FS_LAYER_TYPE_CONTENT_PATCH ((FSLayerType) 0x105)
+
+typedef enum CRLayerOption {
+    /**
+     * Supported by read-only layers. If enabled (value != 0) the index of the layer keeps the metadata of all
+     * files, FSGetStat, FSGetStatFile and FSReadDir are then answered from memory once the index is complete.
+     * Only reading the content of files accesses the SD card. An index that has been stored by a previous
+     * run is only used once every file has been checked to be unchanged. Disabled by default.
+     */
+    CR_LAYER_OPTION_INDEX_METADATA = 1,
+    /**
+     * Supported by read-only layers. If value != 0, the files of the layer that are read during the first
+     * value seconds after the start of the application are recorded in the order they are opened, and
+     * written to "<replacement dir>.<title id>.crtrace" once the time is up or the layer is removed.
+     * "cr_pack boot" (tools/pack) creates a boot pack from the trace which stores these files in that order.
+     * Read-only layers then read them from the boot pack with large sequential reads. 0 stops recording.
+     */
+    CR_LAYER_OPTION_BOOT_TRACE = 2,
+    /**
+     * Supported by read-only layers. If enabled (value != 0) the layer learns which files are opened shortly
+     * after each other, and once a file is opened, the start of the files that usually follow it is read by
+     * a worker thread into a small cache. The learned order is kept in "<replacement dir>.<title id>.crprefetch".
+     * Disabled by default, 0 disables it and saves what has been learned.
+     */
+    CR_LAYER_OPTION_PREFETCH = 3,
+    /**
+     * Supported by read-only layers that read from the SD card. Files of up to value bytes (at most 1 MiB) that
+     * are opened read-only are read completely when they are opened and the fd is closed immediately. Reads,
+     * seeks and FSGetStatFile of these handles are served from memory. 0 disables it (default).
+     */
+    CR_LAYER_OPTION_SLURP_SIZE = 4,
+    /**
+     * Supported by read-only layers that read from the SD card. Handles that are read sequentially in chunks of
+     * up to 256 KiB (e.g. audio and video streams) are detected, and a worker thread then keeps the next value
+     * chunks (at most 8) buffered ahead of the read position. 0 disables it (default).
+     */
+    CR_LAYER_OPTION_STREAMING = 5,
+    /**
+     * Supported by read-only layers that read from the SD card. If a file is open through more than one handle,
+     * reads of a range that has just been read through another handle are served from memory instead of the
+     * SD card. 1 enables it, 0 disables it (default).
+     */
+    CR_LAYER_OPTION_COALESCE_READS = 6,
+} CRLayerOption;
+
+/**
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if the option is not supported by the layer.
+ */
+ContentRedirectionApiErrorType CRSetLayerOption(CRLayerHandle handle, CRLayerOption option, uint32_t value);
+
+typedef enum CRLayerIndexState {
+    CR_LAYER_INDEX_STATE_BUILDING  = 0,
+    CR_LAYER_INDEX_STATE_COMPLETE  = 1,
+    CR_LAYER_INDEX_STATE_FAILED    = 2,
+    CR_LAYER_INDEX_STATE_CANCELLED = 3,
+} CRLayerIndexState;
+
+typedef struct CRLayerIndexStats {
+    CRLayerIndexState state;
+    uint32_t numEntries;
+    uint32_t numDirectories;
+    // Memory used by the index itself, 0 once it has been compacted.
+    uint32_t memoryUsage;
+    uint64_t buildTimeInUs;
+} CRLayerIndexStats;
+
+/**
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if the layer has no index (e.g. writeable layers).
+ */
+ContentRedirectionApiErrorType CRGetLayerIndexStats(CRLayerHandle handle, CRLayerIndexStats *outStats);
+
+typedef struct CRLayerPrefetchStats {
+    // Files of which the start has been read ahead.
+    uint32_t numPrefetched;
+    // Prefetched files that have been read by the title, and those that were evicted before that.
+    uint32_t numUsed;
+    uint32_t numWasted;
+    // Reads that have been served from the prefetch cache.
+    uint32_t numHits;
+    // Memory currently used by the prefetch cache.
+    uint32_t cacheSize;
+} CRLayerPrefetchStats;
+
+/**
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if CR_LAYER_OPTION_PREFETCH is not enabled for the layer.
+ */
+ContentRedirectionApiErrorType CRGetLayerPrefetchStats(CRLayerHandle handle, CRLayerPrefetchStats *outStats);
+
+typedef struct CRLayerStreamStats {
+    // Handles that have been detected as streams, and those of them that are still open.
+    uint32_t numStreams;
+    uint32_t numActive;
+    // Reads of streams that have been served from the buffered chunks.
+    uint32_t numHits;
+    // Reads of streams that had to wait for the SD card because the worker had not buffered the data yet.
+    uint32_t numUnderruns;
+} CRLayerStreamStats;
+
+/**
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if CR_LAYER_OPTION_STREAMING is not enabled for the layer.
+ */
+ContentRedirectionApiErrorType CRGetLayerStreamStats(CRLayerHandle handle, CRLayerStreamStats *outStats);
+
+typedef struct CRLayerCoalesceStats {
+    // Reads that have been served from the data of a previous read of the same range (reads coalesced).
+    uint32_t numCoalesced;
+    uint32_t bytesCoalesced;
+} CRLayerCoalesceStats;
+
+/**
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if CR_LAYER_OPTION_COALESCE_READS is not enabled for the layer.
+ */
+ContentRedirectionApiErrorType CRGetLayerCoalesceStats(CRLayerHandle handle, CRLayerCoalesceStats *outStats);
+
+/**
+ * Queues reading the start of a file, or of the files directly inside a directory, into the cache of the
+ * topmost active read-only layer that redirects the absolute path (e.g. "/vol/content/level1"). Later reads
+ * of these files are then served from memory. Never blocks, the path is resolved by a worker thread.
+ * Returns CONTENT_REDIRECTION_API_ERROR_NO_MEMORY if the request could not be queued.
+ */
+ContentRedirectionApiErrorType CRPrefetch(const char *path);
+
+typedef enum CRFileAdvice {
+    // Default read behaviour.
+    CR_FILE_ADVICE_NORMAL = 0,
+    // The file is read in order, small reads are served from a read-ahead buffer of the handle.
+    CR_FILE_ADVICE_SEQUENTIAL = 1,
+    // The file is read at random positions, no data is read ahead for this handle.
+    CR_FILE_ADVICE_RANDOM = 2,
+    // The file will be read soon, its start is read into the cache of the layer by a worker thread.
+    CR_FILE_ADVICE_WILL_NEED = 3,
+    // The data of the file is not needed anymore, the cached and read-ahead data is dropped.
+    CR_FILE_ADVICE_DONT_NEED = 4,
+} CRFileAdvice;
+
+/**
+ * Gives a hint how a redirected file handle is going to be read, similar to posix_fadvise. The hint is
+ * applied to the handle right away, reads it causes (CR_FILE_ADVICE_WILL_NEED) are done by a worker thread.
+ * Waits for FS calls of other threads that are in progress. Handles that are not redirected are ignored.
+ * Returns CONTENT_REDIRECTION_API_ERROR_NO_MEMORY if the reads could not be queued.
+ */
+ContentRedirectionApiErrorType CRAdvise(FSFileHandle handle, CRFileAdvice advice);
+
+/**
+ * Called once the data of a memory file is not used anymore, i.e. after it has been removed (or replaced,
+ * or its layer has been removed) and the last handle that reads it has been closed. It may be called on
+ * any thread, including IO threads, so it must not call FS functions.
+ */
+typedef void (*CRMemoryFileReleaseCallback)(void *data, void *context);
+
+/**
+ * Adds the buffer as file to a layer of type FS_LAYER_TYPE_CONTENT_MEMORY_FILES. path is relative to the
+ * replaced directory (e.g. "text/strings.bin"), missing parent directories are added implicitly. A file with
+ * the same path is replaced. The data is not copied, it must stay valid until release is called (which
+ * may be nullptr). If this fails, release is not called.
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if the layer has the wrong type or the path is used
+ * by a directory.
+ */
+ContentRedirectionApiErrorType CRAddMemoryFile(CRLayerHandle handle, const char *path, const void *data, uint32_t size,
+                                               CRMemoryFileReleaseCallback release, void *context);
+
+/**
+ * Removes a file that has been added with CRAddMemoryFile. Reads of open handles continue to work until
+ * they are closed.
+ */
+ContentRedirectionApiErrorType CRRemoveMemoryFile(CRLayerHandle handle, const char *path);
+
+typedef struct CRFileMapping CRFileMapping;
+
+/**
+ * Returns a read-only pointer to the data of a redirected file that is served from memory (RAM layers, memory
+ * files), so it can be used in place instead of being copied with FSReadFile. The data stays valid until the
+ * mapping is released with CRUnmapFile, even if the file or its layer is removed in the meantime. Every call
+ * creates a new mapping. Takes the layer lock, so it may block while redirected FS calls are running.
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if the file is not found or is not served from memory.
+ */
+ContentRedirectionApiErrorType CRMapFile(const char *path, const void **outData, uint32_t *outSize, CRFileMapping **outMapping);
+
+ContentRedirectionApiErrorType CRUnmapFile(CRFileMapping *mapping);
+
+typedef enum CRBatchOperationType {
+    // Gets the stat of path.
+    CR_BATCH_OPERATION_STAT = 0,
+    // Opens path, reads it into buffer (at most size bytes) and closes it. stat is set as well.
+    CR_BATCH_OPERATION_READ_FILE = 1,
+    // Reads size bytes at pos of an open handle into buffer. The position of the handle is left unchanged, so
+    // the handle may be used by the title while the batch is running.
+    CR_BATCH_OPERATION_READ = 2,
+} CRBatchOperationType;
+
+/**
+ * Set as status of operations on paths or handles that no active layer redirects, they have to be done
+ * with the FS functions.
+ */
+#define CR_BATCH_STATUS_NOT_REDIRECTED ((FSError) 0xFFC00000)
+
+typedef struct CRBatchOperation {
+    CRBatchOperationType type;
+    // Absolute path (e.g. "/vol/content/data/a.bin"), for CR_BATCH_OPERATION_STAT and CR_BATCH_OPERATION_READ_FILE.
+    const char *path;
+    // For CR_BATCH_OPERATION_READ.
+    FSFileHandle handle;
+    uint32_t pos;
+    void *buffer;
+    uint32_t size;
+    // Set when the batch completes: the number of bytes read or FS_ERROR_OK for stats, or an error.
+    FSError status;
+    FSStat stat;
+} CRBatchOperation;
+
+/**
+ * Called once all operations of a batch have completed, on a worker thread.
+ */
+typedef void (*CRBatchCallback)(CRBatchOperation *operations, uint32_t numOperations, void *context);
+
+/**
+ * Runs the operations against the redirected files on a worker thread and calls callback once, instead of
+ * one FS request (and IO thread round trip) per operation. The operations are reordered by path and handle
+ * for locality; their results are written into the array, which must stay valid until callback is called.
+ * Never blocks. Returns CONTENT_REDIRECTION_API_ERROR_NO_MEMORY if the batch could not be queued, callback
+ * is not called then.
+ */
+ContentRedirectionApiErrorType CRSubmitBatch(CRBatchOperation *operations, uint32_t numOperations, CRBatchCallback callback, void *context);
+
+/**
+ * Functions of a layer that is served by a plugin (see CRAddCallbackLayer). Paths are relative to the replaced
+ * directory without a leading slash, "" is the replaced directory itself. Return FS_ERROR_NOT_FOUND from stat to
+ * leave a path to the layers below, other errors are returned to the title.
+ *
+ * The functions are called on the IO threads while the layers are locked, so they must not call FS functions
+ * and should return quickly. Files are read with positional reads of at most 256 KiB.
+ */
+typedef struct CRCallbackLayerFunctions {
+    void *context;
+    // Required. Called for every path of the replaced directory before it is opened or listed.
+    FSError (*stat)(void *context, const char *path, FSStat *outStat);
+    // Required. Opens a file for reading, outFile identifies it in the other calls.
+    FSError (*open)(void *context, const char *path, uint32_t *outFile);
+    // Required. Returns the number of bytes read at pos (0 at the end of the file), or an error.
+    int32_t (*readAt)(void *context, uint32_t file, uint32_t pos, void *buffer, uint32_t size);
+    // Optional.
+    void (*close)(void *context, uint32_t file);
+    // Optional, directories are not listed if it is nullptr. Sets the entry with the given index of the directory
+    // and returns FS_ERROR_OK, or returns FS_ERROR_END_OF_DIR if there are no more entries. The entries are merged
+    // with the directory of the layers below, entries with the same name as one of the plugin's are skipped.
+    FSError (*readDir)(void *context, const char *path, uint32_t index, FSDirectoryEntry *outEntry);
+} CRCallbackLayerFunctions;
+
+/**
+ * Adds a read-only layer that replaces the paths of pathToReplace (e.g. "/vol/content") for which the stat function
+ * finds something with the content the functions return. The functions are copied, the context must stay valid
+ * until the layer is removed with CRRemoveFSLayer.
+ */
+ContentRedirectionApiErrorType CRAddCallbackLayer(CRLayerHandle *handle, const char *layerName, const char *pathToReplace,
+                                                  const CRCallbackLayerFunctions *functions);
+
+typedef struct CRCallbackTiming {
+    uint32_t numCalls;
+    uint32_t maxTimeInUs;
+    uint64_t totalTimeInUs;
+} CRCallbackTiming;
+
+typedef struct CRCallbackLayerStats {
+    CRCallbackTiming stat;
+    CRCallbackTiming open;
+    CRCallbackTiming readAt;
+    CRCallbackTiming close;
+    CRCallbackTiming readDir;
+} CRCallbackLayerStats;
+
+/**
+ * Returns how often and how long the functions of a callback layer have been called.
+ * Returns CONTENT_REDIRECTION_API_ERROR_INVALID_ARG if the layer is not a callback layer.
+ */
+ContentRedirectionApiErrorType CRGetCallbackLayerStats(CRLayerHandle handle, CRCallbackLayerStats *outStats);
@@ -1,6 +1,8 @@
+#include "BootTrace.h"
 #include "FSAReplacements.h"
 #include "FSReplacements.h"
 #include "FileUtils.h"
+#include "WorkerThreads.h"
 #include "utils/StringTools.h"
 #include "utils/logger.h"
 #include "version.h"
@@ -17,6 +19,10 @@ DECL_FUNCTION(void, OSCancelThread, OSThread *thread) {
         DEBUG_FUNCTION_LINE_INFO("Prevent calling OSCancelThread for ContentRedirection IO Threads");
         return;
     }
+    if (isWorkerThread(thread)) {
+        DEBUG_FUNCTION_LINE_INFO("Prevent calling OSCancelThread for ContentRedirection Worker Threads");
+        return;
+    }
     real_OSCancelThread(thread);
 }
 
@@ -53,12 +59,17 @@ WUMS_INITIALIZE() {
 WUMS_APPLICATION_STARTS() {
     OSReport("Running ContentRedirectionModule " VERSION VERSION_EXTRA "\n");
     initLogging();
+    BootTrace::onApplicationStarts();
     startFSIOThreads();
+    startWorkerThreads();
 }
 
 WUMS_APPLICATION_ENDS() {
     clearFSLayer();
 
+    // Worker tasks may still use the IO threads.
+    stopWorkerThreads();
+
     stopFSIOThreads();
 
     deinitLogging();
@@ -0,0 +1,71 @@
+#include "BumpArena.h"
+#include "utils.h"
+#include <cstdlib>
+#include <cstring>
+
+void *BumpArena::alloc(uint32_t size, uint32_t align) {
+    // Try the current block first, then any block that has been kept by reset().
+    for (auto *block = pCurrent; block != nullptr; block = block->next) {
+        auto *data      = getBlockData(block);
+        uint32_t offset = ROUNDUP((uint32_t) data + block->used, align) - (uint32_t) data;
+        if (offset + size <= block->capacity) {
+            block->used = offset + size;
+            pCurrent    = block;
+            return data + offset;
+        }
+    }
+
+    uint32_t capacity = size + align > pBlockSize ? size + align : pBlockSize;
+    auto *block       = (Block *) malloc(sizeof(Block) + capacity);
+    if (block == nullptr) {
+        return nullptr;
+    }
+    block->capacity = capacity;
+    block->used     = 0;
+    block->next     = nullptr;
+
+    if (pHead != nullptr) {
+        // Append to the end of the chain so blocks kept by reset() stay reachable.
+        auto *last = pCurrent != nullptr ? pCurrent : pHead;
+        while (last->next != nullptr) {
+            last = last->next;
+        }
+        last->next = block;
+    } else {
+        pHead = block;
+    }
+    pCurrent = block;
+
+    auto *data      = getBlockData(block);
+    uint32_t offset = ROUNDUP((uint32_t) data, align) - (uint32_t) data;
+    block->used     = offset + size;
+    return data + offset;
+}
+
+const char *BumpArena::copyString(std::string_view str) {
+    auto *res = (char *) alloc(str.size() + 1, 1);
+    if (res == nullptr) {
+        return nullptr;
+    }
+    memcpy(res, str.data(), str.size());
+    res[str.size()] = '\0';
+    return res;
+}
+
+void BumpArena::reset() {
+    for (auto *block = pHead; block != nullptr; block = block->next) {
+        block->used = 0;
+    }
+    pCurrent = pHead;
+}
+
+void BumpArena::clear() {
+    auto *block = pHead;
+    while (block != nullptr) {
+        auto *next = block->next;
+        free(block);
+        block = next;
+    }
+    pHead    = nullptr;
+    pCurrent = nullptr;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Simple bump allocator. Memory is handed out from a chain of malloc'd blocks and can only
+ * be released all at once via reset() or clear().
+ */
+class BumpArena {
+public:
+    explicit BumpArena(uint32_t blockSize = 0x400) : pBlockSize(blockSize) {
+    }
+
+    ~BumpArena() {
+        clear();
+    }
+
+    BumpArena(const BumpArena &)            = delete;
+    BumpArena &operator=(const BumpArena &) = delete;
+
+    /**
+     * Returns nullptr if the memory could not be allocated.
+     */
+    void *alloc(uint32_t size, uint32_t align = 4);
+
+    /**
+     * Copies the string into the arena and appends a null terminator.
+     */
+    const char *copyString(std::string_view str);
+
+    /**
+     * Marks all blocks as unused but keeps them allocated for reuse.
+     */
+    void reset();
+
+    /**
+     * Frees all blocks.
+     */
+    void clear();
+
+private:
+    struct Block {
+        Block *next;
+        uint32_t capacity;
+        uint32_t used;
+    };
+
+    static uint8_t *getBlockData(Block *block) {
+        return reinterpret_cast<uint8_t *>(block + 1);
+    }
+
+    uint32_t pBlockSize;
+    Block *pHead    = nullptr;
+    Block *pCurrent = nullptr;
+};
@@ -0,0 +1,73 @@
+#pragma once
+/**
+ * Decoder for the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md).
+ * No dependencies on wut, the host tools use it to verify what they have compressed.
+ */
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Decompresses a block into dst. Returns the number of bytes written, or -1 if the block is invalid or
+ * doesn't fit into dst.
+ */
+static inline int32_t lz4_decompress_block(const uint8_t *src, uint32_t srcSize, uint8_t *dst, uint32_t dstCapacity) {
+    const uint8_t *ip   = src;
+    const uint8_t *iend = src + srcSize;
+    uint8_t *op         = dst;
+    uint8_t *oend       = dst + dstCapacity;
+
+    while (ip < iend) {
+        uint32_t token         = *ip++;
+        uint32_t literalLength = token >> 4;
+        if (literalLength == 15) {
+            uint8_t cur;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                cur = *ip++;
+                literalLength += cur;
+            } while (cur == 255);
+        }
+        if ((uint32_t) (iend - ip) < literalLength || (uint32_t) (oend - op) < literalLength) {
+            return -1;
+        }
+        memcpy(op, ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+        if (ip == iend) {
+            // The last sequence only has literals.
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t) (op - dst)) {
+            return -1;
+        }
+        uint32_t matchLength = token & 0x0F;
+        if (matchLength == 15) {
+            uint8_t cur;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                cur = *ip++;
+                matchLength += cur;
+            } while (cur == 255);
+        }
+        matchLength += 4;
+        if ((uint32_t) (oend - op) < matchLength) {
+            return -1;
+        }
+        // The match may overlap with the output, so copy byte by byte.
+        const uint8_t *match = op - offset;
+        for (uint32_t i = 0; i < matchLength; i++) {
+            *op++ = *match++;
+        }
+    }
+    return (int32_t) (op - dst);
+}
@@ -0,0 +1,20 @@
+#pragma once
+/**
+ * Conversion of POSIX stat values to their CafeOS counterparts. No dependencies on wut, so host tools
+ * produce exactly the same values as translate_stat.
+ */
+#include <cstdint>
+#include <sys/stat.h>
+
+static inline uint32_t translate_permission_mode_value(uint32_t mode) {
+    // Convert normal Unix octal permission bits into CafeOS hexadecimal permission bits
+    return ((mode & S_IRWXU) << 2) | ((mode & S_IRWXG) << 1) | (mode & S_IRWXO);
+}
+
+static inline uint64_t translate_time_value(int64_t timeValue) {
+    // FSTime stats at 1980-01-01, time_t starts at 1970-01-01
+    int64_t EPOCH_DIFF_SECS_WII_U_FS_TIME = 315532800; //EPOCH_DIFF_SECS(WIIU_FSTIME_EPOCH_YEAR)
+    int64_t adjustedTimeValue             = timeValue - EPOCH_DIFF_SECS_WII_U_FS_TIME;
+    // FSTime is in microseconds, time_t is in seconds
+    return adjustedTimeValue * 1000000;
+}
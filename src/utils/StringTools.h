@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 template<typename... Args>
@@ -22,3 +27,35 @@ static inline bool starts_with_case_insensitive(std::string_view str, std::strin
                           return std::tolower(a) == std::tolower(b);
                       });
 }
+
+static inline uint32_t hash_string(std::string_view str) {
+    // 32-bit FNV-1a
+    uint32_t hash = 0x811C9DC5;
+    for (char c : str) {
+        hash ^= (uint8_t) c;
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+/**
+ * Lowercases the path, converts backslashes, removes double and trailing slashes.
+ */
+static inline std::string normalize_path_key(std::string_view path) {
+    std::string res;
+    res.reserve(path.size());
+    for (char c : path) {
+        if (c == '\\') {
+            c = '/';
+        }
+        //! clear path of double slashes
+        if (c == '/' && !res.empty() && res.back() == '/') {
+            continue;
+        }
+        res.push_back((char) std::tolower(c));
+    }
+    while (res.size() > 1 && res.back() == '/') {
+        res.pop_back();
+    }
+    return res;
+}
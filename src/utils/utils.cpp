@@ -1,3 +1,4 @@
+#include "utils/StatTranslation.h"
 #include "utils/logger.h"
 #include <coreinit/filesystem.h>
 #include <cstdio>
@@ -42,16 +43,11 @@ void dumpHex(const void *data, size_t size) {
 }
 
 FSMode translate_permission_mode(mode_t mode) {
-    // Convert normal Unix octal permission bits into CafeOS hexadecimal permission bits
-    return (FSMode) (((mode & S_IRWXU) << 2) | ((mode & S_IRWXG) << 1) | (mode & S_IRWXO));
+    return (FSMode) translate_permission_mode_value(mode);
 }
 
 FSTime translate_time(time_t timeValue) {
-    // FSTime stats at 1980-01-01, time_t starts at 1970-01-01
-    auto EPOCH_DIFF_SECS_WII_U_FS_TIME = 315532800; //EPOCH_DIFF_SECS(WIIU_FSTIME_EPOCH_YEAR)
-    auto adjustedTimeValue             = timeValue - EPOCH_DIFF_SECS_WII_U_FS_TIME;
-    // FSTime is in microseconds, time_t is in seconds
-    return adjustedTimeValue * 1000000;
+    return translate_time_value(timeValue);
 }
 
 void translate_stat(struct stat *posStat, FSStat *fsStat) {
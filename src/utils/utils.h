@@ -1,5 +1,6 @@
 #pragma once
 
+#include <coreinit/filesystem.h>
 #include <memory>
 #include <mutex>
 #include <vector>
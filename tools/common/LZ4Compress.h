@@ -0,0 +1,78 @@
+#pragma once
+/**
+ * Simple greedy compressor for the LZ4 block format, good enough for packing files on the PC.
+ * The output can be decoded by lz4_decompress_block (src/utils/LZ4Block.h) or any other LZ4 decoder.
+ */
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+// The last match has to start at least 12 bytes before the end of the block.
+#define LZ4_MF_LIMIT      12
+#define LZ4_MAX_OFFSET    0xFFFF
+#define LZ4_HASH_BITS     16
+
+static inline void lz4_write_length(std::vector<uint8_t> &out, uint32_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(length);
+}
+
+static inline void lz4_write_sequence(std::vector<uint8_t> &out, const uint8_t *literals, uint32_t literalLength, uint32_t offset, uint32_t matchLength) {
+    uint32_t matchCode = matchLength == 0 ? 0 : matchLength - LZ4_MIN_MATCH;
+    out.push_back(((literalLength >= 15 ? 15 : literalLength) << 4) | (matchCode >= 15 ? 15 : matchCode));
+    if (literalLength >= 15) {
+        lz4_write_length(out, literalLength - 15);
+    }
+    out.insert(out.end(), literals, literals + literalLength);
+    if (matchLength == 0) {
+        return;
+    }
+    out.push_back(offset & 0xFF);
+    out.push_back(offset >> 8);
+    if (matchCode >= 15) {
+        lz4_write_length(out, matchCode - 15);
+    }
+}
+
+static inline std::vector<uint8_t> lz4_compress_block(const uint8_t *src, uint32_t size) {
+    std::vector<uint8_t> out;
+    out.reserve(size + size / 255 + 16);
+
+    auto read32 = [src](uint32_t pos) {
+        uint32_t res;
+        memcpy(&res, src + pos, sizeof(res));
+        return res;
+    };
+
+    uint32_t anchor = 0;
+    if (size > LZ4_MF_LIMIT) {
+        std::vector<int32_t> table(1 << LZ4_HASH_BITS, -1);
+        uint32_t matchStartLimit = size - LZ4_MF_LIMIT;
+        uint32_t matchEndLimit   = size - LZ4_LAST_LITERALS;
+        uint32_t pos             = 0;
+        while (pos < matchStartLimit) {
+            uint32_t sequence  = read32(pos);
+            uint32_t hash      = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            int32_t candidate  = table[hash];
+            table[hash]        = (int32_t) pos;
+            if (candidate < 0 || pos - candidate > LZ4_MAX_OFFSET || read32(candidate) != sequence) {
+                pos++;
+                continue;
+            }
+            uint32_t matchEnd = pos + LZ4_MIN_MATCH;
+            while (matchEnd < matchEndLimit && src[matchEnd] == src[candidate + (matchEnd - pos)]) {
+                matchEnd++;
+            }
+            lz4_write_sequence(out, src + anchor, pos - anchor, pos - candidate, matchEnd - pos);
+            pos    = matchEnd;
+            anchor = pos;
+        }
+    }
+    lz4_write_sequence(out, src + anchor, size - anchor, 0, 0);
+    return out;
+}
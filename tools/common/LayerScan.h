@@ -0,0 +1,156 @@
+#pragma once
+/**
+ * Scans a replacement directory the same way the module indexes it. Shared by the host tools.
+ */
+#include "LayerIndexFormat.h"
+#include "utils/StatTranslation.h"
+#include "utils/StringTools.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+// Longest path that still fits into a FSA request, including "/vol/content/".
+#define MAX_PATH_LENGTH   0x27F
+#define DELETE_PREFIX     ".deleted_"
+#define MIN_REDIRECT_PATH "/vol/content/"
+
+namespace fs = std::filesystem;
+
+struct ScanResult {
+    std::vector<LayerIndexFileEntry> entries;
+    uint64_t rootModified = 0;
+    uint32_t numWarnings  = 0;
+    uint32_t numErrors    = 0;
+};
+
+static inline std::string getKey(std::string_view relativePath) {
+    // Same as LayerIndex::getKey
+    auto res = normalize_path_key(relativePath);
+    if (!res.empty() && res.front() == '/') {
+        res.erase(0, 1);
+    }
+    return res;
+}
+
+static inline void warn(ScanResult &result, const char *format, const std::string &a, const std::string &b = {}) {
+    fprintf(stderr, "warning: ");
+    fprintf(stderr, format, a.c_str(), b.c_str());
+    fprintf(stderr, "\n");
+    result.numWarnings++;
+}
+
+static inline void error(ScanResult &result, const char *format, const std::string &a) {
+    fprintf(stderr, "error: ");
+    fprintf(stderr, format, a.c_str());
+    fprintf(stderr, "\n");
+    result.numErrors++;
+}
+
+static inline LayerIndexFileEntry toEntry(const std::string &relativePath, const struct stat &sb) {
+    // Mirrors translate_stat + LayerIndex, which only keeps these fields.
+    LayerIndexFileEntry entry{};
+    entry.path  = relativePath;
+    entry.flags = S_ISDIR(sb.st_mode) ? LAYER_INDEX_FILE_FLAG_DIRECTORY : 0;
+    entry.mode  = translate_permission_mode_value(sb.st_mode);
+    // Directories on FAT always have a size of 0.
+    entry.size     = S_ISDIR(sb.st_mode) ? 0 : (uint32_t) sb.st_size;
+    entry.created  = translate_time_value(sb.st_ctime);
+    entry.modified = translate_time_value(sb.st_atime);
+    return entry;
+}
+
+static inline bool scan(const fs::path &root, ScanResult &result) {
+    struct stat sb {};
+    if (stat(root.c_str(), &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        error(result, "%s is not a directory", root.string());
+        return false;
+    }
+    result.rootModified = translate_time_value(sb.st_atime);
+    result.entries.push_back(toEntry({}, sb));
+
+    std::unordered_map<std::string, std::string> rawPathByKey;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        auto relativePath = it->path().lexically_relative(root).generic_string();
+        if (it->is_symlink()) {
+            warn(result, "%s is a symlink, symlinks don't exist on the SD card and are skipped", relativePath);
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (stat(it->path().c_str(), &sb) < 0) {
+            error(result, "Failed to stat %s", relativePath);
+            continue;
+        }
+        if (!S_ISDIR(sb.st_mode) && (uint64_t) sb.st_size > 0xFFFFFFFF) {
+            error(result, "%s is bigger than 4 GiB", relativePath);
+            continue;
+        }
+        if (relativePath.find('\\') != std::string::npos) {
+            warn(result, "%s contains a backslash, the module treats it as a path separator", relativePath);
+        }
+        if (strlen(MIN_REDIRECT_PATH) + relativePath.size() > MAX_PATH_LENGTH) {
+            warn(result, "%s is too long to be accessed via FSA", relativePath);
+        }
+
+        auto key = getKey(relativePath);
+        if (auto [existing, inserted] = rawPathByKey.try_emplace(key, relativePath); !inserted) {
+            // FAT is case-insensitive, only one of them can exist on the SD card.
+            warn(result, "%s and %s only differ in case", existing->second, relativePath);
+            continue;
+        }
+        result.entries.push_back(toEntry(relativePath, sb));
+    }
+    if (ec) {
+        error(result, "Failed to scan: %s", ec.message());
+        return false;
+    }
+
+    // Whiteouts next to the file they hide make the file inaccessible.
+    for (auto &[key, rawPath] : rawPathByKey) {
+        auto slash    = key.find_last_of('/');
+        auto fileName = slash == std::string::npos ? std::string_view(key) : std::string_view(key).substr(slash + 1);
+        if (!starts_with_case_insensitive(fileName, DELETE_PREFIX) || fileName.size() == strlen(DELETE_PREFIX)) {
+            continue;
+        }
+        auto target = std::string(key.substr(0, slash == std::string::npos ? 0 : slash + 1)).append(fileName.substr(strlen(DELETE_PREFIX)));
+        if (auto it = rawPathByKey.find(target); it != rawPathByKey.end()) {
+            warn(result, "%s is hidden by the whiteout %s", it->second, rawPath);
+        }
+    }
+
+    // Different paths with the same hash can't be told apart by the existence filter and always hit the disk.
+    std::unordered_map<uint32_t, std::string> keyByHash;
+    for (auto &entry : result.entries) {
+        if (auto [existing, inserted] = keyByHash.try_emplace(hash_string(getKey(entry.path)), entry.path); !inserted) {
+            warn(result, "Hash collision between %s and %s", existing->second, entry.path);
+        }
+    }
+
+    std::unordered_map<std::string, uint32_t> numChildren;
+    for (auto &entry : result.entries) {
+        if (entry.path.empty()) {
+            continue;
+        }
+        auto key   = getKey(entry.path);
+        auto slash = key.find_last_of('/');
+        numChildren[slash == std::string::npos ? std::string() : key.substr(0, slash)]++;
+    }
+    for (auto &entry : result.entries) {
+        if (entry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY) {
+            entry.numChildren = numChildren[getKey(entry.path)];
+        }
+    }
+
+    std::sort(result.entries.begin(), result.entries.end(), [](const LayerIndexFileEntry &a, const LayerIndexFileEntry &b) {
+        auto keyA  = getKey(a.path);
+        auto keyB  = getKey(b.path);
+        auto hashA = hash_string(keyA);
+        auto hashB = hash_string(keyB);
+        return hashA != hashB ? hashA < hashB : keyA < keyB;
+    });
+    return true;
+}
@@ -0,0 +1,89 @@
+/**
+ * Compiles a replacement directory into a manifest ("<dir>.cr_manifest") that the module uses as the
+ * index of the layer without scanning the SD card. The paths keep their case, the stat values are
+ * translated with the same code the module uses.
+ *
+ * Usage:
+ *   cr_layerindex build <replacement dir> [-o <output file>]
+ *   cr_layerindex check <replacement dir>
+ *   cr_layerindex dump <manifest or index file>
+ */
+#include "LayerScan.h"
+#include <fstream>
+
+static int build(const fs::path &root, const fs::path &output, bool write) {
+    ScanResult result;
+    if (!scan(root, result)) {
+        return 1;
+    }
+    uint32_t numDirectories = std::count_if(result.entries.begin(), result.entries.end(), [](auto &entry) { return entry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY; });
+    printf("%zu entries (%u directories), %u warnings, %u errors\n", result.entries.size() - 1, numDirectories, result.numWarnings, result.numErrors);
+    if (result.numErrors > 0) {
+        return 1;
+    }
+    if (!write) {
+        return 0;
+    }
+
+    auto data = LayerIndexFormat::serialize(result.entries, result.rootModified);
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if (!out.write(reinterpret_cast<const char *>(data.data()), data.size())) {
+        fprintf(stderr, "error: Failed to write %s\n", output.c_str());
+        return 1;
+    }
+    printf("Wrote %s (%zu bytes)\n", output.c_str(), data.size());
+    return 0;
+}
+
+static int dump(const fs::path &file) {
+    std::ifstream in(file, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t rootModified;
+    std::vector<LayerIndexFileEntry> entries;
+    if (!LayerIndexFormat::parse(data.data(), data.size(), &rootModified, entries)) {
+        fprintf(stderr, "error: %s is not a valid index\n", file.c_str());
+        return 1;
+    }
+    printf("root modified: %llu, %zu entries\n", (unsigned long long) rootModified, entries.size());
+    for (auto &entry : entries) {
+        printf("%08X %s %10u mode %03X children %5u /%s\n", hash_string(getKey(entry.path)), (entry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY) ? "d" : "f",
+               entry.size, entry.mode, entry.numChildren, entry.path.c_str());
+    }
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  %s build <replacement dir> [-o <output file>]\n", name);
+    fprintf(stderr, "  %s check <replacement dir>\n", name);
+    fprintf(stderr, "  %s dump <manifest or index file>\n", name);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string command = argv[1];
+    fs::path path       = argv[2];
+    if (command == "build") {
+        auto root = path.lexically_normal();
+        if (root.has_filename() == false) {
+            root = root.parent_path();
+        }
+        fs::path output = root.string() + LAYER_INDEX_MANIFEST_SUFFIX;
+        if (argc == 5 && std::string(argv[3]) == "-o") {
+            output = argv[4];
+        } else if (argc != 3) {
+            usage(argv[0]);
+            return 1;
+        }
+        return build(root, output, true);
+    } else if (command == "check" && argc == 3) {
+        return build(path, {}, false);
+    } else if (command == "dump" && argc == 3) {
+        return dump(path);
+    }
+    usage(argv[0]);
+    return 1;
+}
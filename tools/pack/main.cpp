@@ -0,0 +1,496 @@
+/**
+ * Creates pack files for FS_LAYER_TYPE_CONTENT_PACK_MERGE / FS_LAYER_TYPE_AOC_PACK_MERGE layers and
+ * compares reading a pack with reading the loose files of the replacement directory.
+ *
+ * Usage:
+ *   cr_pack create <replacement dir> [-c] [-o <output file>]
+ *   cr_pack boot <replacement dir> <trace> [-c] [-o <output file>]
+ *   cr_pack list <pack>
+ *   cr_pack bench <replacement dir> <pack> [-n <iterations>]
+ *
+ * -c compresses the files in chunks of PACK_CHUNK_SIZE bytes with LZ4. Files that don't get smaller are
+ * stored as is.
+ *
+ * boot creates the boot pack of a title from a trace recorded with CR_LAYER_OPTION_BOOT_TRACE: only the files
+ * of the trace are stored, in the order the title has opened them. By default it is written next to the trace
+ * ("<replacement dir>.<title id>.crpack"), where the module looks for it.
+ *
+ * For meaningful numbers, run the benchmark against the SD card (e.g. in a card reader). The page cache
+ * is dropped for all files before each iteration. The benchmark reads all files sequentially, then does
+ * random reads of 4 KiB to 64 KiB. Compressed chunks are decompressed on the PC, which is a lot faster
+ * than on the console.
+ */
+#include "BootTraceFormat.h"
+#include "LZ4Compress.h"
+#include "LayerScan.h"
+#include "PackFormat.h"
+#include "utils/LZ4Block.h"
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <unistd.h>
+
+#define BENCH_RANDOM_READ_MIN 0x1000
+#define BENCH_RANDOM_READ_MAX 0x10000
+
+struct Pack {
+    PackFileHeader header{};
+    uint64_t rootModified = 0;
+    std::vector<LayerIndexFileEntry> entries;
+    std::vector<PackFileLocation> locations;
+};
+
+static bool readAt(int fd, uint64_t offset, void *buffer, size_t size) {
+    auto *cur = static_cast<uint8_t *>(buffer);
+    while (size > 0) {
+        auto res = pread(fd, cur, size, (off_t) offset);
+        if (res <= 0) {
+            return false;
+        }
+        cur += res;
+        offset += res;
+        size -= res;
+    }
+    return true;
+}
+
+static bool loadPack(int fd, Pack &pack) {
+    uint8_t headerData[PACK_FILE_HEADER_SIZE];
+    if (!readAt(fd, 0, headerData, sizeof(headerData)) || !PackFormat::parseHeader(headerData, sizeof(headerData), &pack.header)) {
+        return false;
+    }
+    std::vector<uint8_t> directory(pack.header.directorySize);
+    if (!readAt(fd, pack.header.directoryOffset, directory.data(), directory.size()) ||
+        !LayerIndexFormat::parse(directory.data(), directory.size(), &pack.rootModified, pack.entries)) {
+        return false;
+    }
+    std::vector<uint8_t> locations(pack.entries.size() * PACK_FILE_LOCATION_SIZE);
+    return readAt(fd, pack.header.locationsOffset, locations.data(), locations.size()) &&
+           PackFormat::parseLocations(locations.data(), pack.entries.size(), pack.header.locationsChecksum, pack.locations);
+}
+
+/**
+ * Returns false if the data doesn't get smaller, the file should be stored as is then.
+ */
+static bool compressChunks(const std::vector<char> &data, std::vector<uint8_t> &out) {
+    auto *src          = reinterpret_cast<const uint8_t *>(data.data());
+    uint32_t size      = data.size();
+    uint32_t numChunks = PackFormat::getNumChunks(size);
+    std::vector<uint8_t> chunks;
+    std::vector<uint8_t> decompressed(PACK_CHUNK_SIZE);
+    out.clear();
+    LayerIndexFormat::putBE32(out, 0);
+    for (uint32_t i = 0; i < numChunks; i++) {
+        uint32_t chunkSize = std::min<uint32_t>(PACK_CHUNK_SIZE, size - i * PACK_CHUNK_SIZE);
+        auto *chunk        = src + i * PACK_CHUNK_SIZE;
+        auto compressed    = lz4_compress_block(chunk, chunkSize);
+        // Stored chunks are recognized by their size, so a compressed chunk has to be smaller.
+        if (compressed.size() < chunkSize) {
+            if (lz4_decompress_block(compressed.data(), compressed.size(), decompressed.data(), chunkSize) != (int32_t) chunkSize ||
+                memcmp(decompressed.data(), chunk, chunkSize) != 0) {
+                fprintf(stderr, "error: Failed to verify the compressed data\n");
+                exit(1);
+            }
+            chunks.insert(chunks.end(), compressed.begin(), compressed.end());
+        } else {
+            chunks.insert(chunks.end(), chunk, chunk + chunkSize);
+        }
+        LayerIndexFormat::putBE32(out, chunks.size());
+    }
+    out.insert(out.end(), chunks.begin(), chunks.end());
+    return out.size() < size;
+}
+
+/**
+ * Writes the entries of result to a pack, the data of the files in dataOrder.
+ */
+static int writePack(const fs::path &root, const ScanResult &result, const std::vector<uint32_t> &dataOrder, const fs::path &output, bool compress) {
+    FILE *out = fopen(output.c_str(), "wb");
+    if (out == nullptr) {
+        fprintf(stderr, "error: Failed to create %s\n", output.c_str());
+        return 1;
+    }
+
+    std::vector<PackFileLocation> locations(result.entries.size(), PackFileLocation{0, 0, PACK_LOCATION_FLAG_STORED});
+    std::vector<uint8_t> header(PACK_FILE_HEADER_SIZE);
+    bool success       = fwrite(header.data(), 1, header.size(), out) == header.size();
+    uint64_t offset    = PACK_FILE_HEADER_SIZE;
+    uint64_t totalSize = 0;
+    std::vector<char> buffer;
+    std::vector<uint8_t> compressed;
+    for (auto i : dataOrder) {
+        auto &entry = result.entries[i];
+        if (!success || (entry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY)) {
+            continue;
+        }
+        std::ifstream in(root / entry.path, std::ios::binary);
+        buffer.resize(entry.size);
+        if (!in.read(buffer.data(), buffer.size())) {
+            fprintf(stderr, "error: Failed to read %s\n", entry.path.c_str());
+            success = false;
+            break;
+        }
+        totalSize += entry.size;
+        if (compress && compressChunks(buffer, compressed)) {
+            success      = fwrite(compressed.data(), 1, compressed.size(), out) == compressed.size();
+            locations[i] = {offset, (uint32_t) compressed.size(), PACK_LOCATION_FLAG_LZ4_CHUNKS};
+            offset += compressed.size();
+            continue;
+        }
+        success      = fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+        locations[i] = {offset, entry.size, PACK_LOCATION_FLAG_STORED};
+        offset += entry.size;
+    }
+
+    PackFileHeader packHeader{};
+    auto directory               = LayerIndexFormat::serialize(result.entries, result.rootModified);
+    auto locationData            = PackFormat::serializeLocations(locations);
+    packHeader.directoryOffset   = offset;
+    packHeader.directorySize     = directory.size();
+    packHeader.locationsOffset   = offset + directory.size();
+    packHeader.locationsChecksum = LayerIndexFormat::checksum(locationData.data(), locationData.size());
+    header                       = PackFormat::serializeHeader(packHeader);
+
+    success = success && fwrite(directory.data(), 1, directory.size(), out) == directory.size();
+    success = success && fwrite(locationData.data(), 1, locationData.size(), out) == locationData.size();
+    success = success && fseek(out, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), out) == header.size();
+    success = fclose(out) == 0 && success;
+
+    uint64_t packSize = packHeader.locationsOffset + locationData.size();
+    if (success && packSize > 0x7FFFFFFF) {
+        fprintf(stderr, "error: The pack is bigger than 2 GiB, split the replacement directory\n");
+        success = false;
+    }
+    if (!success) {
+        fs::remove(output);
+        fprintf(stderr, "error: Failed to write %s\n", output.c_str());
+        return 1;
+    }
+    printf("Wrote %s: %zu entries, %llu bytes (%llu bytes of data), %u warnings\n", output.c_str(), result.entries.size() - 1, (unsigned long long) packSize,
+           (unsigned long long) totalSize, result.numWarnings);
+    return 0;
+}
+
+static int create(const fs::path &root, const fs::path &output, bool compress) {
+    ScanResult result;
+    if (!scan(root, result)) {
+        return 1;
+    }
+    if (result.numErrors > 0) {
+        fprintf(stderr, "%u errors, no pack created\n", result.numErrors);
+        return 1;
+    }
+
+    // The directory is sorted by hash, the data by path so files of the same directory are next to each other.
+    std::vector<uint32_t> dataOrder(result.entries.size());
+    std::iota(dataOrder.begin(), dataOrder.end(), 0);
+    std::sort(dataOrder.begin(), dataOrder.end(), [&](uint32_t a, uint32_t b) { return result.entries[a].path < result.entries[b].path; });
+    return writePack(root, result, dataOrder, output, compress);
+}
+
+static int boot(const fs::path &root, const fs::path &tracePath, const fs::path &output, bool compress) {
+    std::ifstream in(tracePath, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t titleId;
+    std::vector<BootTraceEntry> trace;
+    if (!in.good() && !in.eof()) {
+        fprintf(stderr, "error: Failed to read %s\n", tracePath.c_str());
+        return 1;
+    }
+    if (data.size() > BOOT_TRACE_MAX_SIZE || !BootTraceFormat::parse(data.data(), data.size(), &titleId, trace)) {
+        fprintf(stderr, "error: %s is not a valid boot trace\n", tracePath.c_str());
+        return 1;
+    }
+
+    ScanResult scanned;
+    if (!scan(root, scanned)) {
+        return 1;
+    }
+    if (scanned.numErrors > 0) {
+        fprintf(stderr, "%u errors, no pack created\n", scanned.numErrors);
+        return 1;
+    }
+    std::unordered_map<std::string, uint32_t> entryByKey;
+    for (uint32_t i = 0; i < scanned.entries.size(); i++) {
+        entryByKey.emplace(getKey(scanned.entries[i].path), i);
+    }
+
+    // Only the traced files and their parent directories are part of the boot pack.
+    ScanResult result;
+    result.rootModified = scanned.rootModified;
+    result.numWarnings  = scanned.numWarnings;
+    result.entries.push_back(scanned.entries[entryByKey.at(std::string())]);
+    result.entries[0].numChildren = 0;
+    std::unordered_map<std::string, uint32_t> addedByKey{{std::string(), 0}};
+    std::vector<uint32_t> dataOrder;
+    uint64_t totalSize = 0;
+    uint64_t readSize  = 0;
+
+    auto addEntry = [&](const std::string &key, uint32_t scannedIndex) {
+        if (auto it = addedByKey.find(key); it != addedByKey.end()) {
+            return it->second;
+        }
+        auto slash  = key.find_last_of('/');
+        auto parent = slash == std::string::npos ? std::string() : key.substr(0, slash);
+        result.entries[addedByKey.at(parent)].numChildren++;
+        result.entries.push_back(scanned.entries[scannedIndex]);
+        result.entries.back().numChildren = 0;
+        addedByKey.emplace(key, result.entries.size() - 1);
+        return (uint32_t) result.entries.size() - 1;
+    };
+    for (auto &traced : trace) {
+        auto key = getKey(traced.path);
+        auto it  = entryByKey.find(key);
+        if (it == entryByKey.end() || (scanned.entries[it->second].flags & LAYER_INDEX_FILE_FLAG_DIRECTORY)) {
+            warn(result, "%s is not a file of the replacement directory, skipped", traced.path);
+            continue;
+        }
+        if (addedByKey.contains(key)) {
+            continue;
+        }
+        // Parents first, so every entry has been added after its parent.
+        for (auto slash = key.find('/'); slash != std::string::npos; slash = key.find('/', slash + 1)) {
+            auto parent = key.substr(0, slash);
+            addEntry(parent, entryByKey.at(parent));
+        }
+        dataOrder.push_back(addEntry(key, it->second));
+        totalSize += scanned.entries[it->second].size;
+        for (auto &range : traced.ranges) {
+            readSize += range.size;
+        }
+    }
+    if (dataOrder.empty()) {
+        fprintf(stderr, "error: None of the traced files exist, no pack created\n");
+        return 1;
+    }
+    printf("Title %016llX read %llu of %llu bytes of %zu files during boot\n", (unsigned long long) titleId, (unsigned long long) readSize,
+           (unsigned long long) totalSize, dataOrder.size());
+    return writePack(root, result, dataOrder, output, compress);
+}
+
+static int list(const fs::path &file) {
+    int fd = open(file.c_str(), O_RDONLY);
+    Pack pack;
+    if (fd < 0 || !loadPack(fd, pack)) {
+        fprintf(stderr, "error: %s is not a valid pack\n", file.c_str());
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    close(fd);
+    for (uint32_t i = 0; i < pack.entries.size(); i++) {
+        auto &entry    = pack.entries[i];
+        auto &location = pack.locations[i];
+        printf("%s %10u %10u @ %10llu /%s\n", (entry.flags & LAYER_INDEX_FILE_FLAG_DIRECTORY) ? "d" : (location.flags & PACK_LOCATION_FLAG_LZ4_CHUNKS) ? "c" : "f",
+               entry.size, location.storedSize, (unsigned long long) location.offset, entry.path.c_str());
+    }
+    return 0;
+}
+
+static void dropCache(const fs::path &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void report(const char *name, double seconds, uint64_t bytes, uint32_t reads) {
+    printf("%-13s %8.3f s %10.2f MB/s %10.0f reads/s\n", name, seconds, bytes / seconds / (1024.0 * 1024.0), reads / seconds);
+}
+
+/**
+ * Reads a range of a file like the pack layer does: only the chunks that are touched are read and decompressed.
+ */
+static bool readFromPack(int fd, const Pack &pack, uint32_t i, uint32_t pos, uint32_t size, uint8_t *buffer) {
+    auto &location = pack.locations[i];
+    if (!(location.flags & PACK_LOCATION_FLAG_LZ4_CHUNKS)) {
+        return readAt(fd, location.offset + pos, buffer, size);
+    }
+    uint32_t fileSize  = pack.entries[i].size;
+    uint32_t first     = pos / PACK_CHUNK_SIZE;
+    uint32_t last      = (pos + size - 1) / PACK_CHUNK_SIZE;
+    uint32_t tableSize = PackFormat::getChunkTableSize(fileSize);
+    std::vector<uint8_t> table((last - first + 2) * sizeof(uint32_t));
+    if (!readAt(fd, location.offset + first * sizeof(uint32_t), table.data(), table.size())) {
+        return false;
+    }
+    uint32_t srcStart = LayerIndexFormat::getBE32(table.data());
+    std::vector<uint8_t> src(LayerIndexFormat::getBE32(table.data() + (last - first + 1) * sizeof(uint32_t)) - srcStart);
+    if (!readAt(fd, location.offset + tableSize + srcStart, src.data(), src.size())) {
+        return false;
+    }
+    std::vector<uint8_t> chunk(PACK_CHUNK_SIZE);
+    for (uint32_t cur = first; cur <= last; cur++) {
+        uint32_t start     = LayerIndexFormat::getBE32(table.data() + (cur - first) * sizeof(uint32_t)) - srcStart;
+        uint32_t end       = LayerIndexFormat::getBE32(table.data() + (cur - first + 1) * sizeof(uint32_t)) - srcStart;
+        uint32_t chunkSize = std::min<uint32_t>(PACK_CHUNK_SIZE, fileSize - cur * PACK_CHUNK_SIZE);
+        if (end - start == chunkSize) {
+            memcpy(chunk.data(), src.data() + start, chunkSize);
+        } else if (lz4_decompress_block(src.data() + start, end - start, chunk.data(), chunkSize) != (int32_t) chunkSize) {
+            return false;
+        }
+        uint32_t copyStart = std::max(pos, cur * PACK_CHUNK_SIZE);
+        uint32_t copyEnd   = std::min(pos + size, cur * PACK_CHUNK_SIZE + chunkSize);
+        memcpy(buffer + (copyStart - pos), chunk.data() + (copyStart - cur * PACK_CHUNK_SIZE), copyEnd - copyStart);
+    }
+    return true;
+}
+
+struct RandomRead {
+    uint32_t file;
+    uint32_t pos;
+    uint32_t size;
+};
+
+static int bench(const fs::path &root, const fs::path &packPath, uint32_t iterations) {
+    int packFd = open(packPath.c_str(), O_RDONLY);
+    Pack pack;
+    if (packFd < 0 || !loadPack(packFd, pack)) {
+        fprintf(stderr, "error: %s is not a valid pack\n", packPath.c_str());
+        return 1;
+    }
+
+    // Read the files in the same order as they are stored in the pack.
+    std::vector<uint32_t> files;
+    uint64_t totalSize = 0;
+    for (uint32_t i = 0; i < pack.entries.size(); i++) {
+        if (!(pack.entries[i].flags & LAYER_INDEX_FILE_FLAG_DIRECTORY)) {
+            files.push_back(i);
+            totalSize += pack.entries[i].size;
+        }
+    }
+    std::sort(files.begin(), files.end(), [&](uint32_t a, uint32_t b) { return pack.locations[a].offset < pack.locations[b].offset; });
+
+    // Same reads for the loose files and the pack, one per file.
+    std::vector<RandomRead> randomReads;
+    uint64_t randomSize = 0;
+    std::mt19937 random(0);
+    for (uint32_t n = 0; n < files.size(); n++) {
+        auto i = files[random() % files.size()];
+        if (pack.entries[i].size == 0) {
+            continue;
+        }
+        uint32_t pos  = random() % pack.entries[i].size;
+        uint32_t size = BENCH_RANDOM_READ_MIN + random() % (BENCH_RANDOM_READ_MAX - BENCH_RANDOM_READ_MIN + 1);
+        size          = std::min(size, pack.entries[i].size - pos);
+        randomReads.push_back({i, pos, size});
+        randomSize += size;
+    }
+
+    std::vector<uint8_t> buffer;
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+        for (auto i : files) {
+            dropCache(root / pack.entries[i].path);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (auto i : files) {
+            auto &entry = pack.entries[i];
+            int fd      = open((root / entry.path).c_str(), O_RDONLY);
+            buffer.resize(entry.size);
+            if (fd < 0 || !readAt(fd, 0, buffer.data(), buffer.size())) {
+                fprintf(stderr, "error: Failed to read %s\n", entry.path.c_str());
+                return 1;
+            }
+            close(fd);
+        }
+        report("loose", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), totalSize, files.size());
+
+        posix_fadvise(packFd, 0, 0, POSIX_FADV_DONTNEED);
+        start = std::chrono::steady_clock::now();
+        for (auto i : files) {
+            buffer.resize(pack.entries[i].size);
+            if (buffer.size() > 0 && !readFromPack(packFd, pack, i, 0, buffer.size(), buffer.data())) {
+                fprintf(stderr, "error: Failed to read %s from the pack\n", pack.entries[i].path.c_str());
+                return 1;
+            }
+        }
+        report("pack", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), totalSize, files.size());
+
+        for (auto i : files) {
+            dropCache(root / pack.entries[i].path);
+        }
+        start = std::chrono::steady_clock::now();
+        for (auto &read : randomReads) {
+            auto &entry = pack.entries[read.file];
+            int fd      = open((root / entry.path).c_str(), O_RDONLY);
+            buffer.resize(read.size);
+            if (fd < 0 || !readAt(fd, read.pos, buffer.data(), buffer.size())) {
+                fprintf(stderr, "error: Failed to read %s\n", entry.path.c_str());
+                return 1;
+            }
+            close(fd);
+        }
+        report("loose random", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), randomSize, randomReads.size());
+
+        posix_fadvise(packFd, 0, 0, POSIX_FADV_DONTNEED);
+        start = std::chrono::steady_clock::now();
+        for (auto &read : randomReads) {
+            buffer.resize(read.size);
+            if (!readFromPack(packFd, pack, read.file, read.pos, read.size, buffer.data())) {
+                fprintf(stderr, "error: Failed to read %s from the pack\n", pack.entries[read.file].path.c_str());
+                return 1;
+            }
+        }
+        report("pack random", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), randomSize, randomReads.size());
+    }
+    close(packFd);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  %s create <replacement dir> [-c] [-o <output file>]\n", name);
+    fprintf(stderr, "  %s boot <replacement dir> <trace> [-c] [-o <output file>]\n", name);
+    fprintf(stderr, "  %s list <pack>\n", name);
+    fprintf(stderr, "  %s bench <replacement dir> <pack> [-n <iterations>]\n", name);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string command = argv[1];
+    fs::path path       = argv[2];
+    if (command == "create" || (command == "boot" && argc >= 4)) {
+        auto root = path.lexically_normal();
+        if (root.has_filename() == false) {
+            root = root.parent_path();
+        }
+        bool isBoot     = command == "boot";
+        fs::path output = root.string() + PACK_FILE_SUFFIX;
+        if (isBoot) {
+            output = fs::path(argv[3]).replace_extension(PACK_FILE_SUFFIX);
+        }
+        bool compress = false;
+        for (int i = isBoot ? 4 : 3; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-c") {
+                compress = true;
+            } else if (arg == "-o" && i + 1 < argc) {
+                output = argv[++i];
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        return isBoot ? boot(root, argv[3], output, compress) : create(root, output, compress);
+    } else if (command == "list" && argc == 3) {
+        return list(path);
+    } else if (command == "bench" && (argc == 4 || argc == 6)) {
+        uint32_t iterations = 3;
+        if (argc == 6) {
+            if (std::string(argv[4]) != "-n" || (iterations = strtoul(argv[5], nullptr, 10)) == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        return bench(path, argv[3], iterations);
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,528 @@
+/**
+ * Creates patch files for FS_LAYER_TYPE_CONTENT_PATCH layers and measures how fast patched files can be read.
+ *
+ * Usage:
+ *   cr_patch create <original> <modified> [-o <output file>]
+ *   cr_patch dir <original dir> <modified dir> <patch dir>
+ *   cr_patch apply <original> <patch> -o <output file>
+ *   cr_patch bench <original> <patch> [-n <iterations>]
+ *
+ * create writes "<modified>.crpatch" by default. dir creates a patch in <patch dir> for every file of
+ * <modified dir> that differs from the file with the same path in <original dir>, this is the directory that
+ * is added as layer.
+ *
+ * The patches are created by looking up blocks of PATCH_BLOCK_SIZE bytes of the modified file in a hash table
+ * of the original. Matches are extended in both directions, and after a mismatch the copy is first continued
+ * at the same distance, so in-place changes only store the changed bytes.
+ *
+ * bench reads the modified file through the patch like the layer does (in windows of PATCH_WINDOW_SIZE bytes
+ * with a cache of PATCH_CACHE_WINDOWS windows) and compares it with reading the original. The page cache is
+ * dropped for both files before each run. Reads are done sequentially in reads of BENCH_SEQUENTIAL_READ_SIZE
+ * bytes, then randomly with reads of 4 KiB to 64 KiB.
+ */
+#include "PatchFormat.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+#define PATCH_BLOCK_SIZE 32
+// A copy that continues after a mismatch at the same distance has to match at least this many bytes.
+#define PATCH_MIN_CONTINUE_SIZE 8
+
+#define BENCH_SEQUENTIAL_READ_SIZE 0x20000
+#define BENCH_RANDOM_READ_MIN      0x1000
+#define BENCH_RANDOM_READ_MAX      0x10000
+#define BENCH_RANDOM_READS         1024
+
+static bool readFile(const fs::path &path, std::vector<uint8_t> &out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return in.good() || in.eof();
+}
+
+static bool writeFile(const fs::path &path, const std::vector<uint8_t> &data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(data.data()), (std::streamsize) data.size());
+    return out.good();
+}
+
+static bool readAt(int fd, uint64_t offset, void *buffer, size_t size) {
+    auto *cur = static_cast<uint8_t *>(buffer);
+    while (size > 0) {
+        auto res = pread(fd, cur, size, (off_t) offset);
+        if (res <= 0) {
+            return false;
+        }
+        cur += res;
+        offset += res;
+        size -= res;
+    }
+    return true;
+}
+
+static uint32_t hashBlock(const uint8_t *data) {
+    uint32_t hash = 0;
+    for (uint32_t i = 0; i < PATCH_BLOCK_SIZE; i++) {
+        hash = hash * 257 + data[i];
+    }
+    return hash;
+}
+
+static void addOp(std::vector<PatchOp> &ops, uint32_t targetOffset, uint32_t length, uint32_t type, uint32_t offset) {
+    if (length == 0) {
+        return;
+    }
+    if (!ops.empty()) {
+        auto &last = ops.back();
+        if (last.type == type && last.offset + last.length == offset) {
+            last.length += length;
+            return;
+        }
+    }
+    ops.push_back({targetOffset, length, type, offset});
+}
+
+/**
+ * Returns the ops that turn source into target, the bytes that are not copied from source are appended to data.
+ */
+static std::vector<PatchOp> diff(const std::vector<uint8_t> &source, const std::vector<uint8_t> &target, std::vector<uint8_t> &data) {
+    // Offset + 1 of a block of the original per hash, 0 if there is none.
+    uint32_t tableSize = 1;
+    while (tableSize < (source.size() / PATCH_BLOCK_SIZE) * 2) {
+        tableSize <<= 1;
+    }
+    std::vector<uint32_t> table(tableSize, 0);
+    for (uint64_t offset = 0; offset + PATCH_BLOCK_SIZE <= source.size(); offset += PATCH_BLOCK_SIZE) {
+        auto &slot = table[hashBlock(source.data() + offset) & (tableSize - 1)];
+        if (slot == 0) {
+            slot = offset + 1;
+        }
+    }
+
+    uint32_t highFactor = 1;
+    for (uint32_t i = 1; i < PATCH_BLOCK_SIZE; i++) {
+        highFactor *= 257;
+    }
+
+    auto matchForward = [&](uint32_t sourceOffset, uint32_t targetOffset) {
+        uint32_t length = 0;
+        while (sourceOffset + length < source.size() && targetOffset + length < target.size() && source[sourceOffset + length] == target[targetOffset + length]) {
+            length++;
+        }
+        return length;
+    };
+
+    std::vector<PatchOp> ops;
+    uint32_t literalStart = 0;
+    uint32_t pos          = 0;
+    // Distance of the last copy, a change in place continues at the same distance.
+    int64_t lastDistance = 0;
+    uint32_t hash        = target.size() >= PATCH_BLOCK_SIZE ? hashBlock(target.data()) : 0;
+    while (pos < target.size()) {
+        int64_t candidate = -1;
+        int64_t continued = (int64_t) pos + lastDistance;
+        if (continued >= 0 && continued < (int64_t) source.size() && matchForward(continued, pos) >= PATCH_MIN_CONTINUE_SIZE) {
+            candidate = continued;
+        } else if (pos + PATCH_BLOCK_SIZE <= target.size()) {
+            uint32_t slot = table[hash & (tableSize - 1)];
+            if (slot != 0 && memcmp(source.data() + slot - 1, target.data() + pos, PATCH_BLOCK_SIZE) == 0) {
+                candidate = slot - 1;
+            }
+        }
+
+        if (candidate < 0) {
+            if (pos + PATCH_BLOCK_SIZE < target.size()) {
+                hash = (hash - target[pos] * highFactor) * 257 + target[pos + PATCH_BLOCK_SIZE];
+            }
+            pos++;
+            continue;
+        }
+
+        auto sourceOffset = (uint32_t) candidate;
+        auto targetOffset = pos;
+        while (targetOffset > literalStart && sourceOffset > 0 && source[sourceOffset - 1] == target[targetOffset - 1]) {
+            sourceOffset--;
+            targetOffset--;
+        }
+        uint32_t length = matchForward(sourceOffset, targetOffset);
+
+        addOp(ops, literalStart, targetOffset - literalStart, PATCH_OP_DATA, data.size());
+        data.insert(data.end(), target.begin() + literalStart, target.begin() + targetOffset);
+        addOp(ops, targetOffset, length, PATCH_OP_COPY, sourceOffset);
+
+        pos          = targetOffset + length;
+        literalStart = pos;
+        lastDistance = (int64_t) sourceOffset - targetOffset;
+        if (pos + PATCH_BLOCK_SIZE <= target.size()) {
+            hash = hashBlock(target.data() + pos);
+        }
+    }
+    addOp(ops, literalStart, target.size() - literalStart, PATCH_OP_DATA, data.size());
+    data.insert(data.end(), target.begin() + literalStart, target.end());
+    return ops;
+}
+
+static bool serializePatch(const std::vector<uint8_t> &source, const std::vector<PatchOp> &ops, const std::vector<uint8_t> &data, uint32_t targetSize, std::vector<uint8_t> &out) {
+    auto opData = PatchFormat::serializeOps(ops);
+    PatchFileHeader header{};
+    header.sourceSize     = source.size();
+    header.targetSize     = targetSize;
+    header.numOps         = ops.size();
+    header.opsChecksum    = LayerIndexFormat::checksum(opData.data(), opData.size());
+    header.dataSize       = data.size();
+    header.sourceChecksum = LayerIndexFormat::checksum(source.data(), source.size());
+    out                   = PatchFormat::serializeHeader(header);
+    out.insert(out.end(), opData.begin(), opData.end());
+    out.insert(out.end(), data.begin(), data.end());
+    return out.size() == PatchFormat::getDataOffset(header) + data.size();
+}
+
+struct Patch {
+    PatchFileHeader header{};
+    std::vector<PatchOp> ops;
+};
+
+static bool parsePatch(const uint8_t *data, size_t size, Patch &patch) {
+    if (!PatchFormat::parseHeader(data, size, &patch.header) || size < PatchFormat::getDataOffset(patch.header) + patch.header.dataSize) {
+        return false;
+    }
+    return PatchFormat::parseOps(data + PatchFormat::getOpsOffset(), patch.header, patch.ops);
+}
+
+static bool applyPatch(const std::vector<uint8_t> &source, const std::vector<uint8_t> &patchData, std::vector<uint8_t> &out) {
+    Patch patch;
+    if (!parsePatch(patchData.data(), patchData.size(), patch) || source.size() != patch.header.sourceSize ||
+        LayerIndexFormat::checksum(source.data(), source.size()) != patch.header.sourceChecksum) {
+        return false;
+    }
+    const uint8_t *data = patchData.data() + PatchFormat::getDataOffset(patch.header);
+    out.resize(patch.header.targetSize);
+    return PatchFormat::reconstruct(
+            patch.ops, 0, out.data(), out.size(),
+            [&](uint32_t offset, uint8_t *buffer, uint32_t size) { return memcpy(buffer, source.data() + offset, size) != nullptr; },
+            [&](uint32_t offset, uint8_t *buffer, uint32_t size) { return memcpy(buffer, data + offset, size) != nullptr; });
+}
+
+/**
+ * Returns the size of the patch, or 0 on errors.
+ */
+static size_t createPatch(const fs::path &originalPath, const fs::path &modifiedPath, const fs::path &output) {
+    std::vector<uint8_t> source;
+    std::vector<uint8_t> target;
+    if (!readFile(originalPath, source) || !readFile(modifiedPath, target)) {
+        fprintf(stderr, "error: Failed to read %s or %s\n", originalPath.c_str(), modifiedPath.c_str());
+        return 0;
+    }
+    if (source.size() > UINT32_MAX || target.size() > UINT32_MAX) {
+        fprintf(stderr, "error: %s or %s is bigger than 4 GiB\n", originalPath.c_str(), modifiedPath.c_str());
+        return 0;
+    }
+    std::vector<uint8_t> data;
+    auto ops = diff(source, target, data);
+    std::vector<uint8_t> patch;
+    std::vector<uint8_t> check;
+    if (!serializePatch(source, ops, data, target.size(), patch) || !applyPatch(source, patch, check) || check != target) {
+        fprintf(stderr, "error: Failed to create a patch for %s\n", modifiedPath.c_str());
+        return 0;
+    }
+    if (!writeFile(output, patch)) {
+        fprintf(stderr, "error: Failed to write %s\n", output.c_str());
+        return 0;
+    }
+    printf("Wrote %s: %zu ops, %zu of %zu bytes stored in the patch\n", output.c_str(), ops.size(), data.size(), target.size());
+    return patch.size();
+}
+
+static int create(const fs::path &originalPath, const fs::path &modifiedPath, const fs::path &output) {
+    return createPatch(originalPath, modifiedPath, output) > 0 ? 0 : 1;
+}
+
+static bool isSameFile(const fs::path &a, const fs::path &b) {
+    std::vector<uint8_t> dataA;
+    std::vector<uint8_t> dataB;
+    return fs::file_size(a) == fs::file_size(b) && readFile(a, dataA) && readFile(b, dataB) && dataA == dataB;
+}
+
+static int dir(const fs::path &originalRoot, const fs::path &modifiedRoot, const fs::path &patchRoot) {
+    std::error_code ec;
+    uint32_t numPatches = 0;
+    uint32_t numErrors  = 0;
+    uint64_t patchSize  = 0;
+    uint64_t fileSize   = 0;
+    for (auto it = fs::recursive_directory_iterator(modifiedRoot, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file()) {
+            continue;
+        }
+        auto relativePath = it->path().lexically_relative(modifiedRoot);
+        auto original     = originalRoot / relativePath;
+        if (!fs::is_regular_file(original)) {
+            fprintf(stderr, "warning: %s is not part of the original, add it with a replace or merge layer\n", relativePath.c_str());
+            continue;
+        }
+        if (isSameFile(original, it->path())) {
+            continue;
+        }
+        auto output = patchRoot / (relativePath.string() + PATCH_FILE_SUFFIX);
+        fs::create_directories(output.parent_path(), ec);
+        auto size = createPatch(original, it->path(), output);
+        if (size == 0) {
+            numErrors++;
+            continue;
+        }
+        numPatches++;
+        patchSize += size;
+        fileSize += it->file_size();
+    }
+    if (ec) {
+        fprintf(stderr, "error: Failed to read %s: %s\n", modifiedRoot.c_str(), ec.message().c_str());
+        return 1;
+    }
+    printf("%u patches with %llu bytes for %llu bytes of modified files, %u errors\n", numPatches, (unsigned long long) patchSize,
+           (unsigned long long) fileSize, numErrors);
+    return numErrors > 0 ? 1 : 0;
+}
+
+static int apply(const fs::path &originalPath, const fs::path &patchPath, const fs::path &output) {
+    std::vector<uint8_t> source;
+    std::vector<uint8_t> patch;
+    std::vector<uint8_t> out;
+    if (!readFile(originalPath, source) || !readFile(patchPath, patch)) {
+        fprintf(stderr, "error: Failed to read %s or %s\n", originalPath.c_str(), patchPath.c_str());
+        return 1;
+    }
+    if (!applyPatch(source, patch, out)) {
+        fprintf(stderr, "error: %s is not a valid patch for %s\n", patchPath.c_str(), originalPath.c_str());
+        return 1;
+    }
+    if (!writeFile(output, out)) {
+        fprintf(stderr, "error: Failed to write %s\n", output.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the modified file like the patch layer: windows that are touched by a read are reconstructed from the
+ * original and the data of the patch and kept in a small LRU cache.
+ */
+class PatchedReader {
+public:
+    PatchedReader(int sourceFd, int patchFd, Patch patch) : pSourceFd(sourceFd), pPatchFd(patchFd), pPatch(std::move(patch)) {
+        pCache.resize(PATCH_CACHE_WINDOWS);
+    }
+
+    bool read(uint32_t pos, uint8_t *buffer, uint32_t size) {
+        uint32_t done = 0;
+        while (done < size) {
+            uint32_t window = (pos + done) / PATCH_WINDOW_SIZE;
+            auto *cached    = getWindow(window);
+            if (cached == nullptr) {
+                return false;
+            }
+            uint32_t posInWindow = pos + done - window * PATCH_WINDOW_SIZE;
+            uint32_t toCopy      = std::min<uint32_t>(cached->data.size() - posInWindow, size - done);
+            memcpy(buffer + done, cached->data.data() + posInWindow, toCopy);
+            done += toCopy;
+        }
+        return true;
+    }
+
+    void clear() {
+        for (auto &cached : pCache) {
+            cached.data.clear();
+        }
+    }
+
+    uint32_t numDecoded = 0;
+
+private:
+    struct CachedWindow {
+        uint32_t window;
+        uint32_t lastUse;
+        std::vector<uint8_t> data;
+    };
+
+    CachedWindow *getWindow(uint32_t window) {
+        auto *oldest = &pCache[0];
+        for (auto &cached : pCache) {
+            if (!cached.data.empty() && cached.window == window) {
+                cached.lastUse = ++pClock;
+                return &cached;
+            }
+            if (cached.data.empty() || (!oldest->data.empty() && cached.lastUse < oldest->lastUse)) {
+                oldest = &cached;
+            }
+        }
+        uint32_t offset = window * PATCH_WINDOW_SIZE;
+        oldest->data.resize(std::min<uint32_t>(pPatch.header.targetSize - offset, PATCH_WINDOW_SIZE));
+        uint64_t dataOffset = PatchFormat::getDataOffset(pPatch.header);
+        bool success        = PatchFormat::reconstruct(
+                pPatch.ops, offset, oldest->data.data(), oldest->data.size(),
+                [&](uint32_t srcOffset, uint8_t *buffer, uint32_t size) { return readAt(pSourceFd, srcOffset, buffer, size); },
+                [&](uint32_t patchOffset, uint8_t *buffer, uint32_t size) { return readAt(pPatchFd, dataOffset + patchOffset, buffer, size); });
+        if (!success) {
+            oldest->data.clear();
+            return nullptr;
+        }
+        oldest->window  = window;
+        oldest->lastUse = ++pClock;
+        numDecoded++;
+        return oldest;
+    }
+
+    int pSourceFd;
+    int pPatchFd;
+    Patch pPatch;
+    std::vector<CachedWindow> pCache;
+    uint32_t pClock = 0;
+};
+
+static void report(const char *name, double seconds, uint64_t bytes, uint32_t reads) {
+    printf("%-16s %8.3f s %10.2f MB/s %10.0f reads/s\n", name, seconds, bytes / seconds / (1024.0 * 1024.0), reads / seconds);
+}
+
+struct Read {
+    uint32_t pos;
+    uint32_t size;
+};
+
+static int bench(const fs::path &originalPath, const fs::path &patchPath, uint32_t iterations) {
+    int sourceFd = open(originalPath.c_str(), O_RDONLY);
+    int patchFd  = open(patchPath.c_str(), O_RDONLY);
+    std::vector<uint8_t> patchData;
+    Patch patch;
+    if (sourceFd < 0 || patchFd < 0 || !readFile(patchPath, patchData) || !parsePatch(patchData.data(), patchData.size(), patch)) {
+        fprintf(stderr, "error: Failed to open %s or %s is not a valid patch\n", originalPath.c_str(), patchPath.c_str());
+        return 1;
+    }
+    auto sourceSize = (uint64_t) lseek(sourceFd, 0, SEEK_END);
+    if (sourceSize != patch.header.sourceSize || sourceSize == 0 || patch.header.targetSize == 0) {
+        fprintf(stderr, "error: %s doesn't belong to %s or one of the files is empty\n", patchPath.c_str(), originalPath.c_str());
+        return 1;
+    }
+    uint64_t copied = 0;
+    for (auto &op : patch.ops) {
+        if (op.type == PATCH_OP_COPY) {
+            copied += op.length;
+        }
+    }
+    printf("%u ops, %llu of %u bytes copied from the original, %u bytes of data\n", patch.header.numOps, (unsigned long long) copied,
+           patch.header.targetSize, patch.header.dataSize);
+
+    // The same random reads for the original and the patched file.
+    std::vector<Read> randomReads;
+    uint64_t randomSourceSize = 0;
+    uint64_t randomTargetSize = 0;
+    std::mt19937 random(0);
+    for (uint32_t n = 0; n < BENCH_RANDOM_READS; n++) {
+        uint32_t pos  = random() % patch.header.targetSize;
+        uint32_t size = BENCH_RANDOM_READ_MIN + random() % (BENCH_RANDOM_READ_MAX - BENCH_RANDOM_READ_MIN + 1);
+        randomReads.push_back({pos, size});
+        randomSourceSize += std::min<uint64_t>(size, sourceSize - std::min<uint64_t>(pos, sourceSize));
+        randomTargetSize += std::min(size, patch.header.targetSize - pos);
+    }
+
+    PatchedReader reader(sourceFd, patchFd, patch);
+    std::vector<uint8_t> buffer(std::max(BENCH_SEQUENTIAL_READ_SIZE, BENCH_RANDOM_READ_MAX));
+    auto dropCaches = [&]() {
+        posix_fadvise(sourceFd, 0, 0, POSIX_FADV_DONTNEED);
+        posix_fadvise(patchFd, 0, 0, POSIX_FADV_DONTNEED);
+        reader.clear();
+    };
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+        dropCaches();
+        auto start = std::chrono::steady_clock::now();
+        uint32_t numReads = 0;
+        for (uint64_t pos = 0; pos < sourceSize; pos += BENCH_SEQUENTIAL_READ_SIZE, numReads++) {
+            if (!readAt(sourceFd, pos, buffer.data(), std::min<uint64_t>(BENCH_SEQUENTIAL_READ_SIZE, sourceSize - pos))) {
+                fprintf(stderr, "error: Failed to read %s\n", originalPath.c_str());
+                return 1;
+            }
+        }
+        report("original", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), sourceSize, numReads);
+
+        dropCaches();
+        start    = std::chrono::steady_clock::now();
+        numReads = 0;
+        for (uint32_t pos = 0; pos < patch.header.targetSize; pos += std::min<uint32_t>(BENCH_SEQUENTIAL_READ_SIZE, patch.header.targetSize - pos), numReads++) {
+            if (!reader.read(pos, buffer.data(), std::min<uint32_t>(BENCH_SEQUENTIAL_READ_SIZE, patch.header.targetSize - pos))) {
+                fprintf(stderr, "error: Failed to read %s through the patch\n", originalPath.c_str());
+                return 1;
+            }
+        }
+        report("patched", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), patch.header.targetSize, numReads);
+
+        dropCaches();
+        start = std::chrono::steady_clock::now();
+        for (auto &read : randomReads) {
+            if (read.pos < sourceSize && !readAt(sourceFd, read.pos, buffer.data(), std::min<uint64_t>(read.size, sourceSize - read.pos))) {
+                fprintf(stderr, "error: Failed to read %s\n", originalPath.c_str());
+                return 1;
+            }
+        }
+        report("original random", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), randomSourceSize, randomReads.size());
+
+        dropCaches();
+        reader.numDecoded = 0;
+        start             = std::chrono::steady_clock::now();
+        for (auto &read : randomReads) {
+            if (!reader.read(read.pos, buffer.data(), std::min(read.size, patch.header.targetSize - read.pos))) {
+                fprintf(stderr, "error: Failed to read %s through the patch\n", originalPath.c_str());
+                return 1;
+            }
+        }
+        report("patched random", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), randomTargetSize, randomReads.size());
+        printf("%u windows reconstructed for %zu random reads\n", reader.numDecoded, randomReads.size());
+    }
+    close(sourceFd);
+    close(patchFd);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  %s create <original> <modified> [-o <output file>]\n", name);
+    fprintf(stderr, "  %s dir <original dir> <modified dir> <patch dir>\n", name);
+    fprintf(stderr, "  %s apply <original> <patch> -o <output file>\n", name);
+    fprintf(stderr, "  %s bench <original> <patch> [-n <iterations>]\n", name);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string command = argv[1];
+    fs::path first      = argv[2];
+    fs::path second     = argv[3];
+    if (command == "create" && (argc == 4 || (argc == 6 && std::string(argv[4]) == "-o"))) {
+        fs::path output = argc == 6 ? fs::path(argv[5]) : fs::path(second.string() + PATCH_FILE_SUFFIX);
+        return create(first, second, output);
+    } else if (command == "dir" && argc == 5) {
+        return dir(first, second, argv[4]);
+    } else if (command == "apply" && argc == 6 && std::string(argv[4]) == "-o") {
+        return apply(first, second, argv[5]);
+    } else if (command == "bench" && (argc == 4 || argc == 6)) {
+        uint32_t iterations = 3;
+        if (argc == 6) {
+            if (std::string(argv[4]) != "-n" || (iterations = strtoul(argv[5], nullptr, 10)) == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        return bench(first, second, iterations);
+    }
+    usage(argv[0]);
+    return 1;
+}